@@ -187,7 +187,8 @@ static bool tb_lookup_cmp(const void *p, const void *d)
         tb_page_addr0(tb) == desc->page_addr0 &&
         tb->cs_base == desc->cs_base &&
         tb->flags == desc->flags &&
-        tb_cflags(tb) == desc->cflags) {
+        /* a trace is found under the flags of the TB it replaced */
+        (tb_cflags(tb) & ~CF_TRACE) == desc->cflags) {
         /* check next page if needed */
         tb_page_addr_t tb_phys_page1 = tb_page_addr1(tb);
         if (tb_phys_page1 == -1) {
@@ -238,6 +239,19 @@ static TranslationBlock *tb_htable_lookup(CPUState *cpu, vaddr pc,
     return qht_lookup_custom(&tb_ctx.htable, &desc, h, tb_lookup_cmp);
 }
 
+/*
+ * How often the TB that a jump from @tb to @pc chains to has run,
+ * for translator_trace_branch().
+ */
+uint64_t tb_dest_exec_count(CPUState *cpu, const TranslationBlock *tb,
+                            vaddr pc)
+{
+    TranslationBlock *dest = tb_htable_lookup(cpu, pc, tb->cs_base, tb->flags,
+                                              tb_cflags(tb) & ~CF_TRACE);
+
+    return dest ? *tcg_tb_exec_count(dest) : 0;
+}
+
 /* Might cause an exception, so have a longjmp destination ready */
 static inline TranslationBlock *tb_lookup(CPUState *cpu, vaddr pc,
                                           uint64_t cs_base, uint32_t flags,
@@ -261,7 +275,7 @@ static inline TranslationBlock *tb_lookup(CPUState *cpu, vaddr pc,
                    jc->array[hash].pc == pc &&
                    tb->cs_base == cs_base &&
                    tb->flags == flags &&
-                   tb_cflags(tb) == cflags)) {
+                   (tb_cflags(tb) & ~CF_TRACE) == cflags)) {
             return tb;
         }
         tb = tb_htable_lookup(cpu, pc, cs_base, flags, cflags);
@@ -279,7 +293,7 @@ static inline TranslationBlock *tb_lookup(CPUState *cpu, vaddr pc,
                    tb->pc == pc &&
                    tb->cs_base == cs_base &&
                    tb->flags == flags &&
-                   tb_cflags(tb) == cflags)) {
+                   (tb_cflags(tb) & ~CF_TRACE) == cflags)) {
             return tb;
         }
         tb = tb_htable_lookup(cpu, pc, cs_base, flags, cflags);
@@ -998,11 +1012,16 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
             }
 
             tb = tb_lookup(cpu, pc, cs_base, flags, cflags);
-            if (tb == NULL) {
+            if (tb == NULL || unlikely(tb_trace_due(tb))) {
                 CPUJumpCache *jc;
                 uint32_t h;
 
                 mmap_lock();
+                if (tb) {
+                    /* hot enough to be replaced by a trace of its loop */
+                    tb_phys_invalidate(tb, -1);
+                    cflags |= CF_TRACE;
+                }
                 tb = tb_gen_code(cpu, pc, cs_base, flags, cflags);
                 mmap_unlock();
 
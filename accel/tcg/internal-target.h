@@ -75,6 +75,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu, vaddr pc,
 void page_init(void);
 void tb_htable_init(void);
 void tb_reset_jump(TranslationBlock *tb, int n);
+void tb_evict(CPUState *cpu);
 TranslationBlock *tb_link_page(TranslationBlock *tb);
 bool tb_invalidate_phys_page_unwind(tb_page_addr_t addr, uintptr_t pc);
 void cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
@@ -94,6 +95,31 @@ static inline vaddr log_pc(CPUState *cpu, const TranslationBlock *tb)
 }
 
 extern bool one_insn_per_tb;
+extern bool tcg_hot_blocks;
+extern uint32_t tcg_trace_threshold;
+
+/*
+ * Whether a TB translated with @cflags may be replaced by a trace once
+ * it has run tcg_trace_threshold times. Traces need the execution counts
+ * to pick their path, and side exits from the middle of a TB would upset
+ * icount's accounting of whole TBs.
+ */
+static inline bool tb_trace_allowed(uint32_t cflags)
+{
+    return qatomic_read(&tcg_trace_threshold) &&
+           qatomic_read(&tcg_hot_blocks) &&
+           !(cflags & (CF_COUNT_MASK | CF_NO_GOTO_TB | CF_SINGLE_STEP |
+                       CF_MEMI_ONLY | CF_USE_ICOUNT | CF_NOIRQ | CF_TRACE));
+}
+
+uint64_t tb_dest_exec_count(CPUState *cpu, const TranslationBlock *tb,
+                            vaddr pc);
+
+static inline bool tb_trace_due(const TranslationBlock *tb)
+{
+    return tb_trace_allowed(tb_cflags(tb)) &&
+           *tcg_tb_exec_count(tb) >= qatomic_read(&tcg_trace_threshold);
+}
 
 /**
  * tcg_req_mo:
@@ -9,10 +9,12 @@
 #include "qemu/osdep.h"
 #include "qemu/accel.h"
 #include "qemu/qht.h"
+#include "qemu/timer.h"
 #include "qapi/error.h"
 #include "qapi/type-helpers.h"
 #include "qapi/qapi-commands-machine.h"
 #include "monitor/monitor.h"
+#include "disas/disas.h"
 #include "sysemu/cpus.h"
 #include "sysemu/cpu-timers.h"
 #include "sysemu/tcg.h"
@@ -189,8 +191,14 @@ static void dump_exec_info(GString *buf)
     g_string_append_printf(buf, "\nStatistics:\n");
     g_string_append_printf(buf, "TB flush count      %u\n",
                            qatomic_read(&tb_ctx.tb_flush_count));
+    g_string_append_printf(buf, "TB evict count      %u\n",
+                           qatomic_read(&tb_ctx.tb_evict_count));
     g_string_append_printf(buf, "TB invalidate count %u\n",
                            qatomic_read(&tb_ctx.tb_phys_invalidate_count));
+    g_string_append_printf(buf, "TB translate count  %" PRIu64 "\n",
+                           stat64_get(&tb_ctx.tb_gen_count));
+    g_string_append_printf(buf, "translation time    %0.3f ms\n",
+                           stat64_get(&tb_ctx.tb_gen_time) / (double)SCALE_MS);
 
     tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
     g_string_append_printf(buf, "TLB full flushes    %zu\n", flush_full);
@@ -215,6 +223,153 @@ HumanReadableText *qmp_x_query_jit(Error **errp)
     return human_readable_text_from_str(buf);
 }
 
+/*
+ * What we keep of a TB: it may be gone by the time we look at the
+ * snapshot, a TB flush can run while the monitor holds the BQL.
+ */
+typedef struct HotBlock {
+    vaddr pc;
+    bool pcrel;
+    tb_page_addr_t phys_addr;
+    uint64_t count;
+    int insns;
+    int guest_size;
+    int host_size;
+    int jumps;
+    int chained;
+    bool invalid;
+} HotBlock;
+
+typedef struct HotBlocks {
+    GArray *blocks;
+    uint64_t total;
+} HotBlocks;
+
+static gboolean hot_blocks_iter(gpointer key, gpointer value, gpointer data)
+{
+    const TranslationBlock *tb = value;
+    HotBlocks *hb = data;
+    HotBlock b = { 0 };
+    int i;
+
+    /* racing with the TB itself, a count that is off by one is fine */
+    b.count = *tcg_tb_exec_count(tb);
+    if (!b.count) {
+        return false;
+    }
+    b.pc = tb->pc;
+    b.pcrel = qatomic_read(&tb->cflags) & CF_PCREL;
+    b.phys_addr = tb->page_addr[0];
+    b.insns = tb->icount;
+    b.guest_size = tb->size;
+    b.host_size = tb->tc.size;
+    b.invalid = qatomic_read(&tb->cflags) & CF_INVALID;
+    for (i = 0; i < ARRAY_SIZE(tb->jmp_reset_offset); i++) {
+        if (tb->jmp_reset_offset[i] != TB_JMP_OFFSET_INVALID) {
+            b.jumps++;
+            if (qatomic_read(&tb->jmp_dest[i]) & ~(uintptr_t)1) {
+                b.chained++;
+            }
+        }
+    }
+
+    g_array_append_val(hb->blocks, b);
+    hb->total += b.count;
+    return false;
+}
+
+static gboolean hot_blocks_reset_iter(gpointer key, gpointer value,
+                                      gpointer data)
+{
+    TranslationBlock *tb = value;
+
+    *tcg_tb_exec_count(tb) = 0;
+    return false;
+}
+
+static gint hot_block_cmp(gconstpointer a, gconstpointer b)
+{
+    const HotBlock *ha = a;
+    const HotBlock *hb = b;
+
+    return ha->count < hb->count ? 1 : ha->count > hb->count ? -1 : 0;
+}
+
+TcgHotBlocks *qmp_x_query_tcg_hot_blocks(bool has_top, int64_t top,
+                                         bool has_reset, bool reset,
+                                         Error **errp)
+{
+    HotBlocks hb = { 0 };
+    TcgHotBlocks *res;
+    TcgHotBlockList **tail;
+    int64_t now;
+    guint i;
+
+    if (!tcg_enabled()) {
+        error_setg(errp, "Hot block information is only available "
+                   "with accel=tcg");
+        return NULL;
+    }
+    if (!object_property_get_bool(OBJECT(current_accel()), "hot-blocks",
+                                  &error_abort)) {
+        error_setg(errp, "Hot block counting is disabled");
+        error_append_hint(errp, "Use -accel tcg,hot-blocks=on\n");
+        return NULL;
+    }
+    if (!has_top) {
+        top = 20;
+    } else if (top < 1) {
+        error_setg(errp, "Parameter 'top' must be positive");
+        return NULL;
+    }
+
+    hb.blocks = g_array_new(false, false, sizeof(HotBlock));
+    tcg_tb_foreach(hot_blocks_iter, &hb);
+    now = get_clock();
+
+    if (has_reset && reset) {
+        tcg_tb_foreach(hot_blocks_reset_iter, NULL);
+    }
+
+    g_array_sort(hb.blocks, hot_block_cmp);
+
+    res = g_new0(TcgHotBlocks, 1);
+    res->window_ns = now - qatomic_read__nocheck(&tb_ctx.hot_blocks_since);
+    res->total_count = hb.total;
+    tail = &res->blocks;
+
+    for (i = 0; i < hb.blocks->len && i < top; i++) {
+        HotBlock *b = &g_array_index(hb.blocks, HotBlock, i);
+        TcgHotBlock *value = g_new0(TcgHotBlock, 1);
+
+        if (!b->pcrel) {
+            const char *sym = lookup_symbol(b->pc);
+
+            value->has_pc = true;
+            value->pc = b->pc;
+            if (sym[0]) {
+                value->symbol = g_strdup(sym);
+            }
+        }
+        value->phys_addr = b->phys_addr;
+        value->count = b->count;
+        value->insns = b->insns;
+        value->guest_size = b->guest_size;
+        value->host_size = b->host_size;
+        value->jumps = b->jumps;
+        value->chained = b->chained;
+        value->invalid = b->invalid;
+        QAPI_LIST_APPEND(tail, value);
+    }
+
+    if (has_reset && reset) {
+        qatomic_set__nocheck(&tb_ctx.hot_blocks_since, now);
+    }
+
+    g_array_free(hb.blocks, true);
+    return res;
+}
+
 static void tcg_dump_op_count(GString *buf)
 {
     g_string_append_printf(buf, "[TCG profiler not compiled]\n");
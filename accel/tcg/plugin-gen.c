@@ -79,10 +79,12 @@ enum plugin_gen_from {
 
 enum plugin_gen_cb {
     PLUGIN_GEN_CB_UDATA,
+    PLUGIN_GEN_CB_UDATA_R,
     PLUGIN_GEN_CB_INLINE,
     PLUGIN_GEN_CB_MEM,
     PLUGIN_GEN_ENABLE_MEM_HELPER,
     PLUGIN_GEN_DISABLE_MEM_HELPER,
+    PLUGIN_GEN_CB_MEM_BATCH,
     PLUGIN_GEN_N_CBS,
 };
 
@@ -93,12 +95,21 @@ enum plugin_gen_cb {
 void HELPER(plugin_vcpu_udata_cb)(uint32_t cpu_index, void *udata)
 { }
 
+void HELPER(plugin_vcpu_udata_cb_r)(uint32_t cpu_index, void *udata)
+{ }
+
 void HELPER(plugin_vcpu_mem_cb)(unsigned int vcpu_index,
                                 qemu_plugin_meminfo_t info, uint64_t vaddr,
                                 void *userdata)
 { }
 
-static void gen_empty_udata_cb(void)
+/* This one is real: make room for the batch records of the TB */
+void HELPER(plugin_mem_batch_reserve)(uint32_t n)
+{
+    qemu_plugin_mem_batch_reserve(current_cpu, n);
+}
+
+static void gen_empty_udata_cb(void (*gen_helper)(TCGv_i32, TCGv_ptr))
 {
     TCGv_i32 cpu_index = tcg_temp_ebb_new_i32();
     TCGv_ptr udata = tcg_temp_ebb_new_ptr();
@@ -106,28 +117,55 @@ static void gen_empty_udata_cb(void)
     tcg_gen_movi_ptr(udata, 0);
     tcg_gen_ld_i32(cpu_index, tcg_env,
                    -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
-    gen_helper_plugin_vcpu_udata_cb(cpu_index, udata);
+    gen_helper(cpu_index, udata);
 
     tcg_temp_free_ptr(udata);
     tcg_temp_free_i32(cpu_index);
 }
 
+/* callbacks that don't look at the CPU state: globals may stay in registers */
+static void gen_empty_udata_cb_no_rwg(void)
+{
+    gen_empty_udata_cb(gen_helper_plugin_vcpu_udata_cb);
+}
+
+/* callbacks that read registers: globals are synced before the call */
+static void gen_empty_udata_cb_no_wg(void)
+{
+    gen_empty_udata_cb(gen_helper_plugin_vcpu_udata_cb_r);
+}
+
 /*
  * For now we only support addi_i64.
  * When we support more ops, we can generate one empty inline cb for each.
+ *
+ * The counter lives at base + cpu_index * stride, so that scoreboards
+ * get one per vCPU without calling out of the generated code. Plain
+ * pointer ops use a stride of 0, which the optimizer folds away.
  */
 static void gen_empty_inline_cb(void)
 {
+    TCGv_i32 cpu_index = tcg_temp_ebb_new_i32();
+    TCGv_ptr cpu_offset = tcg_temp_ebb_new_ptr();
     TCGv_i64 val = tcg_temp_ebb_new_i64();
     TCGv_ptr ptr = tcg_temp_ebb_new_ptr();
 
+    tcg_gen_ld_i32(cpu_index, tcg_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    /* the second operand is replaced by the stride */
+    tcg_gen_mul_i32(cpu_index, cpu_index, cpu_index);
+    tcg_gen_ext_i32_ptr(cpu_offset, cpu_index);
+
     tcg_gen_movi_ptr(ptr, 0);
+    tcg_gen_add_ptr(ptr, ptr, cpu_offset);
     tcg_gen_ld_i64(val, ptr, 0);
     /* pass an immediate != 0 so that it doesn't get optimized away */
     tcg_gen_addi_i64(val, val, 0xdeadface);
     tcg_gen_st_i64(val, ptr, 0);
     tcg_temp_free_ptr(ptr);
     tcg_temp_free_i64(val);
+    tcg_temp_free_ptr(cpu_offset);
+    tcg_temp_free_i32(cpu_index);
 }
 
 static void gen_empty_mem_cb(TCGv_i64 addr, uint32_t info)
@@ -148,6 +186,65 @@ static void gen_empty_mem_cb(TCGv_i64 addr, uint32_t info)
     tcg_temp_free_i32(cpu_index);
 }
 
+/*
+ * Append a record to the vCPU's batch buffer. Unlike the callbacks this
+ * is kept as is if the instruction wants it, only the tag and owner are
+ * filled in; it is repeated for every plugin that wants it.
+ */
+static void gen_mem_batch_record(TCGv_i64 addr, uint32_t info)
+{
+    TCGv_i32 tag = tcg_temp_ebb_new_i32();
+    TCGv_i32 owner = tcg_temp_ebb_new_i32();
+    TCGv_i32 n = tcg_temp_ebb_new_i32();
+    TCGv_i32 offset = tcg_temp_ebb_new_i32();
+    TCGv_ptr batch = tcg_temp_ebb_new_ptr();
+    TCGv_ptr rec = tcg_temp_ebb_new_ptr();
+
+    /* must come first, see inject_mem_batch() */
+    tcg_gen_movi_i32(tag, 0);
+    tcg_gen_movi_i32(owner, 0);
+
+    tcg_gen_ld_ptr(batch, tcg_env, offsetof(CPUState, plugin_mem_batch) -
+                                   offsetof(ArchCPU, env));
+    tcg_gen_ld_i32(n, batch, offsetof(struct qemu_plugin_mem_batch, n));
+    tcg_gen_muli_i32(offset, n, sizeof(struct qemu_plugin_mem_batch_rec));
+    tcg_gen_ext_i32_ptr(rec, offset);
+    tcg_gen_add_ptr(rec, rec, batch);
+
+    tcg_gen_st_i64(addr, rec, offsetof(struct qemu_plugin_mem_batch, rec) +
+                              offsetof(struct qemu_plugin_mem_batch_rec,
+                                       rec.vaddr));
+    tcg_gen_st_i32(tcg_constant_i32(info), rec,
+                   offsetof(struct qemu_plugin_mem_batch, rec) +
+                   offsetof(struct qemu_plugin_mem_batch_rec, rec.info));
+    tcg_gen_st_i32(tag, rec, offsetof(struct qemu_plugin_mem_batch, rec) +
+                             offsetof(struct qemu_plugin_mem_batch_rec,
+                                      rec.tag));
+    tcg_gen_st_i32(owner, rec, offsetof(struct qemu_plugin_mem_batch, rec) +
+                               offsetof(struct qemu_plugin_mem_batch_rec,
+                                        owner));
+
+    tcg_gen_addi_i32(n, n, 1);
+    tcg_gen_st_i32(n, batch, offsetof(struct qemu_plugin_mem_batch, n));
+
+    tcg_temp_free_ptr(rec);
+    tcg_temp_free_ptr(batch);
+    tcg_temp_free_i32(offset);
+    tcg_temp_free_i32(n);
+    tcg_temp_free_i32(owner);
+    tcg_temp_free_i32(tag);
+}
+
+/* the number of records is filled in once the TB is complete */
+static void gen_empty_mem_batch_reserve(void)
+{
+    TCGv_i32 n = tcg_temp_ebb_new_i32();
+
+    tcg_gen_movi_i32(n, 0);
+    gen_helper_plugin_mem_batch_reserve(n);
+    tcg_temp_free_i32(n);
+}
+
 /*
  * Share the same function for enable/disable. When enabling, the NULL
  * pointer will be overwritten later.
@@ -192,7 +289,8 @@ static void plugin_gen_empty_callback(enum plugin_gen_from from)
                     gen_empty_mem_helper);
         /* fall through */
     case PLUGIN_GEN_FROM_TB:
-        gen_wrapped(from, PLUGIN_GEN_CB_UDATA, gen_empty_udata_cb);
+        gen_wrapped(from, PLUGIN_GEN_CB_UDATA, gen_empty_udata_cb_no_rwg);
+        gen_wrapped(from, PLUGIN_GEN_CB_UDATA_R, gen_empty_udata_cb_no_wg);
         gen_wrapped(from, PLUGIN_GEN_CB_INLINE, gen_empty_inline_cb);
         break;
     default:
@@ -211,6 +309,10 @@ void plugin_gen_empty_mem_callback(TCGv_i64 addr, uint32_t info)
     gen_plugin_cb_start(PLUGIN_GEN_FROM_MEM, PLUGIN_GEN_CB_INLINE, rw);
     gen_empty_inline_cb();
     tcg_gen_plugin_cb_end();
+
+    gen_plugin_cb_start(PLUGIN_GEN_FROM_MEM, PLUGIN_GEN_CB_MEM_BATCH, rw);
+    gen_mem_batch_record(addr, info);
+    tcg_gen_plugin_cb_end();
 }
 
 static TCGOp *find_op(TCGOp *op, TCGOpcode opc)
@@ -274,6 +376,38 @@ static TCGOp *copy_const_ptr(TCGOp **begin_op, TCGOp *op, void *ptr)
     return op;
 }
 
+static TCGOp *copy_ld_i32(TCGOp **begin_op, TCGOp *op)
+{
+    return copy_op(begin_op, op, INDEX_op_ld_i32);
+}
+
+static TCGOp *copy_mul_i32(TCGOp **begin_op, TCGOp *op, uint32_t v)
+{
+    op = copy_op(begin_op, op, INDEX_op_mul_i32);
+    op->args[2] = tcgv_i32_arg(tcg_constant_i32(v));
+    return op;
+}
+
+static TCGOp *copy_ext_i32_ptr(TCGOp **begin_op, TCGOp *op)
+{
+    if (UINTPTR_MAX == UINT32_MAX) {
+        op = copy_op(begin_op, op, INDEX_op_mov_i32);
+    } else {
+        op = copy_op(begin_op, op, INDEX_op_ext_i32_i64);
+    }
+    return op;
+}
+
+static TCGOp *copy_add_ptr(TCGOp **begin_op, TCGOp *op)
+{
+    if (UINTPTR_MAX == UINT32_MAX) {
+        op = copy_op(begin_op, op, INDEX_op_add_i32);
+    } else {
+        op = copy_op(begin_op, op, INDEX_op_add_i64);
+    }
+    return op;
+}
+
 static TCGOp *copy_ld_i64(TCGOp **begin_op, TCGOp *op)
 {
     if (TCG_TARGET_REG_BITS == 32) {
@@ -380,8 +514,17 @@ static TCGOp *append_inline_cb(const struct qemu_plugin_dyn_cb *cb,
                                TCGOp *begin_op, TCGOp *op,
                                int *unused)
 {
-    /* const_ptr */
-    op = copy_const_ptr(&begin_op, op, cb->userp);
+    size_t stride;
+    char *base = qemu_plugin_inline_base(cb, &stride);
+
+    /* ld_i32 cpu_index, mul_i32 by stride, extend to a pointer */
+    op = copy_ld_i32(&begin_op, op);
+    op = copy_mul_i32(&begin_op, op, stride);
+    op = copy_ext_i32_ptr(&begin_op, op);
+
+    /* const_ptr, add_ptr */
+    op = copy_const_ptr(&begin_op, op, base);
+    op = copy_add_ptr(&begin_op, op);
 
     /* ld_i64 */
     op = copy_ld_i64(&begin_op, op);
@@ -488,6 +631,88 @@ inject_mem_cb(const GArray *cbs, TCGOp *begin_op)
     inject_cb_type(cbs, begin_op, append_mem_cb, op_rw);
 }
 
+/* drop the markers around ops that stay, leaving the ops' links intact */
+static void unwrap_ops(TCGOp *begin_op, TCGOp *end_op)
+{
+    rm_ops_range(begin_op, begin_op);
+    rm_ops_range(end_op, end_op);
+}
+
+/* the first two ops of a record are the mov_i32 of its tag and owner */
+static void set_mem_batch_owner(TCGOp *op, const struct qemu_plugin_dyn_cb *cb)
+{
+    tcg_debug_assert(op->opc == INDEX_op_mov_i32);
+    op->args[1] = tcgv_i32_arg(tcg_constant_i32(cb->batch.tag));
+    op = QTAILQ_NEXT(op, link);
+    tcg_debug_assert(op->opc == INDEX_op_mov_i32);
+    op->args[1] = tcgv_i32_arg(tcg_constant_i32(cb->batch.owner));
+}
+
+/* Returns the number of records kept, one per plugin that wants them */
+static unsigned inject_mem_batch(const GArray *cbs, TCGOp *begin_op)
+{
+    TCGOp *end_op;
+    TCGOp *last_op;
+    TCGOp *op;
+    unsigned n = 0;
+    guint i;
+
+    end_op = find_op(begin_op, INDEX_op_plugin_cb_end);
+    tcg_debug_assert(end_op);
+    last_op = QTAILQ_PREV(end_op, link);
+
+    for (i = 0; cbs && i < cbs->len; i++) {
+        const struct qemu_plugin_dyn_cb *cb =
+            &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+        TCGOp *src = begin_op;
+        TCGOp *first;
+
+        if (!op_rw(begin_op, cb)) {
+            continue;
+        }
+        if (n++ == 0) {
+            set_mem_batch_owner(QTAILQ_NEXT(begin_op, link), cb);
+            continue;
+        }
+        /* another copy of the record, after the last one */
+        op = QTAILQ_PREV(end_op, link);
+        first = copy_op_nocheck(&src, op);
+        op = first;
+        while (src != last_op) {
+            op = copy_op_nocheck(&src, op);
+        }
+        set_mem_batch_owner(first, cb);
+    }
+
+    if (n == 0) {
+        rm_ops(begin_op);
+        return 0;
+    }
+    unwrap_ops(begin_op, end_op);
+    return n;
+}
+
+static void inject_mem_batch_reserve(TCGOp *begin_op, uint32_t n)
+{
+    TCGOp *end_op;
+    TCGOp *op;
+
+    if (n == 0) {
+        rm_ops(begin_op);
+        return;
+    }
+
+    end_op = find_op(begin_op, INDEX_op_plugin_cb_end);
+    tcg_debug_assert(end_op);
+
+    /* mov_i32 n */
+    op = QTAILQ_NEXT(begin_op, link);
+    tcg_debug_assert(op->opc == INDEX_op_mov_i32);
+    op->args[1] = tcgv_i32_arg(tcg_constant_i32(n));
+
+    unwrap_ops(begin_op, end_op);
+}
+
 /* we could change the ops in place, but we can reuse more code by copying */
 static void inject_mem_helper(TCGOp *begin_op, GArray *arr)
 {
@@ -523,12 +748,13 @@ static void inject_mem_enable_helper(struct qemu_plugin_tb *ptb,
                                      struct qemu_plugin_insn *plugin_insn,
                                      TCGOp *begin_op)
 {
-    GArray *cbs[2];
+    GArray *cbs[3];
     GArray *arr;
     size_t n_cbs, i;
 
     cbs[0] = plugin_insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_REGULAR];
     cbs[1] = plugin_insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_INLINE];
+    cbs[2] = plugin_insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_BATCH];
 
     n_cbs = 0;
     for (i = 0; i < ARRAY_SIZE(cbs); i++) {
@@ -588,6 +814,12 @@ static void plugin_gen_tb_udata(const struct qemu_plugin_tb *ptb,
     inject_udata_cb(ptb->cbs[PLUGIN_CB_REGULAR], begin_op);
 }
 
+static void plugin_gen_tb_udata_r(const struct qemu_plugin_tb *ptb,
+                                  TCGOp *begin_op)
+{
+    inject_udata_cb(ptb->cbs[PLUGIN_CB_REGULAR_R], begin_op);
+}
+
 static void plugin_gen_tb_inline(const struct qemu_plugin_tb *ptb,
                                  TCGOp *begin_op)
 {
@@ -602,6 +834,14 @@ static void plugin_gen_insn_udata(const struct qemu_plugin_tb *ptb,
     inject_udata_cb(insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_REGULAR], begin_op);
 }
 
+static void plugin_gen_insn_udata_r(const struct qemu_plugin_tb *ptb,
+                                    TCGOp *begin_op, int insn_idx)
+{
+    struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, insn_idx);
+
+    inject_udata_cb(insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_REGULAR_R], begin_op);
+}
+
 static void plugin_gen_insn_inline(const struct qemu_plugin_tb *ptb,
                                    TCGOp *begin_op, int insn_idx)
 {
@@ -627,6 +867,15 @@ static void plugin_gen_mem_inline(const struct qemu_plugin_tb *ptb,
     inject_inline_cb(cbs, begin_op, op_rw);
 }
 
+static unsigned plugin_gen_mem_batch(const struct qemu_plugin_tb *ptb,
+                                     TCGOp *begin_op, int insn_idx)
+{
+    struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, insn_idx);
+
+    return inject_mem_batch(insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_BATCH],
+                            begin_op);
+}
+
 static void plugin_gen_enable_mem_helper(struct qemu_plugin_tb *ptb,
                                          TCGOp *begin_op, int insn_idx)
 {
@@ -673,6 +922,9 @@ static void pr_ops(void)
             case PLUGIN_GEN_CB_UDATA:
                 type = "udata";
                 break;
+            case PLUGIN_GEN_CB_UDATA_R:
+                type = "udata (read regs)";
+                break;
             case PLUGIN_GEN_CB_INLINE:
                 type = "inline";
                 break;
@@ -685,6 +937,9 @@ static void pr_ops(void)
             case PLUGIN_GEN_DISABLE_MEM_HELPER:
                 type = "disable mem helper";
                 break;
+            case PLUGIN_GEN_CB_MEM_BATCH:
+                type = "mem batch";
+                break;
             default:
                 break;
             }
@@ -698,6 +953,8 @@ static void pr_ops(void)
 static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
 {
     TCGOp *op;
+    TCGOp *batch_reserve_op = NULL;
+    uint32_t n_batch = 0;
     int insn_idx = -1;
 
     pr_ops();
@@ -721,9 +978,16 @@ static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
                 case PLUGIN_GEN_CB_UDATA:
                     plugin_gen_tb_udata(plugin_tb, op);
                     break;
+                case PLUGIN_GEN_CB_UDATA_R:
+                    plugin_gen_tb_udata_r(plugin_tb, op);
+                    break;
                 case PLUGIN_GEN_CB_INLINE:
                     plugin_gen_tb_inline(plugin_tb, op);
                     break;
+                case PLUGIN_GEN_CB_MEM_BATCH:
+                    /* wait until all the records are known */
+                    batch_reserve_op = op;
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -737,6 +1001,9 @@ static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
                 case PLUGIN_GEN_CB_UDATA:
                     plugin_gen_insn_udata(plugin_tb, op, insn_idx);
                     break;
+                case PLUGIN_GEN_CB_UDATA_R:
+                    plugin_gen_insn_udata_r(plugin_tb, op, insn_idx);
+                    break;
                 case PLUGIN_GEN_CB_INLINE:
                     plugin_gen_insn_inline(plugin_tb, op, insn_idx);
                     break;
@@ -759,6 +1026,9 @@ static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
                 case PLUGIN_GEN_CB_INLINE:
                     plugin_gen_mem_inline(plugin_tb, op, insn_idx);
                     break;
+                case PLUGIN_GEN_CB_MEM_BATCH:
+                    n_batch += plugin_gen_mem_batch(plugin_tb, op, insn_idx);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -788,6 +1058,9 @@ static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
             break;
         }
     }
+    if (batch_reserve_op) {
+        inject_mem_batch_reserve(batch_reserve_op, n_batch);
+    }
     pr_ops();
 }
 
@@ -818,6 +1091,8 @@ bool plugin_gen_tb_start(CPUState *cpu, const DisasContextBase *db,
         ptb->mem_helper = false;
 
         plugin_gen_empty_callback(PLUGIN_GEN_FROM_TB);
+        gen_wrapped(PLUGIN_GEN_FROM_TB, PLUGIN_GEN_CB_MEM_BATCH,
+                    gen_empty_mem_batch_reserve);
     }
 
     tcg_ctx->plugin_insn = NULL;
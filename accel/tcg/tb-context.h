@@ -22,6 +22,7 @@
 
 #include "qemu/thread.h"
 #include "qemu/qht.h"
+#include "qemu/stats64.h"
 
 #define CODE_GEN_HTABLE_BITS     15
 #define CODE_GEN_HTABLE_SIZE     (1 << CODE_GEN_HTABLE_BITS)
@@ -34,7 +35,13 @@ struct TBContext {
 
     /* statistics */
     unsigned tb_flush_count;
+    unsigned tb_evict_count;
     unsigned tb_phys_invalidate_count;
+    /* successful translations and the host time they took, in ns */
+    Stat64 tb_gen_count;
+    Stat64 tb_gen_time;
+    /* host time since which the TBs' exec_count have been counting */
+    int64_t hot_blocks_since;
 };
 
 extern TBContext tb_ctx;
@@ -18,6 +18,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/bitmap.h"
 #include "qemu/interval-tree.h"
 #include "qemu/qtree.h"
 #include "exec/cputlb.h"
@@ -60,6 +61,7 @@ void tb_htable_init(void)
     unsigned int mode = QHT_MODE_AUTO_RESIZE;
 
     qht_init(&tb_ctx.htable, tb_cmp, CODE_GEN_HTABLE_SIZE, mode);
+    tb_ctx.hot_blocks_since = get_clock();
 }
 
 typedef struct PageDesc PageDesc;
@@ -178,10 +180,23 @@ static int v_l2_levels;
 
 static void *l1_map[V_L1_MAX_SIZE];
 
+/*
+ * Once a page with code has seen SMC_BITMAP_USE_THRESHOLD writes, a
+ * bitmap of the bytes its TBs were translated from is built, one bit
+ * per SMC_BITMAP_GRANULE bytes. Writes that miss it, typically to
+ * variables that share the page with code, then skip invalidation.
+ */
+#define SMC_BITMAP_USE_THRESHOLD 10
+#define SMC_BITMAP_GRANULE_BITS  4
+#define SMC_BITMAP_BITS          (TARGET_PAGE_SIZE >> SMC_BITMAP_GRANULE_BITS)
+
 struct PageDesc {
     QemuSpin lock;
     /* list of TBs intersecting this ram page */
     uintptr_t first_tb;
+    /* protected by lock, dropped whenever the list changes */
+    unsigned long *code_bitmap;
+    unsigned int code_write_count;
 };
 
 void page_table_config_init(void)
@@ -649,6 +664,42 @@ static void page_collection_unlock(struct page_collection *set)
     g_free(set);
 }
 
+static void invalidate_page_bitmap(PageDesc *p)
+{
+    assert_page_locked(p);
+
+    g_free(p->code_bitmap);
+    p->code_bitmap = NULL;
+    p->code_write_count = 0;
+}
+
+/* Called with @p->lock held. */
+static void build_page_bitmap(PageDesc *p)
+{
+    TranslationBlock *tb;
+    PageForEachNext n;
+
+    assert_page_locked(p);
+    p->code_bitmap = bitmap_new(SMC_BITMAP_BITS);
+
+    PAGE_FOR_EACH_TB(unused, unused, p, tb, n) {
+        tb_page_addr_t tb_start, tb_last;
+
+        /* same as in tb_invalidate_phys_page_range__locked */
+        tb_start = tb_page_addr0(tb);
+        tb_last = tb_start + tb->size - 1;
+        if (n == 0) {
+            tb_last = MIN(tb_last, tb_start | ~TARGET_PAGE_MASK);
+        } else {
+            tb_start = tb_page_addr1(tb);
+            tb_last = tb_start + (tb_last & ~TARGET_PAGE_MASK);
+        }
+        tb_start = (tb_start & ~TARGET_PAGE_MASK) >> SMC_BITMAP_GRANULE_BITS;
+        tb_last = (tb_last & ~TARGET_PAGE_MASK) >> SMC_BITMAP_GRANULE_BITS;
+        bitmap_set(p->code_bitmap, tb_start, tb_last - tb_start + 1);
+    }
+}
+
 /* Set to NULL all the 'first_tb' fields in all PageDescs. */
 static void tb_remove_all_1(int level, void **lp)
 {
@@ -663,6 +714,7 @@ static void tb_remove_all_1(int level, void **lp)
         for (i = 0; i < V_L2_SIZE; ++i) {
             page_lock(&pd[i]);
             pd[i].first_tb = (uintptr_t)NULL;
+            invalidate_page_bitmap(&pd[i]);
             page_unlock(&pd[i]);
         }
     } else {
@@ -696,6 +748,7 @@ static void tb_page_add(PageDesc *p, TranslationBlock *tb, unsigned int n)
     tb->page_next[n] = p->first_tb;
     page_already_protected = p->first_tb != 0;
     p->first_tb = (uintptr_t)tb | n;
+    invalidate_page_bitmap(p);
 
     /*
      * If some code is already present, then the pages are already
@@ -732,6 +785,7 @@ static void tb_page_remove(PageDesc *pd, TranslationBlock *tb)
     PAGE_FOR_EACH_TB(unused, unused, pd, tb1, n1) {
         if (tb1 == tb) {
             *pprev = tb1->page_next[n1];
+            invalidate_page_bitmap(pd);
             return;
         }
         pprev = &tb1->page_next[n1];
@@ -776,6 +830,8 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
     tcg_region_reset_all();
     /* XXX: flush processor icache at this point if cache flush is expensive */
     qatomic_inc(&tb_ctx.tb_flush_count);
+    /* the execution counts went with the TBs */
+    qatomic_set__nocheck(&tb_ctx.hot_blocks_since, get_clock());
 
 done:
     mmap_unlock();
@@ -917,7 +973,7 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
     /* remove the TB from the hash list */
     phys_pc = tb_page_addr0(tb);
     h = tb_hash_func(phys_pc, (orig_cflags & CF_PCREL ? 0 : tb->pc),
-                     tb->flags, tb->cs_base, orig_cflags);
+                     tb->flags, tb->cs_base, orig_cflags & ~CF_TRACE);
     if (!qht_remove(&tb_ctx.htable, tb, h)) {
         return;
     }
@@ -963,6 +1019,78 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     }
 }
 
+static gboolean tb_evict_collect(gpointer key, gpointer value, gpointer data)
+{
+    g_ptr_array_add(data, value);
+    return false;
+}
+
+static unsigned tb_reclaim_count(void)
+{
+    return qatomic_read(&tb_ctx.tb_flush_count) +
+           qatomic_read(&tb_ctx.tb_evict_count);
+}
+
+/* evict the TBs of one region, or all of them if that is not possible */
+static void do_tb_evict(CPUState *cpu, run_on_cpu_data reclaim_count)
+{
+    g_autoptr(GPtrArray) tbs = NULL;
+    size_t idx;
+    guint i;
+
+    mmap_lock();
+    /* If room has been made on request of another CPU, just retry. */
+    if (tb_reclaim_count() != reclaim_count.host_int) {
+        mmap_unlock();
+        return;
+    }
+    if (!tcg_region_evict_pick(&idx)) {
+        mmap_unlock();
+        do_tb_flush(cpu, RUN_ON_CPU_HOST_INT(tb_ctx.tb_flush_count));
+        return;
+    }
+
+    /*
+     * Unlink the region's TBs from the hash table, the page lists, the
+     * jump caches and from every TB that chains to them, wherever those
+     * are; nothing may reach the region once it is reused.
+     */
+    tbs = g_ptr_array_new();
+    tcg_region_tb_foreach(idx, tb_evict_collect, tbs);
+    qemu_thread_jit_write();
+    for (i = 0; i < tbs->len; i++) {
+        TranslationBlock *tb = g_ptr_array_index(tbs, i);
+
+        if (!(tb_cflags(tb) & CF_INVALID)) {
+            tb_phys_invalidate(tb, -1);
+        }
+    }
+    qemu_thread_jit_execute();
+
+    tcg_region_evict(idx);
+    qatomic_inc(&tb_ctx.tb_evict_count);
+    mmap_unlock();
+}
+
+/*
+ * Make room in a full code buffer.  Rather than flushing every TB, evict
+ * the oldest region that does not hold the hot working set; this falls
+ * back to tb_flush() if the buffer is a single region.
+ */
+void tb_evict(CPUState *cpu)
+{
+    if (tcg_enabled()) {
+        unsigned reclaim_count = tb_reclaim_count();
+
+        if (cpu_in_serial_context(cpu)) {
+            do_tb_evict(cpu, RUN_ON_CPU_HOST_INT(reclaim_count));
+        } else {
+            async_safe_run_on_cpu(cpu, do_tb_evict,
+                                  RUN_ON_CPU_HOST_INT(reclaim_count));
+        }
+    }
+}
+
 /*
  * Add a new TB and link it to the physical page tables.
  * Called with mmap_lock held for user-mode emulation.
@@ -984,7 +1112,7 @@ TranslationBlock *tb_link_page(TranslationBlock *tb)
 
     /* add in the hash table */
     h = tb_hash_func(tb_page_addr0(tb), (tb->cflags & CF_PCREL ? 0 : tb->pc),
-                     tb->flags, tb->cs_base, tb->cflags);
+                     tb->flags, tb->cs_base, tb->cflags & ~CF_TRACE);
     qht_insert(&tb_ctx.htable, tb, h, &existing_tb);
 
     /* remove TB from the page(s) if we couldn't insert it */
@@ -1242,6 +1370,36 @@ void tb_invalidate_phys_range_fast(ram_addr_t ram_addr,
                                    uintptr_t retaddr)
 {
     struct page_collection *pages;
+    ram_addr_t offset = ram_addr & ~TARGET_PAGE_MASK;
+    ram_addr_t last = offset + size - 1;
+    PageDesc *p;
+    bool hit;
+
+    /*
+     * Check the bitmap first, without building a page collection, unless
+     * the access spills into the next page. An unaligned access may span
+     * two granules, so look at every granule it touches.
+     */
+    if (last < TARGET_PAGE_SIZE) {
+        p = page_find(ram_addr >> TARGET_PAGE_BITS);
+        if (!p) {
+            return;
+        }
+        page_lock(p);
+        if (!p->code_bitmap &&
+            ++p->code_write_count >= SMC_BITMAP_USE_THRESHOLD) {
+            build_page_bitmap(p);
+        }
+        hit = !p->code_bitmap ||
+              find_next_bit(p->code_bitmap,
+                            (last >> SMC_BITMAP_GRANULE_BITS) + 1,
+                            offset >> SMC_BITMAP_GRANULE_BITS) <=
+              (last >> SMC_BITMAP_GRANULE_BITS);
+        page_unlock(p);
+        if (!hit) {
+            return;
+        }
+    }
 
     pages = page_collection_lock(ram_addr, ram_addr + size - 1);
     tb_invalidate_phys_page_fast__locked(pages, ram_addr, size, retaddr);
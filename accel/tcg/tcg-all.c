@@ -45,6 +45,8 @@ struct TCGState {
 
     bool mttcg_enabled;
     bool one_insn_per_tb;
+    bool hot_blocks;
+    uint32_t trace_threshold;
     int splitwx_enabled;
     unsigned long tb_size;
 };
@@ -99,6 +101,8 @@ static void tcg_accel_instance_init(Object *obj)
 
 bool mttcg_enabled;
 bool one_insn_per_tb;
+bool tcg_hot_blocks;
+uint32_t tcg_trace_threshold;
 
 static int tcg_init_machine(MachineState *ms)
 {
@@ -111,6 +115,8 @@ static int tcg_init_machine(MachineState *ms)
 
     tcg_allowed = true;
     mttcg_enabled = s->mttcg_enabled;
+    tcg_hot_blocks = s->hot_blocks;
+    tcg_trace_threshold = s->trace_threshold;
 
     page_init();
     tb_htable_init();
@@ -207,6 +213,46 @@ static void tcg_set_one_insn_per_tb(Object *obj, bool value, Error **errp)
     qatomic_set(&one_insn_per_tb, value);
 }
 
+static bool tcg_get_hot_blocks(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->hot_blocks;
+}
+
+static void tcg_set_hot_blocks(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->hot_blocks = value;
+    /* TBs translated from now on follow */
+    qatomic_set(&tcg_hot_blocks, value);
+}
+
+static void tcg_get_trace_threshold(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->trace_threshold;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_trace_threshold(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    s->trace_threshold = value;
+    /* TBs translated from now on follow */
+    qatomic_set(&tcg_trace_threshold, value);
+}
+
 static int tcg_gdbstub_supported_sstep_flags(void)
 {
     /*
@@ -252,6 +298,19 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
                                    tcg_set_one_insn_per_tb);
     object_class_property_set_description(oc, "one-insn-per-tb",
         "Only put one guest insn in each translation block");
+
+    object_class_property_add_bool(oc, "hot-blocks",
+                                   tcg_get_hot_blocks,
+                                   tcg_set_hot_blocks);
+    object_class_property_set_description(oc, "hot-blocks",
+        "Count the executions of each translation block");
+
+    object_class_property_add(oc, "trace-threshold", "uint32",
+        tcg_get_trace_threshold, tcg_set_trace_threshold,
+        NULL, NULL);
+    object_class_property_set_description(oc, "trace-threshold",
+        "Executions after which a translation block is retranslated "
+        "along its hot branches, 0 to never do so");
 }
 
 static const TypeInfo tcg_accel_type = {
@@ -284,6 +284,12 @@ static int setjmp_gen_code(CPUArchState *env, TranslationBlock *tb,
     return tcg_gen_code(tcg_ctx, tb, pc);
 }
 
+static void tb_gen_account(int64_t start)
+{
+    stat64_add(&tb_ctx.tb_gen_count, 1);
+    stat64_add(&tb_ctx.tb_gen_time, get_clock() - start);
+}
+
 /* Called with mmap_lock held for user mode emulation.  */
 TranslationBlock *tb_gen_code(CPUState *cpu,
                               vaddr pc, uint64_t cs_base,
@@ -294,7 +300,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb_page_addr_t phys_pc, phys_p2;
     tcg_insn_unit *gen_code_buf;
     int gen_code_size, search_size, max_insns;
-    int64_t ti;
+    int64_t ti, gen_start = get_clock();
     void *host_pc;
 
     assert_memory_lock();
@@ -317,10 +323,10 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     assert_no_pages_locked();
     tb = tcg_tb_alloc(tcg_ctx);
     if (unlikely(!tb)) {
-        /* flush must be done */
-        tb_flush(cpu);
+        /* the buffer is full, evict a region (or flush) to make room */
+        tb_evict(cpu);
         mmap_unlock();
-        /* Make the execution loop process the flush as soon as possible.  */
+        /* Make the execution loop process the eviction as soon as possible. */
         cpu->exception_index = EXCP_INTERRUPT;
         cpu_loop_exit(cpu);
     }
@@ -333,6 +339,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->cs_base = cs_base;
     tb->flags = flags;
     tb->cflags = cflags;
+    *tcg_tb_exec_count(tb) = 0;
     tb_set_page_addr0(tb, phys_pc);
     tb_set_page_addr1(tb, -1);
     if (phys_pc != -1) {
@@ -535,6 +542,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
      */
     if (tb_page_addr0(tb) == -1) {
         assert_no_pages_locked();
+        tb_gen_account(gen_start);
         return tb;
     }
 
@@ -551,6 +559,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
      */
     existing_tb = tb_link_page(tb);
     assert_no_pages_locked();
+    tb_gen_account(gen_start);
 
     /* if the TB already exists, discard what we just translated */
     if (unlikely(existing_tb != tb)) {
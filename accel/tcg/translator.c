@@ -78,6 +78,33 @@ static TCGOp *gen_tb_start(DisasContextBase *db, uint32_t cflags)
         tcg_gen_brcondi_i32(TCG_COND_LT, count, 0, tcg_ctx->exitreq_label);
     }
 
+    if (qatomic_read(&tcg_hot_blocks)) {
+        /* only counted once the TB really runs, not on an exit request */
+        TCGv_ptr ptr = tcg_constant_ptr(tcg_tb_exec_count(db->tb));
+        TCGv_i64 exec_count = tcg_temp_new_i64();
+
+        tcg_gen_ld_i64(exec_count, ptr, 0);
+        tcg_gen_addi_i64(exec_count, exec_count, 1);
+        tcg_gen_st_i64(exec_count, ptr, 0);
+
+        if (tb_trace_allowed(cflags)) {
+            /*
+             * Leave through an exit request the one time the count hits
+             * the threshold, the main loop then replaces us by a trace.
+             */
+            TCGLabel *cold = gen_new_label();
+
+            tcg_gen_brcondi_i64(TCG_COND_NE, exec_count,
+                                qatomic_read(&tcg_trace_threshold), cold);
+            tcg_gen_st16_i32(tcg_constant_i32(-1), tcg_env,
+                             offsetof(ArchCPU,
+                                      parent_obj.neg.icount_decr.u16.high)
+                             - offsetof(ArchCPU, env));
+            tcg_gen_br(tcg_ctx->exitreq_label);
+            gen_set_label(cold);
+        }
+    }
+
     if (cflags & CF_USE_ICOUNT) {
         tcg_gen_st16_i32(count, tcg_env,
                          offsetof(ArchCPU, parent_obj.neg.icount_decr.u16.low)
@@ -123,6 +150,46 @@ bool translator_use_goto_tb(DisasContextBase *db, vaddr dest)
     return ((db->pc_first ^ dest) & TARGET_PAGE_MASK) == 0;
 }
 
+bool translator_trace_jump(DisasContextBase *db, vaddr dest)
+{
+    /* plugins expect to see the guest code in the order it is laid out */
+    return (tb_cflags(db->tb) & CF_TRACE) && !db->plugin_enabled &&
+           !db->singlestep_enabled &&
+           dest >= db->pc_next && is_same_page(db, dest);
+}
+
+bool translator_trace_branch(DisasContextBase *db, CPUState *cpu,
+                             vaddr taken, vaddr *dest)
+{
+    uint64_t n_taken, n_next;
+    bool can_take;
+
+    if (!translator_trace_jump(db, db->pc_next)) {
+        return false;
+    }
+    can_take = translator_trace_jump(db, taken);
+
+    /*
+     * The TBs that the two exits would chain to. Without a count for the
+     * fall-through there is only the branch to follow, if it can be.
+     */
+    n_next = tb_dest_exec_count(cpu, db->tb, db->pc_next);
+    if (!n_next && !can_take) {
+        return false;
+    }
+    n_taken = tb_dest_exec_count(cpu, db->tb, taken);
+
+    if (n_next > 2 * n_taken) {
+        *dest = db->pc_next;
+        return true;
+    }
+    if (can_take && n_taken > 2 * n_next) {
+        *dest = taken;
+        return true;
+    }
+    return false;
+}
+
 void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
                      vaddr pc, void *host_pc, const TranslatorOps *ops,
                      DisasContextBase *db)
@@ -1,3 +1,4 @@
 TARGET_ARCH=h8300
+TARGET_XML_FILES= gdb-xml/h8300-core.xml
 TARGET_NEED_FDT=y
 TARGET_BIG_ENDIAN=y
@@ -7,6 +7,7 @@
 
 #include <inttypes.h>
 #include <stdio.h>
+#include <string.h>
 #include <glib.h>
 
 #include <qemu-plugin.h>
@@ -20,7 +21,6 @@ static enum qemu_plugin_mem_rw rw = QEMU_PLUGIN_MEM_RW;
 static GHashTable *miss_ht;
 
 static GMutex hashtable_lock;
-static GRand *rng;
 
 static int limit;
 static bool sys;
@@ -38,9 +38,10 @@ enum EvictionPolicy policy;
  * put in any of the blocks inside the set. The number of block per set is
  * called the associativity (assoc).
  *
- * Each block contains the stored tag and a valid bit. Since this is not
- * a functional simulator, the data itself is not stored. We only identify
- * whether a block is in the cache or not by searching for its tag.
+ * Each block is only represented by its stored tag, an invalid block holding
+ * a tag no address can produce. Since this is not a functional simulator, the
+ * data itself is not stored. We only identify whether a block is in the cache
+ * or not by searching for its tag.
  *
  * In order to search for memory data in the cache, the set identifier and tag
  * are extracted from the address and the set is probed to see whether a tag
@@ -53,16 +54,18 @@ enum EvictionPolicy policy;
  * The tag is compared against all the tags of a set to search for a match. If a
  * match is found, then the access is a hit.
  *
+ * The tags of a set are stored contiguously and padded to a whole number of
+ * TagVec, so that a set is probed a vector of tags at a time.
+ *
  * The CacheSet also contains bookkeaping information about eviction details.
  */
 
-typedef struct {
-    uint64_t tag;
-    bool valid;
-} CacheBlock;
+typedef uint64_t TagVec __attribute__((vector_size(32)));
+
+#define TAGS_PER_VEC ((int)(sizeof(TagVec) / sizeof(uint64_t)))
 
 typedef struct {
-    CacheBlock *blocks;
+    uint64_t *tags;
     uint64_t *lru_priorities;
     uint64_t lru_gen_counter;
     GQueue *fifo_queue;
@@ -73,11 +76,11 @@ typedef struct {
     int num_sets;
     int cachesize;
     int assoc;
+    int tag_vecs;
     int blksize_shift;
     uint64_t set_mask;
     uint64_t tag_mask;
-    uint64_t accesses;
-    uint64_t misses;
+    uint64_t invalid_tag;
 } Cache;
 
 typedef struct {
@@ -89,29 +92,51 @@ typedef struct {
     uint64_t l2_misses;
 } InsnData;
 
+/*
+ * Everything a vCPU touches on its own: its L1 caches, its L2 unless that
+ * is shared, and the counters. Only the vCPU itself ever uses its Core
+ * while running, so none of this needs locking.
+ */
+typedef struct {
+    Cache *l1_dcache;
+    Cache *l1_icache;
+    Cache *l2_ucache;
+    GRand *rng;
+    uint64_t l1_daccesses;
+    uint64_t l1_dmisses;
+    uint64_t l1_iaccesses;
+    uint64_t l1_imisses;
+    uint64_t l2_accesses;
+    uint64_t l2_misses;
+} Core;
+
 void (*update_hit)(Cache *cache, int set, int blk);
 void (*update_miss)(Cache *cache, int set, int blk);
 
 void (*metadata_init)(Cache *cache);
 void (*metadata_destroy)(Cache *cache);
 
-static int cores;
-static Cache **l1_dcaches, **l1_icaches;
+static struct qemu_plugin_scoreboard *cores;
+
+static int l1_iassoc, l1_iblksize, l1_icachesize;
+static int l1_dassoc, l1_dblksize, l1_dcachesize;
+static int l2_assoc, l2_blksize, l2_cachesize;
 
 static bool use_l2;
-static Cache **l2_ucaches;
 
-static GMutex *l1_dcache_locks;
-static GMutex *l1_icache_locks;
-static GMutex *l2_ucache_locks;
+/*
+ * A shared L2 is protected by sharded locks: sets are spread over the
+ * shards, so vCPUs only contend when they hit sets in the same shard.
+ */
+#define L2_SHARDS 64
 
-static uint64_t l1_dmem_accesses;
-static uint64_t l1_imem_accesses;
-static uint64_t l1_imisses;
-static uint64_t l1_dmisses;
+typedef struct {
+    GMutex lock;
+} __attribute__((aligned(64))) CacheShard;
 
-static uint64_t l2_mem_accesses;
-static uint64_t l2_misses;
+static bool l2_shared;
+static Cache *l2_shared_cache;
+static CacheShard *l2_shards;
 
 static int pow_of_two(int num)
 {
@@ -156,7 +181,8 @@ static void lru_update_blk(Cache *cache, int set_idx, int blk_idx)
 
 static int lru_get_lru_block(Cache *cache, int set_idx)
 {
-    int i, min_idx, min_priority;
+    int i, min_idx;
+    uint64_t min_priority;
 
     min_priority = cache->sets[set_idx].lru_priorities[0];
     min_idx = 0;
@@ -236,6 +262,8 @@ static const char *cache_config_error(int blksize, int assoc, int cachesize)
         return "cache size must be divisible by block size";
     } else if (cachesize % (blksize * assoc) != 0) {
         return "cache size must be divisible by set size (assoc * block size)";
+    } else if (blksize == 1 && cachesize == assoc) {
+        return "a fully associative cache needs blocks of 2 bytes or more";
     } else {
         return NULL;
     }
@@ -243,13 +271,13 @@ static const char *cache_config_error(int blksize, int assoc, int cachesize)
 
 static bool bad_cache_params(int blksize, int assoc, int cachesize)
 {
-    return (cachesize % blksize) != 0 || (cachesize % (blksize * assoc) != 0);
+    return cache_config_error(blksize, assoc, cachesize) != NULL;
 }
 
 static Cache *cache_init(int blksize, int assoc, int cachesize)
 {
     Cache *cache;
-    int i;
+    int i, j;
     uint64_t blk_mask;
 
     /*
@@ -264,16 +292,22 @@ static Cache *cache_init(int blksize, int assoc, int cachesize)
     cache->num_sets = cachesize / (blksize * assoc);
     cache->sets = g_new(CacheSet, cache->num_sets);
     cache->blksize_shift = pow_of_two(blksize);
-    cache->accesses = 0;
-    cache->misses = 0;
-
-    for (i = 0; i < cache->num_sets; i++) {
-        cache->sets[i].blocks = g_new0(CacheBlock, assoc);
-    }
+    cache->tag_vecs = (assoc + TAGS_PER_VEC - 1) / TAGS_PER_VEC;
 
     blk_mask = blksize - 1;
     cache->set_mask = ((cache->num_sets - 1) << cache->blksize_shift);
     cache->tag_mask = ~(cache->set_mask | blk_mask);
+    /* has bits no tag has, thanks to the checks in cache_config_error() */
+    cache->invalid_tag = ~cache->tag_mask;
+
+    for (i = 0; i < cache->num_sets; i++) {
+        int n = cache->tag_vecs * TAGS_PER_VEC;
+
+        cache->sets[i].tags = g_new(uint64_t, n);
+        for (j = 0; j < n; j++) {
+            cache->sets[i].tags[j] = cache->invalid_tag;
+        }
+    }
 
     if (metadata_init) {
         metadata_init(cache);
@@ -282,38 +316,45 @@ static Cache *cache_init(int blksize, int assoc, int cachesize)
     return cache;
 }
 
-static Cache **caches_init(int blksize, int assoc, int cachesize)
+/*
+ * Find @tag in @set, returns its block or -1. The padding blocks past
+ * assoc always hold invalid_tag, so searching for that finds the first
+ * invalid block if there is one and a padding block otherwise.
+ */
+static int find_tag(Cache *cache, int set, uint64_t tag)
 {
-    Cache **caches;
-    int i;
-
-    if (bad_cache_params(blksize, assoc, cachesize)) {
-        return NULL;
-    }
+    const uint64_t *tags = cache->sets[set].tags;
+    TagVec key = (TagVec){} + tag;
+    int v, i;
 
-    caches = g_new(Cache *, cores);
+    for (v = 0; v < cache->tag_vecs; v++) {
+        TagVec blk, eq;
+        uint64_t any = 0;
 
-    for (i = 0; i < cores; i++) {
-        caches[i] = cache_init(blksize, assoc, cachesize);
+        memcpy(&blk, &tags[v * TAGS_PER_VEC], sizeof(blk));
+        eq = (TagVec)(blk == key);
+        for (i = 0; i < TAGS_PER_VEC; i++) {
+            any |= eq[i];
+        }
+        if (any) {
+            for (i = 0; !eq[i]; i++) {
+                continue;
+            }
+            return v * TAGS_PER_VEC + i;
+        }
     }
 
-    return caches;
+    return -1;
 }
 
 static int get_invalid_block(Cache *cache, uint64_t set)
 {
-    int i;
+    int blk = find_tag(cache, set, cache->invalid_tag);
 
-    for (i = 0; i < cache->assoc; i++) {
-        if (!cache->sets[set].blocks[i].valid) {
-            return i;
-        }
-    }
-
-    return -1;
+    return blk < cache->assoc ? blk : -1;
 }
 
-static int get_replaced_block(Cache *cache, int set)
+static int get_replaced_block(Cache *cache, int set, GRand *rng)
 {
     switch (policy) {
     case RAND:
@@ -329,31 +370,19 @@ static int get_replaced_block(Cache *cache, int set)
 
 static int in_cache(Cache *cache, uint64_t addr)
 {
-    int i;
-    uint64_t tag, set;
-
-    tag = extract_tag(cache, addr);
-    set = extract_set(cache, addr);
-
-    for (i = 0; i < cache->assoc; i++) {
-        if (cache->sets[set].blocks[i].tag == tag &&
-                cache->sets[set].blocks[i].valid) {
-            return i;
-        }
-    }
-
-    return -1;
+    return find_tag(cache, extract_set(cache, addr), extract_tag(cache, addr));
 }
 
 /**
  * access_cache(): Simulate a cache access
  * @cache: The cache under simulation
  * @addr: The address of the requested memory location
+ * @rng: random numbers for the RAND policy, owned by the caller
  *
  * Returns true if the requested data is hit in the cache and false when missed.
  * The cache is updated on miss for the next access.
  */
-static bool access_cache(Cache *cache, uint64_t addr)
+static bool access_cache(Cache *cache, uint64_t addr, GRand *rng)
 {
     int hit_blk, replaced_blk;
     uint64_t tag, set;
@@ -372,26 +401,59 @@ static bool access_cache(Cache *cache, uint64_t addr)
     replaced_blk = get_invalid_block(cache, set);
 
     if (replaced_blk == -1) {
-        replaced_blk = get_replaced_block(cache, set);
+        replaced_blk = get_replaced_block(cache, set, rng);
     }
 
     if (update_miss) {
         update_miss(cache, set, replaced_blk);
     }
 
-    cache->sets[set].blocks[replaced_blk].tag = tag;
-    cache->sets[set].blocks[replaced_blk].valid = true;
+    cache->sets[set].tags[replaced_blk] = tag;
 
     return false;
 }
 
+/* Caches are only built when a vCPU first needs them */
+static Core *get_core(unsigned int vcpu_index)
+{
+    Core *core = qemu_plugin_scoreboard_find(cores, vcpu_index);
+
+    if (!core->l1_dcache) {
+        core->l1_dcache = cache_init(l1_dblksize, l1_dassoc, l1_dcachesize);
+        core->l1_icache = cache_init(l1_iblksize, l1_iassoc, l1_icachesize);
+        if (use_l2 && !l2_shared) {
+            core->l2_ucache = cache_init(l2_blksize, l2_assoc, l2_cachesize);
+        }
+        if (policy == RAND) {
+            core->rng = g_rand_new();
+        }
+    }
+    return core;
+}
+
+static bool access_l2(Core *core, uint64_t addr)
+{
+    CacheShard *shard;
+    bool hit;
+
+    if (!l2_shared) {
+        return access_cache(core->l2_ucache, addr, core->rng);
+    }
+
+    shard = &l2_shards[extract_set(l2_shared_cache, addr) % L2_SHARDS];
+    g_mutex_lock(&shard->lock);
+    hit = access_cache(l2_shared_cache, addr, core->rng);
+    g_mutex_unlock(&shard->lock);
+    return hit;
+}
+
 static void vcpu_mem_access(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
                             uint64_t vaddr, void *userdata)
 {
     uint64_t effective_addr;
     struct qemu_plugin_hwaddr *hwaddr;
-    int cache_idx;
     InsnData *insn;
+    Core *core;
     bool hit_in_l1;
 
     hwaddr = qemu_plugin_get_hwaddr(info, vaddr);
@@ -400,66 +462,58 @@ static void vcpu_mem_access(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
     }
 
     effective_addr = hwaddr ? qemu_plugin_hwaddr_phys_addr(hwaddr) : vaddr;
-    cache_idx = vcpu_index % cores;
+    core = get_core(vcpu_index);
 
-    g_mutex_lock(&l1_dcache_locks[cache_idx]);
-    hit_in_l1 = access_cache(l1_dcaches[cache_idx], effective_addr);
+    hit_in_l1 = access_cache(core->l1_dcache, effective_addr, core->rng);
     if (!hit_in_l1) {
         insn = userdata;
-        __atomic_fetch_add(&insn->l1_dmisses, 1, __ATOMIC_SEQ_CST);
-        l1_dcaches[cache_idx]->misses++;
+        __atomic_fetch_add(&insn->l1_dmisses, 1, __ATOMIC_RELAXED);
+        core->l1_dmisses++;
     }
-    l1_dcaches[cache_idx]->accesses++;
-    g_mutex_unlock(&l1_dcache_locks[cache_idx]);
+    core->l1_daccesses++;
 
     if (hit_in_l1 || !use_l2) {
         /* No need to access L2 */
         return;
     }
 
-    g_mutex_lock(&l2_ucache_locks[cache_idx]);
-    if (!access_cache(l2_ucaches[cache_idx], effective_addr)) {
+    if (!access_l2(core, effective_addr)) {
         insn = userdata;
-        __atomic_fetch_add(&insn->l2_misses, 1, __ATOMIC_SEQ_CST);
-        l2_ucaches[cache_idx]->misses++;
+        __atomic_fetch_add(&insn->l2_misses, 1, __ATOMIC_RELAXED);
+        core->l2_misses++;
     }
-    l2_ucaches[cache_idx]->accesses++;
-    g_mutex_unlock(&l2_ucache_locks[cache_idx]);
+    core->l2_accesses++;
 }
 
 static void vcpu_insn_exec(unsigned int vcpu_index, void *userdata)
 {
     uint64_t insn_addr;
     InsnData *insn;
-    int cache_idx;
+    Core *core;
     bool hit_in_l1;
 
     insn_addr = ((InsnData *) userdata)->addr;
+    core = get_core(vcpu_index);
 
-    cache_idx = vcpu_index % cores;
-    g_mutex_lock(&l1_icache_locks[cache_idx]);
-    hit_in_l1 = access_cache(l1_icaches[cache_idx], insn_addr);
+    hit_in_l1 = access_cache(core->l1_icache, insn_addr, core->rng);
     if (!hit_in_l1) {
         insn = userdata;
-        __atomic_fetch_add(&insn->l1_imisses, 1, __ATOMIC_SEQ_CST);
-        l1_icaches[cache_idx]->misses++;
+        __atomic_fetch_add(&insn->l1_imisses, 1, __ATOMIC_RELAXED);
+        core->l1_imisses++;
     }
-    l1_icaches[cache_idx]->accesses++;
-    g_mutex_unlock(&l1_icache_locks[cache_idx]);
+    core->l1_iaccesses++;
 
     if (hit_in_l1 || !use_l2) {
         /* No need to access L2 */
         return;
     }
 
-    g_mutex_lock(&l2_ucache_locks[cache_idx]);
-    if (!access_cache(l2_ucaches[cache_idx], insn_addr)) {
+    if (!access_l2(core, insn_addr)) {
         insn = userdata;
-        __atomic_fetch_add(&insn->l2_misses, 1, __ATOMIC_SEQ_CST);
-        l2_ucaches[cache_idx]->misses++;
+        __atomic_fetch_add(&insn->l2_misses, 1, __ATOMIC_RELAXED);
+        core->l2_misses++;
     }
-    l2_ucaches[cache_idx]->accesses++;
-    g_mutex_unlock(&l2_ucache_locks[cache_idx]);
+    core->l2_accesses++;
 }
 
 static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
@@ -515,7 +569,7 @@ static void insn_free(gpointer data)
 static void cache_free(Cache *cache)
 {
     for (int i = 0; i < cache->num_sets; i++) {
-        g_free(cache->sets[i].blocks);
+        g_free(cache->sets[i].tags);
     }
 
     if (metadata_destroy) {
@@ -526,12 +580,15 @@ static void cache_free(Cache *cache)
     g_free(cache);
 }
 
-static void caches_free(Cache **caches)
+static void core_free(Core *core)
 {
-    int i;
-
-    for (i = 0; i < cores; i++) {
-        cache_free(caches[i]);
+    cache_free(core->l1_dcache);
+    cache_free(core->l1_icache);
+    if (core->l2_ucache) {
+        cache_free(core->l2_ucache);
+    }
+    if (core->rng) {
+        g_rand_free(core->rng);
     }
 }
 
@@ -564,24 +621,6 @@ static void append_stats_line(GString *line,
     g_string_append(line, "\n");
 }
 
-static void sum_stats(void)
-{
-    int i;
-
-    g_assert(cores > 1);
-    for (i = 0; i < cores; i++) {
-        l1_imisses += l1_icaches[i]->misses;
-        l1_dmisses += l1_dcaches[i]->misses;
-        l1_imem_accesses += l1_icaches[i]->accesses;
-        l1_dmem_accesses += l1_dcaches[i]->accesses;
-
-        if (use_l2) {
-            l2_misses += l2_ucaches[i]->misses;
-            l2_mem_accesses += l2_ucaches[i]->accesses;
-        }
-    }
-}
-
 static int dcmp(gconstpointer a, gconstpointer b)
 {
     InsnData *insn_a = (InsnData *) a;
@@ -608,8 +647,8 @@ static int l2_cmp(gconstpointer a, gconstpointer b)
 
 static void log_stats(void)
 {
-    int i;
-    Cache *icache, *dcache, *l2_cache;
+    int i, n = 0;
+    Core sum = { 0 };
 
     g_autoptr(GString) rep = g_string_new("core #, data accesses, data misses,"
                                           " dmiss rate, insn accesses,"
@@ -621,23 +660,32 @@ static void log_stats(void)
 
     g_string_append(rep, "\n");
 
-    for (i = 0; i < cores; i++) {
+    for (i = 0; i < qemu_plugin_num_vcpus(); i++) {
+        Core *core = qemu_plugin_scoreboard_find(cores, i);
+
+        if (!core->l1_dcache) {
+            /* never ran anything */
+            continue;
+        }
         g_string_append_printf(rep, "%-8d", i);
-        dcache = l1_dcaches[i];
-        icache = l1_icaches[i];
-        l2_cache = use_l2 ? l2_ucaches[i] : NULL;
-        append_stats_line(rep, dcache->accesses, dcache->misses,
-                icache->accesses, icache->misses,
-                l2_cache ? l2_cache->accesses : 0,
-                l2_cache ? l2_cache->misses : 0);
+        append_stats_line(rep, core->l1_daccesses, core->l1_dmisses,
+                core->l1_iaccesses, core->l1_imisses,
+                core->l2_accesses, core->l2_misses);
+
+        sum.l1_daccesses += core->l1_daccesses;
+        sum.l1_dmisses += core->l1_dmisses;
+        sum.l1_iaccesses += core->l1_iaccesses;
+        sum.l1_imisses += core->l1_imisses;
+        sum.l2_accesses += core->l2_accesses;
+        sum.l2_misses += core->l2_misses;
+        n++;
     }
 
-    if (cores > 1) {
-        sum_stats();
+    if (n > 1) {
         g_string_append_printf(rep, "%-8s", "sum");
-        append_stats_line(rep, l1_dmem_accesses, l1_dmisses,
-                l1_imem_accesses, l1_imisses,
-                l2_cache ? l2_mem_accesses : 0, l2_cache ? l2_misses : 0);
+        append_stats_line(rep, sum.l1_daccesses, sum.l1_dmisses,
+                sum.l1_iaccesses, sum.l1_imisses,
+                sum.l2_accesses, sum.l2_misses);
     }
 
     g_string_append(rep, "\n");
@@ -702,18 +750,26 @@ finish:
 
 static void plugin_exit(qemu_plugin_id_t id, void *p)
 {
+    int i;
+
     log_stats();
     log_top_insns();
 
-    caches_free(l1_dcaches);
-    caches_free(l1_icaches);
+    for (i = 0; i < qemu_plugin_num_vcpus(); i++) {
+        Core *core = qemu_plugin_scoreboard_find(cores, i);
 
-    g_free(l1_dcache_locks);
-    g_free(l1_icache_locks);
+        if (core->l1_dcache) {
+            core_free(core);
+        }
+    }
+    qemu_plugin_scoreboard_free(cores);
 
-    if (use_l2) {
-        caches_free(l2_ucaches);
-        g_free(l2_ucache_locks);
+    if (l2_shared) {
+        cache_free(l2_shared_cache);
+        for (i = 0; i < L2_SHARDS; i++) {
+            g_mutex_clear(&l2_shards[i].lock);
+        }
+        g_free(l2_shards);
     }
 
     g_hash_table_destroy(miss_ht);
@@ -734,7 +790,6 @@ static void policy_init(void)
         metadata_destroy = fifo_destroy;
         break;
     case RAND:
-        rng = g_rand_new();
         break;
     default:
         g_assert_not_reached();
@@ -746,9 +801,7 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
                         int argc, char **argv)
 {
     int i;
-    int l1_iassoc, l1_iblksize, l1_icachesize;
-    int l1_dassoc, l1_dblksize, l1_dcachesize;
-    int l2_assoc, l2_blksize, l2_cachesize;
+    const char *err;
 
     limit = 32;
     sys = info->system_emulation;
@@ -767,8 +820,6 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
 
     policy = LRU;
 
-    cores = sys ? qemu_plugin_n_vcpus() : 1;
-
     for (i = 0; i < argc; i++) {
         char *opt = argv[i];
         g_auto(GStrv) tokens = g_strsplit(opt, "=", 2);
@@ -788,7 +839,8 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
         } else if (g_strcmp0(tokens[0], "limit") == 0) {
             limit = STRTOLL(tokens[1]);
         } else if (g_strcmp0(tokens[0], "cores") == 0) {
-            cores = STRTOLL(tokens[1]);
+            fprintf(stderr, "cache: ignoring %s, every vCPU now has "
+                    "its own caches\n", opt);
         } else if (g_strcmp0(tokens[0], "l2cachesize") == 0) {
             use_l2 = true;
             l2_cachesize = STRTOLL(tokens[1]);
@@ -803,6 +855,12 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
                 fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
                 return -1;
             }
+        } else if (g_strcmp0(tokens[0], "l2shared") == 0) {
+            if (!qemu_plugin_bool_parse(tokens[0], tokens[1], &l2_shared)) {
+                fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
+                return -1;
+            }
+            use_l2 |= l2_shared;
         } else if (g_strcmp0(tokens[0], "evict") == 0) {
             if (g_strcmp0(tokens[1], "rand") == 0) {
                 policy = RAND;
@@ -822,33 +880,36 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
 
     policy_init();
 
-    l1_dcaches = caches_init(l1_dblksize, l1_dassoc, l1_dcachesize);
-    if (!l1_dcaches) {
-        const char *err = cache_config_error(l1_dblksize, l1_dassoc, l1_dcachesize);
+    err = cache_config_error(l1_dblksize, l1_dassoc, l1_dcachesize);
+    if (err) {
         fprintf(stderr, "dcache cannot be constructed from given parameters\n");
         fprintf(stderr, "%s\n", err);
         return -1;
     }
 
-    l1_icaches = caches_init(l1_iblksize, l1_iassoc, l1_icachesize);
-    if (!l1_icaches) {
-        const char *err = cache_config_error(l1_iblksize, l1_iassoc, l1_icachesize);
+    err = cache_config_error(l1_iblksize, l1_iassoc, l1_icachesize);
+    if (err) {
         fprintf(stderr, "icache cannot be constructed from given parameters\n");
         fprintf(stderr, "%s\n", err);
         return -1;
     }
 
-    l2_ucaches = use_l2 ? caches_init(l2_blksize, l2_assoc, l2_cachesize) : NULL;
-    if (!l2_ucaches && use_l2) {
-        const char *err = cache_config_error(l2_blksize, l2_assoc, l2_cachesize);
+    err = use_l2 ? cache_config_error(l2_blksize, l2_assoc, l2_cachesize) : NULL;
+    if (err) {
         fprintf(stderr, "L2 cache cannot be constructed from given parameters\n");
         fprintf(stderr, "%s\n", err);
         return -1;
     }
 
-    l1_dcache_locks = g_new0(GMutex, cores);
-    l1_icache_locks = g_new0(GMutex, cores);
-    l2_ucache_locks = use_l2 ? g_new0(GMutex, cores) : NULL;
+    if (l2_shared) {
+        l2_shared_cache = cache_init(l2_blksize, l2_assoc, l2_cachesize);
+        l2_shards = g_new0(CacheShard, L2_SHARDS);
+        for (i = 0; i < L2_SHARDS; i++) {
+            g_mutex_init(&l2_shards[i].lock);
+        }
+    }
+
+    cores = qemu_plugin_scoreboard_new(sizeof(Core));
 
     qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
@@ -0,0 +1,568 @@
+/*
+ * Call graph profiler for H8 firmware
+ *
+ * Recognises the H8/300H and H8S call and return instructions at
+ * translation time and keeps a shadow call stack per vCPU. Costs are
+ * counted inline for every executed block into a running total per
+ * vCPU, and the delta since the previous call or return is charged to
+ * the current stack whenever one executes, so only calls and returns
+ * ever leave generated code.
+ *
+ * At exit a flat profile (self and total cost per function) is
+ * printed and, with folded=FILE, the per-stack costs are written in
+ * the folded format understood by flamegraph.pl.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include <inttypes.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <glib.h>
+
+#include <qemu-plugin.h>
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+/* deeper stacks are treated as runaway recursion and not tracked */
+#define MAX_DEPTH 256
+
+typedef enum {
+    EV_CALL,        /* BSR, JSR */
+    EV_TRAP,        /* TRAPA */
+    EV_RTS,
+    EV_RTE,
+} EventKind;
+
+/*
+ * A call or return instruction, found at translation time. Code loaded
+ * in place of other code may have a different instruction at the same
+ * pc, so sites are looked up by pc, kind and target together.
+ */
+typedef struct {
+    EventKind kind;
+    uint64_t pc;
+    uint64_t target;
+    /* function containing the instruction, if there are symbols */
+    const char *fn;
+    /* name for the callee when it is not known by symbol */
+    const char *callee;
+} CallSite;
+
+typedef struct {
+    EventKind kind;
+    const char *name;
+    /* length of the folded stack before this frame was added */
+    gsize folded_len;
+} Frame;
+
+typedef struct {
+    Frame frames[MAX_DEPTH];
+    int depth;
+    /* overflowed frames, popped without touching the stack */
+    int lost;
+    GString *folded;
+    uint64_t last_insns;
+    uint64_t last_states;
+} VCPUStack;
+
+typedef struct {
+    uint64_t insns;
+    uint64_t states;
+} Cost;
+
+typedef struct {
+    const char *name;
+    uint64_t calls;
+    Cost self;
+    Cost total;
+} FuncProfile;
+
+static GMutex lock;
+static GHashTable *sites;
+static GHashTable *stacks;
+static GHashTable *calls;
+static GPtrArray *vcpus;
+
+/* Running cost of everything executed, bumped inline by every block */
+static struct qemu_plugin_scoreboard *totals;
+static qemu_plugin_u64 insn_total;
+static qemu_plugin_u64 state_total;
+
+static char *folded_path;
+static int limit = 30;
+static bool sort_insns;
+
+/*
+ * Rough execution states of one instruction on H8/300H on-chip memory:
+ * two per instruction word fetched plus the data accesses and internal
+ * states of the slow classes. contrib/plugins/howvec.c has the full
+ * class table; this is enough to tell a divide from a move.
+ */
+static uint64_t insn_states(const uint8_t *op, size_t len)
+{
+    uint64_t states = len;
+
+    switch (op[0]) {
+    case 0x01:
+        if (len >= 3 && (op[1] == 0xc0 || op[1] == 0xd0)) {
+            states += (op[2] & 2) ? 20 : 12;            /* MULXS, DIVXS */
+        } else if (op[1] >= 0x10 && op[1] <= 0x30) {
+            states += 4 * ((op[1] >> 4) + 1);           /* LDM, STM */
+        } else if (op[1] == 0x00 && len > 2) {
+            states += 4;                                /* MOV.L mem */
+        }
+        break;
+    case 0x20 ... 0x3f:
+    case 0x68 ... 0x6b:
+    case 0x6e ... 0x6f:
+    case 0x78:
+    case 0x7c:
+    case 0x7e:
+        states += 2;
+        break;
+    case 0x6c ... 0x6d:
+    case 0x7d:
+    case 0x7f:
+        states += 4;
+        break;
+    case 0x40 ... 0x4f:
+    case 0x58:
+    case 0x59 ... 0x5a:
+        states += 2;
+        break;
+    case 0x50 ... 0x51:
+        states += 12;
+        break;
+    case 0x52 ... 0x53:
+        states += 20;
+        break;
+    case 0x54:
+    case 0x55:
+    case 0x5b ... 0x5f:
+        states += 6;
+        break;
+    case 0x56:
+        states += 10;
+        break;
+    case 0x57:
+        states += 12;
+        break;
+    }
+    return states;
+}
+
+/*
+ * Decode the call and return instructions. Direct calls know their
+ * target, which names the callee when the guest has no symbols.
+ */
+static bool decode_event(const uint8_t *op, size_t len, uint64_t pc,
+                         EventKind *kind, uint64_t *target)
+{
+    *target = 0;
+    switch (op[0]) {
+    case 0x55:                                  /* BSR d:8 */
+        *kind = EV_CALL;
+        *target = pc + 2 + (int8_t)op[1];
+        return true;
+    case 0x5c:                                  /* BSR d:16 */
+        if (op[1] != 0 || len < 4) {
+            return false;
+        }
+        *kind = EV_CALL;
+        *target = pc + 4 + (int16_t)(op[2] << 8 | op[3]);
+        return true;
+    case 0x5e:                                  /* JSR @aa:24 */
+        if (len < 4) {
+            return false;
+        }
+        *target = op[1] << 16 | op[2] << 8 | op[3];
+        /* fall through */
+    case 0x5d:                                  /* JSR @ERn */
+    case 0x5f:                                  /* JSR @@aa:8 */
+        *kind = EV_CALL;
+        return true;
+    case 0x57:                                  /* TRAPA #x */
+        *kind = EV_TRAP;
+        return true;
+    case 0x54:                                  /* RTS */
+        *kind = EV_RTS;
+        return op[1] == 0x70;
+    case 0x56:                                  /* RTE */
+        *kind = EV_RTE;
+        return op[1] == 0x70;
+    }
+    return false;
+}
+
+static VCPUStack *get_stack(unsigned int cpu_index)
+{
+    VCPUStack *vs;
+
+    while (vcpus->len <= cpu_index) {
+        g_ptr_array_add(vcpus, NULL);
+    }
+    vs = g_ptr_array_index(vcpus, cpu_index);
+    if (!vs) {
+        vs = g_new0(VCPUStack, 1);
+        vs->folded = g_string_new(NULL);
+        vs->frames[0].kind = EV_CALL;
+        vs->depth = 1;
+        vs->last_insns = qemu_plugin_u64_get(insn_total, cpu_index);
+        vs->last_states = qemu_plugin_u64_get(state_total, cpu_index);
+        g_ptr_array_index(vcpus, cpu_index) = vs;
+    }
+    return vs;
+}
+
+static void name_frame(VCPUStack *vs, Frame *f, const char *name)
+{
+    f->name = name;
+    if (vs->folded->len) {
+        g_string_append_c(vs->folded, ';');
+    }
+    g_string_append(vs->folded, name);
+    /* count the call once the callee is known */
+    if (f != &vs->frames[0]) {
+        uint64_t *n = g_hash_table_lookup(calls, name);
+        if (!n) {
+            n = g_new0(uint64_t, 1);
+            g_hash_table_insert(calls, (gpointer) name, n);
+        }
+        (*n)++;
+    }
+}
+
+/* Charge everything since the last event to the current stack */
+static void charge(VCPUStack *vs, unsigned int cpu_index)
+{
+    Cost *c;
+    uint64_t now_insns = qemu_plugin_u64_get(insn_total, cpu_index);
+    uint64_t now_states = qemu_plugin_u64_get(state_total, cpu_index);
+    uint64_t insns = now_insns - vs->last_insns;
+    uint64_t states = now_states - vs->last_states;
+
+    vs->last_insns = now_insns;
+    vs->last_states = now_states;
+    if (!insns) {
+        return;
+    }
+    c = g_hash_table_lookup(stacks, vs->folded->str);
+    if (!c) {
+        c = g_new0(Cost, 1);
+        g_hash_table_insert(stacks, g_strdup(vs->folded->str), c);
+    }
+    c->insns += insns;
+    c->states += states;
+}
+
+static void vcpu_event(unsigned int cpu_index, void *udata)
+{
+    CallSite *site = udata;
+    VCPUStack *vs;
+    Frame *top;
+
+    g_mutex_lock(&lock);
+    vs = get_stack(cpu_index);
+    top = &vs->frames[vs->depth - 1];
+
+    /*
+     * A frame is named by the first of its own call or return
+     * instructions to execute, which is how indirect calls get a name.
+     */
+    if (!vs->lost && !top->name) {
+        if (site->fn) {
+            name_frame(vs, top, site->fn);
+        } else {
+            g_autofree char *name = g_strdup_printf("[0x%06" PRIx64 "]",
+                                                    site->pc);
+            name_frame(vs, top, g_intern_string(name));
+        }
+    }
+    charge(vs, cpu_index);
+
+    switch (site->kind) {
+    case EV_CALL:
+    case EV_TRAP:
+        if (vs->depth == MAX_DEPTH) {
+            vs->lost++;
+            break;
+        }
+        top = &vs->frames[vs->depth++];
+        top->kind = site->kind;
+        top->name = NULL;
+        top->folded_len = vs->folded->len;
+        if (!site->fn && site->callee) {
+            name_frame(vs, top, site->callee);
+        }
+        break;
+    case EV_RTS:
+    case EV_RTE:
+        if (vs->lost) {
+            vs->lost--;
+            break;
+        }
+        /*
+         * Interrupts enter their handlers without an instruction we can
+         * see, so an RTE that does not match a TRAPA frame just returns
+         * to the code it interrupted. Anything else that does not match
+         * (longjmp, hand-made stack switches) is ignored as well.
+         */
+        if (vs->depth > 1 &&
+            (top->kind == EV_TRAP) == (site->kind == EV_RTE)) {
+            vs->depth--;
+            g_string_truncate(vs->folded, top->folded_len);
+        }
+        break;
+    }
+    g_mutex_unlock(&lock);
+}
+
+static guint site_hash(gconstpointer key)
+{
+    const CallSite *site = key;
+
+    return g_int64_hash(&site->pc) ^ g_int64_hash(&site->target) ^
+           site->kind;
+}
+
+static gboolean site_equal(gconstpointer a, gconstpointer b)
+{
+    const CallSite *sa = a, *sb = b;
+
+    return sa->pc == sb->pc && sa->kind == sb->kind &&
+           sa->target == sb->target;
+}
+
+static CallSite *get_site(struct qemu_plugin_insn *insn, EventKind kind,
+                          uint64_t target)
+{
+    CallSite key = {
+        .kind = kind,
+        .pc = qemu_plugin_insn_vaddr(insn),
+        .target = target,
+    };
+    uint64_t pc = key.pc;
+    CallSite *site;
+
+    g_mutex_lock(&lock);
+    site = g_hash_table_lookup(sites, &key);
+    if (!site) {
+        site = g_memdup2(&key, sizeof(key));
+        site->fn = qemu_plugin_insn_symbol(insn);
+        if (site->fn) {
+            site->fn = g_intern_string(site->fn);
+        } else if (target) {
+            g_autofree char *name = g_strdup_printf("0x%06" PRIx64, target);
+            site->callee = g_intern_string(name);
+        } else if (kind == EV_CALL || kind == EV_TRAP) {
+            g_autofree char *name = g_strdup_printf("?@0x%06" PRIx64, pc);
+            site->callee = g_intern_string(name);
+        }
+        g_hash_table_add(sites, site);
+    }
+    g_mutex_unlock(&lock);
+    return site;
+}
+
+static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
+{
+    size_t n = qemu_plugin_tb_n_insns(tb);
+    uint64_t states = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
+        const uint8_t *op = qemu_plugin_insn_data(insn);
+        size_t len = qemu_plugin_insn_size(insn);
+        EventKind kind;
+        uint64_t target;
+
+        states += insn_states(op, len);
+        if (decode_event(op, len, qemu_plugin_insn_vaddr(insn),
+                         &kind, &target)) {
+            qemu_plugin_register_vcpu_insn_exec_cb(
+                insn, vcpu_event, QEMU_PLUGIN_CB_NO_REGS,
+                get_site(insn, kind, target));
+        }
+    }
+
+    qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+        tb, QEMU_PLUGIN_INLINE_ADD_U64, insn_total, n);
+    qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+        tb, QEMU_PLUGIN_INLINE_ADD_U64, state_total, states);
+}
+
+static FuncProfile *get_func(GHashTable *funcs, const char *name)
+{
+    FuncProfile *fp = g_hash_table_lookup(funcs, name);
+
+    if (!fp) {
+        uint64_t *n = g_hash_table_lookup(calls, name);
+
+        fp = g_new0(FuncProfile, 1);
+        fp->name = name;
+        fp->calls = n ? *n : 0;
+        g_hash_table_insert(funcs, (gpointer) name, fp);
+    }
+    return fp;
+}
+
+static gint cmp_func(gconstpointer a, gconstpointer b)
+{
+    const FuncProfile *fa = a, *fb = b;
+    uint64_t ca = sort_insns ? fa->self.insns : fa->self.states;
+    uint64_t cb = sort_insns ? fb->self.insns : fb->self.states;
+
+    return ca > cb ? -1 : ca < cb ? 1 : g_strcmp0(fa->name, fb->name);
+}
+
+/*
+ * Build the flat profile from the folded stacks: the last frame of a
+ * stack gets the self cost, every distinct frame in it the total.
+ */
+static GHashTable *flat_profile(Cost *sum)
+{
+    GHashTable *funcs = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, stacks);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        g_auto(GStrv) names = g_strsplit(key, ";", -1);
+        g_autoptr(GHashTable) seen = g_hash_table_new(NULL, NULL);
+        Cost *c = value;
+        int i, n = g_strv_length(names);
+
+        sum->insns += c->insns;
+        sum->states += c->states;
+        for (i = 0; i < n; i++) {
+            const char *name = g_intern_string(names[i]);
+            FuncProfile *fp = get_func(funcs, name);
+
+            if (i == n - 1) {
+                fp->self.insns += c->insns;
+                fp->self.states += c->states;
+            }
+            if (g_hash_table_add(seen, (gpointer) name)) {
+                fp->total.insns += c->insns;
+                fp->total.states += c->states;
+            }
+        }
+    }
+    return funcs;
+}
+
+static void write_folded(void)
+{
+    g_autoptr(GString) out = g_string_new(NULL);
+    g_autoptr(GError) err = NULL;
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, stacks);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        Cost *c = value;
+        g_string_append_printf(out, "%s %" PRIu64 "\n", (char *) key,
+                               sort_insns ? c->insns : c->states);
+    }
+    if (!g_file_set_contents(folded_path, out->str, out->len, &err)) {
+        fprintf(stderr, "callprof: %s\n", err->message);
+    }
+}
+
+static void plugin_exit(qemu_plugin_id_t id, void *p)
+{
+    g_autoptr(GString) report = g_string_new(NULL);
+    g_autoptr(GHashTable) funcs = NULL;
+    Cost sum = { 0 };
+    GList *list, *it;
+    int i;
+
+    g_mutex_lock(&lock);
+    for (i = 0; i < vcpus->len; i++) {
+        VCPUStack *vs = g_ptr_array_index(vcpus, i);
+        if (vs) {
+            if (!vs->frames[vs->depth - 1].name && !vs->lost) {
+                name_frame(vs, &vs->frames[vs->depth - 1], "[unknown]");
+            }
+            charge(vs, i);
+        }
+    }
+
+    funcs = flat_profile(&sum);
+    list = g_list_sort(g_hash_table_get_values(funcs), cmp_func);
+
+    g_string_append_printf(report,
+                           "Flat profile: %" PRIu64 " insns, %" PRIu64
+                           " estimated states\n", sum.insns, sum.states);
+    g_string_append(report, "  %self    self-states     self-insns"
+                    "   total-states    calls  function\n");
+    for (i = 0, it = list; it && i < limit; i++, it = it->next) {
+        FuncProfile *fp = it->data;
+        uint64_t self = sort_insns ? fp->self.insns : fp->self.states;
+        uint64_t all = sort_insns ? sum.insns : sum.states;
+
+        g_string_append_printf(report,
+                               "%7.2f %14" PRIu64 " %14" PRIu64
+                               " %14" PRIu64 " %8" PRIu64 "  %s\n",
+                               all ? 100.0 * self / all : 0.0,
+                               fp->self.states, fp->self.insns,
+                               fp->total.states, fp->calls, fp->name);
+    }
+    g_list_free(list);
+
+    if (folded_path) {
+        write_folded();
+    }
+    g_mutex_unlock(&lock);
+
+    qemu_plugin_outs(report->str);
+}
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
+                                           const qemu_info_t *info,
+                                           int argc, char **argv)
+{
+    int i;
+
+    if (strcmp(info->target_name, "h8300") != 0) {
+        fprintf(stderr, "callprof: only H8 guests are supported\n");
+        return -1;
+    }
+
+    for (i = 0; i < argc; i++) {
+        char *opt = argv[i];
+        g_auto(GStrv) tokens = g_strsplit(opt, "=", 2);
+        if (g_strcmp0(tokens[0], "folded") == 0 && tokens[1]) {
+            folded_path = g_strdup(tokens[1]);
+        } else if (g_strcmp0(tokens[0], "limit") == 0 && tokens[1]) {
+            limit = g_ascii_strtoull(tokens[1], NULL, 10);
+        } else if (g_strcmp0(tokens[0], "sort") == 0) {
+            if (g_strcmp0(tokens[1], "insns") == 0) {
+                sort_insns = true;
+            } else if (g_strcmp0(tokens[1], "states") != 0) {
+                fprintf(stderr, "sort must be insns or states: %s\n", opt);
+                return -1;
+            }
+        } else {
+            fprintf(stderr, "option parsing failed: %s\n", opt);
+            return -1;
+        }
+    }
+
+    sites = g_hash_table_new(site_hash, site_equal);
+    stacks = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    calls = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+    vcpus = g_ptr_array_new();
+    totals = qemu_plugin_scoreboard_new(sizeof(Cost));
+    insn_total = qemu_plugin_scoreboard_u64_in_struct(totals, Cost, insns);
+    state_total = qemu_plugin_scoreboard_u64_in_struct(totals, Cost, states);
+
+    qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+    return 0;
+}
@@ -24,6 +24,16 @@ static GRWLock expand_array_lock;
 static GPtrArray *imatches;
 static GArray *amatches;
 
+/* Registers to log, looked up by name once the first vCPU exists */
+typedef struct {
+    struct qemu_plugin_register *handle;
+    const char *name;
+} Register;
+
+static GPtrArray *rmatches;
+static GArray *regs;
+static GRWLock regs_lock;
+
 /*
  * Expand last_exec array.
  *
@@ -99,6 +109,25 @@ static void vcpu_insn_exec(unsigned int cpu_index, void *udata)
     /* vcpu_mem will add memory access information to last_exec */
     g_string_printf(s, "%u, ", cpu_index);
     g_string_append(s, (char *)udata);
+
+    /* Register values as the instruction starts */
+    if (regs) {
+        g_autoptr(GByteArray) buf = g_byte_array_new();
+
+        g_rw_lock_reader_lock(&regs_lock);
+        for (guint i = 0; i < regs->len; i++) {
+            Register *reg = &g_array_index(regs, Register, i);
+
+            g_byte_array_set_size(buf, 0);
+            if (qemu_plugin_read_register(reg->handle, buf) > 0) {
+                g_string_append_printf(s, ", %s=0x", reg->name);
+                for (guint j = 0; j < buf->len; j++) {
+                    g_string_append_printf(s, "%02x", buf->data[j]);
+                }
+            }
+        }
+        g_rw_lock_reader_unlock(&regs_lock);
+    }
 }
 
 /**
@@ -167,8 +196,10 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
                                              QEMU_PLUGIN_MEM_RW, NULL);
 
             /* Register callback on instruction */
-            qemu_plugin_register_vcpu_insn_exec_cb(insn, vcpu_insn_exec,
-                                                   QEMU_PLUGIN_CB_NO_REGS, output);
+            qemu_plugin_register_vcpu_insn_exec_cb(
+                insn, vcpu_insn_exec,
+                rmatches ? QEMU_PLUGIN_CB_R_REGS : QEMU_PLUGIN_CB_NO_REGS,
+                output);
 
             /* reset skip */
             skip = (imatches || amatches);
@@ -177,6 +208,45 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
     }
 }
 
+/**
+ * On the first vCPU, resolve the requested register names
+ */
+static void vcpu_init(qemu_plugin_id_t id, unsigned int cpu_index)
+{
+    g_autoptr(GArray) all = NULL;
+
+    g_rw_lock_writer_lock(&regs_lock);
+    if (regs) {
+        g_rw_lock_writer_unlock(&regs_lock);
+        return;
+    }
+
+    all = qemu_plugin_get_registers();
+    regs = g_array_new(false, false, sizeof(Register));
+    for (guint i = 0; i < rmatches->len; i++) {
+        const char *name = g_ptr_array_index(rmatches, i);
+        bool found = false;
+
+        for (guint j = 0; j < all->len; j++) {
+            qemu_plugin_reg_descriptor *rd =
+                &g_array_index(all, qemu_plugin_reg_descriptor, j);
+
+            if (g_ascii_strcasecmp(rd->name, name) == 0) {
+                Register reg = { .handle = rd->handle, .name = rd->name };
+                g_array_append_val(regs, reg);
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            g_autofree char *msg =
+                g_strdup_printf("execlog: no register named %s\n", name);
+            qemu_plugin_outs(msg);
+        }
+    }
+    g_rw_lock_writer_unlock(&regs_lock);
+}
+
 /**
  * On plugin exit, print last instruction in cache
  */
@@ -236,6 +306,11 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
             parse_insn_match(tokens[1]);
         } else if (g_strcmp0(tokens[0], "afilter") == 0) {
             parse_vaddr_match(tokens[1]);
+        } else if (g_strcmp0(tokens[0], "reg") == 0) {
+            if (!rmatches) {
+                rmatches = g_ptr_array_new();
+            }
+            g_ptr_array_add(rmatches, g_strdup(tokens[1]));
         } else {
             fprintf(stderr, "option parsing failed: %s\n", opt);
             return -1;
@@ -243,6 +318,9 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
     }
 
     /* Register translation block and exit callbacks */
+    if (rmatches) {
+        qemu_plugin_register_vcpu_init_cb(id, vcpu_init);
+    }
     qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
 
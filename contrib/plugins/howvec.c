@@ -33,6 +33,7 @@ typedef enum {
 static int limit = 50;
 static bool do_inline;
 static bool verbose;
+static int bus_states = 2;
 
 static GMutex lock;
 static GHashTable *insns;
@@ -43,13 +44,18 @@ typedef struct {
     uint32_t mask;
     uint32_t pattern;
     CountType what;
+    /* bus accesses and internal states beyond the instruction fetch */
+    int accesses;
+    int internal;
     uint64_t count;
+    uint64_t states;
 } InsnClassExecCount;
 
 typedef struct {
     char *insn;
     uint32_t opcode;
     uint64_t count;
+    uint64_t states;
     InsnClassExecCount *class;
 } InsnExecCount;
 
@@ -134,6 +140,94 @@ static InsnClassExecCount sparc64_insn_classes[] = {
     { "Unclassified",        "unclas", 0x00000000, 0x00000000, COUNT_INDIVIDUAL},
 };
 
+/*
+ * H8/300H and H8S. The opcode is the first four bytes of the
+ * instruction in big-endian order, zero padded for shorter ones.
+ *
+ * Each class also carries an estimate of its execution states, taken
+ * from the execution state tables in the hardware manuals for the
+ * common form of the class: every instruction word fetched and every
+ * data, stack or branch target access costs one bus access, plus any
+ * internal states. The report multiplies bus accesses by the "bus"
+ * argument, which is 2 for H8/300H on-chip memory and 1 for H8S.
+ * EEPMOV only counts its setup; each byte moved adds two accesses.
+ */
+static InsnClassExecCount h8300_insn_classes[] = {
+    /* Block transfer and multiply-accumulate */
+    { "EEPMOV.B",            "eepmovb", 0xffffffff, 0x7b5c598f, COUNT_CLASS, 2, 0},
+    { "EEPMOV.W",            "eepmovw", 0xffffffff, 0x7bd4598f, COUNT_CLASS, 2, 0},
+    { "MAC",                 "mac",    0xffffff88, 0x01606d00, COUNT_CLASS, 2, 2},
+    { "CLRMAC",              "clrmac", 0xffff0000, 0x01a00000, COUNT_CLASS, 0, 1},
+    { "LDMAC",               "ldmac",  0xffe80000, 0x03200000, COUNT_CLASS, 0, 1},
+    { "STMAC",               "stmac",  0xffe80000, 0x02200000, COUNT_CLASS, 0, 1},
+    /* Multiple register restore and save */
+    { "LDM (2 regs)",        "ldm2",   0xfffffff8, 0x01106d70, COUNT_CLASS, 4, 1},
+    { "LDM (3 regs)",        "ldm3",   0xfffffff8, 0x01206d70, COUNT_CLASS, 6, 1},
+    { "LDM (4 regs)",        "ldm4",   0xfffffff8, 0x01306d70, COUNT_CLASS, 8, 1},
+    { "STM (2 regs)",        "stm2",   0xfffffff8, 0x01106df0, COUNT_CLASS, 4, 1},
+    { "STM (3 regs)",        "stm3",   0xfffffff8, 0x01206df0, COUNT_CLASS, 6, 1},
+    { "STM (4 regs)",        "stm4",   0xfffffff8, 0x01306df0, COUNT_CLASS, 8, 1},
+    /* Multiply and divide */
+    { "MULXU.B",             "mulxub", 0xff000000, 0x50000000, COUNT_CLASS, 0, 12},
+    { "MULXU.W",             "mulxuw", 0xff000000, 0x52000000, COUNT_CLASS, 0, 20},
+    { "DIVXU.B",             "divxub", 0xff000000, 0x51000000, COUNT_CLASS, 0, 12},
+    { "DIVXU.W",             "divxuw", 0xff000000, 0x53000000, COUNT_CLASS, 0, 20},
+    { "MULXS.B",             "mulxsb", 0xffffff00, 0x01c05000, COUNT_CLASS, 0, 12},
+    { "MULXS.W",             "mulxsw", 0xffffff00, 0x01c05200, COUNT_CLASS, 0, 20},
+    { "DIVXS.B",             "divxsb", 0xffffff00, 0x01d05100, COUNT_CLASS, 0, 12},
+    { "DIVXS.W",             "divxsw", 0xffffff00, 0x01d05300, COUNT_CLASS, 0, 20},
+    /* Bit manipulation on memory, i.e. mostly I/O registers */
+    { "Bit test/load (mem)", "bitldm", 0xfd000000, 0x7c000000, COUNT_CLASS, 1, 0},
+    { "Bit set/clr/st (mem)", "bitstm", 0xfd000000, 0x7d000000, COUNT_CLASS, 2, 0},
+    { "Bit ops (abs16/32)",  "bitabs", 0xffd70000, 0x6a100000, COUNT_CLASS, 2, 0},
+    /* Bit manipulation on registers */
+    { "Bit ops (reg)",       "bitr",   0xf8000000, 0x70000000, COUNT_CLASS, 0, 0},
+    { "Bit ops (reg)",       "bitrn",  0xfc000000, 0x60000000, COUNT_CLASS, 0, 0},
+    { "Bit ops (reg)",       "bitrst", 0xff000000, 0x67000000, COUNT_CLASS, 0, 0},
+    /* Branches, calls and returns */
+    { "Bcc d:8",             "bcc8",   0xf0000000, 0x40000000, COUNT_CLASS, 1, 0},
+    { "Bcc d:16",            "bcc16",  0xff0f0000, 0x58000000, COUNT_CLASS, 1, 2},
+    { "BSR",                 "bsr8",   0xff000000, 0x55000000, COUNT_CLASS, 3, 0},
+    { "BSR",                 "bsr16",  0xffff0000, 0x5c000000, COUNT_CLASS, 3, 2},
+    { "JMP",                 "jmpr",   0xff000000, 0x59000000, COUNT_CLASS, 1, 0},
+    { "JMP",                 "jmpa",   0xff000000, 0x5a000000, COUNT_CLASS, 1, 2},
+    { "JMP",                 "jmpi",   0xff000000, 0x5b000000, COUNT_CLASS, 3, 2},
+    { "JSR",                 "jsrr",   0xff000000, 0x5d000000, COUNT_CLASS, 3, 0},
+    { "JSR",                 "jsra",   0xff000000, 0x5e000000, COUNT_CLASS, 3, 2},
+    { "JSR",                 "jsri",   0xff000000, 0x5f000000, COUNT_CLASS, 5, 0},
+    { "RTS",                 "rts",    0xffff0000, 0x54700000, COUNT_CLASS, 3, 2},
+    { "RTE",                 "rte",    0xffff0000, 0x56700000, COUNT_CLASS, 5, 2},
+    { "TRAPA",               "trapa",  0xff000000, 0x57000000, COUNT_CLASS, 6, 4},
+    /* Data moves */
+    { "MOV (reg/imm)",       "movr",   0xfe000000, 0x0c000000, COUNT_CLASS, 0, 0},
+    { "MOV (reg/imm)",       "movrl",  0xff800000, 0x0f800000, COUNT_CLASS, 0, 0},
+    { "MOV (reg/imm)",       "movi8",  0xf0000000, 0xf0000000, COUNT_CLASS, 0, 0},
+    { "MOV (reg/imm)",       "movi16", 0xfff00000, 0x79000000, COUNT_CLASS, 0, 0},
+    { "MOV (reg/imm)",       "movi32", 0xfff00000, 0x7a000000, COUNT_CLASS, 0, 0},
+    { "MOV (@ERs+/@-ERd)",   "movpp",  0xfe000000, 0x6c000000, COUNT_CLASS, 1, 2},
+    { "MOV.L (@ERs+/@-ERd)", "movlpp", 0xffffff00, 0x01006d00, COUNT_CLASS, 2, 2},
+    { "MOV.L (mem)",         "movlm",  0xffff0000, 0x01000000, COUNT_CLASS, 2, 0},
+    { "MOV (mem)",           "movm8",  0xe0000000, 0x20000000, COUNT_CLASS, 1, 0},
+    { "MOV (mem)",           "movm",   0xf8000000, 0x68000000, COUNT_CLASS, 1, 0},
+    { "MOV (mem)",           "movm32", 0xff000000, 0x78000000, COUNT_CLASS, 1, 0},
+    /* Arithmetic, logic and shifts */
+    { "Shift/rotate",        "shift",  0xfc000000, 0x10000000, COUNT_CLASS, 0, 0},
+    { "ALU (imm)",           "alui8",  0x80000000, 0x80000000, COUNT_CLASS, 0, 0},
+    { "ALU (imm)",           "alui16", 0xff000000, 0x79000000, COUNT_CLASS, 0, 0},
+    { "ALU (imm)",           "alui32", 0xff000000, 0x7a000000, COUNT_CLASS, 0, 0},
+    { "ALU (reg)",           "alur",   0xf8000000, 0x08000000, COUNT_CLASS, 0, 0},
+    { "ALU (reg)",           "alur1",  0xf0000000, 0x10000000, COUNT_CLASS, 0, 0},
+    { "ALU (reg)",           "alurw",  0xfc000000, 0x64000000, COUNT_CLASS, 0, 0},
+    { "ALU (reg)",           "alurl",  0xffff0000, 0x01f00000, COUNT_CLASS, 0, 0},
+    /* Control */
+    { "TAS",                 "tas",    0xffffff00, 0x01e07b00, COUNT_CLASS, 2, 2},
+    { "SLEEP",               "sleep",  0xffff0000, 0x01800000, COUNT_CLASS, 0, 0},
+    { "LDC/STC (mem)",       "ldcm",   0xfffe4000, 0x01404000, COUNT_CLASS, 1, 0},
+    { "Control",             "ctrl",   0xf8000000, 0x00000000, COUNT_CLASS, 0, 0},
+    /* Unclassified */
+    { "Unclassified",        "unclas", 0x00000000, 0x00000000, COUNT_INDIVIDUAL},
+};
+
 /* Default matcher for currently unclassified architectures */
 static InsnClassExecCount default_insn_classes[] = {
     { "Unclassified",        "unclas", 0x00000000, 0x00000000, COUNT_INDIVIDUAL},
@@ -143,17 +237,25 @@ typedef struct {
     const char *qemu_target;
     InsnClassExecCount *table;
     int table_sz;
+    /* opcode is read as a big-endian byte stream */
+    bool big_endian;
+    /* table carries state counts, report estimated states */
+    bool states;
 } ClassSelector;
 
 static ClassSelector class_tables[] = {
     { "aarch64", aarch64_insn_classes, ARRAY_SIZE(aarch64_insn_classes) },
     { "sparc",   sparc32_insn_classes, ARRAY_SIZE(sparc32_insn_classes) },
     { "sparc64", sparc64_insn_classes, ARRAY_SIZE(sparc64_insn_classes) },
+    { "h8300",   h8300_insn_classes, ARRAY_SIZE(h8300_insn_classes),
+      true, true },
     { NULL, default_insn_classes, ARRAY_SIZE(default_insn_classes) },
 };
 
 static InsnClassExecCount *class_table;
 static int class_table_sz;
+static bool class_big_endian;
+static bool class_states;
 
 static gint cmp_exec_count(gconstpointer a, gconstpointer b)
 {
@@ -175,12 +277,35 @@ static void plugin_exit(qemu_plugin_id_t id, void *p)
     int i;
     GList *counts;
     InsnClassExecCount *class = NULL;
+    uint64_t total_states = 0;
+
+    if (class_states) {
+        GList *it;
+
+        for (i = 0; i < class_table_sz; i++) {
+            total_states += class_table[i].states;
+        }
+        counts = g_hash_table_get_values(insns);
+        for (it = counts; it; it = g_list_next(it)) {
+            total_states += ((InsnExecCount *) it->data)->states;
+        }
+        g_list_free(counts);
+    }
 
     for (i = 0; i < class_table_sz; i++) {
         class = &class_table[i];
         switch (class->what) {
         case COUNT_CLASS:
-            if (class->count || verbose) {
+            if (class_states && (class->count || verbose)) {
+                g_string_append_printf(report,
+                                       "Class: %-24s\t(%" PRId64 " hits)"
+                                       "\t(%" PRId64 " states, %5.1f%%)\n",
+                                       class->class,
+                                       class->count,
+                                       class->states,
+                                       total_states ? 100.0 * class->states /
+                                       total_states : 0.0);
+            } else if (class->count || verbose) {
                 g_string_append_printf(report,
                                        "Class: %-24s\t(%" PRId64 " hits)\n",
                                        class->class,
@@ -220,6 +345,13 @@ static void plugin_exit(qemu_plugin_id_t id, void *p)
         g_list_free(counts);
     }
 
+    if (class_states) {
+        g_string_append_printf(report,
+                               "Estimated states: %" PRId64
+                               " (%d states per bus access)\n",
+                               total_states, bus_states);
+    }
+
     g_hash_table_destroy(insns);
 
     qemu_plugin_outs(report->str);
@@ -236,20 +368,47 @@ static void vcpu_insn_exec_before(unsigned int cpu_index, void *udata)
     (*count)++;
 }
 
-static uint64_t *find_counter(struct qemu_plugin_insn *insn)
+/*
+ * We only match the first 32 bits of the instruction which is
+ * fine for most RISCs but a bit limiting for CISC architectures.
+ * They would probably benefit from a more tailored plugin.
+ * However we can fall back to individual instruction counting.
+ */
+static uint32_t get_opcode(struct qemu_plugin_insn *insn)
+{
+    const uint8_t *data = qemu_plugin_insn_data(insn);
+    size_t size = qemu_plugin_insn_size(insn);
+    uint32_t opcode = 0;
+    size_t i;
+
+    if (!class_big_endian) {
+        memcpy(&opcode, data, size < 4 ? size : 4);
+        return opcode;
+    }
+    for (i = 0; i < 4; i++) {
+        opcode = (opcode << 8) | (i < size ? data[i] : 0);
+    }
+    return opcode;
+}
+
+/* Estimated states for one execution of @insn in @class */
+static uint64_t insn_states(struct qemu_plugin_insn *insn,
+                            InsnClassExecCount *class)
+{
+    size_t words = qemu_plugin_insn_size(insn) / 2;
+
+    return (words + class->accesses) * bus_states + class->internal;
+}
+
+static uint64_t *find_counter(struct qemu_plugin_insn *insn,
+                              uint64_t **states, uint64_t *weight)
 {
     int i;
     uint64_t *cnt = NULL;
     uint32_t opcode;
     InsnClassExecCount *class = NULL;
 
-    /*
-     * We only match the first 32 bits of the instruction which is
-     * fine for most RISCs but a bit limiting for CISC architectures.
-     * They would probably benefit from a more tailored plugin.
-     * However we can fall back to individual instruction counting.
-     */
-    opcode = *((uint32_t *)qemu_plugin_insn_data(insn));
+    opcode = get_opcode(insn);
 
     for (i = 0; !cnt && i < class_table_sz; i++) {
         class = &class_table[i];
@@ -261,10 +420,16 @@ static uint64_t *find_counter(struct qemu_plugin_insn *insn)
 
     g_assert(class);
 
+    *states = NULL;
+    if (class_states) {
+        *weight = insn_states(insn, class);
+    }
+
     switch (class->what) {
     case COUNT_NONE:
         return NULL;
     case COUNT_CLASS:
+        *states = &class->states;
         return &class->count;
     case COUNT_INDIVIDUAL:
     {
@@ -285,6 +450,7 @@ static uint64_t *find_counter(struct qemu_plugin_insn *insn)
         }
         g_mutex_unlock(&lock);
 
+        *states = &icount->states;
         return &icount->count;
     }
     default:
@@ -300,9 +466,9 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
     size_t i;
 
     for (i = 0; i < n; i++) {
-        uint64_t *cnt;
+        uint64_t *cnt, *states, weight = 0;
         struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
-        cnt = find_counter(insn);
+        cnt = find_counter(insn, &states, &weight);
 
         if (cnt) {
             if (do_inline) {
@@ -313,6 +479,11 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
                     insn, vcpu_insn_exec_before, QEMU_PLUGIN_CB_NO_REGS, cnt);
             }
         }
+        /* the weight is fixed at translation time, so always inline */
+        if (states && weight) {
+            qemu_plugin_register_vcpu_insn_exec_inline(
+                insn, QEMU_PLUGIN_INLINE_ADD_U64, states, weight);
+        }
     }
 }
 
@@ -329,6 +500,10 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
             strcmp(entry->qemu_target, info->target_name) == 0) {
             class_table = entry->table;
             class_table_sz = entry->table_sz;
+            class_big_endian = entry->big_endian;
+            class_states = entry->states;
+            /* state estimates are meant to be cheap, count inline too */
+            do_inline = entry->states;
             break;
         }
     }
@@ -346,6 +521,16 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
                 fprintf(stderr, "boolean argument parsing failed: %s\n", p);
                 return -1;
             }
+        } else if (g_strcmp0(tokens[0], "bus") == 0) {
+            guint64 value;
+
+            if (!tokens[1] ||
+                !g_ascii_string_to_unsigned(tokens[1], 10, 1, G_MAXINT,
+                                            &value, NULL)) {
+                fprintf(stderr, "bus states must be at least 1: %s\n", p);
+                return -1;
+            }
+            bus_states = value;
         } else if (g_strcmp0(tokens[0], "count") == 0) {
             char *value = tokens[1];
             int j;
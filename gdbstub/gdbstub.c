@@ -437,6 +437,8 @@ void gdb_feature_builder_init(GDBFeatureBuilder *builder, GDBFeature *feature,
     g_ptr_array_add(builder->xml, header);
     builder->base_reg = base_reg;
     feature->xmlname = xmlname;
+    feature->name = name;
+    feature->regs = NULL;
     feature->num_regs = 0;
 }
 
@@ -500,7 +502,58 @@ const GDBFeature *gdb_find_static_feature(const char *xmlname)
     g_assert_not_reached();
 }
 
-static int gdb_read_register(CPUState *cpu, GByteArray *buf, int reg)
+/* like gdb_find_static_feature(), but @xmlname may be dynamic */
+static const GDBFeature *gdb_lookup_static_feature(const char *xmlname)
+{
+    const GDBFeature *feature;
+
+    for (feature = gdb_static_features; feature->xmlname; feature++) {
+        if (!strcmp(feature->xmlname, xmlname)) {
+            return feature;
+        }
+    }
+    return NULL;
+}
+
+static void gdb_append_feature_regs(GArray *regs, const char *xmlname,
+                                    int base_reg)
+{
+    const GDBFeature *feature = gdb_lookup_static_feature(xmlname);
+
+    if (!feature || !feature->regs) {
+        return;
+    }
+    for (int i = 0; i < feature->num_regs; i++) {
+        if (feature->regs[i]) {
+            GDBRegDesc desc = {
+                .gdb_reg = base_reg + i,
+                .name = feature->regs[i],
+                .feature_name = feature->name,
+            };
+            g_array_append_val(regs, desc);
+        }
+    }
+}
+
+GArray *gdb_get_register_list(CPUState *cpu)
+{
+    CPUClass *cc = CPU_GET_CLASS(cpu);
+    GArray *regs = g_array_new(false, false, sizeof(GDBRegDesc));
+    GDBRegisterState *r;
+
+    if (cc->gdb_core_xml_file) {
+        gdb_append_feature_regs(regs, cc->gdb_core_xml_file, 0);
+    }
+    if (cpu->gdb_regs) {
+        for (guint i = 0; i < cpu->gdb_regs->len; i++) {
+            r = &g_array_index(cpu->gdb_regs, GDBRegisterState, i);
+            gdb_append_feature_regs(regs, r->xml, r->base_reg);
+        }
+    }
+    return regs;
+}
+
+int gdb_read_register(CPUState *cpu, GByteArray *buf, int reg)
 {
     CPUClass *cc = CPU_GET_CLASS(cpu);
     CPUArchState *env = cpu_env(cpu);
@@ -329,19 +329,27 @@ ERST
 
     {
         .name       = "savevm",
-        .args_type  = "name:s?",
-        .params     = "tag",
-        .help       = "save a VM snapshot. If no tag is provided, a new snapshot is created",
+        .args_type  = "incremental:-i,name:s?",
+        .params     = "[-i] tag",
+        .help       = "save a VM snapshot. If no tag is provided, a new snapshot is created\n\t\t\t"
+                      "-i: only save the RAM written since the previous -i snapshot",
         .cmd        = hmp_savevm,
     },
 
 SRST
-``savevm`` *tag*
+``savevm [-i]`` *tag*
   Create a snapshot of the whole virtual machine. If *tag* is
   provided, it is used as human readable identifier. If there is already
   a snapshot with the same tag, it is replaced. More info at
   :ref:`vm_005fsnapshots`.
 
+  ``-i`` makes the snapshot incremental: it only holds the RAM pages
+  written since the previous ``savevm -i``, or since a ``loadvm`` that
+  followed it, and loading it also loads the snapshots it is based on. The first one of
+  such a chain is a full snapshot. The RAM writes are tracked until a
+  ``savevm`` without ``-i`` or a migration. Deleting or replacing a
+  snapshot makes the ones based on it impossible to load.
+
   Since 4.0, savevm stopped allowing the snapshot id to be set, accepting
   only *tag* as parameter.
 ERST
@@ -86,6 +86,8 @@ struct PFlashCFI01 {
     void *storage;
     VMChangeStateEntry *vmstate;
     bool old_multiple_chip_handling;
+    char *mmap_path;
+    bool mmap_shared;
 };
 
 static int pflash_post_load(void *opaque, int version_id);
@@ -817,11 +819,48 @@ static void pflash_cfi01_realize(DeviceState *dev, Error **errp)
 
     total_len = pfl->sector_len * pfl->nb_blocs;
 
-    memory_region_init_rom_device(
-        &pfl->mem, OBJECT(dev),
-        &pflash_cfi01_ops,
-        pfl,
-        pfl->name, total_len, errp);
+    if (pfl->mmap_path) {
+#ifdef CONFIG_POSIX
+        uint32_t ram_flags = 0;
+
+        if (pfl->blk) {
+            error_setg(errp, "attributes \"drive\" and \"mmap-path\" "
+                       "are mutually exclusive.");
+            return;
+        }
+        if (access(pfl->mmap_path, R_OK)) {
+            error_setg_errno(errp, errno, "can't access flash image %s",
+                             pfl->mmap_path);
+            return;
+        }
+        if (pfl->mmap_shared) {
+            ram_flags |= RAM_SHARED;
+        } else if (access(pfl->mmap_path, W_OK)) {
+            /* private mapping, writes never reach the file */
+            ram_flags |= RAM_READONLY_FD;
+        }
+        /*
+         * The image is paged in on demand rather than read at realize.
+         * Program and erase go straight to the mapping: into the image
+         * file when shared, into private copies of the touched pages
+         * otherwise.
+         */
+        memory_region_init_rom_device_from_file(
+            &pfl->mem, OBJECT(dev),
+            &pflash_cfi01_ops,
+            pfl,
+            pfl->name, total_len, ram_flags, pfl->mmap_path, errp);
+#else
+        error_setg(errp, "attribute \"mmap-path\" is not supported "
+                   "on this host.");
+#endif
+    } else {
+        memory_region_init_rom_device(
+            &pfl->mem, OBJECT(dev),
+            &pflash_cfi01_ops,
+            pfl,
+            pfl->name, total_len, errp);
+    }
     if (*errp) {
         return;
     }
@@ -923,6 +962,14 @@ static Property pflash_cfi01_properties[] = {
     DEFINE_PROP_STRING("name", PFlashCFI01, name),
     DEFINE_PROP_BOOL("old-multiple-chip-handling", PFlashCFI01,
                      old_multiple_chip_handling, false),
+    /*
+     * Instead of a drive, map a raw image file of exactly the flash size.
+     * With mmap-shared the guest's program and erase operations are
+     * written back to the file, otherwise they are private to this
+     * instance.
+     */
+    DEFINE_PROP_STRING("mmap-path", PFlashCFI01, mmap_path),
+    DEFINE_PROP_BOOL("mmap-shared", PFlashCFI01, mmap_shared, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -18,19 +18,39 @@
 
 #include "qemu/osdep.h"
 #include "qapi/error.h"
+#include "qemu/cutils.h"
 #include "cpu.h"
+#include "qemu/error-report.h"
 #include "hw/hw.h"
 #include "hw/sysbus.h"
 #include "hw/loader.h"
 #include "hw/block/flash.h"
+#include "hw/qdev-properties.h"
 #include "hw/net/smc91c111.h"
 #include "hw/h8300/h8s2674.h"
 #include "sysemu/sysemu.h"
 #include "sysemu/qtest.h"
 #include "sysemu/device_tree.h"
 #include "hw/boards.h"
+#include "qom/object.h"
 
 #define DRAM_BASE 0x00400000
+#define FLASH_SIZE (4 * MiB)
+#define FLASH_SECTOR (128 * KiB)
+
+struct EDOSK2674MachineState {
+    /*< private >*/
+    MachineState parent_obj;
+    /*< public >*/
+    char *flash_image;
+    bool flash_shared;
+};
+typedef struct EDOSK2674MachineState EDOSK2674MachineState;
+
+#define TYPE_EDOSK2674_MACHINE MACHINE_TYPE_NAME("edosk2674")
+
+DECLARE_INSTANCE_CHECKER(EDOSK2674MachineState, EDOSK2674_MACHINE,
+                         TYPE_EDOSK2674_MACHINE)
 
 static void setup_vector(unsigned int base)
 {
@@ -43,29 +63,74 @@ static void setup_vector(unsigned int base)
     rom_add_blob_fixed("vector", rom_vec, sizeof(rom_vec), 0x000000);
 }
 
+/*
+ * Same configuration as pflash_cfi01_register(), but the contents are
+ * a mapping of the image file, paged in as the guest touches them.
+ */
+static void edosk2674_flash_mmap(EDOSK2674MachineState *ms)
+{
+    DeviceState *dev = qdev_new(TYPE_PFLASH_CFI01);
+
+    qdev_prop_set_string(dev, "mmap-path", ms->flash_image);
+    qdev_prop_set_bit(dev, "mmap-shared", ms->flash_shared);
+    qdev_prop_set_uint32(dev, "num-blocks", FLASH_SIZE / FLASH_SECTOR);
+    qdev_prop_set_uint64(dev, "sector-length", FLASH_SECTOR);
+    qdev_prop_set_uint8(dev, "width", 2);
+    qdev_prop_set_bit(dev, "big-endian", false);
+    qdev_prop_set_uint16(dev, "id0", 0x0089);
+    qdev_prop_set_uint16(dev, "id1", 0x0016);
+    qdev_prop_set_uint16(dev, "id2", 0x0000);
+    qdev_prop_set_uint16(dev, "id3", 0x0000);
+    qdev_prop_set_string(dev, "name", "edosk2674.flash");
+    sysbus_realize_and_unref(SYS_BUS_DEVICE(dev), &error_fatal);
+    sysbus_mmio_map(SYS_BUS_DEVICE(dev), 0, 0x0);
+}
+
 
 static void edosk2674_init(MachineState *machine)
 {
+    MachineClass *mc = MACHINE_GET_CLASS(machine);
+    EDOSK2674MachineState *ms = EDOSK2674_MACHINE(machine);
     H8S2674State *s = g_new(H8S2674State, 1);
     MemoryRegion *sysmem = get_system_memory();
-    MemoryRegion *sdram = g_new(MemoryRegion, 1);
     const char *kernel_filename = machine->kernel_filename;
     const char *dtb_filename = machine->dtb;
     void *dtb = NULL;
     int dtb_size;
     DriveInfo *dinfo;
 
+    if (machine->ram_size != mc->default_ram_size) {
+        char *sz = size_to_str(mc->default_ram_size);
+        error_report("Invalid RAM size, should be %s", sz);
+        g_free(sz);
+        exit(1);
+    }
+
     /* Allocate memory space */
-    memory_region_init_ram(sdram, NULL, "sdram", 8 * MiB,
-                           &error_fatal);
-    memory_region_add_subregion(sysmem, DRAM_BASE, sdram);
+    memory_region_add_subregion(sysmem, DRAM_BASE, machine->ram);
     dinfo = drive_get(IF_PFLASH, 0, 0);
-    pflash_cfi01_register(0x0, "edosk2674.flash", 4 * MiB,
-                          dinfo ? blk_by_legacy_dinfo(dinfo) : NULL,
-                          128 * KiB, 2, 0x0089, 0x0016, 0x0000, 0x0000,
-                          0);
+    if (ms->flash_image) {
+        if (dinfo) {
+            error_report("flash-image and -drive if=pflash "
+                         "are mutually exclusive");
+            exit(1);
+        }
+        /* they would be written to the image that other instances share */
+        if (ms->flash_shared && (kernel_filename || machine->firmware)) {
+            error_report("flash-shared=on cannot be used with -kernel "
+                         "or -bios");
+            exit(1);
+        }
+        edosk2674_flash_mmap(ms);
+    } else {
+        pflash_cfi01_register(0x0, "edosk2674.flash", FLASH_SIZE,
+                              dinfo ? blk_by_legacy_dinfo(dinfo) : NULL,
+                              FLASH_SECTOR, 2, 0x0089, 0x0016, 0x0000, 0x0000,
+                              0);
+    }
 
-    if (!kernel_filename) {
+    /* the firmware may be in flash-image already */
+    if (!kernel_filename && (machine->firmware || !ms->flash_image)) {
         rom_add_file_fixed(machine->firmware, 0, 0);
     }
 
@@ -104,6 +169,30 @@ static void edosk2674_init(MachineState *machine)
     }
 }
 
+static char *edosk2674_get_flash_image(Object *obj, Error **errp)
+{
+    return g_strdup(EDOSK2674_MACHINE(obj)->flash_image);
+}
+
+static void edosk2674_set_flash_image(Object *obj, const char *value,
+                                      Error **errp)
+{
+    EDOSK2674MachineState *ms = EDOSK2674_MACHINE(obj);
+
+    g_free(ms->flash_image);
+    ms->flash_image = g_strdup(value);
+}
+
+static bool edosk2674_get_flash_shared(Object *obj, Error **errp)
+{
+    return EDOSK2674_MACHINE(obj)->flash_shared;
+}
+
+static void edosk2674_set_flash_shared(Object *obj, bool value, Error **errp)
+{
+    EDOSK2674_MACHINE(obj)->flash_shared = value;
+}
+
 static void edosk2674_class_init(ObjectClass *oc, void *data)
 {
     MachineClass *mc = MACHINE_CLASS(oc);
@@ -112,12 +201,27 @@ static void edosk2674_class_init(ObjectClass *oc, void *data)
     mc->init = edosk2674_init;
     mc->is_default = 0;
     mc->default_cpu_type = TYPE_H8S2674_CPU;
+    mc->default_ram_size = 8 * MiB;
+    mc->default_ram_id = "sdram";
+
+    object_class_property_add_str(oc, "flash-image",
+                                  edosk2674_get_flash_image,
+                                  edosk2674_set_flash_image);
+    object_class_property_set_description(oc, "flash-image",
+        "Raw flash image to map on demand instead of -drive if=pflash");
+    object_class_property_add_bool(oc, "flash-shared",
+                                   edosk2674_get_flash_shared,
+                                   edosk2674_set_flash_shared);
+    object_class_property_set_description(oc, "flash-shared",
+        "Write flash updates back to flash-image (default: private), "
+        "not with -kernel or -bios");
 }
 
 static const TypeInfo edosk2674_type = {
-    .name = MACHINE_TYPE_NAME("edosk2674"),
+    .name = TYPE_EDOSK2674_MACHINE,
     .parent = TYPE_MACHINE,
     .class_init = edosk2674_class_init,
+    .instance_size = sizeof(EDOSK2674MachineState),
 };
 
 static void edosk2674_machine_init(void)
@@ -0,0 +1,558 @@
+/*
+ * H8/300 in-process fuzzing harness
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 or later, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Usage:
+ *   -object h8300-fuzz,id=fuzz,input=@@,start=ADDR,end=ADDR[,crash=ADDR]
+ *          [,inject=serial|net][,sci=QOM-PATH][,timeout=MS]
+ *
+ * When the guest first reaches "start", RAM, device and CPU state are
+ * captured.  Each iteration feeds the contents of "input" to the SCI
+ * receive path or to the NIC as one frame, and runs until the guest
+ * reaches "end" (or "crash", or the virtual time budget runs out).
+ * Only RAM pages dirtied during the iteration are copied back.
+ *
+ * The edge coverage map is shared with afl-fuzz through __AFL_SHM_ID,
+ * and iterations are driven by the AFL fork server pipes when present.
+ * In this persistent mode QEMU never forks, so the reported pid is our
+ * own one; keep "timeout" below the afl-fuzz -t value.  An iteration that
+ * runs out of time is reported as killed by SIGALRM, a crash as SIGABRT.
+ */
+
+#include "qemu/osdep.h"
+#include <sys/shm.h>
+#include "qapi/error.h"
+#include "qemu/error-report.h"
+#include "qemu/main-loop.h"
+#include "qemu/timer.h"
+#include "qom/object_interfaces.h"
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "exec/ramblock.h"
+#include "hw/char/renesas_sci.h"
+#include "chardev/char.h"
+#include "io/channel-buffer.h"
+#include "migration/qemu-file.h"
+#include "migration/savevm.h"
+#include "migration/migration.h"
+#include "net/net.h"
+#include "sysemu/runstate.h"
+#include "sysemu/sysemu.h"
+
+#define TYPE_H8300_FUZZ "h8300-fuzz"
+OBJECT_DECLARE_SIMPLE_TYPE(H8300FuzzState, H8300_FUZZ)
+
+#define FUZZ_MAP_SIZE (64 * KiB)
+#define FORKSRV_FD 198
+#define FUZZ_NOADDR UINT32_MAX
+
+enum {
+    FUZZ_IDLE,
+    FUZZ_CAPTURE,               /* waiting for the snapshot point */
+    FUZZ_RUNNING,
+    FUZZ_RESET,                 /* iteration finished, restore state */
+    FUZZ_DONE,
+};
+
+typedef struct FuzzRAM {
+    MemoryRegion *mr;
+    uint8_t *host;
+    uint8_t *copy;
+    ram_addr_t size;
+} FuzzRAM;
+
+struct H8300FuzzState {
+    Object parent_obj;
+
+    char *input;
+    char *inject;
+    char *sci_path;
+    uint32_t hook_pc[H8300_FUZZ_NR_HOOKS];
+    uint32_t timeout;
+
+    Notifier machine_done;
+    VMChangeStateEntry *vmstate;
+    QEMUBH *resume_bh;
+    QEMUTimer *timeout_timer;
+    QEMUTimer *feed_timer;
+    bool forkserver;
+    int state;
+    int status;
+
+    /* captured state */
+    H8300CPU *cpu;
+    CPUH8300State env;
+    uint32_t interrupt_request;
+    uint32_t halted;
+    QIOChannelBuffer *devstate;
+    GArray *ram;
+
+    /* input injection */
+    Chardev *chr;
+    NetClientState *nc;
+    uint8_t *buf;
+    gsize buf_len;
+    gsize buf_pos;
+};
+
+static H8300FuzzState *fuzz_state;
+
+static int fuzz_add_ram(RAMBlock *rb, void *opaque)
+{
+    H8300FuzzState *s = opaque;
+    FuzzRAM r;
+
+    if (!rb->mr || memory_region_is_rom(rb->mr)) {
+        return 0;
+    }
+    r.mr = rb->mr;
+    r.host = qemu_ram_get_host_addr(rb);
+    r.size = qemu_ram_get_used_length(rb);
+    r.copy = g_memdup2(r.host, r.size);
+    memory_region_set_log(r.mr, true, DIRTY_MEMORY_VGA);
+    g_array_append_val(s->ram, r);
+    return 0;
+}
+
+static void fuzz_clear_dirty(H8300FuzzState *s)
+{
+    int i;
+
+    for (i = 0; i < s->ram->len; i++) {
+        FuzzRAM *r = &g_array_index(s->ram, FuzzRAM, i);
+        g_free(memory_region_snapshot_and_clear_dirty(r->mr, 0, r->size,
+                                                      DIRTY_MEMORY_VGA));
+    }
+}
+
+static void fuzz_capture(H8300FuzzState *s)
+{
+    CPUState *cs = CPU(s->cpu);
+    QEMUFile *f;
+
+    s->env = s->cpu->env;
+    s->interrupt_request = cs->interrupt_request;
+    s->halted = cs->halted;
+
+    s->devstate = qio_channel_buffer_new(4096);
+    f = qemu_file_new_output(QIO_CHANNEL(s->devstate));
+    if (qemu_save_device_state(f) < 0) {
+        error_report("h8300-fuzz: failed to save device state");
+        exit(1);
+    }
+    qemu_fflush(f);
+    /* qemu_fclose() drops one reference, keep the buffer */
+    object_ref(OBJECT(s->devstate));
+    qemu_fclose(f);
+
+    s->ram = g_array_new(false, false, sizeof(FuzzRAM));
+    qemu_ram_foreach_block(fuzz_add_ram, s);
+    fuzz_clear_dirty(s);
+}
+
+static void fuzz_restore(H8300FuzzState *s)
+{
+    CPUState *cs = CPU(s->cpu);
+    QEMUFile *f;
+    int i;
+
+    for (i = 0; i < s->ram->len; i++) {
+        FuzzRAM *r = &g_array_index(s->ram, FuzzRAM, i);
+        ram_addr_t base = memory_region_get_ram_addr(r->mr);
+        DirtyBitmapSnapshot *snap;
+        ram_addr_t off;
+
+        snap = memory_region_snapshot_and_clear_dirty(r->mr, 0, r->size,
+                                                      DIRTY_MEMORY_VGA);
+        for (off = 0; off < r->size; off += TARGET_PAGE_SIZE) {
+            if (memory_region_snapshot_get_dirty(r->mr, snap, off,
+                                                 TARGET_PAGE_SIZE)) {
+                memcpy(r->host + off, r->copy + off, TARGET_PAGE_SIZE);
+                tb_invalidate_phys_range(base + off,
+                                         base + off + TARGET_PAGE_SIZE - 1);
+            }
+        }
+        g_free(snap);
+    }
+
+    qio_channel_io_seek(QIO_CHANNEL(s->devstate), 0, SEEK_SET, NULL);
+    f = qemu_file_new_input(QIO_CHANNEL(s->devstate));
+    if (qemu_loadvm_state(f) < 0) {
+        error_report("h8300-fuzz: failed to restore device state");
+        exit(1);
+    }
+    object_ref(OBJECT(s->devstate));
+    qemu_fclose(f);
+    migration_incoming_state_destroy();
+
+    /* The interrupt acknowledge line is wiring, not state */
+    s->env.ack = s->cpu->env.ack;
+    s->cpu->env = s->env;
+    cs->interrupt_request = s->interrupt_request;
+    cs->halted = s->halted;
+}
+
+static void fuzz_feed(void *opaque)
+{
+    H8300FuzzState *s = opaque;
+
+    while (s->buf_pos < s->buf_len && qemu_chr_be_can_write(s->chr) > 0) {
+        qemu_chr_be_write(s->chr, s->buf + s->buf_pos, 1);
+        s->buf_pos++;
+    }
+    if (s->buf_pos < s->buf_len) {
+        /* SCI accepts one character per frame time */
+        timer_mod(s->feed_timer,
+                  qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 10 * SCALE_US);
+    }
+}
+
+static bool fuzz_next_input(H8300FuzzState *s)
+{
+    uint32_t msg;
+    pid_t pid = getpid();
+    g_autoptr(GError) err = NULL;
+
+    if (s->forkserver) {
+        if (read(FORKSRV_FD, &msg, 4) != 4) {
+            /* afl-fuzz went away */
+            return false;
+        }
+        if (write(FORKSRV_FD + 1, &pid, 4) != 4) {
+            return false;
+        }
+    }
+
+    g_free(s->buf);
+    s->buf = NULL;
+    s->buf_len = s->buf_pos = 0;
+    if (!g_file_get_contents(s->input, (gchar **)&s->buf, &s->buf_len,
+                             &err)) {
+        error_report("h8300-fuzz: %s", err->message);
+        return false;
+    }
+
+    if (s->nc) {
+        qemu_receive_packet(s->nc, s->buf, s->buf_len);
+    } else {
+        fuzz_feed(s);
+    }
+    if (s->timeout) {
+        timer_mod(s->timeout_timer,
+                  qemu_clock_get_ms(QEMU_CLOCK_VIRTUAL) + s->timeout);
+    }
+    s->state = FUZZ_RUNNING;
+    return true;
+}
+
+static void fuzz_report(H8300FuzzState *s)
+{
+    if (s->forkserver) {
+        if (write(FORKSRV_FD + 1, &s->status, 4) != 4) {
+            s->forkserver = false;
+        }
+    } else if (s->status) {
+        /* Non fork server mode: let the fuzzer see an abnormal exit */
+        abort();
+    }
+}
+
+static void fuzz_resume_bh(void *opaque)
+{
+    vm_start();
+}
+
+static void fuzz_vm_state_change(void *opaque, bool running, RunState state)
+{
+    H8300FuzzState *s = opaque;
+
+    if (running) {
+        return;
+    }
+    switch (s->state) {
+    case FUZZ_CAPTURE:
+        fuzz_capture(s);
+        break;
+    case FUZZ_RESET:
+        timer_del(s->timeout_timer);
+        timer_del(s->feed_timer);
+        fuzz_report(s);
+        if (!s->forkserver) {
+            /* Single shot without afl-fuzz */
+            s->state = FUZZ_DONE;
+            qemu_system_shutdown_request(SHUTDOWN_CAUSE_GUEST_SHUTDOWN);
+            return;
+        }
+        fuzz_restore(s);
+        break;
+    default:
+        return;
+    }
+    if (!fuzz_next_input(s)) {
+        s->state = FUZZ_DONE;
+        qemu_system_shutdown_request(SHUTDOWN_CAUSE_HOST_QMP_QUIT);
+        return;
+    }
+    qemu_bh_schedule(s->resume_bh);
+}
+
+static void fuzz_finish(H8300FuzzState *s, int status)
+{
+    s->status = status;
+    s->state = FUZZ_RESET;
+    vm_stop(RUN_STATE_PAUSED);
+}
+
+static void fuzz_timeout(void *opaque)
+{
+    H8300FuzzState *s = opaque;
+
+    /* the iteration may have ended already, keep its status */
+    if (s->state != FUZZ_RUNNING) {
+        return;
+    }
+    fuzz_finish(s, SIGALRM);
+}
+
+/* Called from the vCPU thread by helper_fuzz_event */
+static bool fuzz_event(CPUH8300State *env, int hook)
+{
+    H8300FuzzState *s = fuzz_state;
+
+    switch (hook) {
+    case H8300_FUZZ_START:
+        if (s->state != FUZZ_IDLE) {
+            return false;
+        }
+        s->state = FUZZ_CAPTURE;
+        vm_stop(RUN_STATE_PAUSED);
+        return true;
+    case H8300_FUZZ_END:
+    case H8300_FUZZ_CRASH:
+        if (s->state != FUZZ_RUNNING) {
+            return false;
+        }
+        fuzz_finish(s, hook == H8300_FUZZ_CRASH ? SIGABRT : 0);
+        return true;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static void fuzz_setup_map(void)
+{
+    const char *id = getenv("__AFL_SHM_ID");
+    void *map;
+
+    h8300_fuzz.map_size = FUZZ_MAP_SIZE;
+    if (id) {
+        map = shmat(atoi(id), NULL, 0);
+        if (map == (void *)-1) {
+            error_report("h8300-fuzz: shmat: %s", strerror(errno));
+            exit(1);
+        }
+        h8300_fuzz.map = map;
+    } else {
+        h8300_fuzz.map = g_malloc0(FUZZ_MAP_SIZE);
+    }
+}
+
+static void fuzz_find_nic(NICState *nic, void *opaque)
+{
+    NICState **found = opaque;
+
+    if (!*found) {
+        *found = nic;
+    }
+}
+
+static void fuzz_machine_done(Notifier *notifier, void *data)
+{
+    H8300FuzzState *s = container_of(notifier, H8300FuzzState, machine_done);
+    uint32_t hello = 0;
+    int i;
+
+    s->cpu = H8300_CPU(first_cpu);
+    if (g_str_equal(s->inject, "net")) {
+        NICState *nic = NULL;
+
+        qemu_foreach_nic(fuzz_find_nic, &nic);
+        if (!nic) {
+            error_report("h8300-fuzz: no NIC to inject into");
+            exit(1);
+        }
+        s->nc = qemu_get_queue(nic);
+    } else {
+        Object *sci = object_resolve_path_type(s->sci_path,
+                                               TYPE_RENESAS_SCI, NULL);
+        if (!sci) {
+            error_report("h8300-fuzz: '%s' is not a SCI", s->sci_path);
+            exit(1);
+        }
+        s->chr = qemu_chr_fe_get_driver(&RSCI(sci)->chr);
+        if (!s->chr) {
+            error_report("h8300-fuzz: '%s' has no chardev", s->sci_path);
+            exit(1);
+        }
+    }
+
+    fuzz_setup_map();
+    for (i = 0; i < H8300_FUZZ_NR_HOOKS; i++) {
+        h8300_fuzz.hook_valid[i] = s->hook_pc[i] != FUZZ_NOADDR;
+        h8300_fuzz.hook_pc[i] = s->hook_pc[i];
+    }
+    h8300_fuzz.event = fuzz_event;
+
+    s->vmstate = qemu_add_vm_change_state_handler(fuzz_vm_state_change, s);
+    s->resume_bh = qemu_bh_new(fuzz_resume_bh, s);
+    s->timeout_timer = timer_new_ms(QEMU_CLOCK_VIRTUAL, fuzz_timeout, s);
+    s->feed_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, fuzz_feed, s);
+
+    /* Fork server handshake */
+    s->forkserver = write(FORKSRV_FD + 1, &hello, 4) == 4;
+}
+
+static void fuzz_complete(UserCreatable *uc, Error **errp)
+{
+    H8300FuzzState *s = H8300_FUZZ(uc);
+
+    if (fuzz_state) {
+        error_setg(errp, "only one " TYPE_H8300_FUZZ " object is allowed");
+        return;
+    }
+    if (!s->input) {
+        error_setg(errp, "property 'input' is required");
+        return;
+    }
+    if (s->hook_pc[H8300_FUZZ_START] == FUZZ_NOADDR ||
+        s->hook_pc[H8300_FUZZ_END] == FUZZ_NOADDR) {
+        error_setg(errp, "properties 'start' and 'end' are required");
+        return;
+    }
+    if (!g_str_equal(s->inject, "serial") && !g_str_equal(s->inject, "net")) {
+        error_setg(errp, "property 'inject' must be 'serial' or 'net'");
+        return;
+    }
+    fuzz_state = s;
+    s->machine_done.notify = fuzz_machine_done;
+    qemu_add_machine_init_done_notifier(&s->machine_done);
+}
+
+static char *fuzz_get_input(Object *obj, Error **errp)
+{
+    return g_strdup(H8300_FUZZ(obj)->input);
+}
+
+static void fuzz_set_input(Object *obj, const char *value, Error **errp)
+{
+    H8300FuzzState *s = H8300_FUZZ(obj);
+
+    g_free(s->input);
+    s->input = g_strdup(value);
+}
+
+static char *fuzz_get_inject(Object *obj, Error **errp)
+{
+    return g_strdup(H8300_FUZZ(obj)->inject);
+}
+
+static void fuzz_set_inject(Object *obj, const char *value, Error **errp)
+{
+    H8300FuzzState *s = H8300_FUZZ(obj);
+
+    g_free(s->inject);
+    s->inject = g_strdup(value);
+}
+
+static char *fuzz_get_sci(Object *obj, Error **errp)
+{
+    return g_strdup(H8300_FUZZ(obj)->sci_path);
+}
+
+static void fuzz_set_sci(Object *obj, const char *value, Error **errp)
+{
+    H8300FuzzState *s = H8300_FUZZ(obj);
+
+    g_free(s->sci_path);
+    s->sci_path = g_strdup(value);
+}
+
+static void fuzz_init(Object *obj)
+{
+    H8300FuzzState *s = H8300_FUZZ(obj);
+    int i;
+
+    for (i = 0; i < H8300_FUZZ_NR_HOOKS; i++) {
+        s->hook_pc[i] = FUZZ_NOADDR;
+    }
+    s->inject = g_strdup("serial");
+    s->sci_path = g_strdup("/machine/mcu/sci[0]");
+    s->timeout = 1000;
+
+    object_property_add_uint32_ptr(obj, "start", &s->hook_pc[H8300_FUZZ_START],
+                                   OBJ_PROP_FLAG_READWRITE);
+    object_property_add_uint32_ptr(obj, "end", &s->hook_pc[H8300_FUZZ_END],
+                                   OBJ_PROP_FLAG_READWRITE);
+    object_property_add_uint32_ptr(obj, "crash", &s->hook_pc[H8300_FUZZ_CRASH],
+                                   OBJ_PROP_FLAG_READWRITE);
+    object_property_add_uint32_ptr(obj, "timeout", &s->timeout,
+                                   OBJ_PROP_FLAG_READWRITE);
+}
+
+static void fuzz_finalize(Object *obj)
+{
+    H8300FuzzState *s = H8300_FUZZ(obj);
+
+    g_free(s->input);
+    g_free(s->inject);
+    g_free(s->sci_path);
+    g_free(s->buf);
+}
+
+static void fuzz_class_init(ObjectClass *oc, void *data)
+{
+    UserCreatableClass *ucc = USER_CREATABLE_CLASS(oc);
+
+    ucc->complete = fuzz_complete;
+    object_class_property_add_str(oc, "input",
+                                  fuzz_get_input, fuzz_set_input);
+    object_class_property_add_str(oc, "inject",
+                                  fuzz_get_inject, fuzz_set_inject);
+    object_class_property_add_str(oc, "sci",
+                                  fuzz_get_sci, fuzz_set_sci);
+}
+
+static const TypeInfo h8300_fuzz_info = {
+    .name = TYPE_H8300_FUZZ,
+    .parent = TYPE_OBJECT,
+    .instance_size = sizeof(H8300FuzzState),
+    .instance_init = fuzz_init,
+    .instance_finalize = fuzz_finalize,
+    .class_init = fuzz_class_init,
+    .interfaces = (InterfaceInfo[]) {
+        { TYPE_USER_CREATABLE },
+        { }
+    },
+};
+
+static void h8300_fuzz_register_types(void)
+{
+    type_register_static(&h8300_fuzz_info);
+}
+
+type_init(h8300_fuzz_register_types)
@@ -18,6 +18,8 @@
 
 #include "qemu/osdep.h"
 #include "qapi/error.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
 #include "cpu.h"
 #include "hw/hw.h"
 #include "hw/sysbus.h"
@@ -66,18 +68,23 @@ static void setup_vector(unsigned int base)
 
 static void kanebebe_init(MachineState *machine)
 {
+    MachineClass *mc = MACHINE_GET_CLASS(machine);
     KaneBebeMachineState *s = KANEBEBE_MACHINE(machine);
     MemoryRegion *sysmem = get_system_memory();
-    MemoryRegion *dram = g_new(MemoryRegion, 1);
     const char *kernel_filename = machine->kernel_filename;
     const char *dtb_filename = machine->dtb;
     void *dtb = NULL;
     int dtb_size;
 
+    if (machine->ram_size != mc->default_ram_size) {
+        char *sz = size_to_str(mc->default_ram_size);
+        error_report("Invalid RAM size, should be %s", sz);
+        g_free(sz);
+        exit(1);
+    }
+
     /* Allocate memory space */
-    memory_region_init_ram(dram, NULL, "kanebebe.dram",
-                           DRAM_SIZE, &error_fatal);
-    memory_region_add_subregion(sysmem, DRAM_BASE, dram);
+    memory_region_add_subregion(sysmem, DRAM_BASE, machine->ram);
 
     if (!kernel_filename) {
         rom_add_file_fixed(machine->firmware, 0, 0);
@@ -126,6 +133,8 @@ static void kanebebe_class_init(ObjectClass *oc, void *data)
     mc->init = kanebebe_init;
     mc->is_default = 1;
     mc->default_cpu_type = TYPE_H83069_CPU;
+    mc->default_ram_size = DRAM_SIZE;
+    mc->default_ram_id = "kanebebe.dram";
 }
 
 static const TypeInfo kanebebe_type[] = {
@@ -13,6 +13,9 @@
 typedef struct GDBFeature {
     const char *xmlname;
     const char *xml;
+    const char *name;
+    /* register names, indexed from the first register of the feature */
+    const char * const *regs;
     int num_regs;
 } GDBFeature;
 
@@ -104,6 +107,39 @@ const GDBFeature *gdb_find_static_feature(const char *xmlname);
 
 void gdb_set_stop_cpu(CPUState *cpu);
 
+/**
+ * typedef GDBRegDesc - a register description from gdbstub
+ * @gdb_reg: register number as used by gdb
+ * @name: name of the register
+ * @feature_name: name of the feature the register belongs to
+ */
+typedef struct {
+    int gdb_reg;
+    const char *name;
+    const char *feature_name;
+} GDBRegDesc;
+
+/**
+ * gdb_get_register_list() - list the named registers of a vCPU
+ * @cpu: the vCPU
+ *
+ * Only registers described by a static XML feature have a name and are
+ * listed. The strings point into those features and must not be freed.
+ *
+ * Returns: a GArray of GDBRegDesc, to be freed by the caller
+ */
+GArray *gdb_get_register_list(CPUState *cpu);
+
+/**
+ * gdb_read_register() - read a register into a buffer
+ * @cpu: the vCPU
+ * @buf: buffer the value is appended to, in target byte order
+ * @reg: the gdb register number
+ *
+ * Returns: the size of the register, or 0 if it is not readable
+ */
+int gdb_read_register(CPUState *cpu, GByteArray *buf, int reg);
+
 /* in gdbstub-xml.c, generated by scripts/feature_to_c.py */
 extern const GDBFeature gdb_static_features[];
 
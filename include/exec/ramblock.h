@@ -75,6 +75,15 @@ struct RAMBlock {
      * could not have been valid on the source.
      */
     ram_addr_t postcopy_length;
+
+    /*
+     * With mapped-ram, where the bitmap of the pages written to the
+     * migration file and the pages themselves are in that file, and the
+     * bitmap itself while saving.
+     */
+    uint64_t bitmap_offset;
+    uint64_t pages_offset;
+    unsigned long *file_bmap;
 };
 #endif
 #endif
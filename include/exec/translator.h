@@ -159,6 +159,34 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
  */
 bool translator_use_goto_tb(DisasContextBase *db, vaddr dest);
 
+/**
+ * translator_trace_jump
+ * @db: Disassembly context
+ * @dest: target pc of an unconditional jump
+ *
+ * Return true if the TB is a trace (CF_TRACE) and may carry on
+ * translating at @dest instead of ending with the jump. That is
+ * the case if @dest lies ahead on the TB's first page, which keeps
+ * traces free of loops and tb->size covering all of their code.
+ */
+bool translator_trace_jump(DisasContextBase *db, vaddr dest);
+
+/**
+ * translator_trace_branch
+ * @db: Disassembly context
+ * @cpu: Target vCPU
+ * @taken: target pc of a conditional branch
+ * @dest: where to continue translating
+ *
+ * In a trace, pick the successor of a conditional branch that the TBs
+ * at @taken and at db->pc_next say is the far more frequent one. Return
+ * true and set @dest to it if translation may continue there, as for
+ * translator_trace_jump(). The target must then branch to a side exit
+ * on the opposite condition. Return false to end the TB as usual.
+ */
+bool translator_trace_branch(DisasContextBase *db, CPUState *cpu,
+                             vaddr taken, vaddr *dest);
+
 /**
  * translator_io_start
  * @db: Disassembly context
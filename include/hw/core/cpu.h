@@ -536,6 +536,7 @@ struct CPUState {
 
 #ifdef CONFIG_PLUGIN
     GArray *plugin_mem_cbs;
+    struct qemu_plugin_mem_batch *plugin_mem_batch;
 #endif
 
     /* TODO Move common fields from CPUArchState here. */
@@ -24,6 +24,8 @@
  * @vmstate: blockdev node name to store VM state in
  * @has_devices: whether to use explicit device list
  * @devices: explicit device list to snapshot
+ * @incremental: only save the RAM pages written since the previous
+ *   incremental snapshot, or since it was loaded
  * @errp: pointer to error object
  * On success, return %true.
  * On failure, store an error through @errp and return %false.
@@ -31,7 +33,7 @@
 bool save_snapshot(const char *name, bool overwrite,
                    const char *vmstate,
                    bool has_devices, strList *devices,
-                   Error **errp);
+                   bool incremental, Error **errp);
 
 /**
  * load_snapshot: Load an internal snapshot.
@@ -60,6 +60,7 @@ union qemu_plugin_cb_sig {
     qemu_plugin_vcpu_udata_cb_t      vcpu_udata;
     qemu_plugin_vcpu_tb_trans_cb_t   vcpu_tb_trans;
     qemu_plugin_vcpu_mem_cb_t        vcpu_mem;
+    qemu_plugin_vcpu_mem_batch_cb_t  vcpu_mem_batch;
     qemu_plugin_vcpu_syscall_cb_t    vcpu_syscall;
     qemu_plugin_vcpu_syscall_ret_cb_t vcpu_syscall_ret;
     void *generic;
@@ -73,7 +74,9 @@ enum plugin_dyn_cb_type {
 
 enum plugin_dyn_cb_subtype {
     PLUGIN_CB_REGULAR,
+    PLUGIN_CB_REGULAR_R,    /* regular callback that reads registers */
     PLUGIN_CB_INLINE,
+    PLUGIN_CB_BATCH,        /* mem access record for the batch buffer */
     PLUGIN_N_CB_SUBTYPES,
 };
 
@@ -91,12 +94,62 @@ struct qemu_plugin_dyn_cb {
     /* fields specific to each dyn_cb type go here */
     union {
         struct {
+            /* scoreboard counter, or score == NULL to update userp */
+            qemu_plugin_u64 entry;
             enum qemu_plugin_op op;
             uint64_t imm;
         } inline_insn;
+        struct {
+            uint32_t tag;
+            uint32_t owner;
+        } batch;
     };
 };
 
+/* A batched memory access record, and the plugin it is for */
+struct qemu_plugin_mem_batch_rec {
+    qemu_plugin_mem_record rec;
+    uint32_t owner;
+};
+
+/*
+ * Per-vCPU buffer of memory access records. Generated code appends to
+ * it directly; a check at the start of every TB recording accesses
+ * makes sure the TB cannot overflow it. The records of each plugin are
+ * gathered in @out before they are handed to it.
+ */
+struct qemu_plugin_mem_batch {
+    uint32_t n;
+    /* records the current TB may still append from generated code */
+    uint32_t reserve;
+    uint32_t size;
+    qemu_plugin_mem_record *out;
+    struct qemu_plugin_mem_batch_rec rec[];
+};
+
+struct qemu_plugin_scoreboard {
+    GArray *data;
+    QLIST_ENTRY(qemu_plugin_scoreboard) entry;
+};
+
+/*
+ * Address of the counter an inline op updates for vCPU 0, and in
+ * @stride the distance to the next vCPU's. Ops registered with a plain
+ * pointer have a stride of 0, every vCPU updates the same counter.
+ */
+static inline char *
+qemu_plugin_inline_base(const struct qemu_plugin_dyn_cb *cb, size_t *stride)
+{
+    const qemu_plugin_u64 *entry = &cb->inline_insn.entry;
+
+    if (!entry->score) {
+        *stride = 0;
+        return cb->userp;
+    }
+    *stride = g_array_get_element_size(entry->score->data);
+    return entry->score->data->data + entry->offset;
+}
+
 /* Internal context for instrumenting an instruction */
 struct qemu_plugin_insn {
     GByteArray *data;
@@ -199,6 +252,8 @@ void qemu_plugin_vcpu_syscall_ret(CPUState *cpu, int64_t num, int64_t ret);
 void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                              MemOpIdx oi, enum qemu_plugin_mem_rw rw);
 
+void qemu_plugin_mem_batch_reserve(CPUState *cpu, uint32_t n);
+
 void qemu_plugin_flush_cb(void);
 
 void qemu_plugin_atexit_cb(void);
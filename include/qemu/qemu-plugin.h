@@ -50,11 +50,19 @@ typedef uint64_t qemu_plugin_id_t;
  *
  * The plugins export the API they were built against by exposing the
  * symbol qemu_plugin_version which can be checked.
+ *
+ * version 2:
+ * - added scoreboards, per-vCPU storage for plugin counters, and the
+ *   *_inline_per_vcpu registration functions that update them
+ * - added qemu_plugin_get_registers() and qemu_plugin_read_register(),
+ *   for callbacks registered with QEMU_PLUGIN_CB_R_REGS
+ * - added batched memory access records, see
+ *   qemu_plugin_register_vcpu_mem_batch_cb()
  */
 
 extern QEMU_PLUGIN_EXPORT int qemu_plugin_version;
 
-#define QEMU_PLUGIN_VERSION 1
+#define QEMU_PLUGIN_VERSION 2
 
 /**
  * struct qemu_info_t - system information for plugins
@@ -227,8 +235,10 @@ struct qemu_plugin_insn;
  * @QEMU_PLUGIN_CB_R_REGS: callback reads the CPU's regs
  * @QEMU_PLUGIN_CB_RW_REGS: callback reads and writes the CPU's regs
  *
- * Note: currently unused, plugins cannot read or change system
- * register state.
+ * Only tb and insn exec callbacks registered with R_REGS or RW_REGS may
+ * use qemu_plugin_read_register(). The guest state is brought up to
+ * date before those calls only, so the others stay cheap. Plugins
+ * cannot change register state.
  */
 enum qemu_plugin_cb_flags {
     QEMU_PLUGIN_CB_NO_REGS,
@@ -312,6 +322,129 @@ void qemu_plugin_register_vcpu_tb_exec_inline(struct qemu_plugin_tb *tb,
                                               enum qemu_plugin_op op,
                                               void *ptr, uint64_t imm);
 
+/**
+ * struct qemu_plugin_scoreboard - opaque handle for a scoreboard
+ *
+ * A scoreboard is an array of plugin defined entries, one per vCPU,
+ * that QEMU allocates and grows as vCPUs are created. Inline ops
+ * registered against it update the entry of the vCPU executing the
+ * code, so counters need neither locks nor atomics.
+ */
+struct qemu_plugin_scoreboard;
+
+/**
+ * typedef qemu_plugin_u64 - uint64_t member of a scoreboard entry
+ * @score: the scoreboard
+ * @offset: offset of the uint64_t in the entry
+ *
+ * Build one with qemu_plugin_scoreboard_u64() or
+ * qemu_plugin_scoreboard_u64_in_struct().
+ */
+typedef struct {
+    struct qemu_plugin_scoreboard *score;
+    size_t offset;
+} qemu_plugin_u64;
+
+/**
+ * qemu_plugin_scoreboard_new() - allocate a new scoreboard
+ * @element_size: size of one vCPU's entry
+ *
+ * Entries are zero initialised, including those of vCPUs created later.
+ */
+QEMU_PLUGIN_API
+struct qemu_plugin_scoreboard *qemu_plugin_scoreboard_new(size_t element_size);
+
+/**
+ * qemu_plugin_scoreboard_free() - free a scoreboard
+ * @score: scoreboard to free
+ *
+ * No code using the scoreboard may run afterwards, so only call this
+ * when the plugin exits.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_scoreboard_free(struct qemu_plugin_scoreboard *score);
+
+/**
+ * qemu_plugin_scoreboard_find() - get the entry of a vCPU
+ * @score: scoreboard to query
+ * @vcpu_index: vCPU whose entry is returned
+ *
+ * The pointer is only valid until the next vCPU is created, which may
+ * move the scoreboard.
+ */
+QEMU_PLUGIN_API
+void *qemu_plugin_scoreboard_find(struct qemu_plugin_scoreboard *score,
+                                  unsigned int vcpu_index);
+
+/* the whole entry is a single uint64_t */
+#define qemu_plugin_scoreboard_u64(score) \
+    ((qemu_plugin_u64) {score, 0})
+
+/* the uint64_t @member of entries of type @type */
+#define qemu_plugin_scoreboard_u64_in_struct(score, type, member) \
+    ((qemu_plugin_u64) {score, offsetof(type, member)})
+
+/**
+ * qemu_plugin_u64_add() - add to the counter of a vCPU
+ * @entry: counter
+ * @vcpu_index: vCPU to update
+ * @added: value to add
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_u64_add(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t added);
+
+/**
+ * qemu_plugin_u64_get() - read the counter of a vCPU
+ * @entry: counter
+ * @vcpu_index: vCPU to read
+ */
+QEMU_PLUGIN_API
+uint64_t qemu_plugin_u64_get(qemu_plugin_u64 entry, unsigned int vcpu_index);
+
+/**
+ * qemu_plugin_u64_set() - set the counter of a vCPU
+ * @entry: counter
+ * @vcpu_index: vCPU to update
+ * @val: new value
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_u64_set(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t val);
+
+/**
+ * qemu_plugin_u64_sum() - sum a counter over all vCPUs
+ * @entry: counter
+ */
+QEMU_PLUGIN_API
+uint64_t qemu_plugin_u64_sum(qemu_plugin_u64 entry);
+
+/**
+ * qemu_plugin_num_vcpus() - number of vCPUs created so far
+ *
+ * Unlike qemu_plugin_n_vcpus() this also works in user-mode, where it
+ * counts the threads started so far.
+ */
+QEMU_PLUGIN_API
+int qemu_plugin_num_vcpus(void);
+
+/**
+ * qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu() - per-vCPU inline op
+ * @tb: the opaque qemu_plugin_tb handle for the translation
+ * @op: the type of qemu_plugin_op (e.g. ADD_U64)
+ * @entry: the scoreboard counter to update
+ * @imm: the op data (e.g. 1)
+ *
+ * Like qemu_plugin_register_vcpu_tb_exec_inline(), but the generated
+ * code updates the @entry of the vCPU executing the block.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+    struct qemu_plugin_tb *tb,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm);
+
 /**
  * qemu_plugin_register_vcpu_insn_exec_cb() - register insn execution cb
  * @insn: the opaque qemu_plugin_insn handle for an instruction
@@ -342,6 +475,23 @@ void qemu_plugin_register_vcpu_insn_exec_inline(struct qemu_plugin_insn *insn,
                                                 enum qemu_plugin_op op,
                                                 void *ptr, uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu() - per-vCPU inline op
+ * @insn: the opaque qemu_plugin_insn handle for an instruction
+ * @op: the type of qemu_plugin_op (e.g. ADD_U64)
+ * @entry: the scoreboard counter to update
+ * @imm: the op data (e.g. 1)
+ *
+ * Like qemu_plugin_register_vcpu_insn_exec_inline(), but the generated
+ * code updates the @entry of the vCPU executing the instruction.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm);
+
 /**
  * qemu_plugin_tb_n_insns() - query helper for number of insns in TB
  * @tb: opaque handle to TB passed to callback
@@ -567,7 +717,90 @@ void qemu_plugin_register_vcpu_mem_inline(struct qemu_plugin_insn *insn,
                                           enum qemu_plugin_op op, void *ptr,
                                           uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_mem_inline_per_vcpu() - per-vCPU inline op
+ * @insn: handle for instruction to instrument
+ * @rw: apply to reads, writes or both
+ * @op: the op, of type qemu_plugin_op
+ * @entry: the scoreboard counter to update
+ * @imm: immediate data for @op
+ *
+ * Like qemu_plugin_register_vcpu_mem_inline(), but the update goes to
+ * the @entry of the vCPU doing the access, which makes it exact with
+ * several vCPUs.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_mem_rw rw,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm);
+
+/**
+ * typedef qemu_plugin_mem_record - one batched memory access
+ * @vaddr: the virtual address of the access
+ * @info: the same handle a memory callback would get
+ * @tag: the value passed to qemu_plugin_register_vcpu_mem_batch() for
+ * the instruction doing the access
+ */
+typedef struct {
+    uint64_t vaddr;
+    qemu_plugin_meminfo_t info;
+    uint32_t tag;
+} qemu_plugin_mem_record;
 
+/**
+ * typedef qemu_plugin_vcpu_mem_batch_cb_t - batched memory callback type
+ * @id: unique plugin id
+ * @vcpu_index: the executing vCPU
+ * @records: the accesses, oldest first
+ * @n: number of @records
+ * @userdata: any user data attached to the callback
+ */
+typedef void (*qemu_plugin_vcpu_mem_batch_cb_t)(
+    qemu_plugin_id_t id, unsigned int vcpu_index,
+    const qemu_plugin_mem_record *records, size_t n, void *userdata);
+
+/**
+ * qemu_plugin_register_vcpu_mem_batch_cb() - receive memory accesses in bulk
+ * @id: plugin ID
+ * @cb: callback of type qemu_plugin_vcpu_mem_batch_cb_t
+ * @entries: how many records to gather before calling @cb
+ * @userdata: opaque pointer for userdata
+ *
+ * Instructions instrumented with qemu_plugin_register_vcpu_mem_batch()
+ * append a record for every access to a buffer of the vCPU from
+ * generated code. @cb gets the buffer once it is about to fill up,
+ * which is checked as a block starts, and whatever is left when the
+ * vCPU exits or QEMU does. The records are only valid during the call.
+ *
+ * @cb only gets the records of instructions the plugin instrumented
+ * itself, with its own @rw filter and tag. Register from
+ * qemu_plugin_install(), before instrumenting; the largest @entries of
+ * all plugins sizes the buffer the vCPU shares between them.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_register_vcpu_mem_batch_cb(qemu_plugin_id_t id,
+                                            qemu_plugin_vcpu_mem_batch_cb_t cb,
+                                            size_t entries, void *userdata);
+
+/**
+ * qemu_plugin_register_vcpu_mem_batch() - record accesses of an instruction
+ * @insn: handle for instruction to instrument
+ * @rw: record reads, writes or both
+ * @tag: value stored in each record, e.g. an index in a plugin table
+ *
+ * Unlike qemu_plugin_register_vcpu_mem_cb() this does not leave the
+ * generated code, the accesses are handed over in batches to the
+ * callback set with qemu_plugin_register_vcpu_mem_batch_cb(). As the
+ * callback runs later, the records cannot be used with
+ * qemu_plugin_get_hwaddr().
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_register_vcpu_mem_batch(struct qemu_plugin_insn *insn,
+                                         enum qemu_plugin_mem_rw rw,
+                                         uint32_t tag);
 
 typedef void
 (*qemu_plugin_vcpu_syscall_cb_t)(qemu_plugin_id_t id, unsigned int vcpu_index,
@@ -708,4 +941,51 @@ uint64_t qemu_plugin_end_code(void);
 QEMU_PLUGIN_API
 uint64_t qemu_plugin_entry_code(void);
 
+/** struct qemu_plugin_register - Opaque handle for register access */
+struct qemu_plugin_register;
+
+/**
+ * typedef qemu_plugin_reg_descriptor - register descriptions
+ *
+ * @handle: opaque handle for retrieving value with qemu_plugin_read_register
+ * @name: register name
+ * @feature: optional feature descriptor, can be NULL
+ */
+typedef struct {
+    struct qemu_plugin_register *handle;
+    const char *name;
+    const char *feature;
+} qemu_plugin_reg_descriptor;
+
+/**
+ * qemu_plugin_get_registers() - return register list for the vCPU
+ *
+ * Returns the registers that have a name in the gdb description of
+ * the guest CPU. The handles can be used with any vCPU of the machine.
+ * Call this from the vcpu_init callback or later, and keep the handles
+ * of the registers of interest. No vCPU exists yet when the plugin is
+ * installed, the array is empty then. The array (but not the names)
+ * should be freed with g_array_free() once done.
+ *
+ * Returns a GArray of qemu_plugin_reg_descriptor.
+ */
+QEMU_PLUGIN_API
+GArray *qemu_plugin_get_registers(void);
+
+/**
+ * qemu_plugin_read_register() - read a register of the current vCPU
+ *
+ * @handle: a handle from qemu_plugin_get_registers()
+ * @buf: A GByteArray for the data owned by the plugin
+ *
+ * The value is appended to @buf in guest byte order. This is only
+ * valid from a tb or insn exec callback registered with
+ * QEMU_PLUGIN_CB_R_REGS, other callbacks may see stale values.
+ *
+ * Returns the size of the read register, 0 or -1 on error.
+ */
+QEMU_PLUGIN_API
+int qemu_plugin_read_register(struct qemu_plugin_register *handle,
+                              GByteArray *buf);
+
 #endif /* QEMU_QEMU_PLUGIN_H */
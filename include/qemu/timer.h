@@ -83,10 +83,12 @@ typedef void QEMUTimerListNotifyCB(void *opaque, QEMUClockType type);
 
 struct QEMUTimer {
     int64_t expire_time;        /* in nanoseconds */
+    int64_t slack;              /* may run this much later, in nanoseconds */
     QEMUTimerList *timer_list;
     QEMUTimerCB *cb;
     void *opaque;
-    QEMUTimer *next;
+    uint64_t seq;               /* keeps timers due together in FIFO order */
+    size_t heap_index;          /* position in timer_list while pending */
     int attributes;
     int scale;
 };
@@ -635,6 +637,19 @@ static inline void timer_free(QEMUTimer *ts)
     }
 }
 
+/**
+ * timer_set_slack_ns:
+ * @ts: the timer
+ * @slack: how late, in nanoseconds, the timer may run
+ *
+ * Let the timer run up to @slack after its expiry time, so that it can
+ * run in the same pass as other timers due around then rather than
+ * waking up the thread that runs them once more. The default of 0
+ * runs the timer as soon as it expires. Takes effect the next time
+ * the timer is modified.
+ */
+void timer_set_slack_ns(QEMUTimer *ts, int64_t slack);
+
 /**
  * timer_mod_ns:
  * @ts: the timer
@@ -755,6 +755,9 @@ void tcg_pool_reset(TCGContext *s);
 TranslationBlock *tcg_tb_alloc(TCGContext *s);
 
 void tcg_region_reset_all(void);
+bool tcg_region_evict_pick(size_t *pidx);
+void tcg_region_tb_foreach(size_t idx, GTraverseFunc func, gpointer user_data);
+void tcg_region_evict(size_t idx);
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
@@ -764,6 +767,7 @@ void tcg_tb_remove(TranslationBlock *tb);
 TranslationBlock *tcg_tb_lookup(uintptr_t tc_ptr);
 void tcg_tb_foreach(GTraverseFunc func, gpointer user_data);
 size_t tcg_nb_tbs(void);
+uint64_t *tcg_tb_exec_count(const TranslationBlock *tb);
 
 /* user-mode: Called with mmap_lock held.  */
 static inline void *tcg_malloc(int size)
@@ -17,6 +17,52 @@
 
 #define OFFSET_OPTION ",offset="
 
+static struct FileOutgoingArgs {
+    char *fname;
+} outgoing_args;
+
+typedef struct FileMapped {
+    dev_t dev;
+    ino_t ino;
+} FileMapped;
+
+/* the files that RAM was mapped from, with x-mapped-ram-mmap */
+static GArray *mapped_files;
+
+void file_add_mapped(int fd)
+{
+    struct stat st;
+    FileMapped m;
+
+    if (fstat(fd, &st) < 0) {
+        return;
+    }
+    if (!mapped_files) {
+        mapped_files = g_array_new(false, false, sizeof(FileMapped));
+    }
+    m.dev = st.st_dev;
+    m.ino = st.st_ino;
+    g_array_append_val(mapped_files, m);
+}
+
+static bool file_is_mapped(const char *filename)
+{
+    struct stat st;
+    guint i;
+
+    if (!mapped_files || stat(filename, &st) < 0) {
+        return false;
+    }
+    for (i = 0; i < mapped_files->len; i++) {
+        FileMapped *m = &g_array_index(mapped_files, FileMapped, i);
+
+        if (m->dev == st.st_dev && m->ino == st.st_ino) {
+            return true;
+        }
+    }
+    return false;
+}
+
 /* Remove the offset option from @filespec and return it in @offsetp. */
 
 int file_parse_offset(char *filespec, uint64_t *offsetp, Error **errp)
@@ -36,6 +82,32 @@ int file_parse_offset(char *filespec, uint64_t *offsetp, Error **errp)
     return 0;
 }
 
+/*
+ * With mapped-ram, each multifd channel opens the file on its own, and
+ * only writes at the offsets of the pages it is given.
+ */
+void file_send_channel_create(QIOTaskFunc f, void *data)
+{
+    QIOChannelFile *ioc;
+    QIOTask *task;
+    Error *err = NULL;
+
+    ioc = qio_channel_file_new_path(outgoing_args.fname, O_WRONLY, 0, &err);
+    task = qio_task_new(OBJECT(ioc), f, data, NULL);
+    if (!ioc) {
+        qio_task_set_error(task, err);
+    }
+    qio_task_complete(task);
+}
+
+int file_send_channel_destroy(QIOChannel *ioc)
+{
+    object_unref(OBJECT(ioc));
+    g_free(outgoing_args.fname);
+    outgoing_args.fname = NULL;
+    return 0;
+}
+
 void file_start_outgoing_migration(MigrationState *s,
                                    FileMigrationArgs *file_args, Error **errp)
 {
@@ -46,12 +118,22 @@ void file_start_outgoing_migration(MigrationState *s,
 
     trace_migration_file_outgoing(filename);
 
+    /* truncating it would take away the pages that were not copied yet */
+    if (file_is_mapped(filename)) {
+        error_setg(errp, "Guest RAM is still mapped from '%s', migrate to "
+                   "another file", filename);
+        return;
+    }
+
     fioc = qio_channel_file_new_path(filename, O_CREAT | O_WRONLY | O_TRUNC,
                                      0600, errp);
     if (!fioc) {
         return;
     }
 
+    g_free(outgoing_args.fname);
+    outgoing_args.fname = g_strdup(filename);
+
     ioc = QIO_CHANNEL(fioc);
     if (offset && qio_channel_io_seek(ioc, offset, SEEK_SET, errp) < 0) {
         return;
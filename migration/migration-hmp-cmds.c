@@ -416,7 +416,8 @@ void hmp_savevm(Monitor *mon, const QDict *qdict)
     Error *err = NULL;
 
     save_snapshot(qdict_get_try_str(qdict, "name"),
-                  true, NULL, false, NULL, &err);
+                  true, NULL, false, NULL,
+                  qdict_get_try_bool(qdict, "incremental", false), &err);
     hmp_handle_error(mon, err);
 }
 
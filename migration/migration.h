@@ -445,6 +445,13 @@ struct MigrationState {
      * Default value is false. (since 8.1)
      */
     bool multifd_flush_after_each_section;
+    /*
+     * With mapped-ram, map the RAM of the incoming side from the
+     * migration file instead of reading it, so that its pages are only
+     * loaded when first touched.  Only RAM that is not shared can be
+     * mapped.
+     */
+    bool mapped_ram_mmap;
     /*
      * This decides the size of guest memory chunk that will be used
      * to track dirty bitmap clearing.  The size of memory chunk will
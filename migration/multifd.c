@@ -21,6 +21,7 @@
 #include "migration.h"
 #include "migration-stats.h"
 #include "socket.h"
+#include "file.h"
 #include "tls.h"
 #include "qemu-file.h"
 #include "trace.h"
@@ -511,6 +512,9 @@ static void multifd_send_terminate_threads(Error *err)
 
 static int multifd_send_channel_destroy(QIOChannel *send)
 {
+    if (migrate_mapped_ram()) {
+        return file_send_channel_destroy(send);
+    }
     return socket_send_channel_destroy(send);
 }
 
@@ -647,6 +651,44 @@ int multifd_send_sync_main(QEMUFile *f)
     return 0;
 }
 
+/*
+ * With mapped-ram, the pages are written straight to their place in the
+ * file, with one write for each run of contiguous pages.
+ */
+static int multifd_send_mapped_ram(MultiFDSendParams *p, Error **errp)
+{
+    MultiFDPages_t *pages = p->pages;
+    RAMBlock *block = pages->block;
+    uint32_t start = 0, i;
+
+    for (i = 1; i <= pages->num; i++) {
+        ram_addr_t offset = pages->offset[start];
+        size_t len;
+        ssize_t ret;
+
+        if (i < pages->num &&
+            pages->offset[i] == pages->offset[i - 1] + p->page_size) {
+            continue;
+        }
+
+        len = (size_t)(i - start) * p->page_size;
+        ret = qio_channel_pwrite(p->c, block->host + offset, len,
+                                 block->pages_offset + offset, errp);
+        if (ret < 0) {
+            return -1;
+        }
+        if ((size_t)ret != len) {
+            error_setg(errp, "multifd %u: short write to the migration file",
+                       p->id);
+            return -1;
+        }
+        start = i;
+    }
+
+    stat64_add(&mig_stats.multifd_bytes, (uint64_t)pages->num * p->page_size);
+    return 0;
+}
+
 static void *multifd_send_thread(void *opaque)
 {
     MultiFDSendParams *p = opaque;
@@ -660,12 +702,15 @@ static void *multifd_send_thread(void *opaque)
     trace_multifd_send_thread_start(p->id);
     rcu_register_thread();
 
-    if (multifd_send_initial_packet(p, &local_err) < 0) {
-        ret = -1;
-        goto out;
+    /* there is nobody to read packets from the file */
+    if (!migrate_mapped_ram()) {
+        if (multifd_send_initial_packet(p, &local_err) < 0) {
+            ret = -1;
+            goto out;
+        }
+        /* initial packet */
+        p->num_packets = 1;
     }
-    /* initial packet */
-    p->num_packets = 1;
 
     while (true) {
         qemu_sem_post(&multifd_send_state->channels_ready);
@@ -676,7 +721,31 @@ static void *multifd_send_thread(void *opaque)
         }
         qemu_mutex_lock(&p->mutex);
 
-        if (p->pending_job) {
+        if (p->pending_job && migrate_mapped_ram()) {
+            uint32_t flags = p->flags;
+
+            p->flags = 0;
+            qemu_mutex_unlock(&p->mutex);
+
+            /* the channel owns p->pages until pending_job drops */
+            if (p->pages->num) {
+                ret = multifd_send_mapped_ram(p, &local_err);
+                if (ret != 0) {
+                    break;
+                }
+                p->total_normal_pages += p->pages->num;
+            }
+
+            qemu_mutex_lock(&p->mutex);
+            p->pages->num = 0;
+            p->pages->block = NULL;
+            p->pending_job--;
+            qemu_mutex_unlock(&p->mutex);
+
+            if (flags & MULTIFD_FLAG_SYNC) {
+                qemu_sem_post(&p->sem_sync);
+            }
+        } else if (p->pending_job) {
             uint64_t packet_num = p->packet_num;
             uint32_t flags;
             p->normal_num = 0;
@@ -897,7 +966,11 @@ static void multifd_new_send_channel_async(QIOTask *task, gpointer opaque)
 
 static void multifd_new_send_channel_create(gpointer opaque)
 {
-    socket_send_channel_create(multifd_new_send_channel_async, opaque);
+    if (migrate_mapped_ram()) {
+        file_send_channel_create(multifd_new_send_channel_async, opaque);
+    } else {
+        socket_send_channel_create(multifd_new_send_channel_async, opaque);
+    }
 }
 
 int multifd_save_setup(Error **errp)
@@ -963,6 +1036,15 @@ int multifd_save_setup(Error **errp)
     return 0;
 }
 
+/*
+ * With mapped-ram, the incoming side reads the pages from the file at
+ * their offsets, and the source opens no channels for them.
+ */
+static bool multifd_recv_uses_channels(void)
+{
+    return migrate_multifd() && !migrate_mapped_ram();
+}
+
 struct {
     MultiFDRecvParams *params;
     /* number of created threads */
@@ -1011,7 +1093,7 @@ static void multifd_recv_terminate_threads(Error *err)
 
 void multifd_load_shutdown(void)
 {
-    if (migrate_multifd()) {
+    if (multifd_recv_uses_channels()) {
         multifd_recv_terminate_threads(NULL);
     }
 }
@@ -1020,7 +1102,7 @@ void multifd_load_cleanup(void)
 {
     int i;
 
-    if (!migrate_multifd()) {
+    if (!multifd_recv_uses_channels()) {
         return;
     }
     multifd_recv_terminate_threads(NULL);
@@ -1067,7 +1149,7 @@ void multifd_recv_sync_main(void)
 {
     int i;
 
-    if (!migrate_multifd()) {
+    if (!multifd_recv_uses_channels()) {
         return;
     }
     for (i = 0; i < migrate_multifd_channels(); i++) {
@@ -1165,7 +1247,7 @@ int multifd_load_setup(Error **errp)
      * Return successfully if multiFD recv state is already initialised
      * or multiFD is not enabled.
      */
-    if (multifd_recv_state || !migrate_multifd()) {
+    if (multifd_recv_state || !multifd_recv_uses_channels()) {
         return 0;
     }
 
@@ -1211,7 +1293,7 @@ bool multifd_recv_all_channels_created(void)
 {
     int thread_count = migrate_multifd_channels();
 
-    if (!migrate_multifd()) {
+    if (!multifd_recv_uses_channels()) {
         return true;
     }
 
@@ -290,6 +290,50 @@ int qemu_fflush(QEMUFile *f)
     return f->last_error;
 }
 
+/*
+ * The position in the underlying file of the next byte to write, or to
+ * read, for the users that place data at fixed offsets besides the
+ * stream.  Returns -1 on error.
+ */
+off_t qemu_get_offset(QEMUFile *f)
+{
+    Error *local_error = NULL;
+    off_t ret;
+
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+    }
+
+    ret = qio_channel_io_seek(f->ioc, 0, SEEK_CUR, &local_error);
+    if (ret < 0) {
+        qemu_file_set_error_obj(f, -EIO, local_error);
+        return -1;
+    }
+
+    if (!qemu_file_is_writable(f)) {
+        /* what was read ahead is still to be read */
+        ret -= f->buf_size - f->buf_index;
+    }
+    return ret;
+}
+
+/* Move the stream to the absolute position @offset of the file */
+void qemu_set_offset(QEMUFile *f, off_t offset)
+{
+    Error *local_error = NULL;
+
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+    } else {
+        f->buf_index = 0;
+        f->buf_size = 0;
+    }
+
+    if (qio_channel_io_seek(f->ioc, offset, SEEK_SET, &local_error) < 0) {
+        qemu_file_set_error_obj(f, -EIO, local_error);
+    }
+}
+
 /*
  * Attempt to fill the buffer from the underlying file
  * Returns the number of bytes read, or negative value for an error.
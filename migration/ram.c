@@ -32,6 +32,8 @@
 #include "qemu/bitmap.h"
 #include "qemu/madvise.h"
 #include "qemu/main-loop.h"
+#include "qemu/units.h"
+#include "io/channel-file.h"
 #include "xbzrle.h"
 #include "ram-compress.h"
 #include "ram.h"
@@ -61,6 +63,7 @@
 #include "sysemu/runstate.h"
 #include "rdma.h"
 #include "options.h"
+#include "file.h"
 #include "sysemu/dirtylimit.h"
 #include "sysemu/kvm.h"
 
@@ -94,6 +97,20 @@
 #define RAM_SAVE_FLAG_MULTIFD_FLUSH    0x200
 /* We can't use any flag that is bigger than 0x200 */
 
+/*
+ * With mapped-ram, the RAMBlock list of the setup stage is followed, for
+ * each block, by a header giving where the bitmap of its pages present in
+ * the file and the pages themselves are.  The pages are not in the stream,
+ * which goes on after them.
+ */
+#define MAPPED_RAM_HDR_VERSION 1
+/* version, page size, bitmap offset and pages offset */
+#define MAPPED_RAM_HDR_SIZE    (4 + 3 * 8)
+/* the pages of each block start at a multiple of this in the file */
+#define MAPPED_RAM_FILE_OFFSET_ALIGNMENT (1 * MiB)
+/* don't start a thread to read less than this */
+#define MAPPED_RAM_READ_MIN_PAGES ((64 * MiB) >> TARGET_PAGE_BITS)
+
 XBZRLECacheStats xbzrle_counters;
 
 /* used by the search for pages to send */
@@ -200,9 +217,15 @@ static bool postcopy_preempt_active(void)
 
 bool migrate_ram_is_ignored(RAMBlock *block)
 {
+    /*
+     * Shared memory that the destination can map again: a named file,
+     * or with x-ignore-shared-fd a memfd that it opens through
+     * /proc/<pid>/fd of the source.
+     */
     return !qemu_ram_is_migratable(block) ||
-           (migrate_ignore_shared() && qemu_ram_is_shared(block)
-                                    && qemu_ram_is_named_file(block));
+           (migrate_ignore_shared() && qemu_ram_is_shared(block) &&
+            (qemu_ram_is_named_file(block) ||
+             (migrate_ignore_shared_fd() && qemu_ram_get_fd(block) >= 0)));
 }
 
 #undef RAMBLOCK_FOREACH
@@ -1127,6 +1150,18 @@ static int save_zero_page(RAMState *rs, PageSearchStatus *pss,
         return 0;
     }
 
+    if (migrate_mapped_ram()) {
+        /*
+         * A page never written to the file is a hole there, which reads
+         * as zeros.  A page that was written has to be written again.
+         */
+        if (test_bit(offset >> TARGET_PAGE_BITS, pss->block->file_bmap)) {
+            return 0;
+        }
+        stat64_add(&mig_stats.zero_pages, 1);
+        return 1;
+    }
+
     len += save_page_header(pss, file, pss->block, offset | RAM_SAVE_FLAG_ZERO);
     qemu_put_byte(file, 0);
     len += 1;
@@ -1174,6 +1209,40 @@ static bool control_save_page(PageSearchStatus *pss,
     return true;
 }
 
+/*
+ * With mapped-ram, write the page at its place in the file
+ *
+ * Returns the number of pages written, or -1 on error.
+ *
+ * @file: the migration file
+ * @block: block that contains the page we want to send
+ * @offset: offset inside the block for the page
+ * @buf: the page to be sent
+ */
+static int save_mapped_ram_page(QEMUFile *file, RAMBlock *block,
+                                ram_addr_t offset, uint8_t *buf)
+{
+    Error *local_err = NULL;
+    ssize_t ret;
+
+    ret = qio_channel_pwrite(qemu_file_get_ioc(file), buf, TARGET_PAGE_SIZE,
+                             block->pages_offset + offset, &local_err);
+    if (ret != TARGET_PAGE_SIZE) {
+        if (!local_err) {
+            error_setg(&local_err, "Short write to the migration file");
+        }
+        qemu_file_set_error_obj(file, -EIO, local_err);
+        return -1;
+    }
+    set_bit(offset >> TARGET_PAGE_BITS, block->file_bmap);
+
+    /* written to the file, if not to its stream */
+    stat64_add(&mig_stats.qemu_file_transferred, TARGET_PAGE_SIZE);
+    ram_transferred_add(TARGET_PAGE_SIZE);
+    stat64_add(&mig_stats.normal_pages, 1);
+    return 1;
+}
+
 /*
  * directly send the page to the stream
  *
@@ -1190,6 +1259,10 @@ static int save_normal_page(PageSearchStatus *pss, RAMBlock *block,
 {
     QEMUFile *file = pss->pss_channel;
 
+    if (migrate_mapped_ram()) {
+        return save_mapped_ram_page(file, block, offset, buf);
+    }
+
     ram_transferred_add(save_page_header(pss, pss->pss_channel, block,
                                          offset | RAM_SAVE_FLAG_PAGE));
     if (async) {
@@ -1253,6 +1326,10 @@ static int ram_save_page(RAMState *rs, PageSearchStatus *pss)
 static int ram_save_multifd_page(QEMUFile *file, RAMBlock *block,
                                  ram_addr_t offset)
 {
+    if (migrate_mapped_ram()) {
+        /* set now rather than by the channel, for save_zero_page() */
+        set_bit(offset >> TARGET_PAGE_BITS, block->file_bmap);
+    }
     if (multifd_queue_page(file, block, offset) < 0) {
         return -1;
     }
@@ -2413,6 +2490,8 @@ static void ram_save_cleanup(void *opaque)
         block->clear_bmap = NULL;
         g_free(block->bmap);
         block->bmap = NULL;
+        g_free(block->file_bmap);
+        block->file_bmap = NULL;
     }
 
     xbzrle_cleanup();
@@ -2747,7 +2826,46 @@ static int ram_state_init(RAMState **rsp)
     return 0;
 }
 
-static void ram_list_init_bitmaps(void)
+/*
+ * Incremental snapshots: the dirty log stays on after a snapshot of the
+ * chain, so that the next one only needs the pages written since.
+ */
+static struct {
+    bool tracking;
+    bool saving;
+    bool incremental;
+} ram_snapshot;
+
+void ram_snapshot_track(bool on)
+{
+    if (on && !ram_snapshot.tracking) {
+        memory_global_dirty_log_start(GLOBAL_DIRTY_SNAPSHOT);
+    } else if (!on && ram_snapshot.tracking) {
+        memory_global_dirty_log_stop(GLOBAL_DIRTY_SNAPSHOT);
+    }
+    ram_snapshot.tracking = on;
+}
+
+bool ram_snapshot_tracking(void)
+{
+    return ram_snapshot.tracking;
+}
+
+/* Saving a snapshot, of the dirty pages only if incremental */
+void ram_snapshot_begin(bool incremental)
+{
+    assert(!incremental || ram_snapshot.tracking);
+    ram_snapshot.saving = true;
+    ram_snapshot.incremental = incremental;
+}
+
+void ram_snapshot_end(void)
+{
+    ram_snapshot.saving = false;
+    ram_snapshot.incremental = false;
+}
+
+static void ram_list_init_bitmaps(bool all)
 {
     MigrationState *ms = migrate_get_current();
     RAMBlock *block;
@@ -2779,7 +2897,9 @@ static void ram_list_init_bitmaps(void)
              * guest memory.
              */
             block->bmap = bitmap_new(pages);
-            bitmap_set(block->bmap, 0, pages);
+            if (all) {
+                bitmap_set(block->bmap, 0, pages);
+            }
             block->clear_bmap_shift = shift;
             block->clear_bmap = bitmap_new(clear_bmap_size(pages, shift));
         }
@@ -2804,7 +2924,14 @@ static void ram_init_bitmaps(RAMState *rs)
     qemu_mutex_lock_ramlist();
 
     WITH_RCU_READ_LOCK_GUARD() {
-        ram_list_init_bitmaps();
+        /*
+         * An incremental snapshot starts from the pages that the dirty
+         * log collected since the previous one.
+         */
+        ram_list_init_bitmaps(!ram_snapshot.incremental);
+        if (ram_snapshot.incremental) {
+            rs->migration_dirty_pages = 0;
+        }
         /* We don't use dirty log with background snapshots */
         if (!migrate_background_snapshot()) {
             memory_global_dirty_log_start(GLOBAL_DIRTY_MIGRATION);
@@ -2932,6 +3059,64 @@ void qemu_guest_free_page_hint(void *addr, size_t len)
  * @f: QEMUFile where to send the data
  * @opaque: RAMState pointer
  */
+/* Bytes of the bitmap of a block in the file, the same on any host */
+static size_t mapped_ram_bitmap_size(RAMBlock *block)
+{
+    return DIV_ROUND_UP(block->used_length >> TARGET_PAGE_BITS, 64) * 8;
+}
+
+static void mapped_ram_setup_ramblock(QEMUFile *f, RAMBlock *block)
+{
+    off_t offset = qemu_get_offset(f);
+
+    if (offset < 0) {
+        return;
+    }
+
+    block->bitmap_offset = offset + MAPPED_RAM_HDR_SIZE;
+    block->pages_offset = ROUND_UP(block->bitmap_offset +
+                                   mapped_ram_bitmap_size(block),
+                                   MAPPED_RAM_FILE_OFFSET_ALIGNMENT);
+
+    qemu_put_be32(f, MAPPED_RAM_HDR_VERSION);
+    qemu_put_be64(f, TARGET_PAGE_SIZE);
+    qemu_put_be64(f, block->bitmap_offset);
+    qemu_put_be64(f, block->pages_offset);
+
+    if (!migrate_ram_is_ignored(block)) {
+        block->file_bmap = bitmap_new(mapped_ram_bitmap_size(block) * 8);
+    }
+
+    /* the stream goes on after the pages */
+    qemu_set_offset(f, block->pages_offset + block->used_length);
+}
+
+/* The bitmaps are written last, once all the pages are in the file */
+static int mapped_ram_write_bitmaps(QEMUFile *f)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+    RAMBlock *block;
+
+    RCU_READ_LOCK_GUARD();
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        size_t size = mapped_ram_bitmap_size(block);
+        g_autofree unsigned long *le = bitmap_new(size * 8);
+        Error *local_err = NULL;
+
+        bitmap_to_le(le, block->file_bmap, size * 8);
+        if (qio_channel_pwrite(ioc, le, size, block->bitmap_offset,
+                               &local_err) != size) {
+            if (!local_err) {
+                error_setg(&local_err, "Short write to the migration file");
+            }
+            qemu_file_set_error_obj(f, -EIO, local_err);
+            return -EIO;
+        }
+    }
+    return 0;
+}
+
 static int ram_save_setup(QEMUFile *f, void *opaque)
 {
     RAMState **rsp = opaque;
@@ -2942,6 +3127,11 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
         return -1;
     }
 
+    /* a migration consumes the dirty log that the chain relies on */
+    if (ram_snapshot.tracking && !ram_snapshot.saving) {
+        ram_snapshot_track(false);
+    }
+
     /* migration has already setup the bitmap, reuse it. */
     if (!migration_in_colo_state()) {
         if (ram_init_all(rsp) != 0) {
@@ -2966,6 +3156,9 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
             if (migrate_ignore_shared()) {
                 qemu_put_be64(f, block->mr->addr);
             }
+            if (migrate_mapped_ram()) {
+                mapped_ram_setup_ramblock(f, block);
+            }
         }
     }
 
@@ -3188,6 +3381,13 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
         return ret;
     }
 
+    if (migrate_mapped_ram()) {
+        ret = mapped_ram_write_bitmaps(f);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
     if (migrate_multifd() && !migrate_multifd_flush_after_each_section()) {
         qemu_put_be64(f, RAM_SAVE_FLAG_MULTIFD_FLUSH);
     }
@@ -3789,6 +3989,219 @@ void colo_flush_ram_cache(void)
     trace_colo_flush_ram_cache_end();
 }
 
+typedef struct MappedRamReader {
+    QemuThread thread;
+    QIOChannel *ioc;
+    RAMBlock *block;
+    unsigned long *bmap;
+    uint64_t pages_offset;
+    /* the range of pages to load */
+    unsigned long start;
+    unsigned long end;
+    Error *err;
+} MappedRamReader;
+
+static bool mapped_ram_read_range(MappedRamReader *r, unsigned long start,
+                                  unsigned long end)
+{
+    ram_addr_t offset = (ram_addr_t)start << TARGET_PAGE_BITS;
+    size_t len = (size_t)(end - start) << TARGET_PAGE_BITS;
+
+    while (len) {
+        ssize_t ret = qio_channel_pread(r->ioc, r->block->host + offset, len,
+                                        r->pages_offset + offset, &r->err);
+        if (ret <= 0) {
+            /* QIO_CHANNEL_ERR_BLOCK does not set an error */
+            if (!r->err) {
+                error_setg(&r->err, "%s reading block %s from the migration "
+                           "file", ret ? "Error" : "Unexpected end",
+                           r->block->idstr);
+            }
+            return false;
+        }
+        offset += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+static void *mapped_ram_read_thread(void *opaque)
+{
+    MappedRamReader *r = opaque;
+    unsigned long set, clear = r->start;
+
+    while (clear < r->end) {
+        set = find_next_bit(r->bmap, r->end, clear);
+        /* not in the file, so zero on the source */
+        for (; clear < set; clear++) {
+            uint8_t *host = r->block->host +
+                            ((ram_addr_t)clear << TARGET_PAGE_BITS);
+
+            if (!buffer_is_zero(host, TARGET_PAGE_SIZE)) {
+                memset(host, 0, TARGET_PAGE_SIZE);
+            }
+        }
+        if (set >= r->end) {
+            break;
+        }
+        clear = find_next_zero_bit(r->bmap, r->end, set);
+        if (!mapped_ram_read_range(r, set, clear)) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Read the pages of @block from the file, split between as many threads
+ * as there are multifd channels.
+ */
+static int mapped_ram_read_pages(QIOChannel *ioc, RAMBlock *block,
+                                 unsigned long *bmap, uint64_t pages_offset)
+{
+    unsigned long num_pages = block->used_length >> TARGET_PAGE_BITS;
+    g_autofree MappedRamReader *readers = NULL;
+    unsigned long chunk;
+    int n = migrate_multifd() ? migrate_multifd_channels() : 1;
+    int i, ret = 0;
+
+    if (!num_pages) {
+        return 0;
+    }
+    n = MIN(n, DIV_ROUND_UP(num_pages, MAPPED_RAM_READ_MIN_PAGES));
+    chunk = DIV_ROUND_UP(num_pages, n);
+
+    readers = g_new0(MappedRamReader, n);
+    for (i = 0; i < n; i++) {
+        MappedRamReader *r = &readers[i];
+
+        r->ioc = ioc;
+        r->block = block;
+        r->bmap = bmap;
+        r->pages_offset = pages_offset;
+        r->start = MIN(i * chunk, num_pages);
+        r->end = MIN(r->start + chunk, num_pages);
+        /* the first range is ours */
+        if (i) {
+            qemu_thread_create(&r->thread, "mapped-ram-load",
+                               mapped_ram_read_thread, r,
+                               QEMU_THREAD_JOINABLE);
+        }
+    }
+
+    mapped_ram_read_thread(&readers[0]);
+    for (i = 1; i < n; i++) {
+        qemu_thread_join(&readers[i].thread);
+    }
+
+    for (i = 0; i < n; i++) {
+        if (readers[i].err) {
+            if (!ret) {
+                error_report_err(readers[i].err);
+                ret = -EIO;
+            } else {
+                error_free(readers[i].err);
+            }
+        }
+    }
+    return ret;
+}
+
+/*
+ * With x-mapped-ram-mmap, map the pages of @block from the file instead of
+ * reading them.  The pages that are not in it are holes, which read as
+ * zeros.  Returns 1 if mapped, 0 if the block has to be read instead, and
+ * a negative value on error.
+ */
+static int mapped_ram_map_pages(QIOChannel *ioc, RAMBlock *block,
+                                uint64_t pages_offset)
+{
+#ifdef CONFIG_POSIX
+    QIOChannelFile *fioc;
+    size_t pagesize = qemu_real_host_page_size();
+
+    fioc = (QIOChannelFile *)object_dynamic_cast(OBJECT(ioc),
+                                                 TYPE_QIO_CHANNEL_FILE);
+    if (!migrate_mapped_ram_mmap() || !fioc || qemu_ram_is_shared(block) ||
+        qemu_ram_get_fd(block) >= 0 ||
+        !QEMU_PTR_IS_ALIGNED(block->host, pagesize) ||
+        !QEMU_IS_ALIGNED(block->used_length, pagesize) ||
+        !QEMU_IS_ALIGNED(pages_offset, pagesize)) {
+        return 0;
+    }
+
+    if (mmap(block->host, block->used_length, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_FIXED, fioc->fd, pages_offset) == MAP_FAILED) {
+        int ret = -errno;
+
+        error_report("Failed to map block %s from the migration file: %s",
+                     block->idstr, strerror(-ret));
+        return ret;
+    }
+    file_add_mapped(fioc->fd);
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+static int parse_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
+                                     ram_addr_t length)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+    size_t size = mapped_ram_bitmap_size(block);
+    g_autofree unsigned long *le = NULL;
+    g_autofree unsigned long *bmap = NULL;
+    uint64_t page_size, bitmap_offset, pages_offset;
+    uint32_t version;
+    Error *local_err = NULL;
+    int ret = 0;
+
+    version = qemu_get_be32(f);
+    page_size = qemu_get_be64(f);
+    bitmap_offset = qemu_get_be64(f);
+    pages_offset = qemu_get_be64(f);
+    if (version != MAPPED_RAM_HDR_VERSION) {
+        error_report("Unsupported mapped-ram version %u for block %s",
+                     version, block->idstr);
+        return -EINVAL;
+    }
+    if (page_size != TARGET_PAGE_SIZE) {
+        error_report("Mismatched mapped-ram page size for block %s: "
+                     "%" PRIu64 " != %d", block->idstr, page_size,
+                     TARGET_PAGE_SIZE);
+        return -EINVAL;
+    }
+
+    if (!migrate_ram_is_ignored(block)) {
+        le = bitmap_new(size * 8);
+        bmap = bitmap_new(size * 8);
+        if (qio_channel_pread(ioc, le, size, bitmap_offset,
+                              &local_err) != size) {
+            if (local_err) {
+                error_report_err(local_err);
+            } else {
+                error_report("Unexpected end of the migration file "
+                             "in the bitmap of block %s", block->idstr);
+            }
+            return -EIO;
+        }
+        bitmap_from_le(bmap, le, size * 8);
+
+        ret = mapped_ram_map_pages(ioc, block, pages_offset);
+        if (!ret) {
+            ret = mapped_ram_read_pages(ioc, block, bmap, pages_offset);
+        }
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    /* the stream goes on after the pages */
+    qemu_set_offset(f, pages_offset + length);
+    return 0;
+}
+
 static int parse_ramblock(QEMUFile *f, RAMBlock *block, ram_addr_t length)
 {
     int ret = 0;
@@ -3832,6 +4245,12 @@ static int parse_ramblock(QEMUFile *f, RAMBlock *block, ram_addr_t length)
             return -EINVAL;
         }
     }
+    if (migrate_mapped_ram()) {
+        ret = parse_ramblock_mapped_ram(f, block, length);
+        if (ret < 0) {
+            return ret;
+        }
+    }
     ret = rdma_block_notification_handle(f, block->idstr);
     if (ret < 0) {
         qemu_file_set_error(f, ret);
@@ -83,6 +83,12 @@ void colo_release_ram_cache(void);
 void colo_incoming_start_dirty_log(void);
 void colo_record_bitmap(RAMBlock *block, ram_addr_t *normal, uint32_t pages);
 
+/* Incremental snapshots */
+void ram_snapshot_track(bool on);
+bool ram_snapshot_tracking(void);
+void ram_snapshot_begin(bool incremental);
+void ram_snapshot_end(void);
+
 /* Background snapshot */
 bool ram_write_tracking_available(void);
 bool ram_write_tracking_compatible(void);
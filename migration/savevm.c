@@ -45,6 +45,7 @@
 #include "qapi/qapi-commands-migration.h"
 #include "qapi/clone-visitor.h"
 #include "qapi/qapi-builtin-visit.h"
+#include "qapi/qmp/qdict.h"
 #include "qapi/qmp/qerror.h"
 #include "qemu/error-report.h"
 #include "sysemu/cpus.h"
@@ -54,6 +55,7 @@
 #include "qemu/iov.h"
 #include "qemu/job.h"
 #include "qemu/main-loop.h"
+#include "block/block.h"
 #include "block/snapshot.h"
 #include "qemu/cutils.h"
 #include "io/channel-buffer.h"
@@ -245,6 +247,7 @@ static bool should_validate_capability(int capability)
     /* Validate only new capabilities to keep compatibility. */
     switch (capability) {
     case MIGRATION_CAPABILITY_X_IGNORE_SHARED:
+    case MIGRATION_CAPABILITY_X_IGNORE_SHARED_FD:
         return true;
     default:
         return false;
@@ -1714,6 +1717,11 @@ static int qemu_savevm_state(QEMUFile *f, Error **errp)
         return -EINVAL;
     }
 
+    if (migrate_mapped_ram()) {
+        error_setg(errp, "Mapped-ram and snapshots are incompatible");
+        return -EINVAL;
+    }
+
     ret = migrate_init(ms, errp);
     if (ret) {
         return ret;
@@ -3039,11 +3047,86 @@ int qemu_loadvm_approve_switchover(void)
     return migrate_send_rp_switchover_ack(mis);
 }
 
+/*
+ * The last snapshot saved or loaded while the dirty log is kept for
+ * incremental snapshots; the next incremental one only saves the pages
+ * written since.
+ */
+static QEMUSnapshotInfo *snapshot_chain_parent;
+
+static void snapshot_chain_set_parent(const QEMUSnapshotInfo *sn)
+{
+    g_free(snapshot_chain_parent);
+    snapshot_chain_parent = NULL;
+    if (sn && ram_snapshot_tracking()) {
+        snapshot_chain_parent = g_memdup2(sn, sizeof(*sn));
+    } else {
+        ram_snapshot_track(false);
+    }
+}
+
+static bool snapshot_is_parent(const QEMUSnapshotInfo *sn,
+                               const QEMUSnapshotInfo *parent)
+{
+    return !strcmp(sn->name, parent->name) &&
+           sn->date_sec == parent->date_sec &&
+           sn->date_nsec == parent->date_nsec &&
+           sn->vm_clock_nsec == parent->vm_clock_nsec;
+}
+
+/* The parent of a new incremental snapshot, if it still exists */
+static QEMUSnapshotInfo *snapshot_chain_find_parent(BlockDriverState *bs)
+{
+    QEMUSnapshotInfo sn;
+
+    if (!snapshot_chain_parent || !ram_snapshot_tracking() ||
+        bdrv_snapshot_find(bs, &sn, snapshot_chain_parent->name) < 0 ||
+        !snapshot_is_parent(&sn, snapshot_chain_parent)) {
+        return NULL;
+    }
+    return snapshot_chain_parent;
+}
+
+/*
+ * The VM state of an incremental snapshot starts with the identity of
+ * its parent, whose RAM has to be loaded first.
+ */
+static void snapshot_put_parent(QEMUFile *f, const QEMUSnapshotInfo *parent)
+{
+    qemu_put_be32(f, QEMU_VM_CHAIN_MAGIC);
+    qemu_put_counted_string(f, parent->name);
+    qemu_put_be64(f, parent->date_sec);
+    qemu_put_be32(f, parent->date_nsec);
+    qemu_put_be64(f, parent->vm_clock_nsec);
+}
+
+/* magic, counted name, date_sec, date_nsec and vm_clock_nsec */
+#define SNAPSHOT_PARENT_MAX_SIZE (4 + 1 + 255 + 8 + 4 + 8)
+
+static bool snapshot_get_parent(QEMUFile *f, QEMUSnapshotInfo *parent)
+{
+    uint8_t *buf;
+
+    if (qemu_peek_buffer(f, &buf, 4, 0) != 4 ||
+        ldl_be_p(buf) != QEMU_VM_CHAIN_MAGIC) {
+        return false;
+    }
+    qemu_get_be32(f);
+    memset(parent, 0, sizeof(*parent));
+    qemu_get_counted_string(f, parent->name);
+    parent->date_sec = qemu_get_be64(f);
+    parent->date_nsec = qemu_get_be32(f);
+    parent->vm_clock_nsec = qemu_get_be64(f);
+    return true;
+}
+
 bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
-                  bool has_devices, strList *devices, Error **errp)
+                   bool has_devices, strList *devices, bool incremental,
+                   Error **errp)
 {
     BlockDriverState *bs;
     QEMUSnapshotInfo sn1, *sn = &sn1;
+    QEMUSnapshotInfo *parent = NULL;
     int ret = -1, ret2;
     QEMUFile *f;
     int saved_vm_running;
@@ -3128,7 +3211,19 @@ bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
         error_setg(errp, "Could not open VM state file");
         goto the_end;
     }
+    if (incremental) {
+        /* the first snapshot of a chain is a full one */
+        parent = snapshot_chain_find_parent(bs);
+        ram_snapshot_track(true);
+    } else {
+        ram_snapshot_track(false);
+    }
+    if (parent) {
+        snapshot_put_parent(f, parent);
+    }
+    ram_snapshot_begin(parent != NULL);
     ret = qemu_savevm_state(f, errp);
+    ram_snapshot_end();
     vm_state_size = qemu_file_transferred(f);
     ret2 = qemu_fclose(f);
     if (ret < 0) {
@@ -3163,6 +3258,8 @@ bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
 
     bdrv_drain_all_end();
 
+    snapshot_chain_set_parent(ret == 0 ? sn : NULL);
+
     if (saved_vm_running) {
         vm_start();
     }
@@ -3251,16 +3348,129 @@ void qmp_xen_load_devices_state(const char *filename, Error **errp)
     migration_incoming_state_destroy();
 }
 
+/* snapshot_get_parent() on the start of a VM state read into @buf */
+static bool snapshot_parse_parent(const uint8_t *buf, size_t len,
+                                  QEMUSnapshotInfo *parent)
+{
+    const uint8_t *p;
+    size_t name_len;
+
+    if (len < 5 || ldl_be_p(buf) != QEMU_VM_CHAIN_MAGIC) {
+        return false;
+    }
+    name_len = buf[4];
+    if (len < 5 + name_len + 8 + 4 + 8) {
+        return false;
+    }
+    memset(parent, 0, sizeof(*parent));
+    memcpy(parent->name, buf + 5, name_len);
+    p = buf + 5 + name_len;
+    parent->date_sec = ldq_be_p(p);
+    parent->date_nsec = ldl_be_p(p + 8);
+    parent->vm_clock_nsec = ldq_be_p(p + 12);
+    return true;
+}
+
+/*
+ * Read the parent of snapshot @name without reverting to it: the
+ * snapshot is loaded into a read-only view of the image instead. Its
+ * metadata and VM state were flushed when it was created and are never
+ * written in place, so the view sees them as @bs does.
+ *
+ * Returns 1 and fills @parent if the snapshot is incremental, 0 if it is
+ * a full one, -1 on error.
+ */
+static int snapshot_read_parent(BlockDriverState *bs, const char *name,
+                                QEMUSnapshotInfo *parent, Error **errp)
+{
+    g_autofree uint8_t *buf = g_malloc0(SNAPSHOT_PARENT_MAX_SIZE);
+    BlockDriverState *view;
+    QDict *opts;
+    int ret;
+
+    opts = qdict_new();
+    qdict_put_str(opts, "driver", bs->drv->format_name);
+    qdict_put_bool(opts, BDRV_OPT_READ_ONLY, true);
+    qdict_put_bool(opts, BDRV_OPT_FORCE_SHARE, true);
+    view = bdrv_open(bs->filename, NULL, opts, BDRV_O_NO_BACKING, errp);
+    if (!view) {
+        return -1;
+    }
+
+    ret = bdrv_snapshot_load_tmp_by_id_or_name(view, name, errp);
+    if (ret >= 0) {
+        ret = bdrv_load_vmstate(view, buf, 0, SNAPSHOT_PARENT_MAX_SIZE);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Could not read the VM state of "
+                             "snapshot '%s'", name);
+        }
+    }
+    bdrv_unref(view);
+    if (ret < 0) {
+        return -1;
+    }
+    return snapshot_parse_parent(buf, ret, parent);
+}
+
+/*
+ * Returns the names of the snapshots to load for @name, starting with
+ * the full one that its chain of incremental snapshots is based on.
+ * The whole chain is checked before anything is reverted.
+ */
+static GSList *snapshot_find_chain(BlockDriverState *bs, const char *name,
+                                   Error **errp)
+{
+    AioContext *aio_context = bdrv_get_aio_context(bs);
+    GSList *chain = g_slist_prepend(NULL, g_strdup(name));
+    QEMUSnapshotInfo sn, parent;
+    int ret;
+
+    for (;;) {
+        ret = snapshot_read_parent(bs, chain->data, &parent, errp);
+        if (ret < 0) {
+            goto fail;
+        }
+        if (!ret) {
+            return chain;
+        }
+
+        aio_context_acquire(aio_context);
+        ret = bdrv_snapshot_find(bs, &sn, parent.name);
+        aio_context_release(aio_context);
+        if (ret < 0 || !snapshot_is_parent(&sn, &parent)) {
+            error_setg(errp, "Snapshot '%s' is based on snapshot '%s', "
+                       "which no longer exists", (char *)chain->data,
+                       parent.name);
+            goto fail;
+        }
+        if (g_slist_find_custom(chain, parent.name, (GCompareFunc)strcmp)) {
+            error_setg(errp, "Snapshot '%s' is based on itself", parent.name);
+            goto fail;
+        }
+        chain = g_slist_prepend(chain, g_strdup(parent.name));
+    }
+
+fail:
+    g_slist_free_full(chain, g_free);
+    return NULL;
+}
+
 bool load_snapshot(const char *name, const char *vmstate,
                    bool has_devices, strList *devices, Error **errp)
 {
     BlockDriverState *bs_vm_state;
-    QEMUSnapshotInfo sn;
+    QEMUSnapshotInfo sn, parent;
+    GSList *chain = NULL, *l;
     QEMUFile *f;
     int ret;
     AioContext *aio_context;
     MigrationIncomingState *mis = migration_incoming_get_current();
 
+    if (migrate_mapped_ram()) {
+        error_setg(errp, "Mapped-ram and snapshots are incompatible");
+        return false;
+    }
+
     if (!bdrv_all_can_snapshot(has_devices, devices, errp)) {
         return false;
     }
@@ -3301,41 +3511,55 @@ bool load_snapshot(const char *name, const char *vmstate,
     /* Flush all IO requests so they don't interfere with the new state.  */
     bdrv_drain_all_begin();
 
-    ret = bdrv_all_goto_snapshot(name, has_devices, devices, errp);
-    if (ret < 0) {
+    chain = snapshot_find_chain(bs_vm_state, name, errp);
+    if (!chain) {
         goto err_drain;
     }
 
-    /* restore the VM state */
-    f = qemu_fopen_bdrv(bs_vm_state, 0);
-    if (!f) {
-        error_setg(errp, "Could not open VM state file");
-        goto err_drain;
-    }
+    /* an incremental snapshot is loaded on top of its ancestors */
+    for (l = chain; l; l = l->next) {
+        ret = bdrv_all_goto_snapshot(l->data, has_devices, devices, errp);
+        if (ret < 0) {
+            goto err_drain;
+        }
 
-    qemu_system_reset(SHUTDOWN_CAUSE_SNAPSHOT_LOAD);
-    mis->from_src_file = f;
+        /* restore the VM state */
+        f = qemu_fopen_bdrv(bs_vm_state, 0);
+        if (!f) {
+            error_setg(errp, "Could not open VM state file");
+            goto err_drain;
+        }
+        snapshot_get_parent(f, &parent);
 
-    if (!yank_register_instance(MIGRATION_YANK_INSTANCE, errp)) {
-        ret = -EINVAL;
-        goto err_drain;
-    }
-    aio_context_acquire(aio_context);
-    ret = qemu_loadvm_state(f);
-    migration_incoming_state_destroy();
-    aio_context_release(aio_context);
+        if (l == chain) {
+            qemu_system_reset(SHUTDOWN_CAUSE_SNAPSHOT_LOAD);
+        }
+        mis->from_src_file = f;
 
-    bdrv_drain_all_end();
+        if (!yank_register_instance(MIGRATION_YANK_INSTANCE, errp)) {
+            ret = -EINVAL;
+            goto err_drain;
+        }
+        aio_context_acquire(aio_context);
+        ret = qemu_loadvm_state(f);
+        migration_incoming_state_destroy();
+        aio_context_release(aio_context);
 
-    if (ret < 0) {
-        error_setg(errp, "Error %d while loading VM state", ret);
-        return false;
+        if (ret < 0) {
+            error_setg(errp, "Error %d while loading VM state", ret);
+            goto err_drain;
+        }
     }
 
+    bdrv_drain_all_end();
+    g_slist_free_full(chain, g_free);
+    snapshot_chain_set_parent(&sn);
     return true;
 
 err_drain:
     bdrv_drain_all_end();
+    g_slist_free_full(chain, g_free);
+    snapshot_chain_set_parent(NULL);
     return false;
 }
 
@@ -3428,7 +3652,7 @@ static void snapshot_save_job_bh(void *opaque)
 
     job_progress_set_remaining(&s->common, 1);
     s->ret = save_snapshot(s->tag, false, s->vmstate,
-                           true, s->devices, s->errp);
+                           true, s->devices, false, s->errp);
     job_progress_update(&s->common, 1);
 
     qmp_snapshot_job_free(s);
@@ -17,6 +17,8 @@
 #define QEMU_VM_FILE_MAGIC           0x5145564d
 #define QEMU_VM_FILE_VERSION_COMPAT  0x00000002
 #define QEMU_VM_FILE_VERSION         0x00000003
+/* starts the VM state of an incremental snapshot, "QEVC" */
+#define QEMU_VM_CHAIN_MAGIC          0x51455643
 
 #define QEMU_VM_EOF                  0x00
 #define QEMU_VM_SECTION_START        0x01
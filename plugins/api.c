@@ -41,6 +41,7 @@
 #include "exec/exec-all.h"
 #include "exec/ram_addr.h"
 #include "disas/disas.h"
+#include "exec/gdbstub.h"
 #include "plugin.h"
 #ifndef CONFIG_USER_ONLY
 #include "qemu/plugin-memory.h"
@@ -52,6 +53,16 @@
 #endif
 #endif
 
+/*
+ * Callbacks that read registers are kept apart, so that only they make
+ * the generated code sync the guest state before calling out.
+ */
+static enum plugin_dyn_cb_subtype cb_subtype(enum qemu_plugin_cb_flags flags)
+{
+    return flags == QEMU_PLUGIN_CB_NO_REGS ?
+        PLUGIN_CB_REGULAR : PLUGIN_CB_REGULAR_R;
+}
+
 /* Uninstall and Reset handlers */
 
 void qemu_plugin_uninstall(qemu_plugin_id_t id, qemu_plugin_simple_cb_t cb)
@@ -89,7 +100,7 @@ void qemu_plugin_register_vcpu_tb_exec_cb(struct qemu_plugin_tb *tb,
                                           void *udata)
 {
     if (!tb->mem_only) {
-        plugin_register_dyn_cb__udata(&tb->cbs[PLUGIN_CB_REGULAR],
+        plugin_register_dyn_cb__udata(&tb->cbs[cb_subtype(flags)],
                                       cb, flags, udata);
     }
 }
@@ -103,14 +114,26 @@ void qemu_plugin_register_vcpu_tb_exec_inline(struct qemu_plugin_tb *tb,
     }
 }
 
+void qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+    struct qemu_plugin_tb *tb,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm)
+{
+    if (!tb->mem_only) {
+        plugin_register_inline_op_on_entry(&tb->cbs[PLUGIN_CB_INLINE],
+                                           0, op, entry, imm);
+    }
+}
+
 void qemu_plugin_register_vcpu_insn_exec_cb(struct qemu_plugin_insn *insn,
                                             qemu_plugin_vcpu_udata_cb_t cb,
                                             enum qemu_plugin_cb_flags flags,
                                             void *udata)
 {
     if (!insn->mem_only) {
-        plugin_register_dyn_cb__udata(&insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_REGULAR],
-                                      cb, flags, udata);
+        plugin_register_dyn_cb__udata(
+            &insn->cbs[PLUGIN_CB_INSN][cb_subtype(flags)], cb, flags, udata);
     }
 }
 
@@ -124,6 +147,18 @@ void qemu_plugin_register_vcpu_insn_exec_inline(struct qemu_plugin_insn *insn,
     }
 }
 
+void qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm)
+{
+    if (!insn->mem_only) {
+        plugin_register_inline_op_on_entry(
+            &insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_INLINE], 0, op, entry, imm);
+    }
+}
+
 
 /*
  * We always plant memory instrumentation because they don't finalise until
@@ -148,6 +183,32 @@ void qemu_plugin_register_vcpu_mem_inline(struct qemu_plugin_insn *insn,
                               rw, op, ptr, imm);
 }
 
+void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_mem_rw rw,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm)
+{
+    plugin_register_inline_op_on_entry(
+        &insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_INLINE], rw, op, entry, imm);
+}
+
+void qemu_plugin_register_vcpu_mem_batch(struct qemu_plugin_insn *insn,
+                                         enum qemu_plugin_mem_rw rw,
+                                         uint32_t tag)
+{
+    plugin_register_vcpu_mem_batch(
+        &insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_BATCH], rw, tag);
+}
+
+void qemu_plugin_register_vcpu_mem_batch_cb(qemu_plugin_id_t id,
+                                            qemu_plugin_vcpu_mem_batch_cb_t cb,
+                                            size_t entries, void *userdata)
+{
+    plugin_register_mem_batch_cb(id, cb, entries, userdata);
+}
+
 void qemu_plugin_register_vcpu_tb_trans_cb(qemu_plugin_id_t id,
                                            qemu_plugin_vcpu_tb_trans_cb_t cb)
 {
@@ -372,6 +433,68 @@ int qemu_plugin_n_max_vcpus(void)
 #endif
 }
 
+int qemu_plugin_num_vcpus(void)
+{
+    return plugin_num_vcpus();
+}
+
+/*
+ * Scoreboards
+ */
+
+struct qemu_plugin_scoreboard *qemu_plugin_scoreboard_new(size_t element_size)
+{
+    return plugin_scoreboard_new(element_size);
+}
+
+void qemu_plugin_scoreboard_free(struct qemu_plugin_scoreboard *score)
+{
+    plugin_scoreboard_free(score);
+}
+
+void *qemu_plugin_scoreboard_find(struct qemu_plugin_scoreboard *score,
+                                  unsigned int vcpu_index)
+{
+    /* the entry size is not known statically, so no g_array_index */
+    char *base_ptr = score->data->data;
+
+    g_assert(vcpu_index < qemu_plugin_num_vcpus());
+    return base_ptr + vcpu_index * g_array_get_element_size(score->data);
+}
+
+static uint64_t *plugin_u64_address(qemu_plugin_u64 entry,
+                                    unsigned int vcpu_index)
+{
+    char *ptr = qemu_plugin_scoreboard_find(entry.score, vcpu_index);
+    return (uint64_t *)(ptr + entry.offset);
+}
+
+void qemu_plugin_u64_add(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t added)
+{
+    *plugin_u64_address(entry, vcpu_index) += added;
+}
+
+uint64_t qemu_plugin_u64_get(qemu_plugin_u64 entry, unsigned int vcpu_index)
+{
+    return *plugin_u64_address(entry, vcpu_index);
+}
+
+void qemu_plugin_u64_set(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t val)
+{
+    *plugin_u64_address(entry, vcpu_index) = val;
+}
+
+uint64_t qemu_plugin_u64_sum(qemu_plugin_u64 entry)
+{
+    uint64_t total = 0;
+    for (int i = 0, n = qemu_plugin_num_vcpus(); i < n; ++i) {
+        total += qemu_plugin_u64_get(entry, i);
+    }
+    return total;
+}
+
 /*
  * Plugin output
  */
@@ -427,3 +550,42 @@ uint64_t qemu_plugin_entry_code(void)
 #endif
     return entry;
 }
+
+/*
+ * Register handles are the gdb register number plus one, so that no
+ * valid handle is NULL.
+ */
+GArray *qemu_plugin_get_registers(void)
+{
+    /* vCPUs are initialised from the main thread, they all look alike */
+    CPUState *cpu = current_cpu ? current_cpu : first_cpu;
+    g_autoptr(GArray) regs = NULL;
+    GArray *descs;
+
+    if (!cpu) {
+        /* called at install time, before any vCPU */
+        return g_array_new(false, false, sizeof(qemu_plugin_reg_descriptor));
+    }
+    regs = gdb_get_register_list(cpu);
+    descs = g_array_sized_new(false, false,
+                              sizeof(qemu_plugin_reg_descriptor), regs->len);
+    for (guint i = 0; i < regs->len; i++) {
+        GDBRegDesc *reg = &g_array_index(regs, GDBRegDesc, i);
+        qemu_plugin_reg_descriptor desc = {
+            .handle = GINT_TO_POINTER(reg->gdb_reg + 1),
+            .name = reg->name,
+            .feature = reg->feature_name,
+        };
+        g_array_append_val(descs, desc);
+    }
+    return descs;
+}
+
+int qemu_plugin_read_register(struct qemu_plugin_register *reg,
+                              GByteArray *buf)
+{
+    if (!current_cpu || !reg) {
+        return -1;
+    }
+    return gdb_read_register(current_cpu, buf, GPOINTER_TO_INT(reg) - 1);
+}
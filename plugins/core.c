@@ -209,11 +209,23 @@ plugin_register_cb_udata(qemu_plugin_id_t id, enum qemu_plugin_event ev,
     do_plugin_register_cb(id, ev, func, udata);
 }
 
-void qemu_plugin_vcpu_init_hook(CPUState *cpu)
+/* Scoreboard size that has room for @cpu, sizes double to keep growth rare */
+static size_t plugin_scoreboard_size_for__locked(CPUState *cpu)
+{
+    size_t size = plugin.scoreboard_alloc_size;
+
+    while (cpu->cpu_index >= size) {
+        size *= 2;
+    }
+    return size;
+}
+
+static void plugin_vcpu_init(CPUState *cpu)
 {
     bool success;
 
     qemu_rec_mutex_lock(&plugin.lock);
+    qatomic_set(&plugin.num_vcpus, MAX(plugin.num_vcpus, cpu->cpu_index + 1));
     plugin_cpu_update__locked(&cpu->cpu_index, NULL, NULL);
     success = g_hash_table_insert(plugin.cpu_ht, &cpu->cpu_index,
                                   &cpu->cpu_index);
@@ -223,10 +235,153 @@ void qemu_plugin_vcpu_init_hook(CPUState *cpu)
     plugin_vcpu_cb__simple(cpu, QEMU_PLUGIN_EV_VCPU_INIT);
 }
 
+/*
+ * Make room in every scoreboard for @cpu. Generated code has the
+ * scoreboard addresses baked in, so moving them means that no vCPU may
+ * run and that the code cache must be flushed. Safe work gives both:
+ * tb_flush() is immediate there.
+ */
+static void plugin_vcpu_init__safe(CPUState *cpu, run_on_cpu_data unused)
+{
+    struct qemu_plugin_scoreboard *score;
+    size_t size;
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    size = plugin_scoreboard_size_for__locked(cpu);
+    /* another vCPU may have grown them in the meantime */
+    if (size > plugin.scoreboard_alloc_size) {
+        QLIST_FOREACH(score, &plugin.scoreboards, entry) {
+            g_array_set_size(score->data, size);
+        }
+        plugin.scoreboard_alloc_size = size;
+        tb_flush(cpu);
+    }
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    plugin_vcpu_init(cpu);
+}
+
+void qemu_plugin_vcpu_init_hook(CPUState *cpu)
+{
+    size_t size;
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    size = plugin_scoreboard_size_for__locked(cpu);
+    if (size > plugin.scoreboard_alloc_size) {
+        if (!QLIST_EMPTY(&plugin.scoreboards)) {
+            /*
+             * This runs from realize, on the main thread when hotplugging.
+             * The new vCPU runs its queued work before any TB, so it does
+             * not use the scoreboards before they are grown.
+             */
+            qemu_rec_mutex_unlock(&plugin.lock);
+            async_safe_run_on_cpu(cpu, plugin_vcpu_init__safe,
+                                  RUN_ON_CPU_NULL);
+            return;
+        }
+        plugin.scoreboard_alloc_size = size;
+    }
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    plugin_vcpu_init(cpu);
+}
+
+/*
+ * Disable CFI checks.
+ * The callback function has been loaded from an external library so we do not
+ * have type information
+ */
+QEMU_DISABLE_CFI
+static void plugin_mem_batch_flush(CPUState *cpu)
+{
+    struct qemu_plugin_mem_batch *batch = cpu->plugin_mem_batch;
+    enum qemu_plugin_event ev = QEMU_PLUGIN_EV_VCPU_MEM_BATCH;
+    struct qemu_plugin_cb *cb, *next;
+
+    if (!batch || !batch->n) {
+        return;
+    }
+    QLIST_FOREACH_SAFE_RCU(cb, &plugin.cb_lists[ev], entry, next) {
+        qemu_plugin_vcpu_mem_batch_cb_t func = cb->f.vcpu_mem_batch;
+        uint32_t owner = cb->ctx->batch_owner;
+        size_t i, n = 0;
+
+        for (i = 0; i < batch->n; i++) {
+            if (batch->rec[i].owner == owner) {
+                batch->out[n++] = batch->rec[i].rec;
+            }
+        }
+        if (n) {
+            func(cb->ctx->id, cpu->cpu_index, batch->out, n, cb->udata);
+        }
+    }
+    batch->n = 0;
+}
+
+/*
+ * Called from the start of every TB that records accesses, with the
+ * number of records it can append. Flush now if they might not fit,
+ * and allocate or grow the buffer as needed: generated code reloads
+ * its address before each record.
+ */
+void qemu_plugin_mem_batch_reserve(CPUState *cpu, uint32_t n)
+{
+    struct qemu_plugin_mem_batch *batch = cpu->plugin_mem_batch;
+    size_t size = qatomic_read(&plugin.mem_batch_size);
+
+    if (batch && batch->n + n > batch->size) {
+        plugin_mem_batch_flush(cpu);
+    }
+    if (!batch || batch->size < MAX(size, n + 1)) {
+        size = MAX(size, n + 1);
+        plugin_mem_batch_flush(cpu);
+        if (batch) {
+            g_free(batch->out);
+        }
+        batch = g_realloc(batch, sizeof(*batch) +
+                          size * sizeof(struct qemu_plugin_mem_batch_rec));
+        batch->n = 0;
+        batch->size = size;
+        batch->out = g_new(qemu_plugin_mem_record, size);
+        cpu->plugin_mem_batch = batch;
+    }
+    batch->reserve = n;
+}
+
+/* accesses from helpers, which are not covered by the TB's reservation */
+static void plugin_mem_batch_append(CPUState *cpu, uint64_t vaddr,
+                                    qemu_plugin_meminfo_t info, uint32_t tag,
+                                    uint32_t owner)
+{
+    struct qemu_plugin_mem_batch *batch = cpu->plugin_mem_batch;
+    struct qemu_plugin_mem_batch_rec *rec;
+
+    if (!batch) {
+        /* no TB recording inline accesses has run yet */
+        qemu_plugin_mem_batch_reserve(cpu, 0);
+        batch = cpu->plugin_mem_batch;
+    }
+    if (batch->n + 1 + batch->reserve > batch->size) {
+        plugin_mem_batch_flush(cpu);
+    }
+    rec = &batch->rec[batch->n++];
+    rec->rec.vaddr = vaddr;
+    rec->rec.info = info;
+    rec->rec.tag = tag;
+    rec->owner = owner;
+}
+
 void qemu_plugin_vcpu_exit_hook(CPUState *cpu)
 {
     bool success;
 
+    plugin_mem_batch_flush(cpu);
+    if (cpu->plugin_mem_batch) {
+        g_free(cpu->plugin_mem_batch->out);
+    }
+    g_free(cpu->plugin_mem_batch);
+    cpu->plugin_mem_batch = NULL;
+
     plugin_vcpu_cb__simple(cpu, QEMU_PLUGIN_EV_VCPU_EXIT);
 
     qemu_rec_mutex_lock(&plugin.lock);
@@ -266,6 +421,7 @@ void qemu_plugin_vcpu_for_each(qemu_plugin_id_t id,
 /* Allocate and return a callback record */
 static struct qemu_plugin_dyn_cb *plugin_get_dyn_cb(GArray **arr)
 {
+    struct qemu_plugin_dyn_cb *dyn_cb;
     GArray *cbs = *arr;
 
     if (!cbs) {
@@ -274,8 +430,11 @@ static struct qemu_plugin_dyn_cb *plugin_get_dyn_cb(GArray **arr)
         *arr = cbs;
     }
 
+    /* the array is reused across TBs, don't leave stale fields behind */
     g_array_set_size(cbs, cbs->len + 1);
-    return &g_array_index(cbs, struct qemu_plugin_dyn_cb, cbs->len - 1);
+    dyn_cb = &g_array_index(cbs, struct qemu_plugin_dyn_cb, cbs->len - 1);
+    memset(dyn_cb, 0, sizeof(*dyn_cb));
+    return dyn_cb;
 }
 
 void plugin_register_inline_op(GArray **arr,
@@ -293,6 +452,23 @@ void plugin_register_inline_op(GArray **arr,
     dyn_cb->inline_insn.imm = imm;
 }
 
+void plugin_register_inline_op_on_entry(GArray **arr,
+                                        enum qemu_plugin_mem_rw rw,
+                                        enum qemu_plugin_op op,
+                                        qemu_plugin_u64 entry,
+                                        uint64_t imm)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb;
+
+    dyn_cb = plugin_get_dyn_cb(arr);
+    dyn_cb->userp = NULL;
+    dyn_cb->type = PLUGIN_CB_INLINE;
+    dyn_cb->rw = rw;
+    dyn_cb->inline_insn.entry = entry;
+    dyn_cb->inline_insn.op = op;
+    dyn_cb->inline_insn.imm = imm;
+}
+
 void plugin_register_dyn_cb__udata(GArray **arr,
                                    qemu_plugin_vcpu_udata_cb_t cb,
                                    enum qemu_plugin_cb_flags flags,
@@ -301,9 +477,9 @@ void plugin_register_dyn_cb__udata(GArray **arr,
     struct qemu_plugin_dyn_cb *dyn_cb = plugin_get_dyn_cb(arr);
 
     dyn_cb->userp = udata;
-    /* Note flags are discarded as unused. */
     dyn_cb->f.vcpu_udata = cb;
-    dyn_cb->type = PLUGIN_CB_REGULAR;
+    dyn_cb->type = flags == QEMU_PLUGIN_CB_NO_REGS ?
+        PLUGIN_CB_REGULAR : PLUGIN_CB_REGULAR_R;
 }
 
 void plugin_register_vcpu_mem_cb(GArray **arr,
@@ -322,6 +498,57 @@ void plugin_register_vcpu_mem_cb(GArray **arr,
     dyn_cb->f.generic = cb;
 }
 
+/* the plugin whose tb_trans callback runs on this thread */
+static __thread struct qemu_plugin_ctx *tb_trans_ctx;
+
+void plugin_register_vcpu_mem_batch(GArray **arr,
+                                    enum qemu_plugin_mem_rw rw,
+                                    uint32_t tag)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb;
+    uint32_t owner;
+    guint i;
+
+    /* nobody would get the records */
+    if (!tb_trans_ctx || !tb_trans_ctx->batch_owner) {
+        return;
+    }
+    owner = tb_trans_ctx->batch_owner;
+
+    /* each plugin gets records of its own, with its rw filter and tag */
+    for (i = 0; *arr && i < (*arr)->len; i++) {
+        dyn_cb = &g_array_index(*arr, struct qemu_plugin_dyn_cb, i);
+        if (dyn_cb->batch.owner == owner) {
+            dyn_cb->rw |= rw;
+            dyn_cb->batch.tag = tag;
+            return;
+        }
+    }
+    dyn_cb = plugin_get_dyn_cb(arr);
+    dyn_cb->userp = NULL;
+    dyn_cb->type = PLUGIN_CB_BATCH;
+    dyn_cb->rw = rw;
+    dyn_cb->batch.tag = tag;
+    dyn_cb->batch.owner = owner;
+}
+
+void plugin_register_mem_batch_cb(qemu_plugin_id_t id, void *cb,
+                                  size_t entries, void *udata)
+{
+    entries = MIN(MAX(entries, 1), UINT32_MAX / 2);
+    WITH_QEMU_LOCK_GUARD(&plugin.lock) {
+        struct qemu_plugin_ctx *ctx = plugin_id_to_ctx_locked(id);
+
+        if (!ctx->batch_owner) {
+            ctx->batch_owner = ++plugin.n_batch_owners;
+        }
+        if (entries > plugin.mem_batch_size) {
+            qatomic_set(&plugin.mem_batch_size, entries);
+        }
+    }
+    do_plugin_register_cb(id, QEMU_PLUGIN_EV_VCPU_MEM_BATCH, cb, udata);
+}
+
 /*
  * Disable CFI checks.
  * The callback function has been loaded from an external library so we do not
@@ -338,8 +565,10 @@ void qemu_plugin_tb_trans_cb(CPUState *cpu, struct qemu_plugin_tb *tb)
     QLIST_FOREACH_SAFE_RCU(cb, &plugin.cb_lists[ev], entry, next) {
         qemu_plugin_vcpu_tb_trans_cb_t func = cb->f.vcpu_tb_trans;
 
+        tb_trans_ctx = cb->ctx;
         func(cb->ctx->id, tb);
     }
+    tb_trans_ctx = NULL;
 }
 
 /*
@@ -431,9 +660,11 @@ void qemu_plugin_flush_cb(void)
     plugin_cb__simple(QEMU_PLUGIN_EV_FLUSH);
 }
 
-void exec_inline_op(struct qemu_plugin_dyn_cb *cb)
+void exec_inline_op(struct qemu_plugin_dyn_cb *cb, int cpu_index)
 {
-    uint64_t *val = cb->userp;
+    size_t stride;
+    char *base = qemu_plugin_inline_base(cb, &stride);
+    uint64_t *val = (uint64_t *)(base + cpu_index * stride);
 
     switch (cb->inline_insn.op) {
     case QEMU_PLUGIN_INLINE_ADD_U64:
@@ -458,7 +689,7 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
             &g_array_index(arr, struct qemu_plugin_dyn_cb, i);
 
         if (!(rw & cb->rw)) {
-                break;
+            continue;
         }
         switch (cb->type) {
         case PLUGIN_CB_REGULAR:
@@ -466,7 +697,11 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                            vaddr, cb->userp);
             break;
         case PLUGIN_CB_INLINE:
-            exec_inline_op(cb);
+            exec_inline_op(cb, cpu->cpu_index);
+            break;
+        case PLUGIN_CB_BATCH:
+            plugin_mem_batch_append(cpu, vaddr, make_plugin_meminfo(oi, rw),
+                                    cb->batch.tag, cb->batch.owner);
             break;
         default:
             g_assert_not_reached();
@@ -476,6 +711,11 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
 
 void qemu_plugin_atexit_cb(void)
 {
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        plugin_mem_batch_flush(cpu);
+    }
     plugin_cb__udata(QEMU_PLUGIN_EV_ATEXIT);
 }
 
@@ -509,6 +749,11 @@ void qemu_plugin_user_exit(void)
      */
     start_exclusive();
 
+    /* hand over the last batched accesses while the callbacks are there */
+    CPU_FOREACH(cpu) {
+        plugin_mem_batch_flush(cpu);
+    }
+
     qemu_rec_mutex_lock(&plugin.lock);
     /* un-register all callbacks except the final AT_EXIT one */
     for (ev = 0; ev < QEMU_PLUGIN_EV_MAX; ev++) {
@@ -551,6 +796,36 @@ void qemu_plugin_user_postfork(bool is_child)
     }
 }
 
+int plugin_num_vcpus(void)
+{
+    return qatomic_read(&plugin.num_vcpus);
+}
+
+struct qemu_plugin_scoreboard *plugin_scoreboard_new(size_t element_size)
+{
+    struct qemu_plugin_scoreboard *score =
+        g_new0(struct qemu_plugin_scoreboard, 1);
+
+    score->data = g_array_new(false, true, element_size);
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    g_array_set_size(score->data, plugin.scoreboard_alloc_size);
+    QLIST_INSERT_HEAD(&plugin.scoreboards, score, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    return score;
+}
+
+void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score)
+{
+    qemu_rec_mutex_lock(&plugin.lock);
+    QLIST_REMOVE(score, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    g_array_free(score->data, true);
+    g_free(score);
+}
+
 static bool plugin_dyn_cb_arr_cmp(const void *ap, const void *bp)
 {
     return ap == bp;
@@ -567,6 +842,8 @@ static void __attribute__((__constructor__)) plugin_init(void)
     plugin.id_ht = g_hash_table_new(g_int64_hash, g_int64_equal);
     plugin.cpu_ht = g_hash_table_new(g_int_hash, g_int_equal);
     QTAILQ_INIT(&plugin.ctxs);
+    QLIST_INIT(&plugin.scoreboards);
+    plugin.scoreboard_alloc_size = 16; /* avoid frequent reallocation */
     qht_init(&plugin.dyn_cb_arr_ht, plugin_dyn_cb_arr_cmp, 16,
              QHT_MODE_AUTO_RESIZE);
     atexit(qemu_plugin_atexit_cb);
@@ -44,6 +44,16 @@ struct qemu_plugin_state {
      * the code cache is flushed.
      */
     struct qht dyn_cb_arr_ht;
+    /* all scoreboards, resized together as vCPUs are created */
+    QLIST_HEAD(, qemu_plugin_scoreboard) scoreboards;
+    /* number of entries allocated in every scoreboard */
+    size_t scoreboard_alloc_size;
+    /* highest vCPU index created so far, plus one */
+    int num_vcpus;
+    /* records per vCPU to gather before calling the mem batch callbacks */
+    size_t mem_batch_size;
+    /* plugins with a mem batch callback, see qemu_plugin_ctx.batch_owner */
+    uint32_t n_batch_owners;
 };
 
 
@@ -60,6 +70,8 @@ struct qemu_plugin_ctx {
     bool installing;
     bool uninstalling;
     bool resetting;
+    /* tells its mem batch records from those of other plugins, or 0 */
+    uint32_t batch_owner;
 };
 
 struct qemu_plugin_ctx *plugin_id_to_ctx_locked(qemu_plugin_id_t id);
@@ -69,6 +81,12 @@ void plugin_register_inline_op(GArray **arr,
                                enum qemu_plugin_op op, void *ptr,
                                uint64_t imm);
 
+void plugin_register_inline_op_on_entry(GArray **arr,
+                                        enum qemu_plugin_mem_rw rw,
+                                        enum qemu_plugin_op op,
+                                        qemu_plugin_u64 entry,
+                                        uint64_t imm);
+
 void plugin_reset_uninstall(qemu_plugin_id_t id,
                             qemu_plugin_simple_cb_t cb,
                             bool reset);
@@ -95,6 +113,19 @@ void plugin_register_vcpu_mem_cb(GArray **arr,
                                  enum qemu_plugin_mem_rw rw,
                                  void *udata);
 
-void exec_inline_op(struct qemu_plugin_dyn_cb *cb);
+void plugin_register_vcpu_mem_batch(GArray **arr,
+                                    enum qemu_plugin_mem_rw rw,
+                                    uint32_t tag);
+
+void plugin_register_mem_batch_cb(qemu_plugin_id_t id, void *cb,
+                                  size_t entries, void *udata);
+
+void exec_inline_op(struct qemu_plugin_dyn_cb *cb, int cpu_index);
+
+int plugin_num_vcpus(void);
+
+struct qemu_plugin_scoreboard *plugin_scoreboard_new(size_t element_size);
+
+void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score);
 
 #endif /* PLUGIN_H */
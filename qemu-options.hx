@@ -182,9 +182,11 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                igd-passthru=on|off (enable Xen integrated Intel graphics passthrough, default=off)\n"
     "                kernel-irqchip=on|off|split controls accelerated irqchip support (default=on)\n"
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
+    "                hot-blocks=on|off (count TCG translation block executions, default=off)\n"
     "                one-insn-per-tb=on|off (one guest instruction per TCG translation block)\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
     "                tb-size=n (TCG translation block cache size)\n"
+    "                trace-threshold=n (retranslate TCG blocks run n times along their hot branches, default=0)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
     "                eager-split-size=n (KVM Eager Page Split chunk size, default 0, disabled. ARM only)\n"
     "                notify-vmexit=run|internal-error|disable,notify-window=n (enable notify VM exit and set notify window, x86 only)\n"
@@ -212,6 +214,11 @@ SRST
     ``kvm-shadow-mem=size``
         Defines the size of the KVM shadow MMU.
 
+    ``hot-blocks=on|off``
+        Makes every TCG translation block count its executions, for the
+        ``x-query-tcg-hot-blocks`` QMP command. This costs an increment
+        per block executed and is off by default.
+
     ``one-insn-per-tb=on|off``
         Makes the TCG accelerator put only one guest instruction into
         each translation block. This slows down emulation a lot, but
@@ -227,6 +234,17 @@ SRST
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
+    ``trace-threshold=n``
+        Makes the TCG accelerator retranslate a translation block once
+        it has run ``n`` times as a trace: where a branch almost always
+        goes the same way, translation carries on along that path and
+        leaves the other way through a side exit. This gives the TCG
+        optimizer whole loop bodies to work on. Only forward branches
+        within the block's first page are followed, and blocks are not
+        traced under icount, single stepping or plugins. Requires
+        ``hot-blocks=on``. The default of 0 disables traces. Only targets
+        whose translator supports it build traces, currently H8.
+
     ``thread=single|multi``
         Controls number of TCG threads. When the TCG is multi-threaded
         there will be one thread per vCPU therefore taking advantage of
@@ -4637,13 +4655,14 @@ SRST
 ERST
 
 DEF("icount", HAS_ARG, QEMU_OPTION_icount, \
-    "-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=<filename>[,rrsnapshot=<snapshot>]]\n" \
+    "-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=<filename>[,rrsnapshot=<snapshot>][,rrcompress=on|off]\n" \
+    "                [,rrsnapshot-interval=N][,rrsnapshot-mem=size]]\n" \
     "                enable virtual instruction counter with 2^N clock ticks per\n" \
     "                instruction, enable aligning the host and virtual clocks\n" \
     "                or disable real time cpu sleeping, and optionally enable\n" \
     "                record-and-replay mode\n", QEMU_ARCH_ALL)
 SRST
-``-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=filename[,rrsnapshot=snapshot]]``
+``-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=filename[,rrsnapshot=snapshot][,rrcompress=on|off][,rrsnapshot-interval=N][,rrsnapshot-mem=size]]``
     Enable virtual instruction counter. The virtual cpu will execute one
     instruction every 2^N ns of virtual time. If ``auto`` is specified
     then the virtual cpu speed will be automatically adjusted to keep
@@ -4685,6 +4704,14 @@ SRST
     name. In record mode, a new VM snapshot with the given name is created
     at the start of execution recording. In replay mode this option
     specifies the snapshot name used to load the initial VM state.
+    ``rrcompress=on`` compresses the log with zstd while recording, if
+    QEMU was built with zstd support. Replay detects compressed logs by
+    itself.
+    ``rrsnapshot-interval=N`` makes replay keep a snapshot in memory
+    every N instructions, for reverse debugging. They use up to
+    ``rrsnapshot-mem`` bytes (256M by default), the least recently used
+    ones are dropped beyond that. All drives must be read-only, as the
+    snapshots do not include the contents of disks.
 ERST
 
 DEF("watchdog-action", HAS_ARG, QEMU_OPTION_watchdog_action, \
@@ -0,0 +1,425 @@
+/*
+ * replay-autosnapshot.c
+ *
+ * Snapshots kept in memory while replaying
+ *
+ * Reverse debugging loads the nearest snapshot before the target and
+ * replays forward from it. With rrsnapshot-interval, one is taken every
+ * that many instructions, so that this replays at most one interval.
+ * RAM is kept in pages which are shared with the snapshot taken or loaded
+ * before whenever they are unchanged, so each snapshot mostly costs the
+ * pages that the guest wrote in between. When they need more memory than
+ * rrsnapshot-mem, the least recently used ones are dropped.
+ *
+ * The contents of disks are not part of these snapshots.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/queue.h"
+#include "qemu/timer.h"
+#include "qemu/units.h"
+#include "exec/cpu-common.h"
+#include "io/channel-buffer.h"
+#include "migration/global_state.h"
+#include "migration/migration.h"
+#include "migration/qemu-file.h"
+#include "migration/savevm.h"
+#include "sysemu/block-backend.h"
+#include "sysemu/replay.h"
+#include "sysemu/runstate.h"
+#include "replay-internal.h"
+
+#define REPLAY_PAGE_SIZE    (4 * KiB)
+
+typedef struct ReplayPage {
+    unsigned refcount;
+    uint8_t data[REPLAY_PAGE_SIZE];
+} ReplayPage;
+
+typedef struct ReplayRAM {
+    uint8_t *host;
+    ram_addr_t size;
+    size_t first_page;
+} ReplayRAM;
+
+typedef struct ReplayAutoSnapshot {
+    uint64_t icount;
+    uint64_t last_used;
+    QIOChannelBuffer *devstate;
+    /* of all the RAM blocks, in the order of replay_autosnapshot.ram */
+    ReplayPage **pages;
+    QTAILQ_ENTRY(ReplayAutoSnapshot) next;
+} ReplayAutoSnapshot;
+
+uint64_t replay_autosnapshot_icount = -1ULL;
+QEMUTimer *replay_autosnapshot_timer;
+
+static struct {
+    uint64_t interval;
+    uint64_t budget;
+    uint64_t bytes;
+    /* ticks on each use, for the LRU order */
+    uint64_t clock;
+    unsigned count;
+    GArray *ram;
+    size_t nb_pages;
+    /* the snapshot last taken or loaded, a new one shares its pages */
+    ReplayAutoSnapshot *base;
+    /* sorted by icount */
+    QTAILQ_HEAD(, ReplayAutoSnapshot) list;
+} replay_autosnapshot = {
+    .list = QTAILQ_HEAD_INITIALIZER(replay_autosnapshot.list),
+};
+
+/* shared by all the pages of zeros, not counted */
+static ReplayPage replay_zero_page;
+
+static ReplayAutoSnapshot *replay_autosnapshot_lookup(uint64_t icount)
+{
+    ReplayAutoSnapshot *s;
+
+    QTAILQ_FOREACH(s, &replay_autosnapshot.list, next) {
+        if (s->icount == icount) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+static void replay_autosnapshot_use(ReplayAutoSnapshot *s)
+{
+    s->last_used = ++replay_autosnapshot.clock;
+    replay_autosnapshot.base = s;
+}
+
+static void replay_page_put(ReplayPage *p)
+{
+    if (p != &replay_zero_page && !--p->refcount) {
+        replay_autosnapshot.bytes -= sizeof(*p);
+        g_free(p);
+    }
+}
+
+static void replay_autosnapshot_free(ReplayAutoSnapshot *s)
+{
+    size_t i;
+
+    for (i = 0; i < replay_autosnapshot.nb_pages; i++) {
+        replay_page_put(s->pages[i]);
+    }
+    replay_autosnapshot.bytes -= s->devstate->usage;
+    object_unref(OBJECT(s->devstate));
+
+    QTAILQ_REMOVE(&replay_autosnapshot.list, s, next);
+    replay_autosnapshot.count--;
+    if (replay_autosnapshot.base == s) {
+        replay_autosnapshot.base = NULL;
+    }
+    g_free(s->pages);
+    g_free(s);
+}
+
+/* Drop the least recently used snapshots until the rest fit the budget */
+static void replay_autosnapshot_evict(void)
+{
+    while (replay_autosnapshot.bytes > replay_autosnapshot.budget &&
+           replay_autosnapshot.count > 1) {
+        ReplayAutoSnapshot *s, *lru = NULL;
+
+        QTAILQ_FOREACH(s, &replay_autosnapshot.list, next) {
+            if (!lru || s->last_used < lru->last_used) {
+                lru = s;
+            }
+        }
+        replay_autosnapshot_free(lru);
+    }
+}
+
+static int replay_autosnapshot_add_ram(RAMBlock *rb, void *opaque)
+{
+    ReplayRAM r;
+
+    if (!qemu_ram_is_migratable(rb)) {
+        return 0;
+    }
+    r.host = qemu_ram_get_host_addr(rb);
+    r.size = qemu_ram_get_used_length(rb);
+    r.first_page = replay_autosnapshot.nb_pages;
+    replay_autosnapshot.nb_pages += DIV_ROUND_UP(r.size, REPLAY_PAGE_SIZE);
+    g_array_append_val(replay_autosnapshot.ram, r);
+    return 0;
+}
+
+static void replay_autosnapshot_save_ram(ReplayAutoSnapshot *s)
+{
+    ReplayAutoSnapshot *base = replay_autosnapshot.base;
+    guint i;
+
+    for (i = 0; i < replay_autosnapshot.ram->len; i++) {
+        ReplayRAM *r = &g_array_index(replay_autosnapshot.ram, ReplayRAM, i);
+        ram_addr_t off;
+
+        for (off = 0; off < r->size; off += REPLAY_PAGE_SIZE) {
+            size_t n = r->first_page + off / REPLAY_PAGE_SIZE;
+            size_t len = MIN(REPLAY_PAGE_SIZE, r->size - off);
+            uint8_t *host = r->host + off;
+            ReplayPage *p = base ? base->pages[n] : NULL;
+
+            if (p && !memcmp(p->data, host, len)) {
+                /* unchanged, share it */
+            } else if (buffer_is_zero(host, len)) {
+                p = &replay_zero_page;
+            } else {
+                p = g_new0(ReplayPage, 1);
+                memcpy(p->data, host, len);
+                replay_autosnapshot.bytes += sizeof(*p);
+            }
+            if (p != &replay_zero_page) {
+                p->refcount++;
+            }
+            s->pages[n] = p;
+        }
+    }
+}
+
+static void replay_autosnapshot_load_ram(ReplayAutoSnapshot *s)
+{
+    guint i;
+
+    for (i = 0; i < replay_autosnapshot.ram->len; i++) {
+        ReplayRAM *r = &g_array_index(replay_autosnapshot.ram, ReplayRAM, i);
+        ram_addr_t off;
+
+        for (off = 0; off < r->size; off += REPLAY_PAGE_SIZE) {
+            ReplayPage *p = s->pages[r->first_page + off / REPLAY_PAGE_SIZE];
+            size_t len = MIN(REPLAY_PAGE_SIZE, r->size - off);
+
+            if (memcmp(r->host + off, p->data, len)) {
+                memcpy(r->host + off, p->data, len);
+            }
+        }
+    }
+}
+
+static bool replay_autosnapshot_save(uint64_t icount, Error **errp)
+{
+    ReplayAutoSnapshot *s, *pos;
+    QEMUFile *f;
+    int ret;
+
+    if (migration_is_blocked(errp)) {
+        return false;
+    }
+
+    if (!replay_autosnapshot.ram) {
+        replay_autosnapshot.ram = g_array_new(false, false, sizeof(ReplayRAM));
+        qemu_ram_foreach_block(replay_autosnapshot_add_ram, NULL);
+    }
+
+    s = g_new0(ReplayAutoSnapshot, 1);
+    s->icount = icount;
+    s->devstate = qio_channel_buffer_new(4096);
+    f = qemu_file_new_output(QIO_CHANNEL(s->devstate));
+    ret = qemu_save_device_state(f);
+    qemu_fflush(f);
+    /* qemu_fclose() drops one reference, keep the buffer */
+    object_ref(OBJECT(s->devstate));
+    qemu_fclose(f);
+    if (ret < 0) {
+        error_setg(errp, "Error %d while saving VM state", ret);
+        object_unref(OBJECT(s->devstate));
+        g_free(s);
+        return false;
+    }
+    replay_autosnapshot.bytes += s->devstate->usage;
+
+    s->pages = g_new(ReplayPage *, replay_autosnapshot.nb_pages);
+    replay_autosnapshot_save_ram(s);
+
+    QTAILQ_FOREACH(pos, &replay_autosnapshot.list, next) {
+        if (pos->icount > icount) {
+            break;
+        }
+    }
+    if (pos) {
+        QTAILQ_INSERT_BEFORE(pos, s, next);
+    } else {
+        QTAILQ_INSERT_TAIL(&replay_autosnapshot.list, s, next);
+    }
+    replay_autosnapshot.count++;
+
+    replay_autosnapshot_use(s);
+    replay_autosnapshot_evict();
+    return true;
+}
+
+/* Called from the main loop when the vCPU reached the snapshot icount */
+static void replay_autosnapshot_tick(void *opaque)
+{
+    uint64_t icount = replay_get_current_icount();
+    bool running = runstate_is_running();
+    Error *err = NULL;
+
+    if (icount != replay_autosnapshot_icount) {
+        return;
+    }
+
+    /*
+     * Leaving out the snapshot when events are pending only means
+     * that reverse commands replay two intervals there.
+     */
+    replay_autosnapshot_icount =
+        QEMU_ALIGN_UP(icount + 1, replay_autosnapshot.interval);
+    if (!replay_can_snapshot()) {
+        return;
+    }
+
+    global_state_store();
+    if (running) {
+        vm_stop(RUN_STATE_SAVE_VM);
+    }
+    if (!replay_autosnapshot_save(icount, &err)) {
+        warn_reportf_err(err, "Replay: disabling automatic snapshots: ");
+        replay_autosnapshot.interval = 0;
+        replay_autosnapshot_icount = -1ULL;
+    }
+    if (running) {
+        vm_start();
+    }
+}
+
+void replay_autosnapshot_configure(uint64_t interval, uint64_t budget)
+{
+    replay_autosnapshot.interval = interval;
+    replay_autosnapshot.budget = budget;
+}
+
+void replay_autosnapshot_start(void)
+{
+    BlockBackend *blk;
+
+    if (replay_mode != REPLAY_MODE_PLAY || !replay_autosnapshot.interval) {
+        return;
+    }
+
+    /* going back would not undo what the guest wrote to its disks */
+    for (blk = blk_next(NULL); blk; blk = blk_next(blk)) {
+        if (blk_is_inserted(blk) && blk_is_writable(blk)) {
+            error_report("rrsnapshot-interval does not cover the contents "
+                         "of disks, but drive '%s' is writable",
+                         blk_name(blk));
+            error_printf("Attach it with readonly=on.\n");
+            exit(1);
+        }
+    }
+
+    replay_autosnapshot_timer = timer_new_ns(QEMU_CLOCK_REALTIME,
+                                             replay_autosnapshot_tick, NULL);
+    replay_autosnapshot_rearm(replay_get_current_icount());
+}
+
+void replay_autosnapshot_finish(void)
+{
+    ReplayAutoSnapshot *s, *tmp;
+
+    QTAILQ_FOREACH_SAFE(s, &replay_autosnapshot.list, next, tmp) {
+        replay_autosnapshot_free(s);
+    }
+    if (replay_autosnapshot.ram) {
+        g_array_free(replay_autosnapshot.ram, true);
+        replay_autosnapshot.ram = NULL;
+        replay_autosnapshot.nb_pages = 0;
+    }
+    if (replay_autosnapshot_timer) {
+        timer_free(replay_autosnapshot_timer);
+        replay_autosnapshot_timer = NULL;
+    }
+    replay_autosnapshot.interval = 0;
+    replay_autosnapshot_icount = -1ULL;
+}
+
+void replay_autosnapshot_rearm(uint64_t icount)
+{
+    uint64_t next;
+
+    if (!replay_autosnapshot_timer || !replay_autosnapshot.interval) {
+        return;
+    }
+
+    next = QEMU_ALIGN_UP(icount, replay_autosnapshot.interval);
+    if (next == icount && replay_autosnapshot_lookup(icount)) {
+        next += replay_autosnapshot.interval;
+    }
+    replay_autosnapshot_icount = next;
+    if (next == icount) {
+        /* the vCPU does not advance past it, take it from the main loop */
+        timer_mod_ns(replay_autosnapshot_timer,
+                     qemu_clock_get_ns(QEMU_CLOCK_REALTIME));
+    }
+}
+
+int64_t replay_autosnapshot_find(int64_t icount)
+{
+    ReplayAutoSnapshot *s;
+    int64_t ret = -1;
+
+    QTAILQ_FOREACH(s, &replay_autosnapshot.list, next) {
+        if (s->icount > icount) {
+            break;
+        }
+        ret = s->icount;
+    }
+    return ret;
+}
+
+bool replay_autosnapshot_load(int64_t icount, Error **errp)
+{
+    ReplayAutoSnapshot *s = replay_autosnapshot_lookup(icount);
+    QEMUFile *f;
+    int ret;
+
+    if (!s) {
+        error_setg(errp, "No snapshot at instruction %" PRId64, icount);
+        return false;
+    }
+
+    /*
+     * Flush the record/replay queue. Now the VM state is going
+     * to change. Therefore we don't need to preserve its consistency
+     */
+    replay_flush_events();
+
+    qemu_system_reset(SHUTDOWN_CAUSE_SNAPSHOT_LOAD);
+    replay_autosnapshot_load_ram(s);
+
+    qio_channel_io_seek(QIO_CHANNEL(s->devstate), 0, SEEK_SET, NULL);
+    f = qemu_file_new_input(QIO_CHANNEL(s->devstate));
+    /* skip the magic and version written by qemu_save_device_state() */
+    qemu_get_be32(f);
+    qemu_get_be32(f);
+    ret = qemu_load_device_state(f);
+    object_ref(OBJECT(s->devstate));
+    qemu_fclose(f);
+    migration_incoming_state_destroy();
+    if (ret < 0) {
+        error_setg(errp, "Error %d while loading VM state", ret);
+        return false;
+    }
+
+    replay_autosnapshot_use(s);
+    return true;
+}
+
+bool replay_autosnapshot_info(unsigned *count, uint64_t *bytes)
+{
+    *count = replay_autosnapshot.count;
+    *bytes = replay_autosnapshot.bytes;
+    return replay_autosnapshot_timer && replay_autosnapshot.interval;
+}
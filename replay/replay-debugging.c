@@ -19,6 +19,7 @@
 #include "qapi/qapi-commands-replay.h"
 #include "qapi/qmp/qdict.h"
 #include "qemu/timer.h"
+#include "qemu/units.h"
 #include "block/snapshot.h"
 #include "migration/snapshot.h"
 
@@ -33,6 +34,9 @@ bool replay_running_debug(void)
 
 void hmp_info_replay(Monitor *mon, const QDict *qdict)
 {
+    unsigned count;
+    uint64_t bytes;
+
     if (replay_mode == REPLAY_MODE_NONE) {
         monitor_printf(mon, "Record/replay is not active\n");
     } else {
@@ -40,6 +44,10 @@ void hmp_info_replay(Monitor *mon, const QDict *qdict)
             "%s execution '%s': instruction count = %"PRId64"\n",
             replay_mode == REPLAY_MODE_RECORD ? "Recording" : "Replaying",
             replay_get_filename(), replay_get_current_icount());
+        if (replay_autosnapshot_info(&count, &bytes)) {
+            monitor_printf(mon, "%u automatic snapshots in %"PRIu64" KiB\n",
+                           count, bytes / KiB);
+        }
     }
 }
 
@@ -184,6 +192,7 @@ static void replay_seek(int64_t icount, QEMUTimerCB callback, Error **errp)
 {
     char *snapshot = NULL;
     int64_t snapshot_icount;
+    int64_t autosnapshot_icount;
 
     if (replay_mode != REPLAY_MODE_PLAY) {
         error_setg(errp, "replay must be enabled to seek");
@@ -191,14 +200,22 @@ static void replay_seek(int64_t icount, QEMUTimerCB callback, Error **errp)
     }
 
     snapshot = replay_find_nearest_snapshot(icount, &snapshot_icount);
-    if (snapshot) {
+    autosnapshot_icount = replay_autosnapshot_find(icount);
+    if (autosnapshot_icount > snapshot_icount) {
+        /* the one kept in memory is nearer and faster to load */
+        if (icount < replay_get_current_icount()
+            || replay_get_current_icount() < autosnapshot_icount) {
+            vm_stop(RUN_STATE_RESTORE_VM);
+            replay_autosnapshot_load(autosnapshot_icount, errp);
+        }
+    } else if (snapshot) {
         if (icount < replay_get_current_icount()
             || replay_get_current_icount() < snapshot_icount) {
             vm_stop(RUN_STATE_RESTORE_VM);
             load_snapshot(snapshot, NULL, false, NULL, errp);
         }
-        g_free(snapshot);
     }
+    g_free(snapshot);
     if (replay_get_current_icount() <= icount) {
         replay_break(icount, callback, NULL);
         vm_start();
@@ -326,7 +343,8 @@ void replay_gdb_attached(void)
      */
     if (replay_mode == REPLAY_MODE_PLAY
         && !replay_snapshot) {
-        if (!save_snapshot("start_debugging", true, NULL, false, NULL, NULL)) {
+        if (!save_snapshot("start_debugging", true, NULL, false, NULL,
+                           false, NULL)) {
             /* Can't create the snapshot. Continue conventional debugging. */
         }
     }
@@ -27,17 +27,8 @@ static QemuCond mutex_cond;
 static unsigned long mutex_head, mutex_tail;
 
 /* File for replay writing */
-static bool write_error;
 FILE *replay_file;
 
-static void replay_write_error(void)
-{
-    if (!write_error) {
-        error_report("replay write error");
-        write_error = true;
-    }
-}
-
 static void replay_read_error(void)
 {
     error_report("error reading the replay data");
@@ -47,9 +38,7 @@ static void replay_read_error(void)
 void replay_put_byte(uint8_t byte)
 {
     if (replay_file) {
-        if (putc(byte, replay_file) == EOF) {
-            replay_write_error();
-        }
+        replay_log_write(&byte, 1);
     }
 }
 
@@ -82,9 +71,7 @@ void replay_put_array(const uint8_t *buf, size_t size)
 {
     if (replay_file) {
         replay_put_dword(size);
-        if (fwrite(buf, 1, size, replay_file) != size) {
-            replay_write_error();
-        }
+        replay_log_write(buf, size);
     }
 }
 
@@ -92,11 +79,9 @@ uint8_t replay_get_byte(void)
 {
     uint8_t byte = 0;
     if (replay_file) {
-        int r = getc(replay_file);
-        if (r == EOF) {
+        if (!replay_log_read(&byte, 1)) {
             replay_read_error();
         }
-        byte = r;
     }
     return byte;
 }
@@ -138,7 +123,7 @@ void replay_get_array(uint8_t *buf, size_t *size)
 {
     if (replay_file) {
         *size = replay_get_dword();
-        if (fread(buf, 1, *size, replay_file) != *size) {
+        if (!replay_log_read(buf, *size)) {
             replay_read_error();
         }
     }
@@ -149,7 +134,7 @@ void replay_get_array_alloc(uint8_t **buf, size_t *size)
     if (replay_file) {
         *size = replay_get_dword();
         *buf = g_malloc(*size);
-        if (fread(*buf, 1, *size, replay_file) != *size) {
+        if (!replay_log_read(*buf, *size)) {
             replay_read_error();
         }
     }
@@ -272,6 +257,10 @@ void replay_advance_current_icount(uint64_t current_icount)
             timer_mod_ns(replay_break_timer,
                 qemu_clock_get_ns(QEMU_CLOCK_REALTIME));
         }
+        if (replay_autosnapshot_icount == replay_state.current_icount) {
+            timer_mod_ns(replay_autosnapshot_timer,
+                qemu_clock_get_ns(QEMU_CLOCK_REALTIME));
+        }
     }
 }
 
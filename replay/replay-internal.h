@@ -93,6 +93,10 @@ extern FILE *replay_file;
 extern uint64_t replay_break_icount;
 /* Timer for the replay breakpoint callback */
 extern QEMUTimer *replay_break_timer;
+/* Instruction count of the next automatic snapshot */
+extern uint64_t replay_autosnapshot_icount;
+/* Timer for taking it from the main loop */
+extern QEMUTimer *replay_autosnapshot_timer;
 
 void replay_put_byte(uint8_t byte);
 void replay_put_event(uint8_t event);
@@ -108,6 +112,21 @@ int64_t replay_get_qword(void);
 void replay_get_array(uint8_t *buf, size_t *size);
 void replay_get_array_alloc(uint8_t **buf, size_t *size);
 
+/* Buffered access to replay_file, past its header */
+
+/*! Starts writing or reading the log at the current file position. */
+void replay_log_open(bool compress);
+/*! Writes out what is left of the log in record mode. */
+void replay_log_close(void);
+/*! Appends data to the log. */
+void replay_log_write(const void *buf, size_t size);
+/*! Reads data from the log, returns false at its end. */
+bool replay_log_read(void *buf, size_t size);
+/*! Returns the position in the log, to save with a snapshot. */
+uint64_t replay_log_tell(void);
+/*! Continues reading at a position returned by replay_log_tell. */
+void replay_log_seek(uint64_t offset);
+
 /* Mutex functions for protecting replay log file and ensuring
  * synchronisation between vCPU and main-loop threads. */
 
@@ -190,4 +209,21 @@ void *replay_event_net_load(void);
    to make cached timers available for post_load functions. */
 void replay_vmstate_register(void);
 
+/* Snapshots kept in memory while replaying */
+
+/*! Takes a snapshot every interval instructions, in up to budget bytes. */
+void replay_autosnapshot_configure(uint64_t interval, uint64_t budget);
+/*! Sets up the timer for taking the snapshots. */
+void replay_autosnapshot_start(void);
+/*! Frees all the snapshots. */
+void replay_autosnapshot_finish(void);
+/*! Schedules the next snapshot after the VM state was loaded at icount. */
+void replay_autosnapshot_rearm(uint64_t icount);
+/*! Returns the icount of the last snapshot at or before icount, or -1. */
+int64_t replay_autosnapshot_find(int64_t icount);
+/*! Loads the snapshot taken at icount. */
+bool replay_autosnapshot_load(int64_t icount, Error **errp);
+/*! Returns false if the snapshots are disabled. */
+bool replay_autosnapshot_info(unsigned *count, uint64_t *bytes);
+
 #endif
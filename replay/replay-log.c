@@ -0,0 +1,331 @@
+/*
+ * replay-log.c
+ *
+ * Block buffered access to the record/replay log
+ *
+ * After its header the log is a sequence of blocks of up to
+ * REPLAY_LOG_BLOCK bytes of events, each optionally compressed with zstd.
+ * While recording, the threads that log events only copy them into a
+ * buffer. Full buffers go to a writer thread which compresses and writes
+ * them, so the vCPU does not wait for either. Blocks are compressed on
+ * their own rather than as one stream, so that replay can start reading
+ * at the position saved with a snapshot.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/error-report.h"
+#include "qemu/thread.h"
+#include "qemu/units.h"
+#include "sysemu/replay.h"
+#include "replay-internal.h"
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
+
+#define REPLAY_LOG_BLOCK    (256 * KiB)
+#define REPLAY_LOG_BUFFERS  4
+/* set in the stored size of a block compressed with zstd */
+#define REPLAY_LOG_ZSTD     0x80000000u
+/* the writer must keep up with the vCPU, ratio matters less */
+#define REPLAY_LOG_ZSTD_LEVEL 1
+
+typedef struct ReplayLogBuffer {
+    uint8_t *data;
+    size_t len;
+} ReplayLogBuffer;
+
+typedef struct ReplayLogBlock {
+    uint64_t file_offset;
+    uint64_t offset;        /* of its first byte in the log */
+    uint32_t size;
+} ReplayLogBlock;
+
+static struct {
+    /* of the next byte to write or read */
+    uint64_t offset;
+
+    /* record mode, the buffers go round between us and the writer */
+    ReplayLogBuffer buf[REPLAY_LOG_BUFFERS];
+    unsigned head;
+    QemuSemaphore full;
+    QemuSemaphore empty;
+    QemuThread writer;
+    bool compress;
+    bool failed;
+
+    /* replay mode */
+    GArray *blocks;
+    unsigned next_block;
+    uint8_t *data;
+    size_t len;
+    size_t pos;
+} replay_log;
+
+static void replay_log_put_block(const uint8_t *data, uint32_t size,
+                                 void *cctx, uint8_t *out, size_t out_size)
+{
+    const uint8_t *stored = data;
+    uint32_t stored_size = size;
+    uint32_t hdr[2];
+
+#ifdef CONFIG_ZSTD
+    if (cctx) {
+        size_t n = ZSTD_compressCCtx(cctx, out, out_size, data, size,
+                                     REPLAY_LOG_ZSTD_LEVEL);
+
+        if (!ZSTD_isError(n) && n < size) {
+            stored = out;
+            stored_size = n;
+        }
+    }
+#endif
+
+    hdr[0] = cpu_to_be32(size);
+    hdr[1] = cpu_to_be32(stored_size |
+                         (stored == data ? 0 : REPLAY_LOG_ZSTD));
+    if (fwrite(hdr, sizeof(hdr), 1, replay_file) != 1 ||
+        fwrite(stored, 1, stored_size, replay_file) != stored_size) {
+        if (!qatomic_xchg(&replay_log.failed, true)) {
+            error_report("replay write error");
+        }
+    }
+}
+
+static void *replay_log_writer(void *opaque)
+{
+    g_autofree uint8_t *out = NULL;
+    size_t out_size = 0;
+    void *cctx = NULL;
+    unsigned tail = 0;
+
+#ifdef CONFIG_ZSTD
+    if (replay_log.compress) {
+        out_size = ZSTD_compressBound(REPLAY_LOG_BLOCK);
+        out = g_malloc(out_size);
+        cctx = ZSTD_createCCtx();
+    }
+#endif
+
+    for (;;) {
+        ReplayLogBuffer *b;
+
+        qemu_sem_wait(&replay_log.full);
+        b = &replay_log.buf[tail++ % REPLAY_LOG_BUFFERS];
+        /* an empty buffer ends the log */
+        if (!b->len) {
+            break;
+        }
+        replay_log_put_block(b->data, b->len, cctx, out, out_size);
+        qemu_sem_post(&replay_log.empty);
+    }
+
+#ifdef CONFIG_ZSTD
+    ZSTD_freeCCtx(cctx);
+#endif
+    return NULL;
+}
+
+/* hand the current buffer to the writer and take the next one */
+static void replay_log_submit(void)
+{
+    qemu_sem_post(&replay_log.full);
+    replay_log.head++;
+    qemu_sem_wait(&replay_log.empty);
+    replay_log.buf[replay_log.head % REPLAY_LOG_BUFFERS].len = 0;
+}
+
+void replay_log_write(const void *buf, size_t size)
+{
+    const uint8_t *p = buf;
+
+    while (size) {
+        ReplayLogBuffer *b =
+            &replay_log.buf[replay_log.head % REPLAY_LOG_BUFFERS];
+        size_t n = MIN(size, REPLAY_LOG_BLOCK - b->len);
+
+        memcpy(b->data + b->len, p, n);
+        b->len += n;
+        p += n;
+        size -= n;
+        replay_log.offset += n;
+        if (b->len == REPLAY_LOG_BLOCK) {
+            replay_log_submit();
+        }
+    }
+}
+
+/* Find the blocks of the log, so that replay can seek in it */
+static void replay_log_index(void)
+{
+    uint64_t offset = 0;
+    uint32_t hdr[2];
+    ReplayLogBlock blk;
+
+    replay_log.blocks = g_array_new(false, false, sizeof(ReplayLogBlock));
+    for (;;) {
+        blk.file_offset = ftello(replay_file);
+        if (fread(hdr, sizeof(hdr), 1, replay_file) != 1) {
+            break;
+        }
+        blk.offset = offset;
+        blk.size = be32_to_cpu(hdr[0]);
+        g_array_append_val(replay_log.blocks, blk);
+        offset += blk.size;
+        if (fseeko(replay_file, be32_to_cpu(hdr[1]) & ~REPLAY_LOG_ZSTD,
+                   SEEK_CUR)) {
+            break;
+        }
+    }
+}
+
+static bool replay_log_load(unsigned i)
+{
+    ReplayLogBlock *blk;
+    uint32_t hdr[2], stored;
+
+    if (i >= replay_log.blocks->len) {
+        return false;
+    }
+    blk = &g_array_index(replay_log.blocks, ReplayLogBlock, i);
+    if (blk->size > REPLAY_LOG_BLOCK ||
+        fseeko(replay_file, blk->file_offset, SEEK_SET) ||
+        fread(hdr, sizeof(hdr), 1, replay_file) != 1) {
+        return false;
+    }
+
+    stored = be32_to_cpu(hdr[1]);
+    if (!(stored & REPLAY_LOG_ZSTD)) {
+        if (fread(replay_log.data, 1, blk->size, replay_file) != blk->size) {
+            return false;
+        }
+    } else {
+#ifdef CONFIG_ZSTD
+        g_autofree uint8_t *in = NULL;
+
+        stored &= ~REPLAY_LOG_ZSTD;
+        in = g_malloc(stored);
+        if (fread(in, 1, stored, replay_file) != stored ||
+            ZSTD_decompress(replay_log.data, REPLAY_LOG_BLOCK,
+                            in, stored) != blk->size) {
+            return false;
+        }
+#else
+        error_report("Replay: the log is compressed, "
+                     "but QEMU was built without zstd");
+        exit(1);
+#endif
+    }
+
+    replay_log.offset = blk->offset;
+    replay_log.len = blk->size;
+    replay_log.pos = 0;
+    replay_log.next_block = i + 1;
+    return true;
+}
+
+bool replay_log_read(void *buf, size_t size)
+{
+    uint8_t *p = buf;
+
+    while (size) {
+        size_t n;
+
+        if (replay_log.pos == replay_log.len &&
+            !replay_log_load(replay_log.next_block)) {
+            return false;
+        }
+        n = MIN(size, replay_log.len - replay_log.pos);
+        memcpy(p, replay_log.data + replay_log.pos, n);
+        replay_log.pos += n;
+        p += n;
+        size -= n;
+        replay_log.offset += n;
+    }
+    return true;
+}
+
+uint64_t replay_log_tell(void)
+{
+    return replay_log.offset;
+}
+
+void replay_log_seek(uint64_t offset)
+{
+    unsigned lo = 0, hi = replay_log.blocks->len;
+
+    /* the last block that starts at or before offset */
+    while (hi - lo > 1) {
+        unsigned mid = (lo + hi) / 2;
+
+        if (g_array_index(replay_log.blocks, ReplayLogBlock,
+                          mid).offset <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo < replay_log.blocks->len && replay_log_load(lo) &&
+        offset - replay_log.offset <= replay_log.len) {
+        replay_log.pos = offset - replay_log.offset;
+        replay_log.offset = offset;
+    } else {
+        /* at the end, the next read fails */
+        replay_log.offset = offset;
+        replay_log.len = replay_log.pos = 0;
+        replay_log.next_block = replay_log.blocks->len;
+    }
+}
+
+void replay_log_open(bool compress)
+{
+    int i;
+
+    replay_log.offset = 0;
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        replay_log.compress = compress;
+        for (i = 0; i < REPLAY_LOG_BUFFERS; i++) {
+            replay_log.buf[i].data = g_malloc(REPLAY_LOG_BLOCK);
+            replay_log.buf[i].len = 0;
+        }
+        replay_log.head = 0;
+        qemu_sem_init(&replay_log.full, 0);
+        qemu_sem_init(&replay_log.empty, REPLAY_LOG_BUFFERS - 1);
+        qemu_thread_create(&replay_log.writer, "replay-log",
+                           replay_log_writer, NULL, QEMU_THREAD_JOINABLE);
+    } else {
+        replay_log_index();
+        replay_log.data = g_malloc(REPLAY_LOG_BLOCK);
+        replay_log.len = replay_log.pos = 0;
+        replay_log.next_block = 0;
+    }
+}
+
+void replay_log_close(void)
+{
+    int i;
+
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        if (replay_log.buf[replay_log.head % REPLAY_LOG_BUFFERS].len) {
+            replay_log_submit();
+        }
+        qemu_sem_post(&replay_log.full);
+        qemu_thread_join(&replay_log.writer);
+        qemu_sem_destroy(&replay_log.full);
+        qemu_sem_destroy(&replay_log.empty);
+        for (i = 0; i < REPLAY_LOG_BUFFERS; i++) {
+            g_free(replay_log.buf[i].data);
+            replay_log.buf[i].data = NULL;
+        }
+    } else {
+        g_array_free(replay_log.blocks, true);
+        replay_log.blocks = NULL;
+        g_free(replay_log.data);
+        replay_log.data = NULL;
+    }
+}
@@ -11,20 +11,24 @@
 
 #include "qemu/osdep.h"
 #include "qapi/error.h"
+#include "qemu/bswap.h"
 #include "sysemu/cpu-timers.h"
 #include "sysemu/replay.h"
 #include "sysemu/runstate.h"
 #include "replay-internal.h"
 #include "qemu/main-loop.h"
 #include "qemu/option.h"
+#include "qemu/units.h"
 #include "sysemu/cpus.h"
 #include "qemu/error-report.h"
 
 /* Current version of the replay mechanism.
    Increase it when file format changes. */
-#define REPLAY_VERSION              0xe0200c
+#define REPLAY_VERSION              0xe0200d
 /* Size of replay log header */
 #define HEADER_SIZE                 (sizeof(uint32_t) + sizeof(uint64_t))
+/* Default memory budget of the automatic snapshots */
+#define AUTOSNAPSHOT_MEM            (256 * MiB)
 
 ReplayMode replay_mode = REPLAY_MODE_NONE;
 char *replay_snapshot;
@@ -76,12 +80,15 @@ int replay_get_instructions(void)
     int res = 0;
     g_assert(replay_mutex_locked());
     if (replay_next_event_is(EVENT_INSTRUCTION)) {
+        /* stop at the breakpoint or the next automatic snapshot */
+        uint64_t stop = MIN(replay_break_icount, replay_autosnapshot_icount);
+
         res = replay_state.instruction_count;
-        if (replay_break_icount != -1LL) {
+        if (stop != -1ULL) {
             uint64_t current = replay_get_current_icount();
-            assert(replay_break_icount >= current);
-            if (current + res > replay_break_icount) {
-                res = replay_break_icount - current;
+            assert(stop >= current);
+            if (current + res > stop) {
+                res = stop - current;
             }
         }
     }
@@ -226,7 +233,7 @@ bool replay_has_event(void)
     return res;
 }
 
-static void replay_enable(const char *fname, int mode)
+static void replay_enable(const char *fname, int mode, bool compress)
 {
     const char *fmode = NULL;
     assert(!replay_file);
@@ -263,14 +270,18 @@ static void replay_enable(const char *fname, int mode)
     /* skip file header for RECORD and check it for PLAY */
     if (replay_mode == REPLAY_MODE_RECORD) {
         fseek(replay_file, HEADER_SIZE, SEEK_SET);
+        replay_log_open(compress);
     } else if (replay_mode == REPLAY_MODE_PLAY) {
-        unsigned int version = replay_get_dword();
-        if (version != REPLAY_VERSION) {
+        uint32_t version;
+
+        if (fread(&version, sizeof(version), 1, replay_file) != 1 ||
+            be32_to_cpu(version) != REPLAY_VERSION) {
             fprintf(stderr, "Replay: invalid input log file version\n");
             exit(1);
         }
         /* go to the beginning */
         fseek(replay_file, HEADER_SIZE, SEEK_SET);
+        replay_log_open(false);
         replay_fetch_data_kind();
     }
 
@@ -281,6 +292,7 @@ void replay_configure(QemuOpts *opts)
 {
     const char *fname;
     const char *rr;
+    bool compress;
     ReplayMode mode = REPLAY_MODE_NONE;
     Location loc;
 
@@ -310,9 +322,20 @@ void replay_configure(QemuOpts *opts)
         exit(1);
     }
 
+    compress = qemu_opt_get_bool(opts, "rrcompress", false);
+#ifndef CONFIG_ZSTD
+    if (compress) {
+        error_report("rrcompress=on needs QEMU built with zstd");
+        exit(1);
+    }
+#endif
+
     replay_snapshot = g_strdup(qemu_opt_get(opts, "rrsnapshot"));
+    replay_autosnapshot_configure(
+        qemu_opt_get_number(opts, "rrsnapshot-interval", 0),
+        qemu_opt_get_size(opts, "rrsnapshot-mem", AUTOSNAPSHOT_MEM));
     replay_vmstate_register();
-    replay_enable(fname, mode);
+    replay_enable(fname, mode, compress);
 
 out:
     loc_pop(&loc);
@@ -333,7 +356,7 @@ void replay_start(void)
         exit(1);
     }
 
-    /* Timer for snapshotting will be set up here. */
+    replay_autosnapshot_start();
 
     replay_enable_events();
 }
@@ -356,10 +379,17 @@ void replay_finish(void)
             replay_shutdown_request(SHUTDOWN_CAUSE_HOST_SIGNAL);
             /* write end event */
             replay_put_event(EVENT_END);
+        }
+        replay_log_close();
 
+        if (replay_mode == REPLAY_MODE_RECORD) {
             /* write header */
+            uint32_t version = cpu_to_be32(REPLAY_VERSION);
+
             fseek(replay_file, 0, SEEK_SET);
-            replay_put_dword(REPLAY_VERSION);
+            if (fwrite(&version, sizeof(version), 1, replay_file) != 1) {
+                error_report("replay write error");
+            }
         }
 
         fclose(replay_file);
@@ -370,6 +400,7 @@ void replay_finish(void)
 
     g_free(replay_snapshot);
     replay_snapshot = NULL;
+    replay_autosnapshot_finish();
 
     replay_finish_events();
     replay_mode = REPLAY_MODE_NONE;
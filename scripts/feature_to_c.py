@@ -50,8 +50,10 @@ def writeliteral(indent, bytes):
         sys.stderr.write(f'unexpected start tag: {element.tag}\n')
         exit(1)
 
+    name = element.attrib['name']
     regnum = 0
     regnums = []
+    regnames = []
     tags = ['feature']
     for event, element in events:
         if event == 'end':
@@ -68,6 +70,7 @@ def writeliteral(indent, bytes):
                     regnum = int(element.attrib['regnum'])
 
                 regnums.append(regnum)
+                regnames.append(element.attrib['name'])
                 regnum += 1
 
             tags.append(element.tag)
@@ -85,6 +88,15 @@ def writeliteral(indent, bytes):
     writeliteral(8, bytes(os.path.basename(input), 'utf-8'))
     sys.stdout.write(',\n')
     writeliteral(8, read)
-    sys.stdout.write(f',\n        {num_regs},\n    }},\n')
+    sys.stdout.write(',\n')
+    writeliteral(8, bytes(name, 'utf-8'))
+    sys.stdout.write(',\n        (const char * const []) {\n')
+
+    for regnum, regname in zip(regnums, regnames):
+        sys.stdout.write(f'            [{regnum - base_reg}] =\n')
+        writeliteral(16, bytes(regname, 'utf-8'))
+        sys.stdout.write(',\n')
+
+    sys.stdout.write(f'        }},\n        {num_regs},\n    }},\n')
 
 sys.stdout.write('    { NULL }\n};\n')
@@ -10,6 +10,7 @@
 # For help see docs/devel/tracing.rst
 
 import sys
+import heapq
 import struct
 import inspect
 import warnings
@@ -29,6 +30,7 @@
 
 record_type_mapping = 0
 record_type_event = 1
+record_type_flush = 2
 
 log_header_fmt = '=QQQ'
 rec_header_fmt = '=QQII'
@@ -66,18 +68,29 @@ def read_trace_header(fobj):
     if _header_magic != header_magic:
         raise ValueError(f'Not a valid trace file, header magic {_header_magic} != {header_magic}')
 
-    if log_version not in [0, 2, 3, 4]:
+    if log_version not in [0, 2, 3, 4, 5]:
         raise ValueError(f'Unknown version {log_version} of tracelog format!')
-    if log_version != 4:
+    if log_version not in [4, 5]:
         raise ValueError(f'Log format {log_version} not supported with this QEMU release!')
+    return log_version
 
-def read_trace_records(events, fobj, read_header):
+def read_trace_records(events, fobj, read_header, log_version=5):
     """Deserialize trace records from a file, yielding record tuples (event, event_num, timestamp, pid, arg1, ..., arg6).
 
+    Each QEMU thread traces to its own buffer, so the file holds the records
+    of different threads in no particular order. They are yielded in
+    timestamp order, holding them back until a flush record says that no
+    older record follows.
+
+    Version 4 files have no flush records. There, each process wrote its
+    records in timestamp order, so a record is yielded once every process
+    seen so far has written a newer one.
+
     Args:
         event_mapping (str -> Event): events dict, indexed by name
         fobj (file): input file
         read_header (bool): whether headers were read from fobj
+        log_version (int): format version returned by read_trace_header()
 
     """
     frameinfo = inspect.getframeinfo(inspect.currentframe())
@@ -93,6 +106,13 @@ def read_trace_records(events, fobj, read_header):
         for event_id, event in enumerate(events):
             event_id_to_name[event_id] = event.name
 
+    # (timestamp, sequence, record), the sequence keeps records with the
+    # same timestamp in file order
+    pending = []
+    seq = 0
+    # pid -> timestamp of its last record, for files without flush records
+    watermark = {}
+
     while True:
         t = fobj.read(8)
         if len(t) == 0:
@@ -102,6 +122,10 @@ def read_trace_records(events, fobj, read_header):
         if rectype == record_type_mapping:
             event_id, event_name = get_mapping(fobj)
             event_id_to_name[event_id] = event_name
+        elif rectype == record_type_flush:
+            (flush_ns, ) = struct.unpack('=Q', fobj.read(8))
+            while pending and pending[0][0] <= flush_ns:
+                yield heapq.heappop(pending)[2]
         else:
             event_id, timestamp_ns, pid, args_payload = read_record(fobj)
             event_name = event_id_to_name[event_id]
@@ -128,7 +152,18 @@ def read_trace_records(events, fobj, read_header):
                     offset += 8
                     args.append(value)
 
-            yield (event_mapping[event_name], event_name, timestamp_ns, pid) + tuple(args)
+            rec = (event_mapping[event_name], event_name, timestamp_ns, pid) + tuple(args)
+            heapq.heappush(pending, (timestamp_ns, seq, rec))
+            seq += 1
+
+            if log_version < 5:
+                watermark[pid] = max(watermark.get(pid, 0), timestamp_ns)
+                low = min(watermark.values())
+                while pending and pending[0][0] <= low:
+                    yield heapq.heappop(pending)[2]
+
+    while pending:
+        yield heapq.heappop(pending)[2]
 
 class Analyzer:
     """[Deprecated. Refer to Analyzer2 instead.]
@@ -306,11 +341,12 @@ def _process(events, log_fobj, analyzer, read_header=True):
         read_header (bool, optional): Whether to read header data from the log data. Defaults to True.
     """
 
+    log_version = 5
     if read_header:
-        read_trace_header(log_fobj)
+        log_version = read_trace_header(log_fobj)
 
     with analyzer:
-        for event, event_id, timestamp_ns, record_pid, *rec_args in read_trace_records(events, log_fobj, read_header):
+        for event, event_id, timestamp_ns, record_pid, *rec_args in read_trace_records(events, log_fobj, read_header, log_version):
             analyzer._process_event(
                 rec_args,
                 event=event,
@@ -448,6 +448,15 @@ static QemuOptsList qemu_icount_opts = {
         }, {
             .name = "rrsnapshot",
             .type = QEMU_OPT_STRING,
+        }, {
+            .name = "rrcompress",
+            .type = QEMU_OPT_BOOL,
+        }, {
+            .name = "rrsnapshot-interval",
+            .type = QEMU_OPT_NUMBER,
+        }, {
+            .name = "rrsnapshot-mem",
+            .type = QEMU_OPT_SIZE,
         },
         { /* end of list */ }
     },
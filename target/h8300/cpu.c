@@ -205,7 +205,8 @@ static void h8300cpu_class_init(ObjectClass *klass, void *data)
     cc->gdb_read_register = h8300_cpu_gdb_read_register;
     cc->gdb_write_register = h8300_cpu_gdb_write_register;
     cc->disas_set_info = h8300_cpu_disas_set_info;
-    cc->gdb_num_core_regs = 26;
+    cc->gdb_num_core_regs = 10;
+    cc->gdb_core_xml_file = "h8300-core.xml";
     cc->tcg_ops = &h8300_tcg_ops;
 }
 
@@ -74,6 +74,7 @@ typedef struct CPUArchState {
     uint64_t mult_z;
     uint32_t mult_n;
     uint32_t mult_v;
+    uint32_t fuzz_prev_loc;     /* previous TB hash for edge coverage */
     
     /* Fields up to this point are cleared by a CPU reset */
     struct {} end_reset_fields;
@@ -83,7 +84,7 @@ typedef struct CPUArchState {
     uint32_t req_irq;           /* Requested interrupt no (hard) */
     uint32_t ack_irq;           /* execute irq */
     uint32_t req_pri;
-    uint32_t im;
+    uint32_t im;                /* interrupt mode, also the TB flags */
     qemu_irq ack;		/* Interrupt acknowledge */
 } CPUH8300State;
 
@@ -123,6 +124,25 @@ struct H8300CPUClass {
 
 #define CPU_RESOLVING_TYPE TYPE_H8300_CPU
 
+/* Coverage-guided fuzzing support (see hw/h8300/fuzz.c) */
+enum {
+    H8300_FUZZ_START,
+    H8300_FUZZ_END,
+    H8300_FUZZ_CRASH,
+    H8300_FUZZ_NR_HOOKS,
+};
+
+typedef struct H8300FuzzHooks {
+    uint8_t *map;               /* AFL edge counter bitmap, NULL if disabled */
+    uint32_t map_size;          /* power of 2 */
+    bool hook_valid[H8300_FUZZ_NR_HOOKS];
+    uint32_t hook_pc[H8300_FUZZ_NR_HOOKS];
+    /* Return true to leave the cpu loop */
+    bool (*event)(CPUH8300State *env, int hook);
+} H8300FuzzHooks;
+
+extern H8300FuzzHooks h8300_fuzz;
+
 void h8300_cpu_do_interrupt(CPUState *cpu);
 bool h8300_cpu_exec_interrupt(CPUState *cpu, int int_req);
 void h8300_cpu_dump_state(CPUState *cpu, FILE *f, int flags);
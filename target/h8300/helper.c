@@ -24,7 +24,7 @@
 #include "sysemu/sysemu.h"
 #include "hw/irq.h"
 
-static int intmode;
+H8300FuzzHooks h8300_fuzz;
 
 void h8300_cpu_unpack_ccr(CPUH8300State *env, uint32_t ccr)
 {
@@ -60,7 +60,7 @@ void h8300_cpu_do_interrupt(CPUState *cs)
     env->regs[7] -= 4;
     cpu_stl_data(env, env->regs[7], save_ccr_pc);
     env->ccr_i = 1;
-    switch (intmode) {
+    switch (env->im) {
     case 1:
         env->ccr_ui = 1;
         break;
@@ -90,7 +90,7 @@ bool h8300_cpu_exec_interrupt(CPUState *cs, int interrupt_request)
     CPUH8300State *env = &cpu->env;
     int pri;
 
-    switch(intmode) {
+    switch (env->im) {
     case 0:
         pri = env->ccr_i << 3;
         break;
@@ -119,8 +119,15 @@ hwaddr h8300_cpu_get_phys_page_debug(CPUState *cs, vaddr addr)
     return addr;
 }
 
+/*
+ * The interrupt mode is part of the TB flags, so that the inline check after
+ * RTE in translate.c agrees with h8300_cpu_exec_interrupt().  INTCR is only
+ * written by the guest, from the vCPU.
+ */
 void h8300_cpu_setim(int im)
 {
-    intmode = im;
+    H8300CPU *cpu = H8300_CPU(current_cpu ?: first_cpu);
+
+    cpu->env.im = im;
 }
 
@@ -9,3 +9,4 @@ DEF_HELPER_FLAGS_2(daa, TCG_CALL_NO_WG, i32, env, i32)
 DEF_HELPER_FLAGS_2(das, TCG_CALL_NO_WG, i32, env, i32)
 DEF_HELPER_1(eepmovb, void, env)
 DEF_HELPER_1(eepmovw, void, env)
+DEF_HELPER_2(fuzz_event, void, env, i32)
@@ -204,3 +204,10 @@ void G_NORETURN helper_trapa(CPUH8300State *env, uint32_t vec)
 {
     raise_exception(env, vec + 8, 0);
 }
+
+void helper_fuzz_event(CPUH8300State *env, uint32_t hook)
+{
+    if (h8300_fuzz.event(env, hook)) {
+        cpu_loop_exit(env_cpu(env));
+    }
+}
@@ -32,10 +32,41 @@
 #include "exec/helper-info.c.inc"
 #undef  HELPER_H
 
+/*
+ * Operands of the last flag setting instruction. A Bcc which directly
+ * follows it branches on these instead of re-deriving the condition
+ * from the flags.
+ */
+typedef struct DisasFlagSrc {
+    int kind;
+    uint32_t next;      /* address of the instruction that may use it */
+    TCGv a;
+    TCGv b;
+} DisasFlagSrc;
+
+enum {
+    FLAGS_NONE,
+    FLAGS_CMP,          /* a - b, sign extended operands */
+    FLAGS_RES,          /* N and Z from a, V from the operation */
+    FLAGS_MOV,          /* N and Z from a, V cleared */
+};
+
+/* conditional branches a trace may go past */
+#define MAX_SIDE_EXITS 8
+
+typedef struct DisasSideExit {
+    TCGLabel *label;
+    uint32_t dest;
+} DisasSideExit;
+
 typedef struct DisasContext {
     DisasContextBase base;
     CPUH8300State *env;
     uint32_t pc;
+    DisasFlagSrc flags;
+    unsigned goto_tb_used;
+    int nb_side_exits;
+    DisasSideExit side_exit[MAX_SIDE_EXITS];
 } DisasContext;
 
 typedef struct DisasCompare {
@@ -48,6 +79,7 @@ typedef struct DisasCompare {
 #define DISAS_JUMP    DISAS_TARGET_0
 #define DISAS_UPDATE  DISAS_TARGET_1
 #define DISAS_EXIT    DISAS_TARGET_2
+#define DISAS_IRQCHK  DISAS_TARGET_3
 
 /* global register indexes */
 static TCGv cpu_regs[8];
@@ -261,6 +293,7 @@ static bool use_goto_tb(DisasContext *dc, target_ulong dest)
 static void gen_goto_tb(DisasContext *dc, int n, target_ulong dest)
 {
     if (use_goto_tb(dc, dest)) {
+        dc->goto_tb_used |= 1 << n;
         tcg_gen_goto_tb(n);
         tcg_gen_movi_i32(cpu_pc, dest);
         tcg_gen_exit_tb(dc->base.tb, n);
@@ -340,6 +373,61 @@ static void ccr_cond(DisasCompare *dc, uint32_t cond)
     }
 }
 
+static void h8300_flags_src(DisasContext *ctx, int kind, TCGv a, TCGv b)
+{
+    ctx->flags.kind = kind;
+    ctx->flags.next = ctx->base.pc_next;
+    ctx->flags.a = a;
+    ctx->flags.b = b;
+}
+
+/*
+ * Branch to l on cond using the operands of the previous instruction.
+ * Sign extension keeps the unsigned order of B and W operands, so
+ * one brcond covers both signed and unsigned conditions.
+ */
+static bool h8300_fused_brcond(DisasContext *ctx, uint32_t cond, TCGLabel *l)
+{
+    static const TCGCond cmp_cond[16] = {
+        [2] = TCG_COND_GTU, [3] = TCG_COND_LEU,
+        [4] = TCG_COND_GEU, [5] = TCG_COND_LTU,
+        [6] = TCG_COND_NE,  [7] = TCG_COND_EQ,
+        [12] = TCG_COND_GE, [13] = TCG_COND_LT,
+        [14] = TCG_COND_GT, [15] = TCG_COND_LE,
+    };
+    /* against zero; 12 - 15 also depend on V */
+    static const TCGCond test_cond[16] = {
+        [6] = TCG_COND_NE,  [7] = TCG_COND_EQ,
+        [10] = TCG_COND_GE, [11] = TCG_COND_LT,
+        [12] = TCG_COND_GE, [13] = TCG_COND_LT,
+        [14] = TCG_COND_GT, [15] = TCG_COND_LE,
+    };
+    DisasFlagSrc *fs = &ctx->flags;
+    TCGCond c = TCG_COND_NEVER;
+
+    if (fs->next != ctx->pc) {
+        return false;
+    }
+    switch (fs->kind) {
+    case FLAGS_CMP:
+        c = cmp_cond[cond];
+        break;
+    case FLAGS_RES:
+        if (cond < 12) {
+            c = test_cond[cond];
+        }
+        break;
+    case FLAGS_MOV:
+        c = test_cond[cond];
+        break;
+    }
+    if (c == TCG_COND_NEVER) {
+        return false;
+    }
+    tcg_gen_brcond_i32(c, fs->a, fs->b, l);
+    return true;
+}
+
 static inline void h8300_gen_reg_ldb(int rn, TCGv val, bool sign)
 {
     int base;
@@ -434,6 +522,25 @@ static inline void h8300_reg_st(int sz, int rn, TCGv val)
     }
 }
 
+/* MOV: N and Z from the moved value, V cleared */
+static void h8300_mov_flags(DisasContext *ctx, int sz, TCGv val)
+{
+    switch(sz) {
+    case SZ_B:
+        tcg_gen_ext8s_i32(cpu_ccr_n, val);
+        break;
+    case SZ_W:
+        tcg_gen_ext16s_i32(cpu_ccr_n, val);
+        break;
+    default:
+        tcg_gen_mov_i32(cpu_ccr_n, val);
+        break;
+    }
+    tcg_gen_mov_i32(cpu_ccr_z, cpu_ccr_n);
+    tcg_gen_movi_i32(cpu_ccr_v, 0);
+    h8300_flags_src(ctx, FLAGS_MOV, cpu_ccr_n, tcg_constant_i32(0));
+}
+
 static bool trans_MOV_i(DisasContext *ctx, arg_MOV_i *a)
 {
     TCGv imm = tcg_constant_i32(a->imm);
@@ -448,9 +555,7 @@ static bool trans_MOV_i(DisasContext *ctx, arg_MOV_i *a)
         tcg_gen_mov_i32(cpu_regs[a->rd & 7], imm);
         break;
     }
-    tcg_gen_mov_i32(cpu_ccr_z, imm);
-    tcg_gen_mov_i32(cpu_ccr_n, imm);
-    tcg_gen_movi_i32(cpu_ccr_v, 0);
+    h8300_mov_flags(ctx, a->sz, imm);
     return true;
 }
 
@@ -473,9 +578,7 @@ static bool trans_MOV_r(DisasContext *ctx, arg_MOV_r *a)
         tcg_gen_mov_i32(temp, cpu_regs[a->rs]);
         break;
     }
-    tcg_gen_mov_i32(cpu_ccr_z, temp);
-    tcg_gen_mov_i32(cpu_ccr_n, temp);
-    tcg_gen_movi_i32(cpu_ccr_v, 0);
+    h8300_mov_flags(ctx, a->sz, temp);
     return true;
 }
 
@@ -497,9 +600,7 @@ static bool trans_MOV_mr(DisasContext *ctx, arg_MOV_mr *a)
         tcg_gen_mov_i32(cpu_regs[a->r & 7], temp);
         break;
     }
-    tcg_gen_mov_i32(cpu_ccr_z, temp);
-    tcg_gen_mov_i32(cpu_ccr_n, temp);
-    tcg_gen_movi_i32(cpu_ccr_v, 0);
+    h8300_mov_flags(ctx, a->sz, temp);
     return true;
 }
 
@@ -520,9 +621,7 @@ static bool trans_MOV_mpr(DisasContext *ctx, arg_MOV_mr *a)
         tcg_gen_mov_i32(cpu_regs[a->r & 7], temp);
         break;
     }
-    tcg_gen_mov_i32(cpu_ccr_z, temp);
-    tcg_gen_mov_i32(cpu_ccr_n, temp);
-    tcg_gen_movi_i32(cpu_ccr_v, 0);
+    h8300_mov_flags(ctx, a->sz, temp);
     return true;
 }
 
@@ -552,9 +651,7 @@ static bool trans_MOV_ar(DisasContext *ctx, arg_MOV_ar *a)
         tcg_gen_mov_i32(cpu_regs[a->r & 7], temp);
         break;
     }
-    tcg_gen_mov_i32(cpu_ccr_z, temp);
-    tcg_gen_mov_i32(cpu_ccr_n, temp);
-    tcg_gen_movi_i32(cpu_ccr_v, 0);
+    h8300_mov_flags(ctx, a->sz, temp);
     return true;
 }
 
@@ -576,9 +673,7 @@ static bool trans_MOV_rm(DisasContext *ctx, arg_MOV_mr *a)
         break;
     }
     tcg_gen_qemu_st_i32(temp, mem, 0, a->sz | MO_TE);
-    tcg_gen_mov_i32(cpu_ccr_z, temp);
-    tcg_gen_mov_i32(cpu_ccr_n, temp);
-    tcg_gen_movi_i32(cpu_ccr_v, 0);
+    h8300_mov_flags(ctx, a->sz, temp);
     return true;
 }
 
@@ -599,9 +694,7 @@ static bool trans_MOV_rmp(DisasContext *ctx, arg_MOV_mr *a)
         break;
     }
     tcg_gen_qemu_st_i32(temp, cpu_regs[a->er], 0, a->sz | MO_TE);
-    tcg_gen_mov_i32(cpu_ccr_z, temp);
-    tcg_gen_mov_i32(cpu_ccr_n, temp);
-    tcg_gen_movi_i32(cpu_ccr_v, 0);
+    h8300_mov_flags(ctx, a->sz, temp);
     return true;
 }
 
@@ -631,9 +724,7 @@ static bool trans_MOV_ra(DisasContext *ctx, arg_MOV_ra *a)
         break;
     }
     tcg_gen_qemu_st_i32(temp, mem, 0, a->sz | MO_TE);
-    tcg_gen_mov_i32(cpu_ccr_z, temp);
-    tcg_gen_mov_i32(cpu_ccr_n, temp);
-    tcg_gen_movi_i32(cpu_ccr_v, 0);
+    h8300_mov_flags(ctx, a->sz, temp);
     return true;
 }
 
@@ -865,23 +956,31 @@ static bool trans_ADDX_r(DisasContext *ctx, arg_ADDX_r *a)
 
 static bool trans_SUB_i(DisasContext *ctx, arg_SUB_i *a)
 {
-    TCGv temp, reg, imm;
+    TCGv temp, reg, imm, src;
     imm = tcg_constant_i32(a->imm);
     temp = tcg_temp_new();
+    src = tcg_temp_new();
     reg = h8300_reg_ld(a->sz, a->rd, temp, true);
+    tcg_gen_mov_i32(src, reg);
     h8300_sub(a->sz, reg, reg, imm, true);
+    h8300_flags_src(ctx, FLAGS_CMP, src, imm);
     h8300_reg_st(a->sz, a->rd, temp);
     return true;
 }
 
 static bool trans_SUB_r(DisasContext *ctx, arg_SUB_r *a)
 {
-    TCGv temp1, temp2, reg1, reg2;
+    TCGv temp1, temp2, reg1, reg2, src1, src2;
     temp1 = tcg_temp_new();
     temp2 = tcg_temp_new();
+    src1 = tcg_temp_new();
+    src2 = tcg_temp_new();
     reg1 = h8300_reg_ld(a->sz, a->rd, temp1, true);
     reg2 = h8300_reg_ld(a->sz, a->rs, temp2, true);
+    tcg_gen_mov_i32(src1, reg1);
+    tcg_gen_mov_i32(src2, reg2);
     h8300_sub(a->sz, reg1, reg1, reg2, true);
+    h8300_flags_src(ctx, FLAGS_CMP, src1, src2);
     h8300_reg_st(a->sz, a->rd, reg1);
     return true;
 }
@@ -924,6 +1023,7 @@ static bool trans_CMP_i(DisasContext *ctx, arg_CMP_i *a)
     temp = tcg_temp_new();
     reg = h8300_reg_ld(a->sz, a->rd, temp, true);
     h8300_sub(a->sz, NULL, reg, imm, true);
+    h8300_flags_src(ctx, FLAGS_CMP, reg, imm);
     return true;
 }
 
@@ -935,6 +1035,7 @@ static bool trans_CMP_r(DisasContext *ctx, arg_CMP_r *a)
     reg1 = h8300_reg_ld(a->sz, a->rd, temp1, true);
     reg2 = h8300_reg_ld(a->sz, a->rs, temp2, true);
     h8300_sub(a->sz, NULL, reg1, reg2, true);
+    h8300_flags_src(ctx, FLAGS_CMP, reg1, reg2);
     return true;
 }
 
@@ -946,6 +1047,7 @@ static bool trans_INC(DisasContext *ctx, arg_INC *a)
     reg = h8300_reg_ld(a->sz, a->rd, temp, false);
     h8300_add(a->sz, reg, reg, imm, false);
     h8300_reg_st(a->sz, a->rd, temp);
+    h8300_flags_src(ctx, FLAGS_RES, cpu_ccr_n, tcg_constant_i32(0));
     return true;
 }    
 
@@ -957,6 +1059,7 @@ static bool trans_DEC(DisasContext *ctx, arg_DEC *a)
     reg = h8300_reg_ld(a->sz, a->rd, temp, true);
     h8300_sub(a->sz, reg, reg, imm, false);
     h8300_reg_st(a->sz, a->rd, temp);
+    h8300_flags_src(ctx, FLAGS_RES, cpu_ccr_n, tcg_constant_i32(0));
     return true;
 }    
 
@@ -2248,11 +2351,77 @@ static bool trans_BOP2(DisasContext *ctx, arg_BOP2 *a)
     return false;
 }
 
+/*
+ * In a trace, carry on with the hot successor of a branch and leave
+ * to the cold one from a side exit that tb_stop emits. The fuzzer's
+ * coverage map only sees TB entries, so it gets no traces.
+ */
+static bool trace_branch(DisasContext *ctx, uint32_t cd, uint32_t taken)
+{
+    vaddr dest;
+    TCGLabel *l;
+    DisasCompare dc;
+
+    if (h8300_fuzz.map) {
+        return false;
+    }
+    if (cd == 0) {
+        if (!translator_trace_jump(&ctx->base, taken)) {
+            return false;
+        }
+        ctx->base.pc_next = taken;
+        return true;
+    }
+    if (ctx->nb_side_exits == MAX_SIDE_EXITS ||
+        !translator_trace_branch(&ctx->base, env_cpu(ctx->env),
+                                 taken, &dest)) {
+        return false;
+    }
+
+    l = gen_new_label();
+    if (dest == taken) {
+        /* conditions come in pairs that differ in bit 0 */
+        cd ^= 1;
+    }
+    if (!h8300_fused_brcond(ctx, cd, l)) {
+        dc.temp = tcg_temp_new();
+        ccr_cond(&dc, cd);
+        tcg_gen_brcondi_i32(dc.cond, dc.value, 0, l);
+    }
+    ctx->side_exit[ctx->nb_side_exits].label = l;
+    ctx->side_exit[ctx->nb_side_exits].dest =
+        dest == taken ? ctx->base.pc_next : taken;
+    ctx->nb_side_exits++;
+    ctx->base.pc_next = dest;
+    return true;
+}
+
+static void gen_side_exits(DisasContext *ctx)
+{
+    int i, n;
+
+    for (i = 0; i < ctx->nb_side_exits; i++) {
+        gen_set_label(ctx->side_exit[i].label);
+        /* chain while there are goto_tb slots left */
+        n = ctx->goto_tb_used & 1;
+        if (!(ctx->goto_tb_used & (1 << n))) {
+            gen_goto_tb(ctx, n, ctx->side_exit[i].dest);
+        } else {
+            tcg_gen_movi_i32(cpu_pc, ctx->side_exit[i].dest);
+            tcg_gen_lookup_and_goto_ptr();
+        }
+    }
+}
+
 static bool trans_Bcc(DisasContext *ctx, arg_Bcc *a)
 {
     DisasCompare dc;
     TCGLabel *t, *done;
 
+    if (a->cd != 1 && trace_branch(ctx, a->cd, ctx->base.pc_next + a->dsp)) {
+        return true;
+    }
+
     switch (a->cd) {
     case 0:
         /* always true case */
@@ -2263,11 +2432,13 @@ static bool trans_Bcc(DisasContext *ctx, arg_Bcc *a)
         /* Nothing do */
         break;
     case 2 ... 15:
-        dc.temp = tcg_temp_new();
-        ccr_cond(&dc, a->cd);
         t = gen_new_label();
         done = gen_new_label();
-        tcg_gen_brcondi_i32(dc.cond, dc.value, 0, t);
+        if (!h8300_fused_brcond(ctx, a->cd, t)) {
+            dc.temp = tcg_temp_new();
+            ccr_cond(&dc, a->cd);
+            tcg_gen_brcondi_i32(dc.cond, dc.value, 0, t);
+        }
         gen_goto_tb(ctx, 0, ctx->base.pc_next);
         tcg_gen_br(done);
         gen_set_label(t);
@@ -2366,7 +2537,7 @@ static bool trans_RTE(DisasContext *ctx, arg_RTE *a)
     tcg_gen_extract_i32(temp2, temp1, 24, 8);
     tcg_gen_movi_i32(reg, 0);
     gen_helper_set_ccr(tcg_env, reg, temp2);
-    ctx->base.is_jmp = DISAS_EXIT;
+    ctx->base.is_jmp = DISAS_IRQCHK;
     return true;
 }
 
@@ -2600,10 +2771,53 @@ static void h8300_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cs)
     CPUH8300State *env = cpu_env(cs);
     DisasContext *ctx = container_of(dcbase, DisasContext, base);
     ctx->env = env;
+    ctx->flags.kind = FLAGS_NONE;
+    ctx->flags.next = 0;
+    ctx->goto_tb_used = 0;
+    ctx->nb_side_exits = 0;
+}
+
+/* AFL style edge coverage: map[cur ^ prev]++, prev = cur >> 1 */
+static void gen_fuzz_edge(DisasContext *ctx)
+{
+    uint32_t cur = ctx->base.pc_first;
+    TCGv idx, cnt;
+    TCGv_ptr ptr;
+
+    cur = ((cur >> 4) ^ (cur << 8)) & (h8300_fuzz.map_size - 1);
+    idx = tcg_temp_new();
+    cnt = tcg_temp_new();
+    ptr = tcg_temp_new_ptr();
+    tcg_gen_ld_i32(idx, tcg_env, offsetof(CPUH8300State, fuzz_prev_loc));
+    tcg_gen_xori_i32(idx, idx, cur);
+    tcg_gen_ext_i32_ptr(ptr, idx);
+    tcg_gen_add_ptr(ptr, ptr, tcg_constant_ptr(h8300_fuzz.map));
+    tcg_gen_ld8u_i32(cnt, ptr, 0);
+    tcg_gen_addi_i32(cnt, cnt, 1);
+    tcg_gen_st8_i32(cnt, ptr, 0);
+    tcg_gen_st_i32(tcg_constant_i32(cur >> 1), tcg_env,
+                   offsetof(CPUH8300State, fuzz_prev_loc));
+}
+
+static void gen_fuzz_hook(DisasContext *ctx)
+{
+    int i;
+
+    for (i = 0; i < H8300_FUZZ_NR_HOOKS; i++) {
+        if (h8300_fuzz.hook_valid[i] && h8300_fuzz.hook_pc[i] == ctx->pc) {
+            tcg_gen_movi_i32(cpu_pc, ctx->pc);
+            gen_helper_fuzz_event(tcg_env, tcg_constant_i32(i));
+        }
+    }
 }
 
 static void h8300_tr_tb_start(DisasContextBase *dcbase, CPUState *cs)
 {
+    DisasContext *ctx = container_of(dcbase, DisasContext, base);
+
+    if (h8300_fuzz.map) {
+        gen_fuzz_edge(ctx);
+    }
 }
 
 static void h8300_tr_insn_start(DisasContextBase *dcbase, CPUState *cs)
@@ -2611,6 +2825,14 @@ static void h8300_tr_insn_start(DisasContextBase *dcbase, CPUState *cs)
     DisasContext *ctx = container_of(dcbase, DisasContext, base);
 
     tcg_gen_insn_start(ctx->base.pc_next);
+    /*
+     * Let plugin callbacks which read registers see the PC of the
+     * instruction. TCG only stores it where globals get synced, so
+     * TBs without plugins and callbacks without registers don't pay.
+     */
+    if (ctx->base.plugin_enabled) {
+        tcg_gen_movi_i32(cpu_pc, ctx->base.pc_next);
+    }
 }
 
 static void h8300_tr_translate_insn(DisasContextBase *dcbase, CPUState *cs)
@@ -2619,6 +2841,9 @@ static void h8300_tr_translate_insn(DisasContextBase *dcbase, CPUState *cs)
     uint32_t insn;
 
     ctx->pc = ctx->base.pc_next;
+    if (h8300_fuzz.event) {
+        gen_fuzz_hook(ctx);
+    }
     insn = decode_load(ctx);
     if (!decode(ctx, insn)) {
         qemu_log_mask(LOG_GUEST_ERROR,
@@ -2626,6 +2851,52 @@ static void h8300_tr_translate_insn(DisasContextBase *dcbase, CPUState *cs)
     }
 }
 
+/*
+ * Leave the TB to the main loop only if the restored interrupt mask
+ * accepts the pending request, same as h8300_cpu_exec_interrupt.
+ * Otherwise keep going with the next TB.
+ */
+static void gen_irq_check(DisasContext *ctx)
+{
+    TCGLabel *no_irq = gen_new_label();
+    TCGv req = tcg_temp_new();
+    TCGv pri = tcg_temp_new();
+    TCGv temp = tcg_temp_new();
+
+    tcg_gen_ld_i32(req, tcg_env, offsetof(CPUState, interrupt_request) -
+                   offsetof(H8300CPU, env));
+    tcg_gen_andi_i32(req, req, CPU_INTERRUPT_HARD);
+    tcg_gen_brcondi_i32(TCG_COND_EQ, req, 0, no_irq);
+
+    /* set_ccr updated these behind TCG, read them from env */
+    tcg_gen_ld_i32(pri, tcg_env, offsetof(CPUH8300State, ccr_i));
+    switch (ctx->base.tb->flags) {
+    case 0:
+        tcg_gen_shli_i32(pri, pri, 3);
+        break;
+    case 1:
+        tcg_gen_ld_i32(temp, tcg_env, offsetof(CPUH8300State, ccr_ui));
+        tcg_gen_shli_i32(pri, pri, 1);
+        tcg_gen_or_i32(pri, pri, temp);
+        break;
+    case 2:
+        tcg_gen_ld_i32(temp, tcg_env, offsetof(CPUH8300State, exr_i));
+        tcg_gen_shli_i32(pri, pri, 3);
+        tcg_gen_or_i32(pri, pri, temp);
+        tcg_gen_addi_i32(pri, pri, 1);
+        break;
+    default:
+        tcg_gen_movi_i32(pri, 15);
+        break;
+    }
+    tcg_gen_ld_i32(req, tcg_env, offsetof(CPUH8300State, req_pri));
+    tcg_gen_brcond_i32(TCG_COND_GT, pri, req, no_irq);
+    tcg_gen_exit_tb(NULL, 0);
+
+    gen_set_label(no_irq);
+    tcg_gen_lookup_and_goto_ptr();
+}
+
 static void h8300_tr_tb_stop(DisasContextBase *dcbase, CPUState *cs)
 {
     DisasContext *ctx = container_of(dcbase, DisasContext, base);
@@ -2638,6 +2909,9 @@ static void h8300_tr_tb_stop(DisasContextBase *dcbase, CPUState *cs)
     case DISAS_JUMP:
         tcg_gen_lookup_and_goto_ptr();
         break;
+    case DISAS_IRQCHK:
+        gen_irq_check(ctx);
+        break;
     case DISAS_UPDATE:
         tcg_gen_movi_i32(cpu_pc, ctx->base.pc_next);
         /* fall through */
@@ -2649,6 +2923,7 @@ static void h8300_tr_tb_stop(DisasContextBase *dcbase, CPUState *cs)
     default:
         g_assert_not_reached();
     }
+    gen_side_exits(ctx);
 }
 
 static void h8300_tr_disas_log(const DisasContextBase *dcbase,
@@ -111,6 +111,7 @@ typedef enum {
 #endif
 
 #define have_bmi1         (cpuinfo & CPUINFO_BMI1)
+#define have_bmi2         (cpuinfo & CPUINFO_BMI2)
 #define have_popcnt       (cpuinfo & CPUINFO_POPCNT)
 #define have_avx1         (cpuinfo & CPUINFO_AVX1)
 #define have_avx2         (cpuinfo & CPUINFO_AVX2)
@@ -181,7 +182,8 @@ typedef enum {
 #define TCG_TARGET_HAS_ctpop_i64        have_popcnt
 #define TCG_TARGET_HAS_deposit_i64      1
 #define TCG_TARGET_HAS_extract_i64      1
-#define TCG_TARGET_HAS_sextract_i64     0
+/* RORX lets us sign-extend to 64 bits without the high-byte registers */
+#define TCG_TARGET_HAS_sextract_i64     have_bmi2
 #define TCG_TARGET_HAS_extract2_i64     1
 #define TCG_TARGET_HAS_negsetcond_i64   1
 #define TCG_TARGET_HAS_add2_i64         1
@@ -223,16 +225,29 @@ typedef enum {
 #define TCG_TARGET_HAS_bitsel_vec       have_avx512vl
 #define TCG_TARGET_HAS_cmpsel_vec       -1
 
+/*
+ * Fields that neither start at bit 0 nor end at the top are rotated
+ * down to bit 0, inserted there and rotated back; the generic expansion
+ * needs two masks, a shift, an or and a temporary.
+ */
+#define TCG_TARGET_deposit_rot_valid(ofs, len, bits) \
+    (TCG_TARGET_REG_BITS == 64 && (ofs) != 0 && (len) < 32 && \
+     (ofs) + (len) < (bits))
 #define TCG_TARGET_deposit_i32_valid(ofs, len) \
     (((ofs) == 0 && ((len) == 8 || (len) == 16)) || \
-     (TCG_TARGET_REG_BITS == 32 && (ofs) == 8 && (len) == 8))
-#define TCG_TARGET_deposit_i64_valid    TCG_TARGET_deposit_i32_valid
+     (TCG_TARGET_REG_BITS == 32 && (ofs) == 8 && (len) == 8) || \
+     TCG_TARGET_deposit_rot_valid(ofs, len, 32))
+#define TCG_TARGET_deposit_i64_valid(ofs, len) \
+    (((ofs) == 0 && ((len) == 8 || (len) == 16)) || \
+     TCG_TARGET_deposit_rot_valid(ofs, len, 64))
 
 /* Check for the possibility of high-byte extraction and, for 64-bit,
-   zero-extending 32-bit right-shift.  */
-#define TCG_TARGET_extract_i32_valid(ofs, len) ((ofs) == 8 && (len) == 8)
+   zero-extending 32-bit right-shift.  With BMI2, RORX and a shift
+   extract any field.  */
+#define TCG_TARGET_extract_i32_valid(ofs, len) \
+    (((ofs) == 8 && (len) == 8) || have_bmi2)
 #define TCG_TARGET_extract_i64_valid(ofs, len) \
-    (((ofs) == 8 && (len) == 8) || ((ofs) + (len)) == 32)
+    (((ofs) == 8 && (len) == 8) || ((ofs) + (len)) == 32 || have_bmi2)
 
 /* This defines the natural memory order supported by this
  * architecture before guarantees made by various barrier
@@ -45,6 +45,20 @@ typedef struct MemCopyInfo {
     TCGType type;
 } MemCopyInfo;
 
+/*
+ * Bits [pos, pos + len) of a value are bits [src_pos, src_pos + len)
+ * of @src, for as long as @src has not been redefined (see gen).
+ */
+typedef struct TempField {
+    TCGTemp *src;
+    uint32_t src_gen;
+    uint8_t pos;
+    uint8_t len;
+    uint8_t src_pos;
+} TempField;
+
+#define MAX_TEMP_FIELDS 4
+
 typedef struct TempOptInfo {
     bool is_const;
     TCGTemp *prev_copy;
@@ -53,12 +67,16 @@ typedef struct TempOptInfo {
     uint64_t val;
     uint64_t z_mask;  /* mask bit is 0 if and only if value bit is 0 */
     uint64_t s_mask;  /* a left-aligned mask of clrsb(value) bits. */
+    uint32_t gen;     /* bumped each time the value is forgotten */
+    int nb_fields;
+    TempField field[MAX_TEMP_FIELDS];
 } TempOptInfo;
 
 typedef struct OptContext {
     TCGContext *tcg;
     TCGOp *prev_mb;
     TCGTempSet temps_used;
+    uint32_t gen;
 
     IntervalTreeRoot mem_copy;
     QSIMPLEQ_HEAD(, MemCopyInfo) mem_free;
@@ -67,6 +85,8 @@ typedef struct OptContext {
     uint64_t a_mask;  /* mask bit is 0 iff value identical to first input */
     uint64_t z_mask;  /* mask bit is 0 iff value bit is 0 */
     uint64_t s_mask;  /* mask of clrsb(value) bits */
+    int nb_fields;
+    TempField field[MAX_TEMP_FIELDS];
     TCGType type;
 } OptContext;
 
@@ -158,6 +178,8 @@ static void init_ts_info(OptContext *ctx, TCGTemp *ts)
 
     ti->next_copy = ts;
     ti->prev_copy = ts;
+    ti->gen = ++ctx->gen;
+    ti->nb_fields = 0;
     QSIMPLEQ_INIT(&ti->mem_copy);
     if (ts->kind == TEMP_CONST) {
         ti->is_const = true;
@@ -255,6 +277,8 @@ static void reset_ts(OptContext *ctx, TCGTemp *ts)
     ti->is_const = false;
     ti->z_mask = -1;
     ti->s_mask = 0;
+    ti->gen = ++ctx->gen;
+    ti->nb_fields = 0;
 
     if (!QSIMPLEQ_EMPTY(&ti->mem_copy)) {
         if (ts == nts) {
@@ -300,6 +324,78 @@ static void record_mem_copy(OptContext *ctx, TCGType type,
     QSIMPLEQ_INSERT_TAIL(&ti->mem_copy, mc, next);
 }
 
+static bool field_is_valid(OptContext *ctx, const TempField *f)
+{
+    return test_bit(temp_idx(f->src), ctx->temps_used.l)
+        && ts_info(f->src)->gen == f->src_gen
+        && f->src->base_type == ctx->type;
+}
+
+/*
+ * Find where bits [pos, pos + len) of @ts come from.  If they are not
+ * known to be a single field of some other temp, they come from @ts.
+ */
+static TCGTemp *field_source(OptContext *ctx, TCGTemp *ts,
+                             int pos, int len, int *psrc_pos)
+{
+    TempOptInfo *ti = ts_info(ts);
+
+    for (int i = 0; i < ti->nb_fields; i++) {
+        const TempField *f = &ti->field[i];
+
+        if (pos >= f->pos && pos + len <= f->pos + f->len &&
+            field_is_valid(ctx, f)) {
+            *psrc_pos = f->src_pos + pos - f->pos;
+            return f->src;
+        }
+    }
+    *psrc_pos = pos;
+    return ts;
+}
+
+/*
+ * Record that bits [pos, pos + len) of the output of @op come from bits
+ * [src_pos, src_pos + len) of @src.
+ */
+static void field_add(OptContext *ctx, TCGOp *op, int pos, int len,
+                      TCGTemp *src, int src_pos)
+{
+    TempField *f;
+
+    /* The output's previous value is gone once the op is done. */
+    if (len <= 0 || src == arg_temp(op->args[0]) ||
+        ctx->nb_fields == MAX_TEMP_FIELDS) {
+        return;
+    }
+    f = &ctx->field[ctx->nb_fields++];
+    f->src = src;
+    f->src_gen = ts_info(src)->gen;
+    f->pos = pos;
+    f->len = len;
+    f->src_pos = src_pos;
+}
+
+/*
+ * Record that bits [lo, hi) of the output of @op are the same bits of
+ * @ts, along with what is known of where @ts got them from.
+ */
+static void field_add_range(OptContext *ctx, TCGOp *op,
+                            int lo, int hi, TCGTemp *ts)
+{
+    TempOptInfo *ti = ts_info(ts);
+
+    for (int i = 0; i < ti->nb_fields; i++) {
+        const TempField *f = &ti->field[i];
+        int s = MAX(lo, f->pos);
+        int e = MIN(hi, f->pos + f->len);
+
+        if (s < e && field_is_valid(ctx, f)) {
+            field_add(ctx, op, s, e - s, f->src, f->src_pos + s - f->pos);
+        }
+    }
+    field_add(ctx, op, lo, hi - lo, ts, lo);
+}
+
 static bool ts_are_copies(TCGTemp *ts1, TCGTemp *ts2)
 {
     TCGTemp *i;
@@ -396,6 +492,8 @@ static bool tcg_opt_gen_mov(OptContext *ctx, TCGOp *op, TCGArg dst, TCGArg src)
     if (src_ts->type == dst_ts->type) {
         TempOptInfo *ni = ts_info(si->next_copy);
 
+        di->nb_fields = si->nb_fields;
+        memcpy(di->field, si->field, sizeof(si->field));
         di->next_copy = si->next_copy;
         di->prev_copy = src_ts;
         ni->prev_copy = dst_ts;
@@ -833,6 +931,8 @@ static void finish_folding(OptContext *ctx, TCGOp *op)
         if (i == 0) {
             ts_info(ts)->z_mask = ctx->z_mask;
             ts_info(ts)->s_mask = ctx->s_mask;
+            ts_info(ts)->nb_fields = ctx->nb_fields;
+            memcpy(ts_info(ts)->field, ctx->field, sizeof(ctx->field));
         }
     }
 }
@@ -848,6 +948,38 @@ static void finish_folding(OptContext *ctx, TCGOp *op)
  * folders for more specific operations.
  */
 
+/*
+ * If bits [pos, pos + len) of the input of @op are known to be a field
+ * of another temp, read them from there instead, so that a deposit
+ * followed by an extract of the same bits forwards the deposited value.
+ * With @fixed_pos the opcode has no position argument, and the field
+ * must be found at the same position.  Returns the position to read.
+ */
+static int fold_field_source(OptContext *ctx, TCGOp *op,
+                             int pos, int len, bool fixed_pos)
+{
+    int src_pos;
+    TCGTemp *src = field_source(ctx, arg_temp(op->args[1]),
+                                pos, len, &src_pos);
+
+    if (src == arg_temp(op->args[1])) {
+        return pos;
+    }
+    if (src_pos != pos) {
+        if (fixed_pos) {
+            return pos;
+        }
+        /* The backend may only implement some positions. */
+        if (ctx->type == TCG_TYPE_I32
+            ? !TCG_TARGET_extract_i32_valid(src_pos, len)
+            : !TCG_TARGET_extract_i64_valid(src_pos, len)) {
+            return pos;
+        }
+    }
+    op->args[1] = temp_arg(src);
+    return src_pos;
+}
+
 static bool fold_const1(OptContext *ctx, TCGOp *op)
 {
     if (arg_is_const(op->args[1])) {
@@ -1424,10 +1556,88 @@ static bool fold_ctpop(OptContext *ctx, TCGOp *op)
     return false;
 }
 
+/*
+ * Look through the fields that the inputs of a deposit are known to be
+ * made of: deposit the value a field was extracted from, widen the
+ * deposit over an adjacent field holding the neighbouring bits of the
+ * same value, and insert into an older value if everything else that
+ * was deposited into the current one is overwritten.
+ */
+static void fold_deposit_fields(OptContext *ctx, TCGOp *op)
+{
+    int width = ctx->type == TCG_TYPE_I32 ? 32 : 64;
+    TCGTemp *base = arg_temp(op->args[1]);
+    TempOptInfo *bi = ts_info(base);
+    int pos = op->args[3];
+    int len = op->args[4];
+    TCGTemp *src, *lo_src, *hi_src;
+    int src_pos, lo_pos, hi_pos;
+
+    src = field_source(ctx, arg_temp(op->args[2]), 0, len, &src_pos);
+    if (src_pos == 0) {
+        op->args[2] = temp_arg(src);
+    }
+
+    /* Merge with a field of the same value just below or above. */
+    for (int i = 0; i < bi->nb_fields; i++) {
+        const TempField *f = &bi->field[i];
+        int npos, nlen;
+
+        if (f->src != src || !field_is_valid(ctx, f)) {
+            continue;
+        }
+        if (f->pos + f->len == pos && f->src_pos == 0 &&
+            src_pos == f->len) {
+            npos = f->pos;
+        } else if (f->pos == pos + len && src_pos == 0 &&
+                   f->src_pos == len) {
+            npos = pos;
+        } else {
+            continue;
+        }
+        nlen = f->len + len;
+        if (ctx->type == TCG_TYPE_I32
+            ? TCG_TARGET_deposit_i32_valid(npos, nlen)
+            : TCG_TARGET_deposit_i64_valid(npos, nlen)) {
+            op->args[2] = temp_arg(src);
+            op->args[3] = pos = npos;
+            op->args[4] = len = nlen;
+            src_pos = 0;
+            break;
+        }
+    }
+
+    /*
+     * If the bits around the field all come from the same older value,
+     * deposit into that instead; an earlier deposit that this one fully
+     * overwrites then becomes dead.
+     */
+    lo_src = field_source(ctx, base, 0, pos, &lo_pos);
+    hi_src = field_source(ctx, base, pos + len, width - pos - len, &hi_pos);
+    if (pos == 0) {
+        lo_src = hi_src;
+        lo_pos = 0;
+    } else if (pos + len == width) {
+        hi_src = lo_src;
+        hi_pos = pos + len;
+    }
+    if (len < width && lo_src == hi_src && lo_src != base &&
+        lo_pos == 0 && hi_pos == pos + len) {
+        op->args[1] = temp_arg(lo_src);
+        base = lo_src;
+    }
+
+    field_add(ctx, op, pos, len, src, src_pos);
+    field_add_range(ctx, op, 0, pos, base);
+    field_add_range(ctx, op, pos + len, width, base);
+}
+
 static bool fold_deposit(OptContext *ctx, TCGOp *op)
 {
     TCGOpcode and_opc;
 
+    fold_deposit_fields(ctx, op);
+
     if (arg_is_const(op->args[1]) && arg_is_const(op->args[2])) {
         uint64_t t1 = arg_info(op->args[1])->val;
         uint64_t t2 = arg_info(op->args[2])->val;
@@ -1530,6 +1740,8 @@ static bool fold_extract(OptContext *ctx, TCGOp *op)
     int pos = op->args[2];
     int len = op->args[3];
 
+    op->args[2] = pos = fold_field_source(ctx, op, pos, len, false);
+
     if (arg_is_const(op->args[1])) {
         uint64_t t;
 
@@ -1545,6 +1757,7 @@ static bool fold_extract(OptContext *ctx, TCGOp *op)
     }
     ctx->z_mask = z_mask;
     ctx->s_mask = smask_from_zmask(z_mask);
+    field_add(ctx, op, 0, len, arg_temp(op->args[1]), pos);
 
     return fold_masks(ctx, op);
 }
@@ -1572,34 +1785,40 @@ static bool fold_exts(OptContext *ctx, TCGOp *op)
 {
     uint64_t s_mask_old, s_mask, z_mask, sign;
     bool type_change = false;
-
-    if (fold_const1(ctx, op)) {
-        return true;
-    }
-
-    z_mask = arg_info(op->args[1])->z_mask;
-    s_mask = arg_info(op->args[1])->s_mask;
-    s_mask_old = s_mask;
+    int len;
 
     switch (op->opc) {
     CASE_OP_32_64(ext8s):
         sign = INT8_MIN;
-        z_mask = (uint8_t)z_mask;
+        len = 8;
         break;
     CASE_OP_32_64(ext16s):
         sign = INT16_MIN;
-        z_mask = (uint16_t)z_mask;
+        len = 16;
         break;
     case INDEX_op_ext_i32_i64:
         type_change = true;
         QEMU_FALLTHROUGH;
     case INDEX_op_ext32s_i64:
         sign = INT32_MIN;
-        z_mask = (uint32_t)z_mask;
+        len = 32;
         break;
     default:
         g_assert_not_reached();
     }
+    if (!type_change) {
+        fold_field_source(ctx, op, 0, len, true);
+    }
+
+    if (fold_const1(ctx, op)) {
+        return true;
+    }
+
+    z_mask = arg_info(op->args[1])->z_mask;
+    s_mask = arg_info(op->args[1])->s_mask;
+    s_mask_old = s_mask;
+
+    z_mask = extract64(z_mask, 0, len);
 
     if (z_mask & sign) {
         z_mask |= sign;
@@ -1610,6 +1829,7 @@ static bool fold_exts(OptContext *ctx, TCGOp *op)
     ctx->s_mask = s_mask;
     if (!type_change) {
         ctx->a_mask = s_mask & ~s_mask_old;
+        field_add(ctx, op, 0, len, arg_temp(op->args[1]), 0);
     }
 
     return fold_masks(ctx, op);
@@ -1619,6 +1839,24 @@ static bool fold_extu(OptContext *ctx, TCGOp *op)
 {
     uint64_t z_mask_old, z_mask;
     bool type_change = false;
+    int len = 0;
+
+    switch (op->opc) {
+    CASE_OP_32_64(ext8u):
+        len = 8;
+        break;
+    CASE_OP_32_64(ext16u):
+        len = 16;
+        break;
+    case INDEX_op_ext32u_i64:
+        len = 32;
+        break;
+    default:
+        break;
+    }
+    if (len) {
+        fold_field_source(ctx, op, 0, len, true);
+    }
 
     if (fold_const1(ctx, op)) {
         return true;
@@ -1653,6 +1891,9 @@ static bool fold_extu(OptContext *ctx, TCGOp *op)
     if (!type_change) {
         ctx->a_mask = z_mask_old ^ z_mask;
     }
+    if (len) {
+        field_add(ctx, op, 0, len, arg_temp(op->args[1]), 0);
+    }
     return fold_masks(ctx, op);
 }
 
@@ -2061,6 +2302,8 @@ static bool fold_sextract(OptContext *ctx, TCGOp *op)
     int pos = op->args[2];
     int len = op->args[3];
 
+    op->args[2] = pos = fold_field_source(ctx, op, pos, len, false);
+
     if (arg_is_const(op->args[1])) {
         uint64_t t;
 
@@ -2081,6 +2324,7 @@ static bool fold_sextract(OptContext *ctx, TCGOp *op)
     if (pos == 0) {
         ctx->a_mask = s_mask & ~s_mask_old;
     }
+    field_add(ctx, op, 0, len, arg_temp(op->args[1]), pos);
 
     return fold_masks(ctx, op);
 }
@@ -2387,6 +2631,7 @@ void tcg_optimize(TCGContext *s)
         ctx.a_mask = -1;
         ctx.z_mask = -1;
         ctx.s_mask = 0;
+        ctx.nb_fields = 0;
 
         /*
          * Process each opcode.
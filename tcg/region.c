@@ -72,6 +72,12 @@ struct tcg_region_state {
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+    uint64_t *gen; /* when each region was allocated; 0 if empty */
+    uint64_t next_gen;
+
+    /* execution counts of the TBs, see tcg_tb_exec_count() */
+    uint64_t *exec_counts;
+    size_t exec_count_stride;
 };
 
 static struct tcg_region_state region;
@@ -296,6 +302,23 @@ void tcg_tb_foreach(GTraverseFunc func, gpointer user_data)
     tcg_region_tree_unlock_all();
 }
 
+/*
+ * Number of times @tb was entered, bumped by the TB itself when hot block
+ * counting is enabled. The update is not atomic, so with MTTCG this is a
+ * close estimate rather than an exact count.
+ *
+ * The counts are kept in an array of their own rather than in the TB, so
+ * that updating them does not write next to the host code being run.
+ * TBs start at least exec_count_stride bytes apart, which gives each
+ * one its own slot.
+ */
+uint64_t *tcg_tb_exec_count(const TranslationBlock *tb)
+{
+    size_t off = (const char *)tb - (const char *)region.start_aligned;
+
+    return &region.exec_counts[off / region.exec_count_stride];
+}
+
 size_t tcg_nb_tbs(void)
 {
     size_t nb_tbs = 0;
@@ -359,11 +382,23 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
 
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
-        return true;
+    size_t i = region.current;
+
+    if (i < region.n) {
+        region.current++;
+    } else {
+        /* all regions have been handed out; reuse an evicted one */
+        for (i = 0; i < region.n; i++) {
+            if (!region.gen[i]) {
+                break;
+            }
+        }
+        if (i == region.n) {
+            return true;
+        }
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
+    tcg_region_assign(s, i);
+    region.gen[i] = ++region.next_gen;
     return false;
 }
 
@@ -412,6 +447,7 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    memset(region.gen, 0, region.n * sizeof(*region.gen));
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = qatomic_read(&tcg_ctxs[i]);
@@ -422,6 +458,127 @@ void tcg_region_reset_all(void)
     tcg_region_tree_reset_all();
 }
 
+static bool tcg_region_in_use__locked(size_t idx)
+{
+    unsigned int n_ctxs = qatomic_read(&tcg_cur_ctxs);
+    unsigned int i;
+    void *start, *end;
+
+    tcg_region_bounds(idx, &start, &end);
+    for (i = 0; i < n_ctxs; i++) {
+        const TCGContext *s = qatomic_read(&tcg_ctxs[i]);
+
+        if (s->code_gen_buffer == start) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static gboolean tcg_region_heat_iter(gpointer key, gpointer value,
+                                     gpointer data)
+{
+    const TranslationBlock *tb = value;
+    uint64_t *heat = data;
+
+    *heat += *tcg_tb_exec_count(tb);
+    return false;
+}
+
+/*
+ * Pick the region to evict when the buffer is full: the oldest of those
+ * whose TBs have not run more than the average region's, so that the
+ * hot working set stays resident even when it was translated first.
+ * Without exec counts this is simply the oldest region.  Regions that a
+ * context is translating into are never picked.
+ * Returns false if there is no region to evict, e.g. when there is only
+ * one.  Call from a safe-work context.
+ */
+bool tcg_region_evict_pick(size_t *pidx)
+{
+    g_autofree uint64_t *heat = g_new0(uint64_t, region.n);
+    g_autofree bool *cand = g_new0(bool, region.n);
+    uint64_t total = 0, best_gen = UINT64_MAX;
+    size_t i, n_cand = 0, best = region.n;
+
+    qemu_mutex_lock(&region.lock);
+    for (i = 0; i < region.n; i++) {
+        cand[i] = region.gen[i] && !tcg_region_in_use__locked(i);
+        n_cand += cand[i];
+    }
+    qemu_mutex_unlock(&region.lock);
+
+    if (n_cand == 0) {
+        return false;
+    }
+
+    for (i = 0; i < region.n; i++) {
+        struct tcg_region_tree *rt = region_trees + i * tree_size;
+
+        if (cand[i]) {
+            qemu_mutex_lock(&rt->lock);
+            q_tree_foreach(rt->tree, tcg_region_heat_iter, &heat[i]);
+            qemu_mutex_unlock(&rt->lock);
+            total += heat[i];
+        }
+    }
+
+    qemu_mutex_lock(&region.lock);
+    for (i = 0; i < region.n; i++) {
+        if (cand[i] && heat[i] <= total / n_cand &&
+            region.gen[i] < best_gen) {
+            best = i;
+            best_gen = region.gen[i];
+        }
+    }
+    qemu_mutex_unlock(&region.lock);
+
+    /* the coldest candidate is at most average, so there is always one */
+    g_assert(best < region.n);
+    *pidx = best;
+    return true;
+}
+
+/* Call @func on each TB in region @idx, in host code order. */
+void tcg_region_tb_foreach(size_t idx, GTraverseFunc func, gpointer user_data)
+{
+    struct tcg_region_tree *rt = region_trees + idx * tree_size;
+
+    qemu_mutex_lock(&rt->lock);
+    q_tree_foreach(rt->tree, func, user_data);
+    qemu_mutex_unlock(&rt->lock);
+}
+
+/*
+ * Forget the TBs in region @idx and make it available for allocation.
+ * The caller must have invalidated them and removed every jump into
+ * them first.  Call from a safe-work context.
+ */
+void tcg_region_evict(size_t idx)
+{
+    struct tcg_region_tree *rt = region_trees + idx * tree_size;
+    void *start, *end;
+    size_t size_full;
+
+    qemu_mutex_lock(&rt->lock);
+    /* Increment the refcount first so that destroy acts as a reset */
+    q_tree_ref(rt->tree);
+    q_tree_destroy(rt->tree);
+    qemu_mutex_unlock(&rt->lock);
+
+    tcg_region_bounds(idx, &start, &end);
+    size_full = end - start - TCG_HIGHWATER;
+
+    qemu_mutex_lock(&region.lock);
+    g_assert(region.gen[idx] && !tcg_region_in_use__locked(idx));
+    region.gen[idx] = 0;
+    region.agg_size_full -= MIN(region.agg_size_full, size_full);
+    qemu_mutex_unlock(&region.lock);
+}
+
+/* Number of regions a single-threaded context's buffer is divided into */
+#define TCG_EVICT_REGIONS 8
+
 static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
 {
 #ifdef CONFIG_USER_ONLY
@@ -435,9 +592,13 @@ static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
      * being of reasonable size. If that's not possible we make do by evenly
      * dividing the code_gen_buffer among the vCPUs.
      */
-    /* Use a single region if all we have is one vCPU thread */
+    /*
+     * With a single vCPU thread there is only one context, but we still
+     * split the buffer so that filling it up evicts one region instead
+     * of flushing everything; see tcg_region_evict_pick().
+     */
     if (max_cpus == 1 || !qemu_tcg_mttcg_enabled()) {
-        return 1;
+        return MAX(1, MIN(tb_size / (2 * MiB), TCG_EVICT_REGIONS));
     }
 
     /*
@@ -810,6 +971,12 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
 
     /* init the region struct */
     qemu_mutex_init(&region.lock);
+    region.gen = g_new0(uint64_t, region.n);
+    /* only the slots of TBs that exist are ever touched */
+    region.exec_count_stride = ROUND_UP(sizeof(TranslationBlock),
+                                        qemu_icache_linesize);
+    region.exec_counts = g_new0(uint64_t, region.total_size /
+                                          region.exec_count_stride + 1);
 
     /*
      * Set guard pages in the rw buffer, as that's the one into which
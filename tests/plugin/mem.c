@@ -19,13 +19,49 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
 static uint64_t inline_mem_count;
 static uint64_t cb_mem_count;
 static uint64_t io_count;
-static bool do_inline, do_callback;
+static bool do_inline, do_callback, do_batch;
 static bool do_haddr;
 static enum qemu_plugin_mem_rw rw = QEMU_PLUGIN_MEM_RW;
 
+/*
+ * Batched records are counted against a callback on the same accesses.
+ * The plugin may be loaded twice with different track= filters to check
+ * that each gets only its own records; both then share this module, so
+ * the batch state is kept per plugin id.
+ */
+typedef struct {
+    uint64_t records;
+    uint64_t accesses;
+    uint64_t filtered_out;
+} BatchCounts;
+
+typedef struct {
+    qemu_plugin_id_t id;
+    enum qemu_plugin_mem_rw rw;
+    struct qemu_plugin_scoreboard *counts;
+    qemu_plugin_u64 records;
+    qemu_plugin_u64 accesses;
+    qemu_plugin_u64 filtered_out;
+} MemBatch;
+
+static GPtrArray *batches;
+
+static MemBatch *find_batch(qemu_plugin_id_t id)
+{
+    for (guint i = 0; batches && i < batches->len; i++) {
+        MemBatch *b = g_ptr_array_index(batches, i);
+
+        if (b->id == id) {
+            return b;
+        }
+    }
+    return NULL;
+}
+
 static void plugin_exit(qemu_plugin_id_t id, void *p)
 {
     g_autoptr(GString) out = g_string_new("");
+    MemBatch *b = find_batch(id);
 
     if (do_inline) {
         g_string_printf(out, "inline mem accesses: %" PRIu64 "\n", inline_mem_count);
@@ -36,7 +72,45 @@ static void plugin_exit(qemu_plugin_id_t id, void *p)
     if (do_haddr) {
         g_string_append_printf(out, "io accesses: %" PRIu64 "\n", io_count);
     }
+    if (b) {
+        g_string_append_printf(out, "batch mem accesses: %" PRIu64 "\n",
+                               qemu_plugin_u64_sum(b->records));
+    }
     qemu_plugin_outs(out->str);
+
+    if (b) {
+        /* every access recorded once, and only those of this plugin */
+        g_assert_cmpuint(qemu_plugin_u64_sum(b->records), ==,
+                         qemu_plugin_u64_sum(b->accesses));
+        g_assert_cmpuint(qemu_plugin_u64_sum(b->filtered_out), ==, 0);
+        qemu_plugin_scoreboard_free(b->counts);
+    }
+}
+
+static void vcpu_mem_batch(qemu_plugin_id_t id, unsigned int cpu_index,
+                           const qemu_plugin_mem_record *records, size_t n,
+                           void *udata)
+{
+    MemBatch *b = udata;
+    size_t i;
+
+    qemu_plugin_u64_add(b->records, cpu_index, n);
+    for (i = 0; i < n; i++) {
+        bool store = qemu_plugin_mem_is_store(records[i].info);
+
+        if (!(b->rw & (store ? QEMU_PLUGIN_MEM_W : QEMU_PLUGIN_MEM_R))) {
+            qemu_plugin_u64_add(b->filtered_out, cpu_index, 1);
+        }
+    }
+}
+
+static void vcpu_mem_batch_check(unsigned int cpu_index,
+                                 qemu_plugin_meminfo_t meminfo,
+                                 uint64_t vaddr, void *udata)
+{
+    MemBatch *b = udata;
+
+    qemu_plugin_u64_add(b->accesses, cpu_index, 1);
 }
 
 static void vcpu_mem(unsigned int cpu_index, qemu_plugin_meminfo_t meminfo,
@@ -58,6 +132,7 @@ static void vcpu_mem(unsigned int cpu_index, qemu_plugin_meminfo_t meminfo,
 static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
 {
     size_t n = qemu_plugin_tb_n_insns(tb);
+    MemBatch *b = find_batch(id);
     size_t i;
 
     for (i = 0; i < n; i++) {
@@ -73,6 +148,12 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
                                              QEMU_PLUGIN_CB_NO_REGS,
                                              rw, NULL);
         }
+        if (b) {
+            qemu_plugin_register_vcpu_mem_batch(insn, b->rw, i);
+            qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem_batch_check,
+                                             QEMU_PLUGIN_CB_NO_REGS,
+                                             b->rw, b);
+        }
     }
 }
 
@@ -111,12 +192,37 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
                 fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
                 return -1;
             }
+        } else if (g_strcmp0(tokens[0], "batch") == 0) {
+            if (!qemu_plugin_bool_parse(tokens[0], tokens[1], &do_batch)) {
+                fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
+                return -1;
+            }
         } else {
             fprintf(stderr, "option parsing failed: %s\n", opt);
             return -1;
         }
     }
 
+    if (do_batch) {
+        MemBatch *b = g_new0(MemBatch, 1);
+
+        b->id = id;
+        b->rw = rw;
+        b->counts = qemu_plugin_scoreboard_new(sizeof(BatchCounts));
+        b->records = qemu_plugin_scoreboard_u64_in_struct(
+            b->counts, BatchCounts, records);
+        b->accesses = qemu_plugin_scoreboard_u64_in_struct(
+            b->counts, BatchCounts, accesses);
+        b->filtered_out = qemu_plugin_scoreboard_u64_in_struct(
+            b->counts, BatchCounts, filtered_out);
+        if (!batches) {
+            batches = g_ptr_array_new();
+        }
+        g_ptr_array_add(batches, b);
+        /* small, so that the buffer fills up and is flushed while running */
+        qemu_plugin_register_vcpu_mem_batch_cb(id, vcpu_mem_batch, 64, b);
+    }
+
     qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
     return 0;
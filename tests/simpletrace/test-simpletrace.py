@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+#
+# Check that simpletrace.py orders the records of a trace file
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+
+import io
+import os
+import struct
+import sys
+import unittest
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__),
+                                '..', '..', 'scripts'))
+
+import simpletrace
+from tracetool import read_events
+
+TRACE_EVENTS = '''\
+ev_a(uint64_t x) "x %" PRIu64
+ev_b(uint64_t x) "x %" PRIu64
+'''
+
+
+def header(version):
+    return struct.pack(simpletrace.log_header_fmt,
+                       simpletrace.header_event_id,
+                       simpletrace.header_magic, version)
+
+
+def mapping(event_id, name):
+    name = name.encode()
+    return struct.pack('=QQL', simpletrace.record_type_mapping,
+                       event_id, len(name)) + name
+
+
+def event(event_id, timestamp_ns, pid, x):
+    return struct.pack('=Q', simpletrace.record_type_event) + \
+        struct.pack(simpletrace.rec_header_fmt, event_id, timestamp_ns,
+                    simpletrace.rec_header_fmt_len + 8, pid) + \
+        struct.pack('=Q', x)
+
+
+def flush(timestamp_ns):
+    return struct.pack('=QQ', simpletrace.record_type_flush, timestamp_ns)
+
+
+class TestSimpletraceOrder(unittest.TestCase):
+    def records(self, *records, version=5):
+        events = read_events(io.StringIO(TRACE_EVENTS), 'trace-events')
+        fobj = io.BytesIO(header(version) + mapping(0, 'ev_a') +
+                          mapping(1, 'ev_b') + b''.join(records))
+        log_version = simpletrace.read_trace_header(fobj)
+        return [(rec[1], rec[2], rec[3], rec[4]) for rec in
+                simpletrace.read_trace_records(events, fobj, True,
+                                               log_version)]
+
+    def pending(self, *records, version):
+        # how many records are read before each record is yielded
+        events = read_events(io.StringIO(TRACE_EVENTS), 'trace-events')
+        head = header(version) + mapping(0, 'ev_a') + mapping(1, 'ev_b')
+        fobj = io.BytesIO(head + b''.join(records))
+        log_version = simpletrace.read_trace_header(fobj)
+        start = len(head)
+        return [(rec[4], (fobj.tell() - start) // len(records[0]))
+                for rec in simpletrace.read_trace_records(events, fobj, True,
+                                                          log_version)]
+
+    def test_threads(self):
+        # two threads' buffers, written out one after the other
+        self.assertEqual(self.records(event(0, 10, 1, 0),
+                                      event(0, 30, 1, 1),
+                                      event(1, 20, 2, 2),
+                                      event(1, 40, 2, 3),
+                                      flush(40)),
+                         [('ev_a', 10, 1, 0), ('ev_b', 20, 2, 2),
+                          ('ev_a', 30, 1, 1), ('ev_b', 40, 2, 3)])
+
+    def test_across_flush(self):
+        # a record newer than the flush waits for records of the next pass
+        self.assertEqual(self.records(event(0, 30, 1, 0),
+                                      event(0, 50, 1, 1),
+                                      flush(40),
+                                      event(1, 45, 2, 2),
+                                      flush(100)),
+                         [('ev_a', 30, 1, 0), ('ev_b', 45, 2, 2),
+                          ('ev_a', 50, 1, 1)])
+
+    def test_no_final_flush(self):
+        # records after the last flush are still emitted, in order
+        self.assertEqual(self.records(event(0, 20, 1, 0),
+                                      flush(20),
+                                      event(0, 40, 1, 1),
+                                      event(1, 30, 2, 2)),
+                         [('ev_a', 20, 1, 0), ('ev_b', 30, 2, 2),
+                          ('ev_a', 40, 1, 1)])
+
+    def test_same_timestamp(self):
+        # records with the same timestamp stay in file order
+        self.assertEqual(self.records(event(1, 10, 2, 0),
+                                      event(0, 10, 1, 1),
+                                      event(0, 10, 1, 2),
+                                      flush(10)),
+                         [('ev_b', 10, 2, 0), ('ev_a', 10, 1, 1),
+                          ('ev_a', 10, 1, 2)])
+
+    def test_v4_interleaved(self):
+        # without flush records, each process' stream moves the others on
+        self.assertEqual(self.records(event(0, 10, 1, 0),
+                                      event(1, 20, 2, 1),
+                                      event(0, 15, 1, 2),
+                                      event(1, 30, 2, 3),
+                                      event(0, 40, 1, 4),
+                                      version=4),
+                         [('ev_a', 10, 1, 0), ('ev_a', 15, 1, 2),
+                          ('ev_b', 20, 2, 1), ('ev_b', 30, 2, 3),
+                          ('ev_a', 40, 1, 4)])
+
+    def test_v4_watermark(self):
+        # records are yielded as the streams pass them, not at the end
+        self.assertEqual(self.pending(event(0, 10, 1, 0),
+                                      event(1, 12, 2, 1),
+                                      event(0, 20, 1, 2),
+                                      event(1, 15, 2, 3),
+                                      event(0, 30, 1, 4),
+                                      event(1, 35, 2, 5),
+                                      version=4),
+                         [(0, 1), (1, 3), (3, 4), (2, 6), (4, 6), (5, 6)])
+
+
+if __name__ == '__main__':
+    unittest.main()
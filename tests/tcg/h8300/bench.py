@@ -0,0 +1,229 @@
+#!/usr/bin/env python3
+#
+# Run the H8 system tests and benchmarks
+#
+# The guest programs print "BENCH <name> START" and
+# "BENCH <name> END <checksum>" around every kernel and finish with
+# "PASS" or "FAIL" followed by "DONE". They never power the board off,
+# so this script watches the console, times each kernel on the host,
+# collects the translator statistics from "info jit" over QMP and then
+# quits QEMU.
+#
+# With --json the results are written in machine readable form. If the
+# insn plugin is given each program is run a second time under it to
+# count guest instructions. The count covers the whole run, boot and
+# setup included, so guest MIPS are computed over the whole run too,
+# from starting QEMU to DONE.
+#
+# --accel passes accelerator options. For tests of the translator
+# features, --hot-blocks checks the x-query-tcg-hot-blocks reply and
+# --jit-nonzero that an "info jit" counter moved.
+#
+# SPDX-License-Identifier: GPL-2.0-or-later
+
+import argparse
+import json
+import os
+import re
+import select
+import subprocess
+import sys
+import time
+from tempfile import TemporaryDirectory
+
+
+def get_args():
+    parser = argparse.ArgumentParser(description="H8 system test runner")
+    parser.add_argument("--qemu", help="QEMU system binary", required=True)
+    parser.add_argument("--src", help="QEMU source tree", required=True)
+    parser.add_argument("--machine", help="Board to run on", required=True)
+    parser.add_argument("--plugin", help="insn plugin, for instruction counts")
+    parser.add_argument("--accel", help="-accel option for QEMU")
+    parser.add_argument("--hot-blocks", type=int, metavar="MIN",
+                        help="Check the hot blocks reported over QMP, the "
+                        "hottest must have run at least MIN times")
+    parser.add_argument("--jit-nonzero", action="append", default=[],
+                        metavar="KEY",
+                        help="Fail unless this info jit counter is non-zero")
+    parser.add_argument("--timeout", type=float, default=60,
+                        help="Seconds to wait for DONE")
+    parser.add_argument("--output", help="Write the guest console here")
+    parser.add_argument("--json", help="Write results as JSON here")
+    parser.add_argument("binaries", nargs="+", help="Raw guest images")
+    return parser.parse_args()
+
+
+# "info jit" lines look like "TB count            1234"; keep the
+# numeric ones and key them by their label.
+JIT_LINE = re.compile(r"^(\S.*?)\s{2,}(-?[0-9.]+)")
+
+
+def parse_info_jit(text):
+    stats = {}
+    for line in text.splitlines():
+        m = JIT_LINE.match(line)
+        if m:
+            key = m.group(1).strip().lower().replace(" ", "_")
+            value = m.group(2)
+            stats[key] = float(value) if "." in value else int(value)
+    return stats
+
+
+def run_qemu(args, binary, tmpdir, plugin_log=None):
+    qmp_path = os.path.join(tmpdir, "qmp.sock")
+    cmd = [args.qemu, "-M", args.machine,
+           "-display", "none", "-monitor", "none",
+           "-chardev", "stdio,id=output", "-serial", "chardev:output",
+           "-qmp", "unix:%s,server=on,wait=off" % qmp_path]
+    if args.accel:
+        cmd += ["-accel", args.accel]
+    if plugin_log:
+        cmd += ["-plugin", "%s,inline=on" % args.plugin,
+                "-d", "plugin", "-D", plugin_log]
+    cmd += ["-kernel", binary]
+
+    launch = time.monotonic()
+    qemu = subprocess.Popen(cmd, stdin=subprocess.DEVNULL,
+                            stdout=subprocess.PIPE)
+    lines = []
+    kernels = {}
+    start = {}
+    first = None
+    done = None
+    buf = b""
+    hot = None
+    deadline = time.monotonic() + args.timeout
+
+    try:
+        while done is None:
+            left = deadline - time.monotonic()
+            if left <= 0:
+                raise TimeoutError("%s: no DONE after %ds" %
+                                   (binary, args.timeout))
+            r, _, _ = select.select([qemu.stdout], [], [], left)
+            if not r:
+                continue
+            data = os.read(qemu.stdout.fileno(), 4096)
+            now = time.monotonic()
+            if not data:
+                raise RuntimeError("%s: QEMU exited early" % binary)
+            buf += data
+            while b"\n" in buf:
+                raw, buf = buf.split(b"\n", 1)
+                line = raw.decode(errors="replace").rstrip("\r")
+                lines.append(line)
+                words = line.split()
+                if len(words) >= 3 and words[0] == "BENCH":
+                    if words[2] == "START":
+                        start[words[1]] = now
+                        if first is None:
+                            first = now
+                    elif words[2] == "END" and words[1] in start:
+                        kernels[words[1]] = {
+                            "seconds": now - start[words[1]],
+                            "checksum": words[3] if len(words) > 3 else None,
+                        }
+                elif line == "DONE":
+                    done = now
+
+        qmp = QEMUMonitorProtocol(qmp_path)
+        qmp.connect()
+        jit = qmp.cmd("human-monitor-command", command_line="info jit")
+        if args.hot_blocks is not None and not plugin_log:
+            hot = qmp.cmd("x-query-tcg-hot-blocks", top=10)
+        qmp.cmd("quit")
+        qmp.close()
+        qemu.wait(timeout=10)
+    finally:
+        if qemu.poll() is None:
+            qemu.kill()
+            qemu.wait()
+
+    res = {
+        "console": lines,
+        "kernels": kernels,
+        "seconds": done - (first if first is not None else done),
+        "run_seconds": done - launch,
+        "passed": "PASS" in lines,
+        "jit": parse_info_jit(jit),
+    }
+    errors = check_run(args, res["jit"], hot)
+    if errors:
+        res["errors"] = errors
+        res["passed"] = False
+    return res
+
+
+def check_run(args, jit, hot):
+    errors = []
+    for key in args.jit_nonzero:
+        if not jit.get(key):
+            errors.append("info jit: %s is zero" % key)
+    if hot is not None:
+        counts = [b["count"] for b in hot["blocks"]]
+        if not counts or counts[0] < args.hot_blocks:
+            errors.append("hot blocks: no block ran %d times" %
+                          args.hot_blocks)
+        elif counts != sorted(counts, reverse=True):
+            errors.append("hot blocks: not sorted by count")
+        elif sum(counts) > hot["total-count"]:
+            errors.append("hot blocks: counts exceed the total")
+    return errors
+
+
+def count_insns(args, binary, tmpdir):
+    log = os.path.join(tmpdir, "insn.log")
+    run_qemu(args, binary, tmpdir, plugin_log=log)
+    with open(log) as f:
+        for line in f:
+            if line.startswith("insns:"):
+                return int(line.split()[1])
+    return None
+
+
+if __name__ == "__main__":
+    args = get_args()
+    sys.path.append(os.path.join(args.src, "python"))
+    from qemu.qmp.legacy import QEMUMonitorProtocol
+
+    results = {}
+    failed = False
+    output = open(args.output, "w") if args.output else None
+
+    for binary in args.binaries:
+        name = os.path.basename(binary)
+        with TemporaryDirectory() as tmpdir:
+            res = run_qemu(args, binary, tmpdir)
+            if args.plugin:
+                insns = count_insns(args, binary, tmpdir)
+                res["insns"] = insns
+                if insns and res["run_seconds"] > 0:
+                    res["mips"] = insns / res["run_seconds"] / 1e6
+
+        for err in res.get("errors", []):
+            print("  %-24s %s" % (name, err))
+        if output:
+            output.write("\n".join(res.pop("console")) + "\n")
+        else:
+            res.pop("console")
+        if not res["passed"]:
+            failed = True
+        results[name] = res
+
+        for kname, k in res["kernels"].items():
+            print("  %-24s %-10s %8.3fs" % (name, kname, k["seconds"]))
+        if "mips" in res:
+            print("  %-24s %-10s %8.1f MIPS" % (name, "total", res["mips"]))
+        print("  %-24s %-10s %8d TBs, %.3fs translating" %
+              (name, "jit", res["jit"].get("tb_count", 0),
+               res["jit"].get("translation_time", 0) / 1000))
+
+    if output:
+        output.close()
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump({"machine": args.machine, "results": results},
+                      f, indent=2, sort_keys=True)
+
+    sys.exit(1 if failed else 0)
@@ -0,0 +1,298 @@
+/*
+ * CoreMark-class workload
+ *
+ * Modelled on the CoreMark kernels rather than copied from them:
+ * linked list search, reversal and sort, 16 bit matrix arithmetic and
+ * a byte-driven state machine, all folded together with CRC-16.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "bench.h"
+
+#define ITERATIONS 200UL
+
+/* CRC-16/CCITT, bitwise to keep the shift and flag traffic */
+static uint16_t crc16(uint16_t crc, uint8_t data)
+{
+    int i;
+
+    crc ^= (uint16_t)((uint32_t)data << 8);
+    for (i = 0; i < 8; i++) {
+        if (crc & 0x8000) {
+            crc = (uint16_t)(((uint32_t)crc << 1) ^ 0x1021);
+        } else {
+            crc = (uint16_t)((uint32_t)crc << 1);
+        }
+    }
+    return crc;
+}
+
+static uint16_t crc16_32(uint16_t crc, uint32_t v)
+{
+    crc = crc16(crc, v);
+    crc = crc16(crc, v >> 8);
+    crc = crc16(crc, v >> 16);
+    return crc16(crc, v >> 24);
+}
+
+/* list kernel */
+
+#define LIST_LEN 48
+
+typedef struct node {
+    struct node *next;
+    int16_t data;
+    int16_t idx;
+} node_t;
+
+static node_t nodes[LIST_LEN];
+
+static node_t *list_init(uint32_t seed)
+{
+    node_t *head = NULL;
+    int i;
+
+    for (i = LIST_LEN - 1; i >= 0; i--) {
+        seed = seed * 1103515245UL + 12345;
+        nodes[i].data = (int16_t)(seed >> 16);
+        nodes[i].idx = i;
+        nodes[i].next = head;
+        head = &nodes[i];
+    }
+    return head;
+}
+
+static node_t *list_reverse(node_t *list)
+{
+    node_t *prev = NULL, *next;
+
+    while (list) {
+        next = list->next;
+        list->next = prev;
+        prev = list;
+        list = next;
+    }
+    return prev;
+}
+
+static node_t *list_find(node_t *list, int16_t idx)
+{
+    while (list && list->idx != idx) {
+        list = list->next;
+    }
+    return list;
+}
+
+/* bottom-up merge sort on data */
+static node_t *list_sort(node_t *list)
+{
+    uint32_t insize = 1, nmerges, psize, qsize, i;
+    node_t *p, *q, *e, *tail;
+
+    for (;;) {
+        p = list;
+        list = NULL;
+        tail = NULL;
+        nmerges = 0;
+        while (p) {
+            nmerges++;
+            q = p;
+            psize = 0;
+            for (i = 0; i < insize && q; i++) {
+                psize++;
+                q = q->next;
+            }
+            qsize = insize;
+            while (psize > 0 || (qsize > 0 && q)) {
+                if (psize == 0) {
+                    e = q;
+                    q = q->next;
+                    qsize--;
+                } else if (qsize == 0 || !q || p->data <= q->data) {
+                    e = p;
+                    p = p->next;
+                    psize--;
+                } else {
+                    e = q;
+                    q = q->next;
+                    qsize--;
+                }
+                if (tail) {
+                    tail->next = e;
+                } else {
+                    list = e;
+                }
+                tail = e;
+            }
+            p = q;
+        }
+        tail->next = NULL;
+        if (nmerges <= 1) {
+            return list;
+        }
+        insize *= 2;
+    }
+}
+
+static uint16_t list_bench(uint16_t crc, uint32_t seed)
+{
+    node_t *list = list_init(seed), *n;
+    int16_t i;
+
+    list = list_reverse(list);
+    for (i = 0; i < LIST_LEN; i += 5) {
+        n = list_find(list, i);
+        crc = crc16_32(crc, n ? (uint32_t)(uint16_t)n->data : 0xffff);
+    }
+    list = list_sort(list);
+    for (n = list; n; n = n->next) {
+        crc = crc16(crc, (uint8_t)n->idx);
+    }
+    return crc;
+}
+
+/* matrix kernel */
+
+#define MAT_N 12
+
+static int16_t mat_a[MAT_N][MAT_N], mat_b[MAT_N][MAT_N];
+static int32_t mat_c[MAT_N][MAT_N];
+
+static uint16_t matrix_bench(uint16_t crc, uint32_t seed)
+{
+    int i, j, k;
+    int32_t acc, sum = 0;
+
+    for (i = 0; i < MAT_N; i++) {
+        for (j = 0; j < MAT_N; j++) {
+            seed = seed * 1103515245UL + 12345;
+            mat_a[i][j] = (int16_t)((seed >> 16) & 0xff) - 128;
+            mat_b[i][j] = (int16_t)((seed >> 8) & 0x7f);
+        }
+    }
+    /* add a constant, multiply by a vector, then by a matrix */
+    for (i = 0; i < MAT_N; i++) {
+        for (j = 0; j < MAT_N; j++) {
+            mat_a[i][j] += 3;
+        }
+    }
+    for (i = 0; i < MAT_N; i++) {
+        acc = 0;
+        for (j = 0; j < MAT_N; j++) {
+            acc += (int32_t)mat_a[i][j] * mat_b[0][j];
+        }
+        sum += acc;
+    }
+    for (i = 0; i < MAT_N; i++) {
+        for (j = 0; j < MAT_N; j++) {
+            acc = 0;
+            for (k = 0; k < MAT_N; k++) {
+                acc += (int32_t)mat_a[i][k] * mat_b[k][j];
+            }
+            mat_c[i][j] = acc;
+            sum += acc > 1000 ? acc >> 4 : acc;
+        }
+    }
+    crc = crc16_32(crc, (uint32_t)sum);
+    return crc16_32(crc, (uint32_t)mat_c[MAT_N - 1][MAT_N - 1]);
+}
+
+/* state machine kernel: classify comma separated tokens */
+
+enum { ST_START, ST_INT, ST_FLOAT, ST_EXP, ST_SCI, ST_INVALID, ST_NR };
+
+static const char state_input[] =
+    "5012,1234,-874,+122,35.54,-.1,0.0,1.23e5,-7.1e-3,12e,abc,"
+    "7.7.7,--1,+0.5e+9,66,0x1f,1.,9e9,-,3.1415926,";
+
+static uint16_t state_bench(uint16_t crc, uint32_t seed)
+{
+    uint32_t count[ST_NR] = { 0 };
+    const char *p = state_input;
+    int state = ST_START, i;
+    char c;
+
+    /* vary the input stream a little per iteration */
+    for (i = seed & 7; i > 0; i--) {
+        while (*p && *p++ != ',') {
+            continue;
+        }
+    }
+    for (; (c = *p) != 0; p++) {
+        if (c == ',') {
+            count[state]++;
+            state = ST_START;
+            continue;
+        }
+        switch (state) {
+        case ST_START:
+            if ((c >= '0' && c <= '9') || c == '+' || c == '-') {
+                state = ST_INT;
+            } else if (c == '.') {
+                state = ST_FLOAT;
+            } else {
+                state = ST_INVALID;
+            }
+            break;
+        case ST_INT:
+            if (c == '.') {
+                state = ST_FLOAT;
+            } else if (c == 'e' || c == 'E') {
+                state = ST_EXP;
+            } else if (c < '0' || c > '9') {
+                state = ST_INVALID;
+            }
+            break;
+        case ST_FLOAT:
+            if (c == 'e' || c == 'E') {
+                state = ST_EXP;
+            } else if (c < '0' || c > '9') {
+                state = ST_INVALID;
+            }
+            break;
+        case ST_EXP:
+            if ((c >= '0' && c <= '9') || c == '+' || c == '-') {
+                state = ST_SCI;
+            } else {
+                state = ST_INVALID;
+            }
+            break;
+        case ST_SCI:
+            if (c < '0' || c > '9') {
+                state = ST_INVALID;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    for (i = 0; i < ST_NR; i++) {
+        crc = crc16_32(crc, count[i]);
+    }
+    return crc;
+}
+
+static uint32_t __attribute__((noinline)) coremark(uint32_t iterations)
+{
+    uint16_t crc = 0;
+    uint32_t i;
+
+    for (i = 0; i < iterations; i++) {
+        crc = list_bench(crc, i);
+        crc = matrix_bench(crc, i);
+        crc = state_bench(crc, i);
+    }
+    return crc;
+}
+
+int main(void)
+{
+    uint32_t sum;
+
+    bench_start("coremark");
+    sum = coremark(ITERATIONS);
+    bench_end("coremark", sum, 0xa3de);
+
+    return bench_finish();
+}
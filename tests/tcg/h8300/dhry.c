@@ -0,0 +1,217 @@
+/*
+ * Dhrystone-class integer workload
+ *
+ * Not the original Dhrystone, but the same mix: record copies through
+ * pointers, enum switches, string copy and compare, one and two
+ * dimensional array updates and short procedure calls.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "bench.h"
+
+#define LOOPS 20000UL
+
+typedef enum { IDENT_1, IDENT_2, IDENT_3, IDENT_4, IDENT_5 } ident_t;
+
+typedef struct record {
+    struct record *next;
+    ident_t discr;
+    ident_t enum_comp;
+    int32_t int_comp;
+    char str_comp[31];
+} record_t;
+
+static record_t rec_a, rec_b;
+static record_t *rec_glob;
+static int32_t int_glob;
+static char ch_1_glob, ch_2_glob;
+static int32_t arr_1_glob[50];
+static int32_t arr_2_glob[50][50];
+
+static void str_copy(char *dst, const char *src)
+{
+    while ((*dst++ = *src++) != 0) {
+        continue;
+    }
+}
+
+static int str_cmp(const char *a, const char *b)
+{
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return (unsigned char)*a - (unsigned char)*b;
+}
+
+static void __attribute__((noinline)) rec_copy(record_t *dst,
+                                               const record_t *src)
+{
+    *dst = *src;
+}
+
+static int __attribute__((noinline)) func_3(ident_t e)
+{
+    return e == IDENT_3;
+}
+
+static ident_t __attribute__((noinline)) func_1(char c1, char c2)
+{
+    if (c1 != c2) {
+        return IDENT_1;
+    }
+    ch_1_glob = c1;
+    return IDENT_2;
+}
+
+static int __attribute__((noinline)) func_2(const char *s1, const char *s2)
+{
+    int i = 2;
+    char c = 0;
+
+    while (i <= 2) {
+        if (func_1(s1[i], s2[i + 1]) == IDENT_1) {
+            c = 'A';
+            i++;
+        }
+    }
+    if (c >= 'W' && c < 'Z') {
+        i = 7;
+    }
+    if (c == 'R') {
+        return 1;
+    }
+    if (str_cmp(s1, s2) > 0) {
+        int_glob = i + 7;
+        return 1;
+    }
+    return 0;
+}
+
+static void __attribute__((noinline)) proc_6(ident_t in, ident_t *out)
+{
+    *out = in;
+    if (!func_3(in)) {
+        *out = IDENT_4;
+    }
+    switch (in) {
+    case IDENT_1:
+        *out = IDENT_1;
+        break;
+    case IDENT_2:
+        *out = int_glob > 100 ? IDENT_1 : IDENT_4;
+        break;
+    case IDENT_3:
+        *out = IDENT_2;
+        break;
+    case IDENT_4:
+        break;
+    case IDENT_5:
+        *out = IDENT_3;
+        break;
+    }
+}
+
+static void __attribute__((noinline)) proc_7(int32_t a, int32_t b,
+                                             int32_t *out)
+{
+    *out = b + a + 2;
+}
+
+static void __attribute__((noinline)) proc_8(int32_t *arr1,
+                                             int32_t arr2[][50],
+                                             int32_t a, int32_t b)
+{
+    int32_t idx = a + 5;
+    int32_t i;
+
+    arr1[idx] = b;
+    arr1[idx + 1] = arr1[idx];
+    arr1[idx + 30] = idx;
+    for (i = idx; i <= idx + 1; i++) {
+        arr2[idx][i] = idx;
+    }
+    arr2[idx][idx - 1] += 1;
+    arr2[idx + 20][idx] = arr1[idx];
+    int_glob = 5;
+}
+
+static void __attribute__((noinline)) proc_1(record_t *p)
+{
+    record_t *next = p->next;
+
+    rec_copy(next, rec_glob);
+    p->int_comp = 5;
+    next->int_comp = p->int_comp;
+    next->next = p->next;
+    if (next->discr == IDENT_1) {
+        next->int_comp = 6;
+        proc_6(p->enum_comp, &next->enum_comp);
+        next->next = rec_glob->next;
+        proc_7(next->int_comp, 10, &next->int_comp);
+    } else {
+        rec_copy(p, next);
+    }
+}
+
+static uint32_t __attribute__((noinline)) dhry(uint32_t loops)
+{
+    char str_1[31], str_2[31];
+    int32_t int_1 = 0, int_2 = 0, int_3 = 0;
+    ident_t e = IDENT_2;
+    uint32_t run, sum = 0;
+    char ch;
+
+    rec_glob = &rec_a;
+    rec_a.next = &rec_b;
+    rec_a.discr = IDENT_1;
+    rec_a.enum_comp = IDENT_3;
+    rec_a.int_comp = 40;
+    str_copy(rec_a.str_comp, "DHRYSTONE PROGRAM, SOME STRING");
+    str_copy(str_1, "DHRYSTONE PROGRAM, 1'ST STRING");
+    arr_2_glob[8][7] = 10;
+
+    for (run = 1; run <= loops; run++) {
+        ch_2_glob = 'B';
+        int_1 = 2;
+        int_2 = 3;
+        str_copy(str_2, "DHRYSTONE PROGRAM, 2'ND STRING");
+        e = IDENT_2;
+        if (!func_2(str_1, str_2)) {
+            e = IDENT_1;
+        }
+        while (int_1 < int_2) {
+            int_3 = 5 * int_1 - int_2;
+            proc_7(int_1, int_2, &int_3);
+            int_1++;
+        }
+        proc_8(arr_1_glob, arr_2_glob, int_1, int_3);
+        proc_1(rec_glob);
+        for (ch = 'A'; ch <= ch_2_glob; ch++) {
+            if (e == func_1(ch, 'C')) {
+                proc_6(IDENT_1, &e);
+                str_copy(str_2, "DHRYSTONE PROGRAM, 3'RD STRING");
+                int_2 = run;
+                int_glob = run;
+            }
+        }
+        int_2 = int_2 * int_1;
+        int_1 = int_2 / int_3;
+        int_2 = 7 * (int_2 - int_3) - int_1;
+        sum = (sum << 1 | sum >> 31) ^ (uint32_t)(int_1 + int_2 + int_3);
+        sum += (uint32_t)e + (uint32_t)rec_b.int_comp + (uint8_t)str_2[19];
+    }
+    return sum ^ (uint32_t)arr_2_glob[8][7] ^ (uint32_t)int_glob;
+}
+
+int main(void)
+{
+    uint32_t sum;
+
+    bench_start("dhry");
+    sum = dhry(LOOPS);
+    bench_end("dhry", sum, 0x483d983b);
+
+    return bench_finish();
+}
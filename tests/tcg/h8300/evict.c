@@ -0,0 +1,66 @@
+/*
+ * H8 translation cache eviction test
+ *
+ * Rewrites a small function in RAM before every call, so that each call
+ * translates a new block. Run with a small tb-size, this fills the code
+ * buffer several times over: regions are evicted (see "TB evict count"
+ * in "info jit") while the loop around the calls keeps running, and
+ * must still compute the right result.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "bench.h"
+
+#define N_PATCHES 100000
+
+/* alone on its page, so that rewriting it invalidates nothing else */
+static uint8_t __attribute__((aligned(4096))) code[4096];
+
+static uint32_t next(uint32_t x)
+{
+    return x * 1664525 + 1013904223;
+}
+
+/* mov.l #imm,er0; rts */
+static void __attribute__((noinline)) patch(uint32_t imm)
+{
+    volatile uint8_t *p = code;
+
+    p[0] = 0x7a;
+    p[1] = 0x00;
+    p[2] = imm >> 24;
+    p[3] = imm >> 16;
+    p[4] = imm >> 8;
+    p[5] = imm;
+    p[6] = 0x54;
+    p[7] = 0x70;
+}
+
+static uint32_t __attribute__((noinline)) rewrite(uint32_t n)
+{
+    uint32_t (*fn)(void) = (uint32_t (*)(void))code;
+    uint32_t sum = 0, x = 1, i;
+
+    for (i = 0; i < n; i++) {
+        x = next(x);
+        patch(x);
+        sum += fn() ^ i;
+    }
+    return sum;
+}
+
+int main(void)
+{
+    uint32_t expect = 0, x = 1, i;
+
+    for (i = 0; i < N_PATCHES; i++) {
+        x = next(x);
+        expect += x ^ i;
+    }
+
+    bench_start("rewrite");
+    bench_end("rewrite", rewrite(N_PATCHES), expect);
+
+    return bench_finish();
+}
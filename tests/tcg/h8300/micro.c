@@ -0,0 +1,218 @@
+/*
+ * H8 microbenchmarks
+ *
+ * Small kernels that each stress one part of the translator: ALU and
+ * flag computation, bit manipulation on I/O registers, byte and word
+ * arithmetic on register halves, block moves, the multiply-accumulate
+ * unit, call/return and exception round trips.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "bench.h"
+
+#define XSTR(s) STR(s)
+#define STR(s) #s
+
+/* 64 bit adds and signed compares keep C, V, Z and N all live */
+static uint32_t __attribute__((noinline)) alu(uint32_t n)
+{
+    uint32_t x = 0x12345678, b = 0x9abcdef0;
+    uint64_t acc = 0;
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        acc += x;
+        if ((int32_t)x < 0) {
+            b -= x;
+        } else {
+            b += x >> 3;
+        }
+    }
+    return (uint32_t)acc ^ (uint32_t)(acc >> 32) ^ b;
+}
+
+/*
+ * Bit operations with @aa:8 addressing on a timer constant register,
+ * which behaves like plain storage while the timer is stopped. Bits
+ * 0-1 form a two bit counter and bit 7 their xor.
+ */
+static uint32_t __attribute__((noinline)) bitio(uint32_t n)
+{
+    volatile uint8_t *reg = (volatile uint8_t *)TCORA_ADDR;
+    uint32_t sum = 0, i;
+
+    *reg = 0;
+    for (i = 0; i < n; i++) {
+        asm volatile("bnot #0,@" XSTR(TCORA_ADDR) ":8\n\t"
+                     "btst #0,@" XSTR(TCORA_ADDR) ":8\n\t"
+                     "bne 1f\n\t"
+                     "bnot #1,@" XSTR(TCORA_ADDR) ":8\n"
+                     "1:\n\t"
+                     "bld #1,@" XSTR(TCORA_ADDR) ":8\n\t"
+                     "bxor #0,@" XSTR(TCORA_ADDR) ":8\n\t"
+                     "bst #7,@" XSTR(TCORA_ADDR) ":8"
+                     : : : "cc", "memory");
+        sum += *reg;
+    }
+    return sum;
+}
+
+#define EEPMOV_LEN 256
+
+static uint8_t eepmov_src[EEPMOV_LEN];
+static uint8_t eepmov_dst[EEPMOV_LEN];
+
+static uint32_t __attribute__((noinline)) eepmov(uint32_t n)
+{
+    uint32_t sum = 0, i, j;
+
+    for (i = 0; i < n; i++) {
+        register uint8_t *src asm("er5") = eepmov_src;
+        register uint8_t *dst asm("er6") = eepmov_dst;
+        register uint32_t len asm("er4") = EEPMOV_LEN;
+
+        eepmov_src[i % EEPMOV_LEN] = i;
+        asm volatile("eepmov.w"
+                     : "+r"(src), "+r"(dst), "+r"(len) : : "memory");
+        for (j = 0; j < EEPMOV_LEN; j += 16) {
+            sum += eepmov_dst[j];
+        }
+    }
+    return sum;
+}
+
+#ifdef __H8300S__
+#define MAC_LEN 64
+
+static int16_t mac_a[MAC_LEN], mac_b[MAC_LEN];
+
+static uint32_t __attribute__((noinline)) mac(uint32_t n)
+{
+    uint32_t sum = 0, i;
+
+    for (i = 0; i < n; i++) {
+        register int16_t *a asm("er0") = mac_a;
+        register int16_t *b asm("er1") = mac_b;
+        register uint32_t cnt asm("er2") = MAC_LEN / 8;
+        uint32_t r;
+
+        asm volatile("clrmac\n"
+                     "1:\n\t"
+                     "mac @er0+,@er1+\n\t"
+                     "mac @er0+,@er1+\n\t"
+                     "mac @er0+,@er1+\n\t"
+                     "mac @er0+,@er1+\n\t"
+                     "mac @er0+,@er1+\n\t"
+                     "mac @er0+,@er1+\n\t"
+                     "mac @er0+,@er1+\n\t"
+                     "mac @er0+,@er1+\n\t"
+                     "dec.l #1,er2\n\t"
+                     "bne 1b\n\t"
+                     "stmac macl,%3"
+                     : "+r"(a), "+r"(b), "+r"(cnt), "=r"(r) : : "cc");
+        sum += r;
+    }
+    return sum;
+}
+#endif
+
+/*
+ * Byte and word arithmetic, which works on the halves of 32-bit
+ * registers and so is translated to bit-field deposits and extracts.
+ */
+static uint32_t __attribute__((noinline)) bytes(uint32_t n)
+{
+    uint8_t a = 1, b = 2, c = 3, d = 4;
+    uint16_t w = 0x1234;
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        a += b ^ c;
+        b = (b << 1) | (a >> 7);
+        c -= d;
+        d ^= a + (uint8_t)i;
+        w = (w << 3) ^ (w >> 5) ^ a;
+    }
+    return ((uint32_t)a << 24 | (uint32_t)b << 16 | (uint32_t)c << 8 | d) ^ w;
+}
+
+static uint32_t __attribute__((noinline)) fib(uint32_t n)
+{
+    return n < 2 ? n : fib(n - 1) + fib(n - 2);
+}
+
+static uint32_t __attribute__((noinline)) calls(uint32_t n)
+{
+    uint32_t sum = 0, i;
+
+    for (i = 0; i < n; i++) {
+        sum += fib(18);
+    }
+    return sum;
+}
+
+static uint32_t __attribute__((noinline)) trap(uint32_t n)
+{
+    uint32_t i;
+
+    trap_count = 0;
+    asm volatile("andc #0x7f,ccr");
+    for (i = 0; i < n; i++) {
+        asm volatile("trapa #0" : : : "memory");
+    }
+    asm volatile("orc #0x80,ccr");
+    return trap_count;
+}
+
+int main(void)
+{
+    uint32_t i, sum;
+
+    bench_start("alu");
+    sum = alu(500000);
+    bench_end("alu", sum, 0xb8df5e4d);
+
+    bench_start("bitio");
+    sum = bitio(200000);
+    bench_end("bitio", sum, 200000UL / 4 * (0x81 + 0x82 + 0x03 + 0x00));
+
+    bench_start("bytes");
+    sum = bytes(500000);
+    bench_end("bytes", sum, 0x0f404791);
+
+    for (i = 0; i < EEPMOV_LEN; i++) {
+        eepmov_src[i] = i * 7;
+    }
+    bench_start("eepmov");
+    sum = eepmov(20000);
+    bench_end("eepmov", sum, 0x248c000);
+
+#ifdef __H8300S__
+    for (i = 0; i < MAC_LEN; i++) {
+        mac_a[i] = i - 32;
+        mac_b[i] = 3 * i + 1;
+    }
+    bench_start("mac");
+    sum = mac(20000);
+    /*
+     * The MAC unit is not modelled by the translator yet, so only
+     * time it for now.
+     */
+    bench_end_unchecked("mac", sum);
+#endif
+
+    bench_start("calls");
+    sum = calls(100);
+    bench_end("calls", sum, 100UL * 2584);
+
+    set_vector(8, trap_handler);
+    bench_start("trap");
+    sum = trap(200000);
+    bench_end("trap", sum, 200000UL);
+
+    return bench_finish();
+}
@@ -0,0 +1,157 @@
+/*
+ * H8 sub-register tests
+ *
+ * Byte and word moves between the halves of the 32-bit registers and
+ * the extensions are translated to chains of deposits and extracts on
+ * the same TCG globals, which the optimizer folds across instructions.
+ * Each kernel runs such a chain in inline assembly and compares the
+ * result with the same operations written out in C.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "bench.h"
+
+#define N_ITERS 200000
+
+static uint32_t next(uint32_t x)
+{
+    return x * 1103515245 + 12345;
+}
+
+/* halves moved around within and between two registers */
+static void __attribute__((noinline)) shuffle(uint32_t *px, uint32_t *py)
+{
+    register uint32_t x asm("er0") = *px;
+    register uint32_t y asm("er1") = *py;
+
+    asm("mov.b r0l,r1h\n\t"
+        "mov.b r0h,r1l\n\t"
+        "mov.w r1,e0\n\t"
+        "extu.w r0\n\t"
+        "mov.b r1l,r0h\n\t"
+        "exts.l er1\n\t"
+        "mov.w e0,r1\n\t"
+        "mov.b r0h,r0l"
+        : "+r"(x), "+r"(y) : : "cc");
+    *px = x;
+    *py = y;
+}
+
+static void shuffle_ref(uint32_t *px, uint32_t *py)
+{
+    uint32_t x = *px, y = *py;
+
+    y = (y & 0xffff00ff) | (x & 0xff) << 8;
+    y = (y & 0xffffff00) | (x >> 8 & 0xff);
+    x = (x & 0x0000ffff) | (y & 0xffff) << 16;
+    x = (x & 0xffff0000) | (x & 0xff);
+    x = (x & 0xffff00ff) | (y & 0xff) << 8;
+    y = (uint32_t)(int32_t)(int16_t)y;
+    y = (y & 0xffff0000) | x >> 16;
+    x = (x & 0xffffff00) | (x >> 8 & 0xff);
+    *px = x;
+    *py = y;
+}
+
+/* both bytes of a word moved one by one, then extended */
+static uint32_t __attribute__((noinline)) merge(uint32_t in, uint32_t w)
+{
+    register uint32_t x asm("er0") = in;
+    register uint32_t z asm("er2");
+    register uint32_t v asm("er3") = w;
+
+    asm("mov.l er0,er2\n\t"
+        "exts.w r2\n\t"
+        "mov.b r0l,r3l\n\t"
+        "mov.b r0h,r3h\n\t"
+        "extu.l er3\n\t"
+        "add.l er3,er2"
+        : "=&r"(z), "+r"(v) : "r"(x) : "cc");
+    return z ^ v;
+}
+
+static uint32_t merge_ref(uint32_t x, uint32_t w)
+{
+    uint32_t z = (x & 0xffff0000) | (uint16_t)(int16_t)(int8_t)x;
+
+    w = (w & 0xffffff00) | (x & 0xff);
+    w = (w & 0xffff00ff) | (x & 0xff00);
+    w &= 0xffff;
+    z += w;
+    return z ^ w;
+}
+
+/* a byte deposit overwritten by a word one, then read back */
+static uint32_t __attribute__((noinline)) overwrite(uint32_t in_x,
+                                                    uint32_t in_y,
+                                                    uint32_t in_z,
+                                                    uint32_t in_w)
+{
+    register uint32_t x asm("er0") = in_x;
+    register uint32_t y asm("er1") = in_y;
+    register uint32_t z asm("er2") = in_z;
+    register uint32_t w asm("er3") = in_w;
+
+    asm("mov.b r0l,r2l\n\t"
+        "mov.w r1,r2\n\t"
+        "mov.b r2h,r3l\n\t"
+        "mov.w e1,e3"
+        : "+r"(z), "+r"(w) : "r"(x), "r"(y) : "cc");
+    return z ^ w;
+}
+
+static uint32_t overwrite_ref(uint32_t x, uint32_t y, uint32_t z, uint32_t w)
+{
+    z = (z & 0xffffff00) | (x & 0xff);
+    z = (z & 0xffff0000) | (y & 0xffff);
+    w = (w & 0xffffff00) | (z >> 8 & 0xff);
+    w = (w & 0x0000ffff) | (y & 0xffff0000);
+    return z ^ w;
+}
+
+int main(void)
+{
+    uint32_t x, y, sum, expect, i;
+
+    /* the expected results first, so that only the kernels are timed */
+    x = 0x12345678;
+    y = 0x9abcdef0;
+    for (i = 0; i < N_ITERS; i++) {
+        shuffle_ref(&x, &y);
+        x = next(x ^ i);
+    }
+    expect = x ^ y;
+    x = 0x12345678;
+    y = 0x9abcdef0;
+    bench_start("shuffle");
+    for (i = 0; i < N_ITERS; i++) {
+        shuffle(&x, &y);
+        x = next(x ^ i);
+    }
+    bench_end("shuffle", x ^ y, expect);
+
+    expect = 0;
+    for (x = 1, i = 0; i < N_ITERS; i++, x = next(x)) {
+        expect += merge_ref(x, expect);
+    }
+    bench_start("merge");
+    sum = 0;
+    for (x = 1, i = 0; i < N_ITERS; i++, x = next(x)) {
+        sum += merge(x, sum);
+    }
+    bench_end("merge", sum, expect);
+
+    expect = 0;
+    for (x = 1, i = 0; i < N_ITERS; i++, x = next(x)) {
+        expect += overwrite_ref(x, next(x), expect, i);
+    }
+    bench_start("overwrite");
+    sum = 0;
+    for (x = 1, i = 0; i < N_ITERS; i++, x = next(x)) {
+        sum += overwrite(x, next(x), sum, i);
+    }
+    bench_end("overwrite", sum, expect);
+
+    return bench_finish();
+}
@@ -0,0 +1,39 @@
+/*
+ * Helpers shared by the H8 system benchmarks.
+ *
+ * Every benchmark kernel is bracketed by "BENCH <name> START" and
+ * "BENCH <name> END <checksum>" lines on the console. bench.py times
+ * the interval between the two lines on the host and checks the
+ * checksum; "PASS"/"FAIL" followed by "DONE" ends a run.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef H8300_BENCH_H
+#define H8300_BENCH_H
+
+#include <stdint.h>
+#include <minilib.h>
+
+/* Provided by the board glue */
+void set_vector(int vec, void (*handler)(void));
+
+/* Provided by boot.S */
+void trap_handler(void);
+extern volatile uint32_t trap_count;
+
+/*
+ * Iteration counts are sized so that each kernel runs for roughly a
+ * second on a current host; SCALE can be overridden at build time.
+ */
+#ifndef SCALE
+#define SCALE 1
+#endif
+
+void bench_start(const char *name);
+void bench_end(const char *name, uint32_t sum, uint32_t expect);
+/* For kernels whose result QEMU does not compute yet: timed, not checked */
+void bench_end_unchecked(const char *name, uint32_t sum);
+int bench_finish(void);
+
+#endif /* H8300_BENCH_H */
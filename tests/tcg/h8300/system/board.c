@@ -0,0 +1,79 @@
+/*
+ * Board glue for the H8 system tests: console output on the board's
+ * console SCI channel and exception vector slots in internal RAM.
+ *
+ * SCI_BASE and VECTOR_BASE come from the Makefile.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "bench.h"
+
+#define SCI_SMR (*(volatile uint8_t *)(SCI_BASE + 0))
+#define SCI_BRR (*(volatile uint8_t *)(SCI_BASE + 1))
+#define SCI_SCR (*(volatile uint8_t *)(SCI_BASE + 2))
+#define SCI_TDR (*(volatile uint8_t *)(SCI_BASE + 3))
+#define SCI_SSR (*(volatile uint8_t *)(SCI_BASE + 4))
+
+#define SCR_TE   0x20
+#define SSR_TDRE 0x80
+
+volatile uint32_t trap_count;
+static int failures;
+
+void board_init(void)
+{
+    SCI_SCR = 0;
+    /* 8N1 with the shortest bit time so output is not throttled */
+    SCI_SMR = 0;
+    SCI_BRR = 0;
+    SCI_SCR = SCR_TE;
+}
+
+void __sys_outc(char c)
+{
+    while (!(SCI_SSR & SSR_TDRE)) {
+        /* wait for the previous character */
+    }
+    SCI_TDR = c;
+    /* H8S SCI starts transmission when TDRE is cleared */
+    SCI_SSR = SCI_SSR & ~SSR_TDRE;
+}
+
+void set_vector(int vec, void (*handler)(void))
+{
+    volatile uint8_t *slot = (volatile uint8_t *)(VECTOR_BASE + vec * 4);
+    uint32_t addr = (uint32_t)handler;
+
+    /* jmp @aa:24 */
+    slot[0] = 0x5a;
+    slot[1] = addr >> 16;
+    slot[2] = addr >> 8;
+    slot[3] = addr;
+}
+
+void bench_start(const char *name)
+{
+    ml_printf("BENCH %s START\n", name);
+}
+
+void bench_end_unchecked(const char *name, uint32_t sum)
+{
+    ml_printf("BENCH %s END %lx\n", name, (unsigned long)sum);
+}
+
+void bench_end(const char *name, uint32_t sum, uint32_t expect)
+{
+    bench_end_unchecked(name, sum);
+    if (sum != expect) {
+        ml_printf("%s: checksum %lx, expected %lx\n", name,
+                  (unsigned long)sum, (unsigned long)expect);
+        failures++;
+    }
+}
+
+int bench_finish(void)
+{
+    ml_printf("%s\nDONE\n", failures ? "FAIL" : "PASS");
+    return failures;
+}
@@ -27,9 +27,12 @@ static void ptimer_test_expire_qemu_timers(int64_t expire_time,
                                            QEMUClockType type)
 {
     QEMUTimerList *timer_list = main_loop_tlg.tl[type];
-    QEMUTimer *t = timer_list->active_timers.next;
+    GList *l, *next;
 
-    while (t != NULL) {
+    for (l = timer_list->active_timers; l; l = next) {
+        QEMUTimer *t = l->data;
+
+        next = l->next;
         if (t->expire_time == expire_time) {
             timer_del(t);
 
@@ -37,8 +40,6 @@ static void ptimer_test_expire_qemu_timers(int64_t expire_time,
                 t->cb(t->opaque);
             }
         }
-
-        t = t->next;
     }
 }
 
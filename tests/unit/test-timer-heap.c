@@ -0,0 +1,179 @@
+/*
+ * QEMUTimerList active timer heap tests
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+
+#define N_TIMERS 64
+
+typedef struct TestTimer {
+    QEMUTimer timer;
+    int64_t expire;
+    int armed;
+} TestTimer;
+
+static QEMUTimerListGroup tlg;
+static TestTimer timers[N_TIMERS];
+static TestTimer *fired[N_TIMERS];
+static int n_fired;
+static int n_armed;
+
+static void test_timer_cb(void *opaque)
+{
+    g_assert_cmpint(n_fired, <, N_TIMERS);
+    fired[n_fired++] = opaque;
+}
+
+static void test_timers_init(void)
+{
+    int i;
+
+    n_fired = n_armed = 0;
+    for (i = 0; i < N_TIMERS; i++) {
+        timer_init_full(&timers[i].timer, &tlg, QEMU_CLOCK_REALTIME,
+                        SCALE_NS, 0, test_timer_cb, &timers[i]);
+        timers[i].expire = -1;
+    }
+}
+
+/* all expiry times are long past, so that running the list fires them all */
+static void test_timer_arm(TestTimer *t, int64_t expire)
+{
+    t->expire = expire;
+    t->armed = n_armed++;
+    timer_mod_ns(&t->timer, expire);
+}
+
+static void test_timer_del(TestTimer *t)
+{
+    t->expire = -1;
+    timer_del(&t->timer);
+    g_assert_false(timer_pending(&t->timer));
+}
+
+/* the timers fired by expiry time, then in the order they were armed */
+static void test_timers_check(void)
+{
+    int i, n = 0;
+
+    timerlistgroup_run_timers(&tlg);
+
+    for (i = 0; i < N_TIMERS; i++) {
+        if (timers[i].expire != -1) {
+            n++;
+        }
+        g_assert_false(timer_pending(&timers[i].timer));
+    }
+    g_assert_cmpint(n_fired, ==, n);
+
+    for (i = 0; i < n_fired; i++) {
+        g_assert_cmpint(fired[i]->expire, !=, -1);
+        if (i > 0) {
+            g_assert_cmpint(fired[i - 1]->expire, <=, fired[i]->expire);
+            if (fired[i - 1]->expire == fired[i]->expire) {
+                g_assert_cmpint(fired[i - 1]->armed, <, fired[i]->armed);
+            }
+        }
+    }
+
+    for (i = 0; i < N_TIMERS; i++) {
+        timer_deinit(&timers[i].timer);
+    }
+}
+
+static void test_order(void)
+{
+    int i;
+
+    test_timers_init();
+    for (i = 0; i < N_TIMERS; i++) {
+        /* out of order, four timers on each expiry time */
+        test_timer_arm(&timers[i], 1000 + (i * 37) % (N_TIMERS / 4));
+    }
+    test_timers_check();
+}
+
+static void test_del_middle(void)
+{
+    int i;
+
+    test_timers_init();
+    for (i = 0; i < N_TIMERS; i++) {
+        test_timer_arm(&timers[i], 1000 + (i * 37) % N_TIMERS);
+    }
+    /* neither the first nor the last in the heap */
+    for (i = 0; i < N_TIMERS; i += 3) {
+        if (timers[i].expire != 1000 &&
+            timers[i].expire != 1000 + N_TIMERS - 1) {
+            test_timer_del(&timers[i]);
+        }
+    }
+    test_timers_check();
+}
+
+static void test_mod_middle(void)
+{
+    int i;
+
+    test_timers_init();
+    for (i = 0; i < N_TIMERS; i++) {
+        test_timer_arm(&timers[i], 1000 + (i * 37) % N_TIMERS);
+    }
+    /* move pending timers both ways, onto the expiry of other timers */
+    for (i = 1; i < N_TIMERS; i += 4) {
+        test_timer_arm(&timers[i], timers[i].expire + 20);
+        test_timer_arm(&timers[i + 1], timers[i + 1].expire - 20);
+    }
+    test_timer_del(&timers[N_TIMERS / 2]);
+    test_timer_arm(&timers[N_TIMERS / 2], 1000);
+    test_timers_check();
+}
+
+/*
+ * A timer with slack lets the list sleep until a later timer is due, and
+ * then both run in the same pass; timers due after that wait for the next.
+ */
+static void test_slack(void)
+{
+    QEMUTimerList *tl = tlg.tl[QEMU_CLOCK_REALTIME];
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t deadline;
+
+    test_timers_init();
+    timer_set_slack_ns(&timers[0].timer, 20 * SCALE_MS);
+    test_timer_arm(&timers[0], now + 10 * SCALE_MS);
+    test_timer_arm(&timers[1], now + 20 * SCALE_MS);
+    test_timer_arm(&timers[2], now + 10 * NANOSECONDS_PER_SECOND);
+
+    /* the second timer's expiry, not the first one's */
+    deadline = timerlist_deadline_ns(tl);
+    g_assert_cmpint(deadline, >, 10 * SCALE_MS);
+    g_assert_cmpint(deadline, <=, 20 * SCALE_MS);
+
+    g_usleep(deadline / SCALE_US + 1);
+    timerlistgroup_run_timers(&tlg);
+    g_assert_cmpint(n_fired, ==, 2);
+    g_assert(fired[0] == &timers[0]);
+    g_assert(fired[1] == &timers[1]);
+    g_assert_true(timer_pending(&timers[2].timer));
+
+    test_timer_del(&timers[2]);
+    test_timers_check();
+}
+
+int main(int argc, char **argv)
+{
+    init_clocks(NULL);
+    timerlistgroup_init(&tlg, NULL, NULL);
+
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/timer-heap/order", test_order);
+    g_test_add_func("/timer-heap/del-middle", test_del_middle);
+    g_test_add_func("/timer-heap/mod-middle", test_mod_middle);
+    g_test_add_func("/timer-heap/slack", test_slack);
+    return g_test_run();
+}
@@ -25,40 +25,75 @@
 #define HEADER_MAGIC 0xf2b177cb0aa429b4ULL
 
 /** Trace file version number, bump if format changes */
-#define HEADER_VERSION 4
+#define HEADER_VERSION 5
 
 /** Records were dropped event ID */
 #define DROPPED_EVENT_ID (~(uint64_t)0 - 1)
 
-/** Trace record is valid */
-#define TRACE_RECORD_VALID ((uint64_t)1 << 63)
-
 /*
- * Trace records are written out by a dedicated thread.  The thread waits for
- * records to become available, writes them out, and then waits again.
+ * Trace records are written out by a dedicated thread.  The thread sleeps
+ * until a record is published, then gives other records up to the flush
+ * period to come before writing them out; a buffer that fills up past the
+ * threshold, or an explicit flush, wakes it at once.  Nothing wakes it
+ * while no records are traced.
  */
 static GMutex trace_lock;
 static GCond trace_available_cond;
 static GCond trace_empty_cond;
 
 static bool trace_available;
+static bool trace_pending;
 static bool trace_writeout_enabled;
 
 enum {
     TRACE_BUF_LEN = 4096 * 64,
     TRACE_BUF_FLUSH_THRESHOLD = TRACE_BUF_LEN / 4,
+    TRACE_FLUSH_PERIOD_US = 100 * 1000,
+};
+
+/*
+ * Each thread that traces gets its own buffer, so that recording an event
+ * only touches memory of that thread.  The thread is the only one to move
+ * head, the writeout thread is the only one to move tail.
+ *
+ * Buffers are never freed, the buffer of a thread that exited is taken by
+ * the next new thread once the writeout thread has emptied it.
+ */
+enum {
+    TRACE_THREAD_BUF_LIVE,
+    TRACE_THREAD_BUF_EXITED,
+    TRACE_THREAD_BUF_FREE,
 };
 
-uint8_t trace_buf[TRACE_BUF_LEN];
-static volatile gint trace_idx;
-static unsigned int writeout_idx;
-static volatile gint dropped_events;
+typedef struct TraceThreadBuffer {
+    struct TraceThreadBuffer *next;
+    unsigned int head;
+    unsigned int tail;
+    unsigned int dropped;
+    int state;
+    /*
+     * Nonzero while the thread is between trace_record_start() and
+     * trace_record_finish(): 1 before the timestamp is read, then the
+     * timestamp.  The writeout thread uses it to know how far back in time
+     * records that it did not see yet may go.
+     */
+    aligned_uint64_t busy_since;
+    uint8_t buf[TRACE_BUF_LEN];
+} TraceThreadBuffer;
+
+static TraceThreadBuffer *trace_thread_buffers;
+/* The tracer does not yield, so use __thread */
+static __thread TraceThreadBuffer *trace_thread_buffer;
+static void trace_thread_buffer_release(gpointer opaque);
+static GPrivate trace_thread_key = G_PRIVATE_INIT(trace_thread_buffer_release);
+
 static uint32_t trace_pid;
 static FILE *trace_fp;
 static char *trace_file_name;
 
 #define TRACE_RECORD_TYPE_MAPPING 0
 #define TRACE_RECORD_TYPE_EVENT   1
+#define TRACE_RECORD_TYPE_FLUSH   2
 
 /* * Trace buffer entry */
 typedef struct {
@@ -76,53 +111,111 @@ typedef struct {
 } TraceLogHeader;
 
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size);
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size);
+static void read_from_buffer(TraceThreadBuffer *b, unsigned int idx,
+                             void *dataptr, size_t size);
+static unsigned int write_to_buffer(TraceThreadBuffer *b, unsigned int idx,
+                                    const void *dataptr, size_t size);
+
+static void trace_thread_buffer_release(gpointer opaque)
+{
+    TraceThreadBuffer *b = opaque;
+
+    qatomic_store_release(&b->state, TRACE_THREAD_BUF_EXITED);
+    trace_thread_buffer = NULL;
+}
 
-static void clear_buffer_range(unsigned int idx, size_t len)
+static TraceThreadBuffer *trace_thread_buffer_get(void)
 {
-    uint32_t num = 0;
-    while (num < len) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
+    TraceThreadBuffer *b = trace_thread_buffer;
+
+    if (likely(b)) {
+        return b;
+    }
+
+    for (b = qatomic_load_acquire(&trace_thread_buffers); b; b = b->next) {
+        if (qatomic_read(&b->state) == TRACE_THREAD_BUF_FREE &&
+            qatomic_cmpxchg(&b->state, TRACE_THREAD_BUF_FREE,
+                            TRACE_THREAD_BUF_LIVE) == TRACE_THREAD_BUF_FREE) {
+            break;
         }
-        trace_buf[idx++] = 0;
-        num++;
     }
+
+    if (!b) {
+        /* don't use g_malloc, can deadlock when traced */
+        b = calloc(1, sizeof(*b));
+        if (!b) {
+            return NULL;
+        }
+        b->state = TRACE_THREAD_BUF_LIVE;
+        do {
+            b->next = qatomic_read(&trace_thread_buffers);
+        } while (qatomic_cmpxchg(&trace_thread_buffers, b->next, b) != b->next);
+    }
+
+    trace_thread_buffer = b;
+    g_private_set(&trace_thread_key, b);
+    return b;
 }
+
 /**
- * Read a trace record from the trace buffer
+ * Write out the records of a thread buffer
  *
- * @idx         Trace buffer index
- * @record      Trace record to fill
+ * @b           Thread buffer
+ * @now         Timestamp for the dropped events record
  *
- * Returns false if the record is not valid.
+ * Returns whether any record was written.
  */
-static bool get_trace_record(unsigned int idx, TraceRecord **recordptr)
+static bool write_thread_buffer(TraceThreadBuffer *b, uint64_t now)
 {
-    uint64_t event_flag = 0;
-    TraceRecord record;
-    /* read the event flag to see if its a valid record */
-    read_from_buffer(idx, &record, sizeof(event_flag));
+    unsigned int head = qatomic_load_acquire(&b->head);
+    unsigned int tail = b->tail;
+    unsigned int dropped_count = qatomic_xchg(&b->dropped, 0);
+    uint64_t type = TRACE_RECORD_TYPE_EVENT;
+    size_t unused __attribute__ ((unused));
+    bool written = false;
+
+    if (dropped_count) {
+        union {
+            TraceRecord rec;
+            uint8_t bytes[sizeof(TraceRecord) + sizeof(uint64_t)];
+        } dropped;
+
+        dropped.rec.event = DROPPED_EVENT_ID;
+        dropped.rec.timestamp_ns = now;
+        dropped.rec.length = sizeof(TraceRecord) + sizeof(uint64_t);
+        dropped.rec.pid = trace_pid;
+        dropped.rec.arguments[0] = dropped_count;
+        unused = fwrite(&type, sizeof(type), 1, trace_fp);
+        unused = fwrite(&dropped.rec, dropped.rec.length, 1, trace_fp);
+        written = true;
+    }
 
-    if (!(record.event & TRACE_RECORD_VALID)) {
-        return false;
+    while (tail != head) {
+        unsigned int idx = tail % TRACE_BUF_LEN;
+        TraceRecord record;
+        size_t len;
+
+        read_from_buffer(b, idx, &record, sizeof(record));
+        len = MIN(record.length, TRACE_BUF_LEN - idx);
+        unused = fwrite(&type, sizeof(type), 1, trace_fp);
+        unused = fwrite(&b->buf[idx], len, 1, trace_fp);
+        if (len < record.length) {
+            unused = fwrite(b->buf, record.length - len, 1, trace_fp);
+        }
+        tail += record.length;
+        written = true;
     }
+    qatomic_store_release(&b->tail, tail);
 
-    smp_rmb(); /* read memory barrier before accessing record */
-    /* read the record header to know record length */
-    read_from_buffer(idx, &record, sizeof(TraceRecord));
-    *recordptr = malloc(record.length); /* don't use g_malloc, can deadlock when traced */
-    /* make a copy of record to avoid being overwritten */
-    read_from_buffer(idx, *recordptr, record.length);
-    smp_rmb(); /* memory barrier before clearing valid flag */
-    (*recordptr)->event &= ~TRACE_RECORD_VALID;
-    /* clear the trace buffer range for consumed record otherwise any byte
-     * with its MSB set may be considered as a valid event id when the writer
-     * thread crosses this range of buffer again.
+    /*
+     * The thread is gone and will not add records anymore, let a new one
+     * have the buffer.
      */
-    clear_buffer_range(idx, record.length);
-    return true;
+    if (qatomic_load_acquire(&b->state) == TRACE_THREAD_BUF_EXITED &&
+        qatomic_read(&b->head) == tail && !qatomic_read(&b->dropped)) {
+        qatomic_set(&b->state, TRACE_THREAD_BUF_FREE);
+    }
+    return written;
 }
 
 /**
@@ -143,53 +236,82 @@ static void flush_trace_file(bool wait)
     g_mutex_unlock(&trace_lock);
 }
 
-static void wait_for_trace_records_available(void)
+/*
+ * @idle: whether the last pass wrote nothing, so that there is no need to
+ * come back for a trailing flush record unless new records are published
+ */
+static void wait_for_trace_records_available(bool idle)
 {
+    gint64 end_time = 0;
+
     g_mutex_lock(&trace_lock);
     while (!(trace_available && trace_writeout_enabled)) {
         g_cond_signal(&trace_empty_cond);
-        g_cond_wait(&trace_available_cond, &trace_lock);
+        if (!end_time && trace_writeout_enabled &&
+            (!idle || qatomic_read(&trace_pending))) {
+            end_time = g_get_monotonic_time() + TRACE_FLUSH_PERIOD_US;
+        }
+        if (!end_time) {
+            g_cond_wait(&trace_available_cond, &trace_lock);
+        } else if (!g_cond_wait_until(&trace_available_cond, &trace_lock,
+                                      end_time)) {
+            /* Threads that trace rarely do not reach the threshold */
+            if (trace_writeout_enabled) {
+                break;
+            }
+            end_time = 0;
+        }
     }
     trace_available = false;
+    qatomic_set(&trace_pending, false);
     g_mutex_unlock(&trace_lock);
 }
 
 static gpointer writeout_thread(gpointer opaque)
 {
-    TraceRecord *recordptr;
-    union {
-        TraceRecord rec;
-        uint8_t bytes[sizeof(TraceRecord) + sizeof(uint64_t)];
-    } dropped;
-    unsigned int idx = 0;
-    int dropped_count;
+    TraceThreadBuffer *b;
+    uint64_t type = TRACE_RECORD_TYPE_FLUSH;
+    uint64_t now, flush_ns;
     size_t unused __attribute__ ((unused));
-    uint64_t type = TRACE_RECORD_TYPE_EVENT;
+    bool written, was_written = false;
 
     for (;;) {
-        wait_for_trace_records_available();
-
-        if (g_atomic_int_get(&dropped_events)) {
-            dropped.rec.event = DROPPED_EVENT_ID;
-            dropped.rec.timestamp_ns = get_clock();
-            dropped.rec.length = sizeof(TraceRecord) + sizeof(uint64_t);
-            dropped.rec.pid = trace_pid;
-            do {
-                dropped_count = g_atomic_int_get(&dropped_events);
-            } while (!g_atomic_int_compare_and_exchange(&dropped_events,
-                                                        dropped_count, 0));
-            dropped.rec.arguments[0] = dropped_count;
-            unused = fwrite(&type, sizeof(type), 1, trace_fp);
-            unused = fwrite(&dropped.rec, dropped.rec.length, 1, trace_fp);
+        wait_for_trace_records_available(!was_written);
+
+        /*
+         * Records of different threads are written in no particular order.
+         * Each pass ends with a flush record carrying a timestamp that no
+         * record later in the file is older than, so that readers can merge
+         * records by timestamp without reading the whole file.
+         *
+         * A record that we don't see in this pass was either started after
+         * the barrier, and so has a timestamp newer than now, or its thread
+         * shows as busy since no later than its timestamp.
+         */
+        now = get_clock();
+        smp_mb();
+        flush_ns = now;
+        for (b = qatomic_load_acquire(&trace_thread_buffers); b; b = b->next) {
+            uint64_t busy_since = qatomic_read_u64(&b->busy_since);
+
+            if (busy_since && busy_since < flush_ns) {
+                flush_ns = busy_since;
+            }
         }
 
-        while (get_trace_record(idx, &recordptr)) {
+        smp_rmb(); /* see trace_record_finish() */
+
+        written = false;
+        for (b = qatomic_load_acquire(&trace_thread_buffers); b; b = b->next) {
+            written |= write_thread_buffer(b, now);
+        }
+
+        /* One more after records were written, so that readers catch up */
+        if (written || was_written) {
             unused = fwrite(&type, sizeof(type), 1, trace_fp);
-            unused = fwrite(recordptr, recordptr->length, 1, trace_fp);
-            writeout_idx += recordptr->length;
-            free(recordptr); /* don't use g_free, can deadlock when traced */
-            idx = writeout_idx % TRACE_BUF_LEN;
+            unused = fwrite(&flush_ns, sizeof(flush_ns), 1, trace_fp);
         }
+        was_written = written;
 
         fflush(trace_fp);
     }
@@ -198,85 +320,91 @@ static gpointer writeout_thread(gpointer opaque)
 
 void trace_record_write_u64(TraceBufferRecord *rec, uint64_t val)
 {
-    rec->rec_off = write_to_buffer(rec->rec_off, &val, sizeof(uint64_t));
+    rec->rec_off = write_to_buffer(rec->tbuf, rec->rec_off, &val,
+                                   sizeof(uint64_t));
 }
 
 void trace_record_write_str(TraceBufferRecord *rec, const char *s, uint32_t slen)
 {
     /* Write string length first */
-    rec->rec_off = write_to_buffer(rec->rec_off, &slen, sizeof(slen));
+    rec->rec_off = write_to_buffer(rec->tbuf, rec->rec_off, &slen,
+                                   sizeof(slen));
     /* Write actual string now */
-    rec->rec_off = write_to_buffer(rec->rec_off, (void*)s, slen);
+    rec->rec_off = write_to_buffer(rec->tbuf, rec->rec_off, s, slen);
 }
 
 int trace_record_start(TraceBufferRecord *rec, uint32_t event, size_t datasize)
 {
-    unsigned int idx, rec_off, old_idx, new_idx;
+    TraceThreadBuffer *b = trace_thread_buffer_get();
     uint32_t rec_len = sizeof(TraceRecord) + datasize;
-    uint64_t event_u64 = event;
-    uint64_t timestamp_ns = get_clock();
-
-    do {
-        old_idx = g_atomic_int_get(&trace_idx);
-        smp_rmb();
-        new_idx = old_idx + rec_len;
-
-        if (new_idx - writeout_idx > TRACE_BUF_LEN) {
-            /* Trace Buffer Full, Event dropped ! */
-            g_atomic_int_inc(&dropped_events);
-            return -ENOSPC;
-        }
-    } while (!g_atomic_int_compare_and_exchange(&trace_idx, old_idx, new_idx));
+    TraceRecord record;
+    unsigned int head;
+
+    if (!b) {
+        return -ENOMEM;
+    }
 
-    idx = old_idx % TRACE_BUF_LEN;
+    head = b->head;
+    if (head + rec_len - qatomic_load_acquire(&b->tail) > TRACE_BUF_LEN) {
+        /* Trace Buffer Full, Event dropped ! */
+        qatomic_inc(&b->dropped);
+        return -ENOSPC;
+    }
 
-    rec_off = idx;
-    rec_off = write_to_buffer(rec_off, &event_u64, sizeof(event_u64));
-    rec_off = write_to_buffer(rec_off, &timestamp_ns, sizeof(timestamp_ns));
-    rec_off = write_to_buffer(rec_off, &rec_len, sizeof(rec_len));
-    rec_off = write_to_buffer(rec_off, &trace_pid, sizeof(trace_pid));
+    /* See writeout_thread() */
+    qatomic_set_u64(&b->busy_since, 1);
+    smp_mb();
+    record.timestamp_ns = get_clock();
+    qatomic_set_u64(&b->busy_since, record.timestamp_ns);
 
-    rec->tbuf_idx = idx;
-    rec->rec_off  = (idx + sizeof(TraceRecord)) % TRACE_BUF_LEN;
+    record.event = event;
+    record.length = rec_len;
+    record.pid = trace_pid;
+
+    rec->tbuf = b;
+    rec->rec_off = write_to_buffer(b, head, &record, sizeof(record));
     return 0;
 }
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size)
+static void read_from_buffer(TraceThreadBuffer *b, unsigned int idx,
+                             void *dataptr, size_t size)
 {
-    uint8_t *data_ptr = dataptr;
-    uint32_t x = 0;
-    while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        data_ptr[x++] = trace_buf[idx++];
-    }
+    size_t len;
+
+    idx %= TRACE_BUF_LEN;
+    len = MIN(size, TRACE_BUF_LEN - idx);
+    memcpy(dataptr, &b->buf[idx], len);
+    memcpy((uint8_t *)dataptr + len, b->buf, size - len);
 }
 
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size)
+static unsigned int write_to_buffer(TraceThreadBuffer *b, unsigned int idx,
+                                    const void *dataptr, size_t size)
 {
-    uint8_t *data_ptr = dataptr;
-    uint32_t x = 0;
-    while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        trace_buf[idx++] = data_ptr[x++];
-    }
-    return idx; /* most callers wants to know where to write next */
+    unsigned int off = idx % TRACE_BUF_LEN;
+    size_t len = MIN(size, TRACE_BUF_LEN - off);
+
+    memcpy(&b->buf[off], dataptr, len);
+    memcpy(b->buf, (const uint8_t *)dataptr + len, size - len);
+    return idx + size; /* most callers wants to know where to write next */
 }
 
 void trace_record_finish(TraceBufferRecord *rec)
 {
-    TraceRecord record;
-    read_from_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
-    smp_wmb(); /* write barrier before marking as valid */
-    record.event |= TRACE_RECORD_VALID;
-    write_to_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
+    TraceThreadBuffer *b = rec->tbuf;
+
+    /* Publish the record, then stop holding back the flush timestamp */
+    qatomic_store_release(&b->head, rec->rec_off);
+    smp_wmb();
+    qatomic_set_u64(&b->busy_since, 0);
 
-    if (((unsigned int)g_atomic_int_get(&trace_idx) - writeout_idx)
-        > TRACE_BUF_FLUSH_THRESHOLD) {
+    if (rec->rec_off - qatomic_read(&b->tail) > TRACE_BUF_FLUSH_THRESHOLD) {
         flush_trace_file(false);
+    } else if (!qatomic_read(&trace_pending) &&
+               !qatomic_xchg(&trace_pending, true)) {
+        /* First record since the last pass, start the flush period */
+        g_mutex_lock(&trace_lock);
+        g_cond_signal(&trace_available_cond);
+        g_mutex_unlock(&trace_lock);
     }
 }
 
@@ -19,14 +19,15 @@ void st_init_group(size_t group);
 void st_flush_trace_buffer(void);
 
 typedef struct {
-    unsigned int tbuf_idx;
+    struct TraceThreadBuffer *tbuf;
     unsigned int rec_off;
 } TraceBufferRecord;
 
 /* Note for hackers: Make sure MAX_TRACE_LEN < sizeof(uint32_t) */
 #define MAX_TRACE_STRLEN 512
 /**
- * Initialize a trace record and claim space for it in the buffer
+ * Initialize a trace record and claim space for it in the buffer of the
+ * calling thread
  *
  * @arglen  number of bytes required for arguments
  */
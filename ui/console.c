@@ -99,6 +99,8 @@ static void gui_update(void *opaque)
     if (ds->update_interval != interval) {
         ds->update_interval = interval;
         trace_console_refresh(interval);
+        /* a refresh a little late can share a wakeup with other timers */
+        timer_set_slack_ns(ds->gui_timer, interval * SCALE_MS / 8);
     }
     ds->last_update = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
     timer_mod(ds->gui_timer, ds->last_update + interval);
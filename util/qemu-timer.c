@@ -61,12 +61,19 @@ static QEMUClock qemu_clocks[QEMU_CLOCK_MAX];
  * used by different AioContexts / threads. Each clock also has
  * a list of the QEMUTimerLists associated with it, in order that
  * reenabling the clock can call all the notifiers.
+ *
+ * The active timers form a binary min-heap on their expiry time, so
+ * that devices which rearm their timers all the time do not walk a
+ * sorted list each time.
  */
 
 struct QEMUTimerList {
     QEMUClock *clock;
     QemuMutex active_timers_lock;
-    QEMUTimer *active_timers;
+    QEMUTimer **active_timers;
+    size_t nb_active;           /* read without the lock to check for none */
+    size_t max_active;
+    uint64_t seq;
     QLIST_ENTRY(QEMUTimerList) list;
     QEMUTimerListNotifyCB *notify_cb;
     void *notify_opaque;
@@ -93,6 +100,125 @@ static bool timer_expired_ns(QEMUTimer *timer_head, int64_t current_time)
     return timer_head && (timer_head->expire_time <= current_time);
 }
 
+/* the time by which the timer has to have run */
+static int64_t timer_latest_ns(QEMUTimer *ts)
+{
+    if (ts->expire_time > INT64_MAX - ts->slack) {
+        return INT64_MAX;
+    }
+    return ts->expire_time + ts->slack;
+}
+
+static bool timer_before(QEMUTimer *a, QEMUTimer *b)
+{
+    return a->expire_time < b->expire_time ||
+           (a->expire_time == b->expire_time && a->seq < b->seq);
+}
+
+static QEMUTimer *timerlist_first(QEMUTimerList *timer_list)
+{
+    return timer_list->nb_active ? timer_list->active_timers[0] : NULL;
+}
+
+static void timer_heap_set(QEMUTimerList *timer_list, size_t i, QEMUTimer *ts)
+{
+    timer_list->active_timers[i] = ts;
+    ts->heap_index = i;
+}
+
+static void timer_heap_up(QEMUTimerList *timer_list, size_t i)
+{
+    QEMUTimer *ts = timer_list->active_timers[i];
+
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+
+        if (!timer_before(ts, timer_list->active_timers[parent])) {
+            break;
+        }
+        timer_heap_set(timer_list, i, timer_list->active_timers[parent]);
+        i = parent;
+    }
+    timer_heap_set(timer_list, i, ts);
+}
+
+static void timer_heap_down(QEMUTimerList *timer_list, size_t i)
+{
+    QEMUTimer *ts = timer_list->active_timers[i];
+    size_t n = timer_list->nb_active;
+
+    for (;;) {
+        size_t child = 2 * i + 1;
+
+        if (child >= n) {
+            break;
+        }
+        if (child + 1 < n &&
+            timer_before(timer_list->active_timers[child + 1],
+                         timer_list->active_timers[child])) {
+            child++;
+        }
+        if (!timer_before(timer_list->active_timers[child], ts)) {
+            break;
+        }
+        timer_heap_set(timer_list, i, timer_list->active_timers[child]);
+        i = child;
+    }
+    timer_heap_set(timer_list, i, ts);
+}
+
+/* restore the heap after the timer at @i changed its expiry time */
+static void timer_heap_fix(QEMUTimerList *timer_list, size_t i)
+{
+    if (i > 0 && timer_before(timer_list->active_timers[i],
+                              timer_list->active_timers[(i - 1) / 2])) {
+        timer_heap_up(timer_list, i);
+    } else {
+        timer_heap_down(timer_list, i);
+    }
+}
+
+static void timer_heap_remove(QEMUTimerList *timer_list, size_t i)
+{
+    size_t last = timer_list->nb_active - 1;
+
+    qatomic_set(&timer_list->nb_active, last);
+    if (i != last) {
+        timer_heap_set(timer_list, i, timer_list->active_timers[last]);
+        timer_heap_fix(timer_list, i);
+    }
+}
+
+/*
+ * The soonest time by which a timer at @i or below it in the heap whose
+ * attributes are all in @attr_mask has to run, if that is before
+ * @deadline. Timers with slack then take the ones due before them
+ * along, instead of each waking us up.
+ */
+static int64_t timer_heap_deadline(QEMUTimerList *timer_list, size_t i,
+                                   int attr_mask, int64_t deadline)
+{
+    QEMUTimer *ts;
+
+    if (i >= timer_list->nb_active) {
+        return deadline;
+    }
+    ts = timer_list->active_timers[i];
+    /* nothing below expires any earlier */
+    if (ts->expire_time >= deadline) {
+        return deadline;
+    }
+    if (!(ts->attributes & ~attr_mask)) {
+        if (!ts->slack) {
+            /* nor does anything below this one have to run earlier */
+            return ts->expire_time;
+        }
+        deadline = MIN(deadline, timer_latest_ns(ts));
+    }
+    deadline = timer_heap_deadline(timer_list, 2 * i + 1, attr_mask, deadline);
+    return timer_heap_deadline(timer_list, 2 * i + 2, attr_mask, deadline);
+}
+
 QEMUTimerList *timerlist_new(QEMUClockType type,
                              QEMUTimerListNotifyCB *cb,
                              void *opaque)
@@ -117,6 +243,7 @@ void timerlist_free(QEMUTimerList *timer_list)
         QLIST_REMOVE(timer_list, list);
     }
     qemu_mutex_destroy(&timer_list->active_timers_lock);
+    g_free(timer_list->active_timers);
     g_free(timer_list);
 }
 
@@ -171,7 +298,7 @@ void qemu_clock_enable(QEMUClockType type, bool enabled)
 
 bool timerlist_has_timers(QEMUTimerList *timer_list)
 {
-    return !!qatomic_read(&timer_list->active_timers);
+    return !!qatomic_read(&timer_list->nb_active);
 }
 
 bool qemu_clock_has_timers(QEMUClockType type)
@@ -184,15 +311,15 @@ bool timerlist_expired(QEMUTimerList *timer_list)
 {
     int64_t expire_time;
 
-    if (!qatomic_read(&timer_list->active_timers)) {
+    if (!qatomic_read(&timer_list->nb_active)) {
         return false;
     }
 
     WITH_QEMU_LOCK_GUARD(&timer_list->active_timers_lock) {
-        if (!timer_list->active_timers) {
+        if (!timer_list->nb_active) {
             return false;
         }
-        expire_time = timer_list->active_timers->expire_time;
+        expire_time = timerlist_first(timer_list)->expire_time;
     }
 
     return expire_time <= qemu_clock_get_ns(timer_list->clock->type);
@@ -214,7 +341,7 @@ int64_t timerlist_deadline_ns(QEMUTimerList *timer_list)
     int64_t delta;
     int64_t expire_time;
 
-    if (!qatomic_read(&timer_list->active_timers)) {
+    if (!qatomic_read(&timer_list->nb_active)) {
         return -1;
     }
 
@@ -227,10 +354,11 @@ int64_t timerlist_deadline_ns(QEMUTimerList *timer_list)
      * the caller should notice the change and there is no race condition.
      */
     WITH_QEMU_LOCK_GUARD(&timer_list->active_timers_lock) {
-        if (!timer_list->active_timers) {
-            return -1;
-        }
-        expire_time = timer_list->active_timers->expire_time;
+        expire_time = timer_heap_deadline(timer_list, 0, QEMU_TIMER_ATTR_ALL,
+                                          INT64_MAX);
+    }
+    if (expire_time == INT64_MAX) {
+        return -1;
     }
 
     delta = expire_time - qemu_clock_get_ns(timer_list->clock->type);
@@ -252,7 +380,6 @@ int64_t qemu_clock_deadline_ns_all(QEMUClockType type, int attr_mask)
     int64_t deadline = -1;
     int64_t delta;
     int64_t expire_time;
-    QEMUTimer *ts;
     QEMUTimerList *timer_list;
     QEMUClock *clock = qemu_clock_ptr(type);
 
@@ -261,21 +388,16 @@ int64_t qemu_clock_deadline_ns_all(QEMUClockType type, int attr_mask)
     }
 
     QLIST_FOREACH(timer_list, &clock->timerlists, list) {
-        if (!qatomic_read(&timer_list->active_timers)) {
+        if (!qatomic_read(&timer_list->nb_active)) {
             continue;
         }
-        qemu_mutex_lock(&timer_list->active_timers_lock);
-        ts = timer_list->active_timers;
         /* Skip all external timers */
-        while (ts && (ts->attributes & ~attr_mask)) {
-            ts = ts->next;
-        }
-        if (!ts) {
-            qemu_mutex_unlock(&timer_list->active_timers_lock);
+        qemu_mutex_lock(&timer_list->active_timers_lock);
+        expire_time = timer_heap_deadline(timer_list, 0, attr_mask, INT64_MAX);
+        qemu_mutex_unlock(&timer_list->active_timers_lock);
+        if (expire_time == INT64_MAX) {
             continue;
         }
-        expire_time = ts->expire_time;
-        qemu_mutex_unlock(&timer_list->active_timers_lock);
 
         delta = expire_time - qemu_clock_get_ns(type);
         if (delta <= 0) {
@@ -370,6 +492,13 @@ void timer_init_full(QEMUTimer *ts,
     ts->scale = scale;
     ts->attributes = attributes;
     ts->expire_time = -1;
+    ts->slack = 0;
+}
+
+void timer_set_slack_ns(QEMUTimer *ts, int64_t slack)
+{
+    assert(slack >= 0);
+    ts->slack = slack;
 }
 
 void timer_deinit(QEMUTimer *ts)
@@ -380,41 +509,42 @@ void timer_deinit(QEMUTimer *ts)
 
 static void timer_del_locked(QEMUTimerList *timer_list, QEMUTimer *ts)
 {
-    QEMUTimer **pt, *t;
-
-    ts->expire_time = -1;
-    pt = &timer_list->active_timers;
-    for(;;) {
-        t = *pt;
-        if (!t)
-            break;
-        if (t == ts) {
-            qatomic_set(pt, t->next);
-            break;
-        }
-        pt = &t->next;
+    if (ts->expire_time != -1) {
+        timer_heap_remove(timer_list, ts->heap_index);
+        ts->expire_time = -1;
     }
 }
 
+/*
+ * Add or move the timer. Return true if the list may have to run
+ * sooner than before, false if whoever waits for it can stay asleep.
+ */
 static bool timer_mod_ns_locked(QEMUTimerList *timer_list,
                                 QEMUTimer *ts, int64_t expire_time)
 {
-    QEMUTimer **pt, *t;
+    QEMUTimer *first = timerlist_first(timer_list);
+    int64_t deadline = first ? timer_latest_ns(first) : INT64_MAX;
+    size_t n = timer_list->nb_active;
 
-    /* add the timer in the sorted list */
-    pt = &timer_list->active_timers;
-    for (;;) {
-        t = *pt;
-        if (!timer_expired_ns(t, expire_time)) {
-            break;
+    /* behind the timers already due at the same time */
+    ts->seq = timer_list->seq++;
+    if (ts->expire_time != -1) {
+        ts->expire_time = MAX(expire_time, 0);
+        timer_heap_fix(timer_list, ts->heap_index);
+    } else {
+        if (n == timer_list->max_active) {
+            timer_list->max_active = MAX(16, n * 2);
+            timer_list->active_timers = g_renew(QEMUTimer *,
+                                                timer_list->active_timers,
+                                                timer_list->max_active);
         }
-        pt = &t->next;
+        ts->expire_time = MAX(expire_time, 0);
+        timer_heap_set(timer_list, n, ts);
+        qatomic_set(&timer_list->nb_active, n + 1);
+        timer_heap_up(timer_list, n);
     }
-    ts->expire_time = MAX(expire_time, 0);
-    ts->next = *pt;
-    qatomic_set(pt, ts);
 
-    return pt == &timer_list->active_timers;
+    return timer_latest_ns(ts) < deadline;
 }
 
 static void timerlist_rearm(QEMUTimerList *timer_list)
@@ -446,7 +576,6 @@ void timer_mod_ns(QEMUTimer *ts, int64_t expire_time)
     bool rearm;
 
     qemu_mutex_lock(&timer_list->active_timers_lock);
-    timer_del_locked(timer_list, ts);
     rearm = timer_mod_ns_locked(timer_list, ts, expire_time);
     qemu_mutex_unlock(&timer_list->active_timers_lock);
 
@@ -465,9 +594,6 @@ void timer_mod_anticipate_ns(QEMUTimer *ts, int64_t expire_time)
 
     WITH_QEMU_LOCK_GUARD(&timer_list->active_timers_lock) {
         if (ts->expire_time == -1 || ts->expire_time > expire_time) {
-            if (ts->expire_time != -1) {
-                timer_del_locked(timer_list, ts);
-            }
             rearm = timer_mod_ns_locked(timer_list, ts, expire_time);
         } else {
             rearm = false;
@@ -506,7 +632,7 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
     QEMUTimerCB *cb;
     void *opaque;
 
-    if (!qatomic_read(&timer_list->active_timers)) {
+    if (!qatomic_read(&timer_list->nb_active)) {
         return false;
     }
 
@@ -545,7 +671,7 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
      */
     current_time = qemu_clock_get_ns(timer_list->clock->type);
     qemu_mutex_lock(&timer_list->active_timers_lock);
-    while ((ts = timer_list->active_timers)) {
+    while ((ts = timerlist_first(timer_list))) {
         if (!timer_expired_ns(ts, current_time)) {
             /* No expired timers left.  The checkpoint can be skipped
              * if no timers fired or they were all external.
@@ -565,9 +691,7 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
         }
 
         /* remove timer from the list before calling the callback */
-        timer_list->active_timers = ts->next;
-        ts->next = NULL;
-        ts->expire_time = -1;
+        timer_del_locked(timer_list, ts);
         cb = ts->cb;
         opaque = ts->opaque;
 